@@ -4,6 +4,18 @@ This program would be used to load points into the card for the player.
 It initializes the card first time and resets the keys.
 Input:
 Points to be loaded : NumPoints
+Bulk provisioning (operations 7 and 8):
+ The points are entered once, then every card presented is configured in turn,
+ until anything is typed on the console. A card configured already, as told by its
+ key version block, is skipped (7) or reset (8). Cards/minute and the failure rate
+ are reported every BULK_REPORT_CARDS cards and at the end.
+Group recharge (operation 11):
+ The points are added to every card on the reader at once, in one pass, e.g. for a team.
+ The cards seen and recharged are reported, with the time taken.
+Host driven (see CommandFrame.h and host/StationCli):
+ Operations 1 to 5 can also be sent as binary frames, queued for the next cards
+ presented, with the results sent back as frames. Typed operations come first.
+ The menu is not printed any more once a frame has been received.
 Function:
 Step 0: Wait to read the card.
 Step 1: Read the card. (Get UID and debug info). Check for failure.
@@ -28,12 +40,56 @@ Display:
 #include <SPI.h>
 #include <MFRC522.h>
 #include <CardUtil.h>
+#include <Scheduler.h>
+#include <Log.h>
+#include <Journal.h>
+#include <KeyRing.h>
+#include <EEPROMStorage.h>
+#include <CardStats.h>
+#include <CardCache.h>
+#include <CommandLink.h>
+#include <CardScanner.h>
 
 #define RST_PIN         9           // Pin Mapping on Arduino
 #define SS_PIN          10          // Pin Mapping on Arduino
 
 MFRC522 mfrc522(SS_PIN, RST_PIN);   // Create MFRC522 instance.
+CardUtil cardUtil(mfrc522);         // Create CardUtil instance, for every card read.
 
+const uint32_t STORE_ID = 1;   //Store this device is in, sent with the events.
+const uint16_t DEVICE_ID = 0;  //Id of this device, sent with the events.
+Log eventLog;                 //Queues the events, drained to Serial by a task.
+EEPROMStorage storage;        //EEPROM, holding the journal.
+Journal journal(storage);     //Journal of the balance changes, kept until exported.
+KeyRing keyRing;              //Secret keys by version. To rotate: add the new one on every station, then make it current.
+CardCache cache;              //State of the cards seen lately, saves reading them again.
+CommandLink hostLink;            //Operations sent by a host, queued for the next cards.
+CardScanner scanner(mfrc522);    //Finds every card on the reader, for group recharges.
+
+const unsigned long INPUT_TIMEOUT_MS = 1000;  //A number typed without line ending is taken after this time.
+const unsigned int BULK_REPORT_CARDS = 10;    //Cards between two reports in bulk provisioning.
+
+//Steps of the operator dialog.
+enum State {
+  STATE_OPERATION,  //Waiting for the operation.
+  STATE_POINTS,     //Waiting for the number of points.
+  STATE_CARD,       //Waiting for the card.
+  STATE_BULK        //Configuring every card presented, till the operator stops.
+};
+
+Scheduler scheduler;  //Runs the console and card polling without blocking.
+byte pollTask;        //Card polling task, runs in STATE_CARD and STATE_BULK only.
+State state = STATE_OPERATION;
+int operation = 0;    //Operation to be performed.
+int numPoints = 0;    //Number of points to be loaded.
+long inputValue = 0;  //Number being typed on the console.
+bool inputDigits = false;     //Digits were typed for inputValue.
+unsigned long inputMs = 0;    //Time the last digit was typed.
+unsigned long bulkStartMs = 0;  //Time bulk provisioning started.
+unsigned int bulkConfigured = 0;  //Cards configured or reset in bulk provisioning.
+unsigned int bulkSkipped = 0;     //Cards found configured already, and skipped.
+unsigned int bulkFailed = 0;      //Cards failed.
+bool hostDriven = false;  //A host sends the operations, the menu isn't printed.
 
 /**
  * Initialize.
@@ -44,37 +100,160 @@ void setup() {
     
     SPI.begin();        // Init SPI bus
     mfrc522.PCD_Init(); // Init MFRC522 card
+
+    eventLog.begin(STORE_ID, DEVICE_ID);
+    journal.begin();
+    cardUtil.setJournal(&journal);
+    cardUtil.setLog(&eventLog);
+    keyRing.add(1, CardUtil::secretKey(1));
+    cardUtil.setKeyRing(&keyRing);
+    cardUtil.setCache(&cache);
+    scheduler.add(readConsole, 0);
+    scheduler.add(drainLog, 0);
+    pollTask = scheduler.add(pollCard, 0);
+    scheduler.suspend(pollTask);
+    printMenu();
 }
 
 /**
  * Main loop.
  */
 void loop() {
-    int operation = 0;
+    scheduler.run();
+}
+
+/**
+ * Prints the operations and waits for one to be entered.
+ */
+void printMenu() {
+    state = STATE_OPERATION;
+    if (hostDriven)
+      return;
     Serial.println("Enter Operation to be performed:");
     Serial.println("1 for Configure ");
     Serial.println("2 for Recharge ");
     Serial.println("3 for Check Balance");
     Serial.println("4 for Reset");
     Serial.println("5 for Check Status");
-    while(operation == 0)
-      operation = Serial.parseInt();
-      
-    int numPoints = 0;  //Number of points to be loaded.
-    if(operation != 3 && operation != 5) {
-      Serial.println(F("Enter the number of points to be loaded"));
-      while(numPoints == 0)
-        numPoints = Serial.parseInt();
-    }
-    Serial.println(F("Scan a MIFARE Classic PICC to Proceed."));
-      
+    Serial.println("6 for Export Journal");
+    Serial.println("7 for Bulk Configure, skipping configured cards");
+    Serial.println("8 for Bulk Configure, resetting configured cards");
+    Serial.println("9 for Card Statistics");
+    Serial.println("10 for Reset Card Statistics");
+    Serial.println("11 for Group Recharge, every card on the reader");
+}
+
+/**
+ * Reads a number typed on the console without blocking.
+ * Returns true once the number is terminated by any other character, or by a pause in typing.
+ */
+bool readNumber(long* value) {
+    bool terminated = false;
+    //Up to a frame, read by hostLink.
+    while (!terminated && Serial.available() > 0
+        && Serial.peek() != CommandFrame::REQUEST_SYNC) {
+      int c = Serial.read();
+      if (c >= '0' && c <= '9') {
+        inputValue = inputValue * 10 + (c - '0');
+        inputDigits = true;
+        inputMs = millis();
+      } else {
+        terminated = inputDigits;
+      }
+    }
+    if (!inputDigits || (!terminated && millis() - inputMs < INPUT_TIMEOUT_MS))
+      return false;
+    *value = inputValue;
+    inputValue = 0;
+    inputDigits = false;
+    return true;
+}
+
+/**
+ * Task: handles the operator input.
+ */
+void readConsole() {
+    long value;
+    if (hostLink.receive()) {
+      hostDriven = true;
+      if (hostLink.queued() > 0)
+        scheduler.resume(pollTask);
+    }
+    if (state == STATE_BULK) {
+      //Any input ends bulk provisioning.
+      if (Serial.available() == 0)
+        return;
+      while (Serial.available() > 0)
+        Serial.read();
+      stopPolling();
+      printBulkReport();
+      printMenu();
+      return;
+    }
+    if (state == STATE_CARD || !readNumber(&value) || value == 0)
+      return;
+    if (state == STATE_OPERATION) {
+      operation = value;
+      if (operation == 6 || operation == 9 || operation == 10) {
+        //No card needed.
+        if (operation == 6)
+          journal.exportEntries();
+        else if (operation == 9)
+          CardStats::print();
+        else
+          CardStats::reset();
+        printMenu();
+        return;
+      }
+      if (operation != 3 && operation != 5) {
+        Serial.println(F("Enter the number of points to be loaded"));
+        state = STATE_POINTS;
+        return;
+      }
+      numPoints = 0;
+    } else {
+      numPoints = value;
+    }
+    if (operation == 7 || operation == 8) {
+      Serial.println(F("Scan the MIFARE Classic PICCs one after the other. Enter anything to stop."));
+      bulkStartMs = millis();
+      bulkConfigured = bulkSkipped = bulkFailed = 0;
+      state = STATE_BULK;
+    } else if (operation == 11) {
+      Serial.println(F("Place the MIFARE Classic PICCs on the reader together."));
+      state = STATE_CARD;
+    } else {
+      Serial.println(F("Scan a MIFARE Classic PICC to Proceed."));
+      state = STATE_CARD;
+    }
+    scheduler.resume(pollTask);
+}
+
+/**
+ * Task: looks for a card and performs the operation on it.
+ */
+void pollCard() {
+    if (state == STATE_CARD && operation == 11) {
+      groupRecharge();
+      return;
+    }
     // Look for new cards
-    while ( ! mfrc522.PICC_IsNewCardPresent());
+    if ( ! mfrc522.PICC_IsNewCardPresent())
+        return;
 
     // Select one of the cards
     if ( ! mfrc522.PICC_ReadCardSerial())
         return;
 
+    if (state == STATE_BULK) {
+      provisionCard();
+      return;
+    }
+    if (state != STATE_CARD) {
+      runQueued();
+      return;
+    }
+    stopPolling();
     // Show some details of the PICC (that is: the tag/card)
     Serial.print(F("Card UID:"));
     dump_byte_array_internal(mfrc522.uid.uidByte, mfrc522.uid.size);
@@ -88,27 +267,187 @@ void loop() {
         &&  piccType != MFRC522::PICC_TYPE_MIFARE_1K
         &&  piccType != MFRC522::PICC_TYPE_MIFARE_4K) {
         Serial.println(F("This sample only works with MIFARE Classic cards."));
+        printMenu();
         return;
     }
-    CardUtil cardUtil(mfrc522);         //Create CardUtil instance.
+    cardUtil.rebind();                  //Work on the card just read.
+    perform(operation, numPoints);
+    cardUtil.stop();
+    printMenu();
+}
+
+/**
+ * Recharges every card on the reader in one pass, and reports it.
+ */
+void groupRecharge() {
+    scanner.run(rechargeCard);
+    if (scanner.count() == 0)
+      return;
+    stopPolling();
+    Serial.print(F("Cards seen: "));
+    Serial.print(scanner.count());
+    Serial.print(F(" Recharged: "));
+    Serial.print(scanner.processed());
+    Serial.print(F(" Scan ms: "));
+    Serial.print(scanner.scanUs() / 1000);
+    Serial.print(F(" Recharge ms: "));
+    Serial.println(scanner.processUs() / 1000);
+    printMenu();
+}
+
+/**
+ * Recharges a card of a group recharge, selected by the scanner. Returns true if recharged.
+ */
+bool rechargeCard(byte card, MFRC522 &reader) {
+    Serial.print(F("Card UID:"));
+    dump_byte_array_internal(reader.uid.uidByte, reader.uid.size);
+    Serial.println();
+    byte piccType = reader.PICC_GetType(reader.uid.sak);
+    if (    piccType != MFRC522::PICC_TYPE_MIFARE_MINI
+        &&  piccType != MFRC522::PICC_TYPE_MIFARE_1K
+        &&  piccType != MFRC522::PICC_TYPE_MIFARE_4K) {
+      reader.PICC_HaltA();
+      return false;
+    }
+    cardUtil.rebind();                  //Work on the card just read.
+    CardUtil::Status status = perform(2, numPoints);
+    cardUtil.stop();
+    return status.code == CardUtil::STATUS_OK;
+}
+
+/**
+ * Performs the operation queued by the host on the card just selected, and reports it.
+ */
+void runQueued() {
+    CommandLink::Command *command = hostLink.front();
+    if (command == NULL) {
+      stopPolling();
+      return;
+    }
+    CardUtil::Status status;
+    byte piccType = mfrc522.PICC_GetType(mfrc522.uid.sak);
+    if (    piccType != MFRC522::PICC_TYPE_MIFARE_MINI
+        &&  piccType != MFRC522::PICC_TYPE_MIFARE_1K
+        &&  piccType != MFRC522::PICC_TYPE_MIFARE_4K) {
+      status.code = CardUtil::STATUS_FAILURE;
+      status.mfrc522StatusCode = MFRC522::STATUS_OK;
+    } else {
+      cardUtil.rebind();                //Work on the card just read.
+      status = perform(command->opcode, command->points);
+      cardUtil.stop();
+    }
+    hostLink.done(status, mfrc522.uid);
+    stopPolling();
+}
+
+/**
+ * Performs operation 1 to 5 on the card bound to cardUtil, and logs it.
+ */
+CardUtil::Status perform(int operation, int32_t points) {
+    CardUtil::Status status;
+    Log::EventCode event;
+    int32_t delta = points;
     switch(operation){
       case 1:
-        cardUtil.configure(numPoints);
+        status = cardUtil.configure(points);
+        event = Log::EVENT_CONFIGURED;
         break;
       case 2:
-        cardUtil.addPoints(numPoints);
+        status = cardUtil.addPoints(points);
+        event = Log::EVENT_POINTS_ADDED;
         break;
-      case 3:
-        cardUtil.getPoints();
+      case 4:
+        status = cardUtil.reset(points);
+        event = Log::EVENT_CARD_RESET;
+        delta = 0;
         break;
-       case 4:
-        cardUtil.reset(numPoints);
+      case 3:
+        status = cardUtil.getPoints();
+        event = Log::EVENT_NONE;  //Nothing changed.
         break;
-       case 5:
-        cardUtil.checkStatus();
+      default:
+        status = cardUtil.checkStatus();
+        event = Log::EVENT_NONE;
         break;
     }
-    cardUtil.stop();
+    if (status.code == CardUtil::STATUS_JOURNAL_FAILED) {
+      //The card changed all the same.
+      Serial.println(F("Card updated, but not journaled: check the EEPROM"));
+      eventLog.event(event, mfrc522.uid, delta);
+    }
+    if (status.code != CardUtil::STATUS_OK)
+      eventLog.event(Log::EVENT_CARD_ERROR, mfrc522.uid, status.code);
+    else
+      eventLog.event(event, mfrc522.uid, delta);
+    return status;
+}
+
+/**
+ * Stops polling for cards, unless operations are queued for them.
+ */
+void stopPolling() {
+    if (hostLink.queued() == 0)
+      scheduler.suspend(pollTask);
+}
+
+/**
+ * Configures the card just selected in bulk provisioning.
+ * Prints a single line per card: at 9600 baud, Serial output takes as long as the card.
+ */
+void provisionCard() {
+    Serial.print(F("Card UID:"));
+    dump_byte_array_internal(mfrc522.uid.uidByte, mfrc522.uid.size);
+    byte piccType = mfrc522.PICC_GetType(mfrc522.uid.sak);
+    CardUtil::Status status;
+    if (    piccType != MFRC522::PICC_TYPE_MIFARE_MINI
+        &&  piccType != MFRC522::PICC_TYPE_MIFARE_1K
+        &&  piccType != MFRC522::PICC_TYPE_MIFARE_4K) {
+      status.code = CardUtil::STATUS_FAILURE;
+    } else {
+      cardUtil.rebind();                //Work on the card just read.
+      status = cardUtil.provision(numPoints, operation == 8);
+      cardUtil.stop();
+    }
+    if (status.code == CardUtil::STATUS_OK) {
+      bulkConfigured++;
+      Serial.println(F(" configured"));
+      eventLog.event(Log::EVENT_CONFIGURED, mfrc522.uid, numPoints);
+    } else if (status.code == CardUtil::STATUS_ALREADY_CONFIGURED) {
+      bulkSkipped++;
+      Serial.println(F(" skipped, configured already"));
+    } else {
+      bulkFailed++;
+      Serial.print(F(" failed: "));
+      Serial.println(status.code);
+      eventLog.event(Log::EVENT_CARD_ERROR, mfrc522.uid, status.code);
+    }
+    if ((bulkConfigured + bulkSkipped + bulkFailed) % BULK_REPORT_CARDS == 0)
+      printBulkReport();
+}
+
+/**
+ * Prints the counts, the rate and the failure rate of bulk provisioning.
+ */
+void printBulkReport() {
+    unsigned int cards = bulkConfigured + bulkSkipped + bulkFailed;
+    unsigned long elapsedMs = millis() - bulkStartMs;
+    Serial.print(F("Configured: "));
+    Serial.print(bulkConfigured);
+    Serial.print(F(" Skipped: "));
+    Serial.print(bulkSkipped);
+    Serial.print(F(" Failed: "));
+    Serial.print(bulkFailed);
+    Serial.print(F(" Failure rate: "));
+    Serial.print(cards > 0 ? 100UL * bulkFailed / cards : 0);
+    Serial.print(F("% Cards/min: "));
+    Serial.println(elapsedMs > 0 ? 60000.0 * cards / elapsedMs : 0.0);
+}
+
+/**
+ * Task: sends the queued events to Serial.
+ */
+void drainLog() {
+    eventLog.drain();
 }
 
 /**
@@ -2,14 +2,38 @@
  * Violet Purple.
  * A programme for using photosensitive diodes as sensor for motion detection.
  * TBD - Add the circuit diagramme here.
+ *
+ * The sensor is sampled at SAMPLE_RATE_HZ by Timer1 and the ADC (see AdcSampler), whatever loop()
+ * and Serial are doing. The samples are processed in batches by a task, and the LED toggles each
+ * time motion is detected, or lights for PULSE_MS with PULSE_MODE (see AdaptiveDetector).
+ *
+ * Each motion detected is sent as MOTION,<ambient level in ADC counts>, and once a second a report:
+ *   SAMPLES,<samples taken>,<samples dropped>,<processing us>,<processing us per sample>,<largest batch>
+ * Samples taken is the sample rate, and samples dropped should stay 0: the ring (SAMPLE_RING_SIZE)
+ * overflowed otherwise, loop() was held up for too long. The processing time is the CPU budget used,
+ * out of the 1000000 us of the second; the sampling interrupt adds around 5 us per sample.
  */
 
+#include <AdcSampler.h>
+#include <AdaptiveDetector.h>
+#include <Scheduler.h>
+
 const int LED = 9; //The pin for LED.
-int val = 0;  //variable used to store the input
-                //from the sensor.
-int old_val = val;  //will be used to store old value of the input.
-int state = 0;  //State of LED.
-boolean down = false;
+const byte SENSOR = 0;  //Analog input of the sensor.
+const unsigned int SAMPLE_RATE_HZ = 1000;  //Sensor samples per second.
+const byte BATCH = 16;  //Samples processed at most per pass.
+const unsigned long REPORT_MS = 1000;  //Time between two reports.
+const bool PULSE_MODE = false;  //Light the LED for PULSE_MS on motion, instead of toggling it.
+const unsigned int PULSE_MS = 2000;
+
+//Detection logic, driving the LED.
+AdaptiveDetector detector(PULSE_MODE ? AdaptiveDetector::MODE_PULSE : AdaptiveDetector::MODE_TOGGLE,
+    (uint32_t) PULSE_MS * SAMPLE_RATE_HZ / 1000);
+Scheduler scheduler;      //Runs the processing and the report.
+
+unsigned long processed = 0;  //Samples processed since the last report.
+unsigned long busyUs = 0;     //Time spent processing them.
+byte maxBatch = 0;            //Most samples processed in a pass.
 
 /**
  * Initial setup. Called Once during startup.
@@ -17,36 +41,56 @@ boolean down = false;
 void setup() {
   pinMode(LED, OUTPUT); //tell arduino, LED is output.
   Serial.begin(9600); //Set the serial connection at 9600b/s.
-  //Analoguous inpits are automaticall configured 
-  //as inputs in arduino.
+  AdcSampler::begin(SENSOR, SAMPLE_RATE_HZ);
+  scheduler.add(processSamples, 0);
+  scheduler.add(report, REPORT_MS);
 }
 
 /**
  * Main Loop.
  */
 void loop() {
-  val = analogRead(0);  //read the value from the sensor
-  if(val > (old_val+10)) {
-    if(down){ //Switch only if the signal has started increasing after a dip.
-      Serial.println("switched");
-      state = 1 - state;
+  scheduler.run();
+}
+
+/**
+ * Task: runs the detector on the samples taken since the last pass.
+ */
+void processSamples() {
+  uint16_t samples[BATCH];
+  unsigned long start = micros();
+  byte count = AdcSampler::ring.pop(samples, BATCH);
+  if (count == 0)
+    return;
+  for (byte i = 0; i < count; i++) {
+    if (detector.update(samples[i])) {
+      Serial.print(F("MOTION,"));
+      Serial.println(detector.baseline());
     }
-    old_val = val;  //update changed value
-    down = false; //going up
-    Serial.print("Read value:"); Serial.println(val);
-    Serial.print("Old value:"); Serial.println(old_val);
-    Serial.print("Down:"); Serial.println(down);
-  }
-  if(state) {
-    digitalWrite(LED, HIGH); //Turn LED on.
-  } else {
-    digitalWrite(LED, LOW);
   }
-  if( val < (old_val-10)){
-    old_val = val;  //update changed value
-    down = true;  //going down
-    Serial.print("Read value:"); Serial.println(val);
-    Serial.print("Old value:"); Serial.println(old_val);
-    Serial.print("Down:"); Serial.println(down);
-  } 
+  digitalWrite(LED, detector.output() ? HIGH : LOW);
+  busyUs += micros() - start;
+  processed += count;
+  if (count > maxBatch)
+    maxBatch = count;
+}
+
+/**
+ * Task: sends the sampling and processing counters, and clears them.
+ */
+void report() {
+  uint16_t dropped = AdcSampler::ring.takeOverruns();
+  Serial.print(F("SAMPLES,"));
+  Serial.print(processed + dropped);
+  Serial.print(',');
+  Serial.print(dropped);
+  Serial.print(',');
+  Serial.print(busyUs);
+  Serial.print(',');
+  Serial.print(processed > 0 ? busyUs / processed : 0);
+  Serial.print(',');
+  Serial.println(maxBatch);
+  processed = 0;
+  busyUs = 0;
+  maxBatch = 0;
 }
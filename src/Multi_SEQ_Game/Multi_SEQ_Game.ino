@@ -0,0 +1,154 @@
+/**
+  Run Program
+  Every stop of the sequence game on one controller, one MFRC522 reader per stop.
+  Input:
+  None. The serial of a stop is its reader index + 1.
+  Function:
+  Step 0: Poll the readers in turn until a card is read.
+  Step 1: Read the card. (Get UID and debug info). Check for failure.
+  Step 2: Check the serial of the stop against the sequence on the card, award the rewards on a win.
+  Step 3: Stop Communication with the card.
+  Step 4: Leave the stop alone while its game is in progression. The other stops are still polled.
+  Step 5: Log transaction.
+  Every minute the throughput and poll latency of each reader are printed.
+*/
+
+#include <SPI.h>
+#include <CardUtil.h>
+#include <MFRC522.h>
+#include <ReaderManager.h>
+#include <Scheduler.h>
+#include <Log.h>
+#include <Journal.h>
+#include <KeyRing.h>
+#include <EEPROMStorage.h>
+#include <CardStats.h>
+
+
+#define RST_PIN         9           // Pin Mapping on Arduino, shared by the readers
+
+const byte SS_PINS[] = { 10, 8, 7, 6 };  // SS pin of each reader, one per stop.
+
+const uint32_t STORE_ID = 1;   //Store this device is in, sent with the events.
+const uint16_t DEVICE_ID = 4;  //Id of this device, sent with the events.
+Log eventLog;                 //Queues the events, drained to Serial by a task.
+EEPROMStorage storage;        //EEPROM, holding the journal.
+Journal journal(storage);     //Journal of the balance changes, kept until exported.
+KeyRing keyRing;              //Secret keys by version. To rotate: add the new one on every station, then make it current.
+
+const byte GAME_ID = 0;                //Sequence game played, out of the SEQ_GAMES a card holds.
+const unsigned long GAME_MS = 5000;    //Time the game is in progression. No card is read on the stop meanwhile.
+const unsigned long STATS_MS = 60000;  //Time between two prints of the reader counters.
+Scheduler scheduler;  //Runs reader polling and the reports without blocking.
+ReaderManager readers(handleCard);  //The readers, one per stop.
+CardUtil cardUtils[] = {            //CardUtil instance of each reader, for every card read.
+  CardUtil(readers.reader(0)), CardUtil(readers.reader(1)),
+  CardUtil(readers.reader(2)), CardUtil(readers.reader(3))
+};
+
+/**
+   Initialize.
+*/
+void setup() {
+  Serial.begin(9600); // Initialize serial communications with the PC
+  while (!Serial);    // Do nothing if no serial port is opened (added for Arduinos based on ATMEGA32U4)
+
+  SPI.begin();        // Init SPI bus
+  for (byte i = 0; i < sizeof(SS_PINS); i++)
+    readers.add(SS_PINS[i], RST_PIN);
+  readers.begin();    // Init MFRC522 cards
+
+  eventLog.begin(STORE_ID, DEVICE_ID);
+  journal.begin();
+  keyRing.add(1, CardUtil::secretKey(1));
+  for (byte i = 0; i < sizeof(SS_PINS); i++) {
+    cardUtils[i].setJournal(&journal);
+    cardUtils[i].setLog(&eventLog);
+    cardUtils[i].setKeyRing(&keyRing);
+  }
+  Serial.println(F("Scan a MIFARE Classic PICC on any stop to play the game."));
+  scheduler.add(pollReaders, 0);
+  scheduler.add(printStats, STATS_MS);
+  scheduler.add(drainLog, 0);
+  scheduler.add(CardStats::serve, 0);  //With -DCARD_STATS=1, 'S' on Serial prints the card counters, 'R' resets them.
+}
+
+/**
+   Main loop.
+*/
+void loop() {
+  scheduler.run();
+}
+
+/**
+   Task: polls the next reader.
+*/
+void pollReaders() {
+  readers.poll();
+}
+
+/**
+   Runs the game on a card read by one of the readers.
+*/
+void handleCard(byte reader, MFRC522 &mfrc522) {
+  byte serial = reader + 1;  //Serial id of the stop in the game.
+  // Show some details of the PICC (that is: the tag/card)
+  Serial.print(F("Stop "));
+  Serial.print(serial);
+  Serial.print(F(" Card UID:"));
+  dump_byte_array_internal(mfrc522.uid.uidByte, mfrc522.uid.size);
+  Serial.println();
+  byte piccType = mfrc522.PICC_GetType(mfrc522.uid.sak);
+
+  // Check for compatibility
+  if (    piccType != MFRC522::PICC_TYPE_MIFARE_MINI
+          &&  piccType != MFRC522::PICC_TYPE_MIFARE_1K
+          &&  piccType != MFRC522::PICC_TYPE_MIFARE_4K) {
+    Serial.println(F("This sample only works with MIFARE Classic cards."));
+    mfrc522.PICC_HaltA();
+    return;
+  }
+  CardUtil &cardUtil = cardUtils[reader];
+  cardUtil.rebind();                  //Work on the card just read.
+
+  //Check the sequence and award the rewards in one pass over the card.
+  CardUtil::Transaction transaction(cardUtil, GAME_ID);
+  CardUtil::Status status = transaction.load(CardUtil::Transaction::FIELD_CUR_SEQ
+      | CardUtil::Transaction::FIELD_SEQUENCE);
+  if(status.code == CardUtil::STATUS_OK)
+    status = transaction.checkSequence(serial);
+  if(status.code == CardUtil::STATUS_OK)
+    status = transaction.commit();
+  if(status.code == CardUtil::STATUS_OK) {
+   eventLog.event(Log::EVENT_SEQ_STEP, mfrc522.uid, status.currentSeq);
+   //Till the game is over. Don't read this stop while the game is in progression.
+   readers.sleep(reader, GAME_MS);
+  } else {
+    eventLog.event(Log::EVENT_CARD_ERROR, mfrc522.uid, status.code);
+  }
+  cardUtil.stop();
+}
+
+/**
+ * Task: prints the counters of the readers.
+ */
+void printStats() {
+  readers.printStats();
+}
+
+/**
+ * Task: sends the queued events to Serial.
+ */
+void drainLog() {
+  eventLog.drain();
+}
+
+/**
+ * Helper routine to dump a byte array as hex values to Serial.
+ */
+void dump_byte_array_internal(byte *buffer, byte bufferSize) {
+    for (byte i = 0; i < bufferSize; i++) {
+        Serial.print(buffer[i] < 0x10 ? " 0" : " ");
+        Serial.print(buffer[i], HEX);
+    }
+}
@@ -13,6 +13,9 @@
   Step 7: Perform Output.
   Step 8: Enable the game.
   Step 9: Log transaction.
+  Team play (TEAM_SIZE above 1):
+  The players hold their cards on the reader together. They are counted first: a team short of
+  players isn't charged, and presents its cards again. Every card is then charged in one pass.
   Output:
   Speaker:
   Success: Play Game. Total Number of Points are …..
@@ -28,6 +31,14 @@
 #include <SPI.h>
 #include <CardUtil.h>
 #include <MFRC522.h>
+#include <Scheduler.h>
+#include <Log.h>
+#include <Journal.h>
+#include <KeyRing.h>
+#include <EEPROMStorage.h>
+#include <CardStats.h>
+#include <CardScanner.h>
+#include <AdaptivePoller.h>
 
 
 #define RST_PIN         9           // Pin Mapping on Arduino
@@ -35,11 +46,29 @@
  
 
 MFRC522 mfrc522(SS_PIN, RST_PIN);   // Create MFRC522 instance.
+CardUtil cardUtil(mfrc522);         // Create CardUtil instance, for every card read.
+
+const uint32_t STORE_ID = 1;   //Store this device is in, sent with the events.
+const uint16_t DEVICE_ID = 1;  //Id of this device, sent with the events.
+Log eventLog;                 //Queues the events, drained to Serial by a task.
+EEPROMStorage storage;        //EEPROM, holding the journal.
+Journal journal(storage);     //Journal of the balance changes, kept until exported.
+KeyRing keyRing;              //Secret keys by version. To rotate: add the new one on every station, then make it current.
+CardScanner scanner(mfrc522); //Finds the cards of a team.
+
+const byte TEAM_SIZE = 1;     //Cards charged together for a team game, up to SCAN_MAX_CARDS. 1 for a single player.
 
 int numPoints = 0;  //Number of points to be loaded.
 const int LED_SUCCESS = 4; //LED Connected to digital Pin 4
 const int LED_FAILURE = 5; //LED Connected to digital Pin 5
 const int piezoPin = 8;
+const unsigned long FEEDBACK_MS = 2000;  //Time the result is shown on the LEDs.
+
+Scheduler scheduler;  //Runs card polling and feedback without blocking.
+byte ledsTask;        //Turns the LEDs off, re-armed by each result.
+AdaptivePoller poller(mfrc522, scheduler);  //Polls fast after a card, slower and with the field off when idle.
+const unsigned long SERVICE_MS = 20;    //Time between two runs of the Serial tasks: the CPU sleeps meanwhile.
+const unsigned long STATS_MS = 60000;   //Time between two prints of the poll counters.
 
 /**
    Initialize.
@@ -50,6 +79,8 @@ void setup() {
 
   SPI.begin();        // Init SPI bus
   mfrc522.PCD_Init(); // Init MFRC522 card
+  pinMode(LED_SUCCESS, OUTPUT);
+  pinMode(LED_FAILURE, OUTPUT);
 
   Serial.println(F("Enter the number of points required to play the game."));
   while (numPoints == 0)
@@ -57,59 +88,145 @@ void setup() {
   Serial.print("NumPoints Required to play this game:");
   Serial.println(numPoints);  
   Serial.println(F("Scan a MIFARE Classic PICC to play the game."));
+  eventLog.begin(STORE_ID, DEVICE_ID);
+  journal.begin();
+  cardUtil.setJournal(&journal);
+  cardUtil.setLog(&eventLog);
+  keyRing.add(1, CardUtil::secretKey(1));
+  cardUtil.setKeyRing(&keyRing);
+  poller.begin(scheduler.add(pollCard, 0));
+  ledsTask = scheduler.add(ledsOff, FEEDBACK_MS);
+  scheduler.suspend(ledsTask);
+  scheduler.add(drainLog, SERVICE_MS);
+  scheduler.add(CardStats::serve, SERVICE_MS);  //With -DCARD_STATS=1, 'S' on Serial prints the card counters, 'R' resets them.
+  scheduler.add(printStats, STATS_MS);
+  scheduler.setSleep(true);
 }
 
 /**
    Main loop.
 */
 void loop() {
-  // Look for new cards
-  if ( ! mfrc522.PICC_IsNewCardPresent())
+  scheduler.run();
+}
+
+/**
+   Task: looks for a card and charges it.
+*/
+void pollCard() {
+  if (TEAM_SIZE > 1) {
+    pollTeam();
+    return;
+  }
+  // Look for new cards, and select one of them
+  if ( ! poller.poll())
     return;
 
-  // Select one of the cards
-  if ( ! mfrc522.PICC_ReadCardSerial())
+  bool charged = chargeCard(0, mfrc522);
+  showResult(charged ? LED_SUCCESS : LED_FAILURE, !charged);
+}
+
+/**
+   Looks for the cards of a team, held on the reader together, and charges them all.
+*/
+void pollTeam() {
+  if ( ! poller.ready())
+    return;
+  poller.polled(scanner.scan() > 0);
+  if (scanner.count() == 0)
+    return;
+  if (scanner.count() < TEAM_SIZE) {
+    //The cards found are halted: they are found again once presented again.
+    Serial.print(F("Failure: Present the "));
+    Serial.print(TEAM_SIZE);
+    Serial.println(F(" cards of the team together."));
+    showResult(LED_FAILURE, true);
     return;
+  }
+  byte charged = scanner.process(chargeCard);
+  Serial.print(F("Team charged: "));
+  Serial.print(charged);
+  Serial.print('/');
+  Serial.print(scanner.count());
+  Serial.print(F(" in ms: "));
+  Serial.println((scanner.scanUs() + scanner.processUs()) / 1000);
+  bool success = charged == scanner.count();
+  showResult(success ? LED_SUCCESS : LED_FAILURE, !success);
+}
 
+/**
+   Charges the card just selected. Returns true if charged.
+*/
+bool chargeCard(byte card, MFRC522 &reader) {
   // Show some details of the PICC (that is: the tag/card)
   Serial.print(F("Card UID:"));
-  dump_byte_array_internal(mfrc522.uid.uidByte, mfrc522.uid.size);
+  dump_byte_array_internal(reader.uid.uidByte, reader.uid.size);
   Serial.println();
   Serial.print(F("PICC type: "));
-  byte piccType = mfrc522.PICC_GetType(mfrc522.uid.sak);
-  Serial.println(mfrc522.PICC_GetTypeName(piccType));
+  byte piccType = reader.PICC_GetType(reader.uid.sak);
+  Serial.println(reader.PICC_GetTypeName(piccType));
 
   // Check for compatibility
   if (    piccType != MFRC522::PICC_TYPE_MIFARE_MINI
           &&  piccType != MFRC522::PICC_TYPE_MIFARE_1K
           &&  piccType != MFRC522::PICC_TYPE_MIFARE_4K) {
     Serial.println(F("This sample only works with MIFARE Classic cards."));
-    return;
+    reader.PICC_HaltA();
+    return false;
   }
-  CardUtil cardUtil(mfrc522);         //Create CardUtil instance.
+  cardUtil.rebind();                  //Work on the card just read.
   
   CardUtil::Status status = cardUtil.chargePoints(numPoints);
+  cardUtil.stop();
   if(status.code == CardUtil::STATUS_OK) {
    //proceed with the game
+   eventLog.event(Log::EVENT_POINTS_CHARGED, reader.uid, -numPoints);
    Serial.println("Success: Card is good.");
-   //delay(5000);      //delay for 5 seconds (Till the game is over. Don't read if the game is in progression.)
-   digitalWrite(LED_SUCCESS, HIGH); //Turn on the LED.
-   delay(2000); //Wait for 1 seconds.
-   digitalWrite(LED_SUCCESS, LOW); //Turn off the LED.
+   return true;
   } else if(status.code == CardUtil::STATUS_INSUFFICIENT_POINTS){
+   eventLog.event(Log::EVENT_INSUFFICIENT_POINTS, reader.uid, numPoints);
    Serial.println("Failure: Insufficient funds.");
-   digitalWrite(LED_FAILURE, HIGH); //Turn on the LED.
-   tone(piezoPin, 1000, 2000);
-   delay(2000); //Wait for 1 seconds.
-   digitalWrite(LED_FAILURE, LOW); //Turn off the LED.   
   } else {
+    eventLog.event(Log::EVENT_CARD_ERROR, reader.uid, status.code);
     Serial.print("Failure: Error Code:");Serial.println(status.code);
-    digitalWrite(LED_FAILURE, HIGH); //Turn on the LED.
-    tone(piezoPin, 1000, 2000);
-    delay(2000); //Wait for 1 seconds.
-    digitalWrite(LED_FAILURE, LOW); //Turn off the LED.
   }
-  cardUtil.stop();
+  return false;
+}
+
+/**
+ * Turns on the given LED, and beeps if asked, for FEEDBACK_MS.
+ * The next card can be read meanwhile: its result replaces this one, for its own FEEDBACK_MS.
+ */
+void showResult(int led, bool beep) {
+  ledsOff();
+  digitalWrite(led, HIGH); //Turn on the LED.
+  if(beep)
+    tone(piezoPin, 1000, FEEDBACK_MS);
+  scheduler.resume(ledsTask);
+  scheduler.sleep(ledsTask, FEEDBACK_MS);
+}
+
+/**
+ * Task: turns off the LEDs, till the next result.
+ */
+void ledsOff() {
+  digitalWrite(LED_SUCCESS, LOW);
+  digitalWrite(LED_FAILURE, LOW);
+  scheduler.suspend(ledsTask);
+}
+
+/**
+ * Task: prints the poll counters.
+ */
+void printStats() {
+  poller.printStats();
+}
+
+/**
+ * Task: sends the queued events to Serial.
+ */
+void drainLog() {
+  eventLog.drain();
 }
 
 /**
@@ -28,6 +28,13 @@
 #include <SPI.h>
 #include <CardUtil.h>
 #include <MFRC522.h>
+#include <Scheduler.h>
+#include <Log.h>
+#include <Journal.h>
+#include <KeyRing.h>
+#include <EEPROMStorage.h>
+#include <CardStats.h>
+#include <AdaptivePoller.h>
 
 
 #define RST_PIN         9           // Pin Mapping on Arduino
@@ -35,8 +42,24 @@
  
 
 MFRC522 mfrc522(SS_PIN, RST_PIN);   // Create MFRC522 instance.
+CardUtil cardUtil(mfrc522);         // Create CardUtil instance, for every card read.
 
-byte serial = 0x03;  //Serial id for this instance in the game.
+const uint32_t STORE_ID = 1;   //Store this device is in, sent with the events.
+const uint16_t DEVICE_ID = 3;  //Id of this device, sent with the events.
+Log eventLog;                 //Queues the events, drained to Serial by a task.
+EEPROMStorage storage;        //EEPROM, holding the journal.
+Journal journal(storage);     //Journal of the balance changes, kept until exported.
+KeyRing keyRing;              //Secret keys by version. To rotate: add the new one on every station, then make it current.
+
+const unsigned long GAME_MS = 5000;  //Time the game is in progression. No card is read meanwhile.
+Scheduler scheduler;  //Runs card polling and the game timer without blocking.
+byte pollTask;        //Card polling task.
+AdaptivePoller poller(mfrc522, scheduler);  //Polls fast after a card, slower and with the field off when idle.
+const unsigned long SERVICE_MS = 20;    //Time between two runs of the Serial tasks: the CPU sleeps meanwhile.
+const unsigned long STATS_MS = 60000;   //Time between two prints of the poll counters.
+
+const byte GAME_ID = 0;  //Sequence game played, out of the SEQ_GAMES a card holds.
+byte serial = 0x03;  //Serial id for this instance in the game, from 0 to 15.
 
 /**
    Initialize.
@@ -54,18 +77,33 @@ void setup() {
   Serial.print("Serial of this game:");Serial.println(serial);
 
   Serial.println(F("Scan a MIFARE Classic PICC to play the game."));
+  eventLog.begin(STORE_ID, DEVICE_ID);
+  journal.begin();
+  cardUtil.setJournal(&journal);
+  cardUtil.setLog(&eventLog);
+  keyRing.add(1, CardUtil::secretKey(1));
+  cardUtil.setKeyRing(&keyRing);
+  pollTask = scheduler.add(pollCard, 0);
+  poller.begin(pollTask);
+  scheduler.add(drainLog, SERVICE_MS);
+  scheduler.add(CardStats::serve, SERVICE_MS);  //With -DCARD_STATS=1, 'S' on Serial prints the card counters, 'R' resets them.
+  scheduler.add(printStats, STATS_MS);
+  scheduler.setSleep(true);
 }
 
 /**
    Main loop.
 */
 void loop() {
-  // Look for new cards
-  if ( ! mfrc522.PICC_IsNewCardPresent())
-    return;
+  scheduler.run();
+}
 
-  // Select one of the cards
-  if ( ! mfrc522.PICC_ReadCardSerial())
+/**
+   Task: looks for a card and runs the game on it.
+*/
+void pollCard() {
+  // Look for new cards, and select one of them
+  if ( ! poller.poll())
     return;
 
   // Show some details of the PICC (that is: the tag/card)
@@ -83,20 +121,52 @@ void loop() {
     Serial.println(F("This sample only works with MIFARE Classic cards."));
     return;
   }
-  CardUtil cardUtil(mfrc522);         //Create CardUtil instance.
+  cardUtil.rebind();                  //Work on the card just read.
   
-  CardUtil::Status status = cardUtil.checkSequence(serial);
+  //Check the sequence and award the rewards in one pass over the card.
+  CardUtil::Transaction transaction(cardUtil, GAME_ID);
+  CardUtil::Status status = transaction.load(CardUtil::Transaction::FIELD_CUR_SEQ
+      | CardUtil::Transaction::FIELD_SEQUENCE);
+  if(status.code == CardUtil::STATUS_OK)
+    status = transaction.checkSequence(serial);
+  if(status.code == CardUtil::STATUS_OK)
+    status = transaction.commit();
   if(status.code == CardUtil::STATUS_OK) {
    //proceed with the game 
-   delay(5000);      //delay for 5 seconds (Till the game is over. Don't read if the game is in progression.)
+   eventLog.event(Log::EVENT_SEQ_STEP, mfrc522.uid, status.currentSeq);
+   //Till the game is over. Don't read if the game is in progression.
+   scheduler.suspend(pollTask);
+   scheduler.once(gameOver, GAME_MS);
   } else if(status.code == CardUtil::STATUS_INSUFFICIENT_POINTS){
       
   } else {
-    
+    eventLog.event(Log::EVENT_CARD_ERROR, mfrc522.uid, status.code);
   }
   cardUtil.stop();
 }
 
+/**
+ * Task: the game is over, read the next card.
+ */
+void gameOver() {
+  scheduler.resume(pollTask);
+  poller.activity();  //The player may tap again at once.
+}
+
+/**
+ * Task: prints the poll counters.
+ */
+void printStats() {
+  poller.printStats();
+}
+
+/**
+ * Task: sends the queued events to Serial.
+ */
+void drainLog() {
+  eventLog.drain();
+}
+
 /**
  * Helper routine to dump a byte array as hex values to Serial.
  */
@@ -0,0 +1,239 @@
+/*
+ * Arduino.cpp
+ * Host-side stand-in for the Arduino core. See Arduino.h.
+ */
+
+#include "Arduino.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+HardwareSerial Serial;
+
+static uint64_t clockUs = 0;
+static int pins[256];
+
+unsigned long millis() {
+	return (unsigned long) (clockUs / 1000);
+}
+
+unsigned long micros() {
+	return (unsigned long) clockUs;
+}
+
+uint64_t simMicros() {
+	return clockUs;
+}
+
+void simAdvanceMicros(unsigned long us) {
+	clockUs += us;
+}
+
+void delay(unsigned long ms) {
+	clockUs += (uint64_t) ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us) {
+	clockUs += us;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+	(void) pin;
+	(void) mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+	pins[pin] = val;
+}
+
+int digitalRead(uint8_t pin) {
+	return pins[pin];
+}
+
+int analogRead(uint8_t pin) {
+	return pins[pin];
+}
+
+void tone(uint8_t pin, unsigned int frequency, unsigned long duration) {
+	(void) pin;
+	(void) frequency;
+	(void) duration;
+}
+
+void noTone(uint8_t pin) {
+	(void) pin;
+}
+
+void simSetPin(uint8_t pin, int value) {
+	pins[pin] = value;
+}
+
+static std::string toBase(unsigned long value, unsigned char base) {
+	char buf[8 * sizeof(long) + 1];
+	char *str = &buf[sizeof(buf) - 1];
+	*str = '\0';
+	if (base < 2)
+		base = 10;
+	do {
+		char c = value % base;
+		value /= base;
+		*--str = c < 10 ? c + '0' : c + 'A' - 10;
+	} while (value);
+	return str;
+}
+
+String::String(int value, unsigned char base) :
+		buffer(
+				value < 0 && base == DEC ?
+						"-" + toBase(-(long) value, base) :
+						toBase((unsigned int) value, base)) {
+}
+
+String::String(unsigned int value, unsigned char base) :
+		buffer(toBase(value, base)) {
+}
+
+String::String(long value, unsigned char base) :
+		buffer(
+				value < 0 && base == DEC ?
+						"-" + toBase(-value, base) :
+						toBase((unsigned long) value, base)) {
+}
+
+String::String(unsigned long value, unsigned char base) :
+		buffer(toBase(value, base)) {
+}
+
+long String::toInt() const {
+	return atol(buffer.c_str());
+}
+
+void String::trim() {
+	size_t begin = buffer.find_first_not_of(" \t\r\n");
+	size_t end = buffer.find_last_not_of(" \t\r\n");
+	buffer = begin == std::string::npos ?
+			"" : buffer.substr(begin, end - begin + 1);
+}
+
+HardwareSerial::HardwareSerial() :
+		baud(9600), timeout(1000), written(0), muted(false) {
+}
+
+void HardwareSerial::begin(unsigned long baud) {
+	this->baud = baud;
+}
+
+int HardwareSerial::available() {
+	return input.size();
+}
+
+int HardwareSerial::peek() {
+	return input.empty() ? -1 : (byte) input[0];
+}
+
+int HardwareSerial::read() {
+	if (input.empty())
+		return -1;
+	int c = (byte) input[0];
+	input.erase(0, 1);
+	return c;
+}
+
+long HardwareSerial::parseInt() {
+	//Like Stream::parseInt(), waits for the timeout when no digits are available.
+	while (!input.empty() && !isdigit(input[0]) && input[0] != '-')
+		input.erase(0, 1);
+	if (input.empty()) {
+		delay(timeout);
+		return 0;
+	}
+	bool negative = false;
+	if (input[0] == '-') {
+		negative = true;
+		input.erase(0, 1);
+	}
+	long value = 0;
+	while (!input.empty() && isdigit(input[0])) {
+		value = value * 10 + (input[0] - '0');
+		input.erase(0, 1);
+	}
+	return negative ? -value : value;
+}
+
+void HardwareSerial::feed(const char *input) {
+	this->input += input;
+}
+
+void HardwareSerial::feed(const uint8_t *input, size_t size) {
+	this->input.append(reinterpret_cast<const char *>(input), size);
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+	written++;
+	//Start bit, 8 data bits and a stop bit per character.
+	simAdvanceMicros(10000000UL / baud);
+	if (!muted)
+		putchar(c);
+	return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+	for (size_t i = 0; i < size; i++)
+		write(buffer[i]);
+	return size;
+}
+
+size_t HardwareSerial::print(const char *str) {
+	return write((const uint8_t *) str, strlen(str));
+}
+
+size_t HardwareSerial::print(const __FlashStringHelper *str) {
+	return print(reinterpret_cast<const char *>(str));
+}
+
+size_t HardwareSerial::print(const String &str) {
+	return print(str.c_str());
+}
+
+size_t HardwareSerial::print(char c) {
+	return write((uint8_t) c);
+}
+
+size_t HardwareSerial::printNumber(unsigned long n, int base, bool negative) {
+	std::string str = toBase(n, base);
+	if (negative)
+		str = "-" + str;
+	return print(str.c_str());
+}
+
+size_t HardwareSerial::print(unsigned char n, int base) {
+	return printNumber(n, base, false);
+}
+
+size_t HardwareSerial::print(int n, int base) {
+	return print((long) n, base);
+}
+
+size_t HardwareSerial::print(unsigned int n, int base) {
+	return printNumber(n, base, false);
+}
+
+size_t HardwareSerial::print(long n, int base) {
+	if (base == DEC && n < 0)
+		return printNumber(-n, base, true);
+	return printNumber(base == DEC ? n : (unsigned long) n, base, false);
+}
+
+size_t HardwareSerial::print(unsigned long n, int base) {
+	return printNumber(n, base, false);
+}
+
+size_t HardwareSerial::print(double n, int digits) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.*f", digits, n);
+	return print(buf);
+}
+
+size_t HardwareSerial::println() {
+	return print("\r\n");
+}
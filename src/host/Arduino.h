@@ -0,0 +1,239 @@
+/*
+ * Arduino.h
+ * Host-side stand-in for the Arduino core, so the library code in src/lib
+ * can be compiled and run on Linux against the simulated MFRC522 reader.
+ *
+ * Only the subset of the core used by this project is provided.
+ * Time is virtual: millis()/micros() return a simulated clock which is
+ * advanced by delay(), by the simulated RF latency of the reader and by
+ * the time Serial output takes on the wire at the configured baud rate.
+ */
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+//Clock of the boards the sketches run on, for the code deriving timer settings from it.
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define memcpy_P memcpy
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+//Virtual clock.
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+/**
+ * Advances the virtual clock. Used by the simulated peripherals to account for their latency.
+ */
+void simAdvanceMicros(unsigned long us);
+
+/**
+ * Returns the virtual clock in microseconds without the 32 bit wrap around of micros().
+ */
+uint64_t simMicros();
+
+//Pins. Outputs are recorded, inputs read back the last value set with simSetPin().
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void tone(uint8_t pin, unsigned int frequency, unsigned long duration = 0);
+void noTone(uint8_t pin);
+
+/**
+ * Sets the value returned by digitalRead()/analogRead() for the given pin.
+ */
+void simSetPin(uint8_t pin, int value);
+
+//Interrupts. There are none on the host, the simulated peripherals are called synchronously.
+inline void interrupts() {
+}
+inline void noInterrupts() {
+}
+
+/**
+ * Minimal Arduino String, backed by std::string.
+ */
+class String {
+public:
+	String(const char *cstr = "") :
+			buffer(cstr ? cstr : "") {
+	}
+	String(const std::string &str) :
+			buffer(str) {
+	}
+	String(const __FlashStringHelper *str) :
+			buffer(reinterpret_cast<const char *>(str)) {
+	}
+	explicit String(char c) :
+			buffer(1, c) {
+	}
+	explicit String(int value, unsigned char base = DEC);
+	explicit String(unsigned int value, unsigned char base = DEC);
+	explicit String(long value, unsigned char base = DEC);
+	explicit String(unsigned long value, unsigned char base = DEC);
+
+	const char *c_str() const {
+		return buffer.c_str();
+	}
+	unsigned int length() const {
+		return buffer.length();
+	}
+	char operator[](unsigned int index) const {
+		return index < buffer.length() ? buffer[index] : 0;
+	}
+	String &operator+=(const String &rhs) {
+		buffer += rhs.buffer;
+		return *this;
+	}
+	String &operator+=(const char *rhs) {
+		buffer += rhs;
+		return *this;
+	}
+	String &operator+=(char rhs) {
+		buffer += rhs;
+		return *this;
+	}
+	bool operator==(const String &rhs) const {
+		return buffer == rhs.buffer;
+	}
+	bool operator==(const char *rhs) const {
+		return buffer == rhs;
+	}
+	bool equals(const String &rhs) const {
+		return buffer == rhs.buffer;
+	}
+	long toInt() const;
+	void trim();
+
+private:
+	std::string buffer;
+};
+
+inline String operator+(String lhs, const String &rhs) {
+	lhs += rhs;
+	return lhs;
+}
+
+/**
+ * Serial port stand-in.
+ * Output is written to stdout (unless muted) and costs 10 bit times per character on the virtual clock.
+ * Input is taken from a buffer filled with feed().
+ */
+class HardwareSerial {
+public:
+	HardwareSerial();
+
+	void begin(unsigned long baud);
+	void end() {
+	}
+	operator bool() const {
+		return true;
+	}
+
+	int available();
+	int peek();
+	int read();
+	/**
+	 * Room in the transmit buffer. Writes are timed synchronously on the host,
+	 * so this is always the size of the AVR buffer.
+	 */
+	int availableForWrite() {
+		return 63;
+	}
+	long parseInt();
+	void setTimeout(unsigned long timeout) {
+		this->timeout = timeout;
+	}
+	void flush() {
+	}
+
+	size_t write(uint8_t c);
+	size_t write(const uint8_t *buffer, size_t size);
+
+	size_t print(const __FlashStringHelper *str);
+	size_t print(const String &str);
+	size_t print(const char *str);
+	size_t print(char c);
+	size_t print(unsigned char n, int base = DEC);
+	size_t print(int n, int base = DEC);
+	size_t print(unsigned int n, int base = DEC);
+	size_t print(long n, int base = DEC);
+	size_t print(unsigned long n, int base = DEC);
+	size_t print(double n, int digits = 2);
+
+	size_t println();
+	template<typename T> size_t println(T value) {
+		size_t n = print(value);
+		return n + println();
+	}
+	template<typename T> size_t println(T value, int base) {
+		size_t n = print(value, base);
+		return n + println();
+	}
+
+	//Host only controls.
+	/**
+	 * Queues the given characters as input to be read by the sketch.
+	 */
+	void feed(const char *input);
+	void feed(const uint8_t *input, size_t size);
+
+	/**
+	 * Enables or disables echoing the output to stdout. Wire time is accounted either way.
+	 */
+	void setMuted(bool muted) {
+		this->muted = muted;
+	}
+
+	/**
+	 * Number of characters written since start.
+	 */
+	unsigned long bytesWritten() const {
+		return written;
+	}
+
+private:
+	size_t printNumber(unsigned long n, int base, bool negative);
+
+	unsigned long baud;
+	unsigned long timeout;
+	unsigned long written;
+	bool muted;
+	std::string input;
+};
+
+extern HardwareSerial Serial;
+
+#endif /* Arduino_h */
@@ -0,0 +1,284 @@
+/**
+ * Card Poll Simulation
+ * Runs a station polling a simulated MFRC522 reader through a day of sparse taps, and compares
+ * the tight polling loop of the sketches with AdaptivePoller at several idle intervals.
+ * Reports per way the latency from a card being placed to it being found, the share of the time
+ * the RF field is on and the CPU is awake, and the cards found twice while on the reader.
+ *
+ * Build (from src/), with every .cpp file of host/ and lib/:
+ *   g++ -std=c++11 -Ihost -Ilib host/Arduino.cpp host/FileStorage.cpp host/MFRC522.cpp host/SimCard.cpp \
+ *       host/SimReader.cpp lib/AdaptivePoller.cpp lib/CardCache.cpp lib/CardScanner.cpp lib/CardStats.cpp \
+ *       lib/CardUtil.cpp lib/Journal.cpp lib/KeyRing.cpp lib/Log.cpp lib/ReaderManager.cpp lib/Scheduler.cpp \
+ *       host/CardPollSim/CardPollSim.cpp -o cardpoll_sim
+ * Usage:
+ *   cardpoll_sim [-m minutes] [-g gapS] [-t tapMs] [-l leftPercent] [-f fastMs] [-o holdMs] [-k] [-s seed]
+ *   -m  Virtual time simulated per way, in minutes (default 60).
+ *   -g  Mean time between two taps, in seconds (default 30).
+ *   -t  Time a card stays on the reader for a tap, in milliseconds (default 500).
+ *   -l  Share of the cards left on the reader for a minute instead, in % (default 10).
+ *   -f  Time between two polls after activity, in milliseconds (default POLL_FAST_MS).
+ *   -o  Time polling fast after activity, in milliseconds (default POLL_HOLD_MS).
+ *   -k  Keep the field on between polls.
+ *   -s  Seed for the taps.
+ *
+ * Every way sees the same taps. A card found is handled as the sketches do, for 150 ms, and halted.
+ * A card not found before it's taken away is missed. Times are on the virtual clock.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <Scheduler.h>
+#include <AdaptivePoller.h>
+
+#define RST_PIN         9           // Pin Mapping on Arduino
+#define SS_PIN          10          // Pin Mapping on Arduino
+
+MFRC522 mfrc522(SS_PIN, RST_PIN);   // Create MFRC522 instance.
+
+static const unsigned long HANDLE_MS = 150;	// Time the station takes on a card found.
+static const unsigned long LEFT_MS = 60000;	// Time a card left on the reader stays.
+static const unsigned long IDLE_MS[] = { 100, 250, 500, 1000 };
+
+/**
+ * A card placed on the reader.
+ */
+typedef struct {
+	uint64_t placedUs;
+	uint64_t removedUs;
+} Tap;
+
+/**
+ * Results of a way.
+ */
+typedef struct {
+	const char *name;
+	unsigned long idleMs;
+	unsigned long found;
+	unsigned long missed;
+	unsigned long repeats;	// Cards found again while on the reader.
+	unsigned long polls;
+	uint64_t fieldUs;
+	uint64_t awakeUs;
+	uint64_t totalUs;
+	std::vector<unsigned long> latencies;
+	AdaptivePoller::Stats poller;
+} Result;
+
+static std::vector<Tap> taps;
+static SimCard *card;
+static AdaptivePoller *poller;	// NULL for the tight loop.
+static Result *current;
+static size_t tapIndex;			// Tap on the reader, or next.
+static bool onReader;
+static bool tapFound;
+
+/**
+ * Takes the card found, as the sketches do.
+ */
+static void handleCard() {
+	if (tapFound) {
+		current->repeats++;
+	} else {
+		tapFound = true;
+		current->found++;
+		current->latencies.push_back(
+				(unsigned long) (simMicros() - taps[tapIndex].placedUs));
+	}
+	delay(HANDLE_MS);
+	mfrc522.PICC_HaltA();
+}
+
+/**
+ * Task of the tight loop.
+ */
+static void pollTight() {
+	current->polls++;
+	if (!mfrc522.PICC_IsNewCardPresent())
+		return;
+	if (!mfrc522.PICC_ReadCardSerial())
+		return;
+	handleCard();
+}
+
+/**
+ * Task of the adaptive ways.
+ */
+static void pollAdaptive() {
+	if (!poller->poll())
+		return;
+	handleCard();
+}
+
+/**
+ * Places and takes away the card, as due.
+ */
+static void moveCard() {
+	SimReader &reader = mfrc522.sim();
+	uint64_t now = simMicros();
+	if (onReader && now >= taps[tapIndex].removedUs) {
+		reader.removeCard(card);
+		onReader = false;
+		if (!tapFound)
+			current->missed++;
+		tapIndex++;
+	}
+	if (!onReader && tapIndex < taps.size() && now >= taps[tapIndex].placedUs) {
+		reader.placeCard(card);
+		onReader = true;
+		tapFound = false;
+	}
+}
+
+static void simulate(Result &result, uint64_t durationUs,
+		unsigned long fastMs, unsigned long holdMs, bool keepField) {
+	SimReader &reader = mfrc522.sim();
+	Scheduler scheduler;
+	AdaptivePoller adaptive(mfrc522, scheduler);
+	current = &result;
+	tapIndex = 0;
+	onReader = false;
+	reader.removeAll();
+	mfrc522.PCD_AntennaOn();
+	delay(1000);
+	uint64_t start = simMicros();
+	for (size_t i = 0; i < taps.size(); i++) {
+		taps[i].placedUs += start;
+		taps[i].removedUs += start;
+	}
+	reader.resetStats();
+	if (result.idleMs == 0) {
+		poller = NULL;
+		scheduler.add(pollTight, 0);
+	} else {
+		poller = &adaptive;
+		adaptive.setTiming(fastMs, result.idleMs, holdMs);
+		adaptive.setFieldOff(!keepField);
+		adaptive.begin(scheduler.add(pollAdaptive, 0));
+		scheduler.setSleep(true);
+	}
+	uint64_t end = start + durationUs;
+	while (simMicros() < end) {
+		moveCard();
+		scheduler.run();
+	}
+	if (onReader && !tapFound)
+		result.missed++;
+	result.totalUs = simMicros() - start;
+	result.fieldUs = reader.fieldOnUs();
+	result.awakeUs = result.totalUs - (uint64_t) scheduler.sleptMillis() * 1000;
+	if (poller != NULL)
+		result.poller = adaptive.stats();
+	for (size_t i = 0; i < taps.size(); i++) {
+		taps[i].placedUs -= start;
+		taps[i].removedUs -= start;
+	}
+}
+
+/**
+ * Nearest-rank percentile of the sorted latencies.
+ */
+static unsigned long percentile(const std::vector<unsigned long> &sorted,
+		unsigned int percent) {
+	if (sorted.empty())
+		return 0;
+	size_t rank = (sorted.size() * percent + 99) / 100;
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void print(Result &result) {
+	double total = result.totalUs > 0 ? result.totalUs : 1;
+	std::sort(result.latencies.begin(), result.latencies.end());
+	printf("%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%.1f,%.1f,%lu,%lu,%lu\n",
+			result.name, result.idleMs, (unsigned long) taps.size(), result.found,
+			result.missed, result.repeats, percentile(result.latencies, 50),
+			percentile(result.latencies, 99), percentile(result.latencies, 100),
+			100.0 * result.fieldUs / total, 100.0 * result.awakeUs / total,
+			result.idleMs == 0 ? result.polls : (unsigned long) result.poller.polls,
+			result.poller.cards > 0 ?
+					(unsigned long) (result.poller.gapSumMs / result.poller.cards) : 0,
+			(unsigned long) result.poller.maxGapMs);
+}
+
+int main(int argc, char **argv) {
+	double minutes = 60;
+	double gapS = 30;
+	unsigned long tapMs = 500;
+	unsigned int leftPercent = 10;
+	unsigned long fastMs = POLL_FAST_MS;
+	unsigned long holdMs = POLL_HOLD_MS;
+	bool keepField = false;
+	unsigned long seed = 1;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+			minutes = atof(argv[++i]);
+		else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc)
+			gapS = atof(argv[++i]);
+		else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			tapMs = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+			leftPercent = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+			fastMs = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+			holdMs = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-k") == 0)
+			keepField = true;
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			seed = strtoul(argv[++i], NULL, 0);
+		else {
+			fprintf(stderr,
+					"Usage: %s [-m minutes] [-g gapS] [-t tapMs] [-l leftPercent] [-f fastMs] [-o holdMs] [-k] [-s seed]\n",
+					argv[0]);
+			return 1;
+		}
+	}
+	if (minutes <= 0 || gapS <= 0) {
+		fprintf(stderr, "Minutes and gap must be positive\n");
+		return 1;
+	}
+
+	//Taps at exponentially distributed times, relative to the start of a way.
+	srand(seed);
+	uint64_t durationUs = (uint64_t) (minutes * 60e6);
+	uint64_t at = 0;
+	for (;;) {
+		double u = (rand() + 1.0) / ((double) RAND_MAX + 2.0);
+		at += (uint64_t) (-log(u) * gapS * 1e6);
+		if (at >= durationUs)
+			break;
+		Tap tap;
+		tap.placedUs = at;
+		bool left = (unsigned int) (rand() % 100) < leftPercent;
+		tap.removedUs = at + (uint64_t) (left ? LEFT_MS : tapMs) * 1000;
+		taps.push_back(tap);
+		at = tap.removedUs;
+	}
+
+	const byte uid[4] = { 0x4B, 0x1D, 0xA7, 0x02 };
+	card = new SimCard(uid, sizeof(uid));
+	mfrc522.PCD_Init();
+
+	std::vector<Result> results;
+	Result tight = Result();
+	tight.name = "tight";
+	results.push_back(tight);
+	for (size_t i = 0; i < sizeof(IDLE_MS) / sizeof(IDLE_MS[0]); i++) {
+		Result adaptive = Result();
+		adaptive.name = "adaptive";
+		adaptive.idleMs = IDLE_MS[i];
+		results.push_back(adaptive);
+	}
+	printf("way,idle_ms,taps,found,missed,repeats,p50_us,p99_us,max_us,field_pct,"
+			"cpu_awake_pct,polls,gap_mean_ms,gap_max_ms\n");
+	for (size_t i = 0; i < results.size(); i++) {
+		simulate(results[i], durationUs, fastMs, holdMs, keepField);
+		print(results[i]);
+	}
+	delete card;
+	return 0;
+}
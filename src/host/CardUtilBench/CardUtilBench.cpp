@@ -0,0 +1,277 @@
+/**
+ * CardUtil Benchmark
+ * Drives every public CardUtil operation many times against a simulated MFRC522 reader, and
+ * reports per operation the RF commands and bytes per tap, and the tap-to-result latency
+ * percentiles. Meant to be run before and after a change, to gate on regressions.
+ *
+ * Build (from src/), with every .cpp file of host/ and lib/:
+ *   g++ -std=c++11 -O2 -Ihost -Ilib host/Arduino.cpp host/FileStorage.cpp host/MFRC522.cpp host/SimCard.cpp \
+ *       host/SimReader.cpp lib/CardCache.cpp lib/CardStats.cpp lib/CardUtil.cpp lib/Journal.cpp lib/KeyRing.cpp \
+ *       lib/Log.cpp lib/ReaderManager.cpp lib/Scheduler.cpp host/CardUtilBench/CardUtilBench.cpp -o cardutil_bench
+ *   Add -DLOG_LEVEL=2 (see Log.h) to measure the production build.
+ * Usage:
+ *   cardutil_bench [-n iterations] [-w] [-c] [-f failurePerMille] [-s seed] [-l command=us]... [-J]
+ *   -n  Cards put through every operation (default 100).
+ *   -w  Write balances with MIFARE_SetValue instead of the native value operations.
+ *   -c  Cache the card state between taps (CardCache).
+ *   -f  Chance of an RF command getting no answer, in 1/1000.
+ *   -s  Seed for the error injection.
+ *   -l  Sets a field of the latency model, in microseconds: request, select, auth, read, write,
+ *       value, transfer, halt, per_byte or timeout. May be repeated.
+ *   -J  JSON output instead of CSV.
+ *
+ * Each iteration takes a blank card through configure, the balance and sequence game
+ * operations and reset, one tap each: the card is placed on the reader, selected, the operation
+ * is run, stop() is called and the card is taken away. The latency of a tap is on the virtual
+ * clock, from the card being placed to stop() returning, Serial output at 9600 baud included.
+ * Failed taps count in the latencies too: they're what the player waits for.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <CardUtil.h>
+
+#define RST_PIN         9           // Pin Mapping on Arduino
+#define SS_PIN          10          // Pin Mapping on Arduino
+
+MFRC522 mfrc522(SS_PIN, RST_PIN);   // Create MFRC522 instance.
+
+static const byte sequence[] = { 0x01, 0x02, 0x03 };
+
+/**
+ * The operations benchmarked, in the order of an iteration.
+ */
+enum Operation {
+	OP_CONFIGURE,
+	OP_CHECK_STATUS,
+	OP_GET_POINTS,
+	OP_ADD_POINTS,
+	OP_CHARGE_POINTS,
+	OP_GET_REWARDS,
+	OP_ADD_REWARDS,
+	OP_CHARGE_REWARDS,
+	OP_INIT_SEQUENCE,
+	OP_CHECK_SEQUENCE,
+	OP_RESET,
+	OP_COUNT,
+};
+
+static const char *const operationNames[OP_COUNT] = { "configure", "checkStatus",
+		"getPoints", "addPoints", "chargePoints", "getRewards", "addRewards",
+		"chargeRewards", "initSequence", "checkSequence", "reset" };
+
+/**
+ * Results of an operation over all the iterations.
+ */
+typedef struct {
+	unsigned long taps;
+	unsigned long failedTaps;	// Taps not returning STATUS_OK.
+	unsigned long calls[SimReader::CMD_COUNT];
+	unsigned long failures;		// RF commands failed.
+	unsigned long bytesOnAir;
+	unsigned long spiBytes;
+	std::vector<unsigned long> latencies;
+} Result;
+
+static Result results[OP_COUNT];
+
+static CardUtil::Status run(CardUtil &cardUtil, int operation, byte step) {
+	switch (operation) {
+	case OP_CONFIGURE:
+		return cardUtil.configure(100);
+	case OP_CHECK_STATUS:
+		return cardUtil.checkStatus();
+	case OP_GET_POINTS:
+		return cardUtil.getPoints();
+	case OP_ADD_POINTS:
+		return cardUtil.addPoints(50);
+	case OP_CHARGE_POINTS:
+		return cardUtil.chargePoints(30);
+	case OP_GET_REWARDS:
+		return cardUtil.getRewards();
+	case OP_ADD_REWARDS:
+		return cardUtil.addRewards(5);
+	case OP_CHARGE_REWARDS:
+		return cardUtil.chargeRewards(2);
+	case OP_INIT_SEQUENCE:
+		return cardUtil.initSequence(0, sequence, sizeof(sequence), 10);
+	case OP_CHECK_SEQUENCE:
+		return cardUtil.checkSequence(0, sequence[step]);
+	default:
+		return cardUtil.reset(20);
+	}
+}
+
+/**
+ * Puts the card through one tap of the operation and accounts for it.
+ */
+static void tap(CardUtil &cardUtil, SimCard &card, int operation, byte step) {
+	SimReader &reader = mfrc522.sim();
+	reader.placeCard(&card);
+	reader.resetStats();
+	uint64_t start = simMicros();
+	CardUtil::Status status;
+	status.code = CardUtil::STATUS_ERROR_WITH_CARD;
+	if (mfrc522.PICC_IsNewCardPresent() && mfrc522.PICC_ReadCardSerial()) {
+		cardUtil.rebind();
+		status = run(cardUtil, operation, step);
+		cardUtil.stop();
+	}
+	uint64_t elapsed = simMicros() - start;
+	reader.removeCard(&card);
+
+	Result &result = results[operation];
+	result.taps++;
+	if (status.code != CardUtil::STATUS_OK)
+		result.failedTaps++;
+	for (byte cmd = 0; cmd < SimReader::CMD_COUNT; cmd++) {
+		result.calls[cmd] += reader.stats.calls[cmd];
+		result.failures += reader.stats.failures[cmd];
+	}
+	result.bytesOnAir += reader.stats.bytesOnAir;
+	result.spiBytes += reader.stats.spiBytes;
+	result.latencies.push_back((unsigned long) elapsed);
+}
+
+/**
+ * Nearest-rank percentile of the sorted latencies.
+ */
+static unsigned long percentile(const std::vector<unsigned long> &sorted,
+		unsigned int percent) {
+	if (sorted.empty())
+		return 0;
+	size_t rank = (sorted.size() * percent + 99) / 100;
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static bool setLatency(SimLatencyModel &latency, const char *arg) {
+	static const struct {
+		const char *name;
+		unsigned long SimLatencyModel::*field;
+	} fields[] = { { "request", &SimLatencyModel::requestUs }, { "select",
+			&SimLatencyModel::selectUs }, { "auth", &SimLatencyModel::authUs }, {
+			"read", &SimLatencyModel::readUs }, { "write",
+			&SimLatencyModel::writeUs }, { "value", &SimLatencyModel::valueUs }, {
+			"transfer", &SimLatencyModel::transferUs }, { "halt",
+			&SimLatencyModel::haltUs }, { "per_byte", &SimLatencyModel::perByteUs },
+			{ "timeout", &SimLatencyModel::timeoutUs } };
+	const char *equals = strchr(arg, '=');
+	if (equals == NULL)
+		return false;
+	for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+		if (strlen(fields[i].name) == (size_t) (equals - arg)
+				&& strncmp(arg, fields[i].name, equals - arg) == 0) {
+			latency.*fields[i].field = strtoul(equals + 1, NULL, 0);
+			return true;
+		}
+	}
+	return false;
+}
+
+static void printCsv() {
+	printf("operation,taps,failed_taps");
+	for (byte cmd = 0; cmd < SimReader::CMD_COUNT; cmd++)
+		printf(",%s", SimReader::commandName((SimReader::Command) cmd));
+	printf(",failures,bytes_on_air,spi_bytes,p50_us,p99_us,max_us\n");
+	for (int operation = 0; operation < OP_COUNT; operation++) {
+		Result &result = results[operation];
+		double taps = result.taps > 0 ? result.taps : 1;
+		printf("%s,%lu,%lu", operationNames[operation], result.taps,
+				result.failedTaps);
+		for (byte cmd = 0; cmd < SimReader::CMD_COUNT; cmd++)
+			printf(",%.2f", result.calls[cmd] / taps);
+		printf(",%.2f,%.1f,%.1f,%lu,%lu,%lu\n", result.failures / taps,
+				result.bytesOnAir / taps, result.spiBytes / taps,
+				percentile(result.latencies, 50),
+				percentile(result.latencies, 99),
+				percentile(result.latencies, 100));
+	}
+}
+
+static void printJson() {
+	printf("[\n");
+	for (int operation = 0; operation < OP_COUNT; operation++) {
+		Result &result = results[operation];
+		double taps = result.taps > 0 ? result.taps : 1;
+		printf("  {\"operation\": \"%s\", \"taps\": %lu, \"failed_taps\": %lu",
+				operationNames[operation], result.taps, result.failedTaps);
+		for (byte cmd = 0; cmd < SimReader::CMD_COUNT; cmd++)
+			printf(", \"%s\": %.2f",
+					SimReader::commandName((SimReader::Command) cmd),
+					result.calls[cmd] / taps);
+		printf(", \"failures\": %.2f, \"bytes_on_air\": %.1f, \"spi_bytes\": %.1f",
+				result.failures / taps, result.bytesOnAir / taps,
+				result.spiBytes / taps);
+		printf(", \"p50_us\": %lu, \"p99_us\": %lu, \"max_us\": %lu}%s\n",
+				percentile(result.latencies, 50),
+				percentile(result.latencies, 99),
+				percentile(result.latencies, 100),
+				operation + 1 < OP_COUNT ? "," : "");
+	}
+	printf("]\n");
+}
+
+int main(int argc, char **argv) {
+	long iterations = 100;
+	bool nativeValueOps = true;
+	bool json = false;
+	CardCache *cache = NULL;
+	SimReader &reader = mfrc522.sim();
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			iterations = atol(argv[++i]);
+		else if (strcmp(argv[i], "-w") == 0)
+			nativeValueOps = false;
+		else if (strcmp(argv[i], "-c") == 0 && cache == NULL)
+			cache = new CardCache();
+		else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+			reader.errors.failurePerMille = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			reader.errors.seed = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc
+				&& setLatency(reader.latency, argv[i + 1]))
+			i++;
+		else if (strcmp(argv[i], "-J") == 0)
+			json = true;
+		else {
+			fprintf(stderr,
+					"Usage: %s [-n iterations] [-w] [-c] [-f failurePerMille] [-s seed] [-l command=us]... [-J]\n",
+					argv[0]);
+			return 1;
+		}
+	}
+	Serial.begin(9600);
+	Serial.setMuted(true);
+	mfrc522.PCD_Init();
+	CardUtil cardUtil(mfrc522);
+	cardUtil.setNativeValueOps(nativeValueOps);
+	cardUtil.setCache(cache);
+
+	for (long i = 0; i < iterations; i++) {
+		//A blank card each time, with its own UID so that the cache doesn't mix them up.
+		byte uid[4] = { 0x42, (byte) (i >> 16), (byte) (i >> 8), (byte) i };
+		SimCard card(uid, sizeof(uid));
+		for (int operation = 0; operation < OP_COUNT; operation++) {
+			if (operation == OP_CHECK_SEQUENCE) {
+				for (byte step = 0; step < sizeof(sequence); step++)
+					tap(cardUtil, card, operation, step);
+			} else {
+				tap(cardUtil, card, operation, 0);
+			}
+		}
+	}
+	for (int operation = 0; operation < OP_COUNT; operation++)
+		std::sort(results[operation].latencies.begin(),
+				results[operation].latencies.end());
+
+	if (json)
+		printJson();
+	else
+		printCsv();
+	delete cache;
+	return 0;
+}
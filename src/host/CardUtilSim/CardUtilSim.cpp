@@ -0,0 +1,409 @@
+/**
+ * CardUtil Simulation
+ * Runs every CardUtil operation against a simulated MFRC522 reader and card on the host,
+ * and reports the RF commands and the time each operation takes.
+ *
+ * Build (from src/), with every .cpp file of host/ and lib/:
+ *   g++ -std=c++11 -Ihost -Ilib host/Arduino.cpp host/FileStorage.cpp host/MFRC522.cpp host/SimCard.cpp \
+ *       host/SimReader.cpp lib/CardCache.cpp lib/CardStats.cpp lib/CardUtil.cpp lib/Journal.cpp lib/KeyRing.cpp \
+ *       lib/Log.cpp lib/ReaderManager.cpp lib/Scheduler.cpp host/CardUtilSim/CardUtilSim.cpp -o cardutil_sim
+ *   Add -DLOG_LEVEL=2 (see Log.h) to measure the production build.
+ * Usage:
+ *   cardutil_sim [-v] [-w] [-c] [-k] [-1 | -m] [-f failurePerMille] [-s seed] [-t command | -T] [-j journal [-x]]
+ *   -v  Echo CardUtil's Serial output.
+ *   -w  Write balances with MIFARE_SetValue instead of the native value operations.
+ *   -c  Cache the card state between taps (CardCache).
+ *   -k  Rotate the secret key: the card is configured on version 1 of a key ring, then version 2 is
+ *       made current. The next tap finds the card on version 1 and upgrades it.
+ *   -1  Configure the card with data layout v1 (see CardUtil::Layout) and keep it.
+ *   -m  Configure the card with data layout v1, then make v2 the layout: the next tap migrates it.
+ *   -f  Chance of an RF command getting no answer, in 1/1000.
+ *   -s  Seed for the error injection.
+ *   -t  Take the card away on this RF command (0 = the first once the card is selected) of the
+ *       tx_chargeInitSequence tap, whose commit changes points and sequence game 0 together. The tap
+ *       after recovers it.
+ *   -T  Instead of the operations, sweep the tears over a game of sequence game 0: each tap of it,
+ *       the one charging points and starting the game included, is torn on every RF command in turn,
+ *       on a card configured anew each time. The player then taps again: a new transaction loads,
+ *       changes and commits the card, as the sketches do. Prints a line per tear with the balances
+ *       left, and exits with 1 unless the game is charged once and paid once every time; with -1, a
+ *       win torn before its rewards may leave them unpaid.
+ *   -j  Journal the balance changes to this file, standing in for a 1 KB EEPROM.
+ *       It persists across runs.
+ *   -x  Export the pending journal entries after the run.
+ *
+ * Each operation is a separate tap: the card is placed on the reader, selected,
+ * the operation is run, stop() is called and the card is taken away.
+ * Output is one CSV line per operation. Times are on the virtual clock and include
+ * the time CardUtil's Serial output takes at 9600 baud.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <CardUtil.h>
+#include <Journal.h>
+#include <KeyRing.h>
+#include <FileStorage.h>
+
+#define RST_PIN         9           // Pin Mapping on Arduino
+#define SS_PIN          10          // Pin Mapping on Arduino
+
+MFRC522 mfrc522(SS_PIN, RST_PIN);   // Create MFRC522 instance.
+
+static const byte cardUid[4] = { 0xDE, 0xAD, 0xBE, 0xEF };
+static SimCard card(cardUid, sizeof(cardUid));
+
+//Version 2 of the secret key, for -k.
+static const MFRC522::MIFARE_Key secretKeyV2 = { { 0x5e, 0x11, 0x7a, 0x03,
+		0xc4, 0x9d } };
+
+static byte sequence[16] = { 0x01, 0x02, 0x03, 0x00 };
+
+/**
+ * The operations, one per tap.
+ */
+enum Operation {
+	OP_CONFIGURE,
+	OP_CHECK_STATUS,
+	OP_CHECK_STATUS_AGAIN,
+	OP_GET_POINTS,
+	OP_ADD_POINTS,
+	OP_CHARGE_POINTS,
+	OP_GET_REWARDS,
+	OP_ADD_REWARDS,
+	OP_CHARGE_REWARDS,
+	OP_INIT_SEQUENCE,
+	OP_CHECK_SEQUENCE_1,
+	OP_CHECK_SEQUENCE_2,
+	OP_CHECK_SEQUENCE_3,
+	OP_TX_CHARGE_INIT_SEQUENCE,
+	OP_TX_CHECK_SEQUENCE_1,
+	OP_TX_CHECK_SEQUENCE_2,
+	OP_TX_CHECK_SEQUENCE_3,
+	OP_RESET,
+};
+
+static const char *const operationNames[] = { "configure", "checkStatus",
+		"checkStatus", "getPoints", "addPoints", "chargePoints", "getRewards", "addRewards",
+		"chargeRewards", "initSequence", "checkSequence", "checkSequence",
+		"checkSequence", "tx_chargeInitSequence", "tx_checkSequence",
+		"tx_checkSequence", "tx_checkSequence", "reset" };
+
+//The game of the tear sweep, -T.
+static const byte sweepSteps[] = { 0x05, 0x06, 0x07 };
+static const int32_t sweepCharge = 10;
+static const int32_t sweepRewards = 42;
+
+/**
+ * Runs a sequence game step as SEQ_Game does, in one transaction.
+ */
+static CardUtil::Status checkSequence(CardUtil &cardUtil, byte next) {
+	CardUtil::Transaction transaction(cardUtil);
+	CardUtil::Status status = transaction.load(
+			CardUtil::Transaction::FIELD_CUR_SEQ
+					| CardUtil::Transaction::FIELD_SEQUENCE);
+	if (status.code == CardUtil::STATUS_OK)
+		status = transaction.checkSequence(next);
+	if (status.code == CardUtil::STATUS_OK)
+		status = transaction.commit();
+	return status;
+}
+
+static CardUtil::Status run(CardUtil &cardUtil, int operation) {
+	CardUtil::Transaction transaction(cardUtil);
+	CardUtil::Status status;
+	switch (operation) {
+	case OP_CONFIGURE:
+		return cardUtil.configure(100);
+	case OP_CHECK_STATUS:
+	case OP_CHECK_STATUS_AGAIN:
+		return cardUtil.checkStatus();
+	case OP_GET_POINTS:
+		return cardUtil.getPoints();
+	case OP_ADD_POINTS:
+		return cardUtil.addPoints(50);
+	case OP_CHARGE_POINTS:
+		return cardUtil.chargePoints(30);
+	case OP_GET_REWARDS:
+		return cardUtil.getRewards();
+	case OP_ADD_REWARDS:
+		return cardUtil.addRewards(5);
+	case OP_CHARGE_REWARDS:
+		return cardUtil.chargeRewards(2);
+	case OP_INIT_SEQUENCE:
+		return cardUtil.initSequence(sequence, 10);
+	case OP_CHECK_SEQUENCE_1:
+		return cardUtil.checkSequence(0x01);
+	case OP_CHECK_SEQUENCE_2:
+		return cardUtil.checkSequence(0x02);
+	case OP_CHECK_SEQUENCE_3:
+		return cardUtil.checkSequence(0x03);
+	case OP_TX_CHARGE_INIT_SEQUENCE:
+		//As Play_SEQ_Game does.
+		status = transaction.load(CardUtil::Transaction::FIELD_POINTS);
+		if (status.code == CardUtil::STATUS_OK)
+			status = transaction.chargePoints(10);
+		if (status.code == CardUtil::STATUS_OK)
+			status = transaction.initSequence(sequence, 10);
+		if (status.code == CardUtil::STATUS_OK)
+			status = transaction.commit();
+		return status;
+	case OP_TX_CHECK_SEQUENCE_1:
+		return checkSequence(cardUtil, 0x01);
+	case OP_TX_CHECK_SEQUENCE_2:
+		return checkSequence(cardUtil, 0x02);
+	case OP_TX_CHECK_SEQUENCE_3:
+		return checkSequence(cardUtil, 0x03);
+	default:
+		return cardUtil.reset(20);
+	}
+}
+
+/**
+ * Places the card and selects it, as a tap does. Returns false if it can't be selected.
+ */
+static bool placeCard(CardUtil &cardUtil, SimCard &simCard) {
+	mfrc522.sim().placeCard(&simCard);
+	if (!mfrc522.PICC_IsNewCardPresent() || !mfrc522.PICC_ReadCardSerial())
+		return false;
+	cardUtil.rebind();
+	return true;
+}
+
+static void removeCard(CardUtil &cardUtil, SimCard &simCard) {
+	cardUtil.stop();
+	mfrc522.sim().removeCard(&simCard);
+}
+
+/**
+ * A tap of the sweep's game, as the sketches do it: a transaction of its own, loaded, changed and
+ * committed. Tap 0 charges the points and starts the game as Play_SEQ_Game does, unless the start
+ * torn on the tap before is finished. The others are its steps, as SEQ_Game.
+ */
+static CardUtil::Status sweepTap(CardUtil &cardUtil, byte tap) {
+	CardUtil::Transaction transaction(cardUtil);
+	CardUtil::Status status;
+	if (tap == 0) {
+		status = transaction.load(CardUtil::Transaction::FIELD_POINTS);
+		bool started = status.code == CardUtil::STATUS_OK
+				&& transaction.startRecovered();
+		if (status.code == CardUtil::STATUS_OK && !started)
+			status = transaction.chargePoints(sweepCharge);
+		if (status.code == CardUtil::STATUS_OK && !started)
+			status = transaction.initSequence(sweepSteps, sizeof(sweepSteps),
+					sweepRewards);
+	} else {
+		status = transaction.load(
+				CardUtil::Transaction::FIELD_CUR_SEQ
+						| CardUtil::Transaction::FIELD_SEQUENCE);
+		if (status.code == CardUtil::STATUS_OK)
+			status = transaction.checkSequence(sweepSteps[tap - 1]);
+	}
+	if (status.code == CardUtil::STATUS_OK)
+		status = transaction.commit();
+	return status;
+}
+
+/**
+ * The tear sweep, -T. Returns false if a tear left the card with other balances than the game
+ * played through, but for the rewards a card that isn't recorded (see CardUtil::Transaction) may lose.
+ */
+static bool sweepTears(CardUtil &cardUtil, int32_t numPoints,
+		CardUtil::Layout layout, bool migrate, KeyRing *keyRing) {
+	SimReader &reader = mfrc522.sim();
+	//The game is played on a v2 card, migrated by the first tap with -m.
+	bool recorded = layout == CardUtil::LAYOUT_V2 || migrate;
+	bool passed = true;
+	printf("torn_tap,command,points,rewards,seq,result\n");
+	for (byte tornTap = 0; tornTap <= sizeof(sweepSteps); tornTap++) {
+		for (long tear = 0;; tear++) {
+			//A new card, configured as for the operations.
+			SimCard sweepCard(cardUid, sizeof(cardUid));
+			if (keyRing != NULL)
+				keyRing->setCurrent(1);
+			if (migrate)
+				cardUtil.setLayout(CardUtil::LAYOUT_V1);
+			if (placeCard(cardUtil, sweepCard))
+				cardUtil.configure(numPoints);
+			removeCard(cardUtil, sweepCard);
+			if (keyRing != NULL)
+				keyRing->setCurrent(2);
+			if (migrate)
+				cardUtil.setLayout(CardUtil::LAYOUT_V2);
+			bool torn = false;
+			for (byte tap = 0; tap <= sizeof(sweepSteps); tap++) {
+				CardUtil::Status status;
+				status.code = CardUtil::STATUS_ERROR_WITH_CARD;
+				//The torn tap, then the player taps again.
+				for (byte attempt = 0; attempt < 2 && status.code != CardUtil::STATUS_OK;
+						attempt++) {
+					if (tap == tornTap && attempt == 0)
+						reader.errors.tearAfter = tear;
+					if (placeCard(cardUtil, sweepCard))
+						status = sweepTap(cardUtil, tap);
+					removeCard(cardUtil, sweepCard);
+					torn |= tap == tornTap && attempt == 0 && reader.errors.tearAfter < 0;
+					reader.errors.tearAfter = -1;
+				}
+			}
+			//Past the last command of the tap: nothing left to tear.
+			if (!torn)
+				break;
+			CardUtil::Status status;
+			memset(&status, 0, sizeof(status));
+			if (placeCard(cardUtil, sweepCard))
+				status = cardUtil.checkStatus();
+			removeCard(cardUtil, sweepCard);
+			bool played = status.code == CardUtil::STATUS_OK
+					&& status.currentPoints == numPoints - sweepCharge
+					&& status.currentSeq == -1;
+			const char *result =
+					played && status.currentRewards == sweepRewards ? "ok" :
+					played && status.currentRewards == 0 && !recorded ?
+							"unpaid" : "wrong";
+			passed &= result[0] != 'w';
+			printf("%s,%ld,%ld,%ld,%ld,%s\n",
+					tornTap == 0 ? "tx_chargeInitSequence" : "tx_checkSequence", tear,
+					(long) status.currentPoints, (long) status.currentRewards,
+					(long) status.currentSeq, result);
+		}
+	}
+	return passed;
+}
+
+int main(int argc, char **argv) {
+	bool verbose = false;
+	bool nativeValueOps = true;
+	const char *journalPath = NULL;
+	bool exportJournal = false;
+	CardCache *cache = NULL;
+	KeyRing *keyRing = NULL;
+	CardUtil::Layout layout = CardUtil::LAYOUT_V2;
+	bool migrate = false;
+	long tearAt = -1;
+	bool sweep = false;
+	SimReader &reader = mfrc522.sim();
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-v") == 0)
+			verbose = true;
+		else if (strcmp(argv[i], "-w") == 0)
+			nativeValueOps = false;
+		else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+			reader.errors.failurePerMille = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			reader.errors.seed = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			tearAt = atol(argv[++i]);
+		else if (strcmp(argv[i], "-T") == 0)
+			sweep = true;
+		else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			journalPath = argv[++i];
+		else if (strcmp(argv[i], "-x") == 0)
+			exportJournal = true;
+		else if (strcmp(argv[i], "-c") == 0 && cache == NULL)
+			cache = new CardCache();
+		else if (strcmp(argv[i], "-k") == 0 && keyRing == NULL) {
+			keyRing = new KeyRing();
+			keyRing->add(1, CardUtil::secretKey(1));
+			keyRing->add(2, &secretKeyV2);
+		} else if (strcmp(argv[i], "-1") == 0 && !migrate) {
+			layout = CardUtil::LAYOUT_V1;
+		} else if (strcmp(argv[i], "-m") == 0 && layout == CardUtil::LAYOUT_V2) {
+			layout = CardUtil::LAYOUT_V1;
+			migrate = true;
+		} else {
+			fprintf(stderr,
+					"Usage: %s [-v] [-w] [-c] [-k] [-1 | -m] [-f failurePerMille] [-s seed] [-t command | -T] [-j journal [-x]]\n",
+					argv[0]);
+			return 1;
+		}
+	}
+	FileStorage *storage = NULL;
+	Journal *journal = NULL;
+	if (journalPath != NULL) {
+		storage = new FileStorage(journalPath, 1024);
+		if (!storage->isOpen()) {
+			fprintf(stderr, "Can't open %s\n", journalPath);
+			return 1;
+		}
+		journal = new Journal(*storage);
+		journal->begin();
+	}
+	Serial.begin(9600);
+	Serial.setMuted(!verbose);
+	mfrc522.PCD_Init();
+	CardUtil cardUtil(mfrc522);
+	cardUtil.setNativeValueOps(nativeValueOps);
+	cardUtil.setJournal(journal);
+	cardUtil.setCache(cache);
+	cardUtil.setKeyRing(keyRing);
+	cardUtil.setLayout(layout);
+
+	if (sweep) {
+		bool passed = sweepTears(cardUtil, 100, layout, migrate, keyRing);
+		delete cache;
+		delete keyRing;
+		delete journal;
+		delete storage;
+		return passed ? 0 : 1;
+	}
+
+	printf("operation,code,mfrc522_status,points,rewards,seq");
+	for (byte cmd = 0; cmd < SimReader::CMD_COUNT; cmd++)
+		printf(",%s", SimReader::commandName((SimReader::Command) cmd));
+	printf(",failures,bytes_on_air,rf_us,serial_bytes,journal_bytes,total_us\n");
+
+	for (int operation = OP_CONFIGURE; operation <= OP_RESET; operation++) {
+		reader.placeCard(&card);
+		reader.resetStats();
+		if (operation == OP_TX_CHARGE_INIT_SEQUENCE)
+			reader.errors.tearAfter = tearAt;
+		unsigned long serialBytes = Serial.bytesWritten();
+		unsigned long journalBytes = storage ? storage->bytesWritten() : 0;
+		uint64_t start = simMicros();
+		CardUtil::Status status;
+		memset(&status, 0, sizeof(status));
+		if (mfrc522.PICC_IsNewCardPresent() && mfrc522.PICC_ReadCardSerial()) {
+			cardUtil.rebind();
+			status = run(cardUtil, operation);
+			cardUtil.stop();
+		} else {
+			status.code = CardUtil::STATUS_ERROR_WITH_CARD;
+		}
+		uint64_t elapsed = simMicros() - start;
+		reader.errors.tearAfter = -1;
+		reader.removeCard(&card);
+		if (operation == OP_CONFIGURE && keyRing != NULL)
+			keyRing->setCurrent(2);
+		if (operation == OP_CONFIGURE && migrate)
+			cardUtil.setLayout(CardUtil::LAYOUT_V2);
+
+		unsigned long failures = 0;
+		printf("%s,%d,%d,%ld,%ld,%ld", operationNames[operation], status.code,
+				status.mfrc522StatusCode, (long) status.currentPoints,
+				(long) status.currentRewards, (long) status.currentSeq);
+		for (byte cmd = 0; cmd < SimReader::CMD_COUNT; cmd++) {
+			printf(",%lu", reader.stats.calls[cmd]);
+			failures += reader.stats.failures[cmd];
+		}
+		printf(",%lu,%lu,%lu,%lu,%lu,%llu\n", failures,
+				reader.stats.bytesOnAir, reader.stats.busyUs,
+				Serial.bytesWritten() - serialBytes,
+				(storage ? storage->bytesWritten() : 0) - journalBytes,
+				(unsigned long long) elapsed);
+	}
+	if (keyRing != NULL)
+		fprintf(stderr, "key ring: %u retries, %u hits, %u upgrades\n",
+				keyRing->retries, keyRing->hits, keyRing->upgrades);
+	if (journal != NULL && exportJournal) {
+		Serial.setMuted(false);
+		journal->exportEntries();
+	}
+	delete cache;
+	delete keyRing;
+	delete journal;
+	delete storage;
+	return 0;
+}
@@ -0,0 +1,192 @@
+/*
+ * ColumnFile.cpp
+ * Columnar file of station events. See ColumnFile.h.
+ */
+
+#include "ColumnFile.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+
+static_assert(sizeof(ColumnFile::Header) == 128, "Header must be 128 bytes");
+static_assert(sizeof(ColumnFile::Zone) == 40, "Zone must be 40 bytes");
+
+static const char MAGIC[8] = { 'E', 'V', 'C', 'O', 'L', 'S', 0, 0 };
+static const size_t COLUMN_WIDTH[ColumnFile::COLUMN_COUNT] = { 8, 4, 2, 4, 1, 4 };
+
+/**
+ * Writes a column of the events, then pads it to ALIGN.
+ */
+static bool writeColumn(FILE *file, const StoredEvent *events, size_t count,
+		ColumnFile::Column column) {
+	byte buffer[4096];
+	size_t width = COLUMN_WIDTH[column];
+	size_t perBuffer = sizeof(buffer) / width;
+	for (size_t first = 0; first < count; first += perBuffer) {
+		size_t n = count - first < perBuffer ? count - first : perBuffer;
+		for (size_t i = 0; i < n; i++) {
+			const StoredEvent &event = events[first + i];
+			switch (column) {
+			case ColumnFile::COLUMN_TIME: {
+				int64_t value = (int64_t) event.receivedUs;
+				memcpy(buffer + i * width, &value, width);
+				break;
+			}
+			case ColumnFile::COLUMN_STORE:
+				memcpy(buffer + i * width, &event.store, width);
+				break;
+			case ColumnFile::COLUMN_DEVICE:
+				memcpy(buffer + i * width, &event.device, width);
+				break;
+			case ColumnFile::COLUMN_UID:
+				memcpy(buffer + i * width, &event.uid, width);
+				break;
+			case ColumnFile::COLUMN_CODE:
+				buffer[i] = event.code;
+				break;
+			default:
+				memcpy(buffer + i * width, &event.delta, width);
+				break;
+			}
+		}
+		if (fwrite(buffer, width, n, file) != n)
+			return false;
+	}
+	static const byte zeros[ColumnFile::ALIGN] = { 0 };
+	size_t pad = (ColumnFile::ALIGN - count * width % ColumnFile::ALIGN)
+			% ColumnFile::ALIGN;
+	return fwrite(zeros, 1, pad, file) == pad;
+}
+
+static size_t aligned(size_t size) {
+	return (size + ColumnFile::ALIGN - 1) / ColumnFile::ALIGN * ColumnFile::ALIGN;
+}
+
+ColumnFile::ColumnFile() :
+		base(NULL), size(0), header(NULL), zones(NULL) {
+}
+
+ColumnFile::~ColumnFile() {
+	close();
+}
+
+bool ColumnFile::write(const std::string &path, const StoredEvent *events,
+		size_t count) {
+	Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.blockRows = BLOCK_ROWS;
+	header.rows = count;
+	header.blocks = (count + BLOCK_ROWS - 1) / BLOCK_ROWS;
+	uint64_t offset = aligned(sizeof(Header));
+	for (int column = 0; column < COLUMN_COUNT; column++) {
+		header.columnOffset[column] = offset;
+		offset += aligned(count * COLUMN_WIDTH[column]);
+	}
+	header.zonesOffset = offset;
+
+	std::vector<Zone> zones(header.blocks);
+	for (uint64_t block = 0; block < header.blocks; block++) {
+		Zone &zone = zones[block];
+		const StoredEvent *event = events + block * BLOCK_ROWS;
+		const StoredEvent *end = block == header.blocks - 1 ?
+				events + count : event + BLOCK_ROWS;
+		zone.timeMin = zone.timeMax = (int64_t) event->receivedUs;
+		zone.storeMin = zone.storeMax = event->store;
+		zone.deltaMin = zone.deltaMax = event->delta;
+		zone.deviceMin = zone.deviceMax = event->device;
+		zone.codes = 0;
+		for (; event < end; event++) {
+			int64_t time = (int64_t) event->receivedUs;
+			zone.timeMin = time < zone.timeMin ? time : zone.timeMin;
+			zone.timeMax = time > zone.timeMax ? time : zone.timeMax;
+			zone.storeMin = event->store < zone.storeMin ? event->store : zone.storeMin;
+			zone.storeMax = event->store > zone.storeMax ? event->store : zone.storeMax;
+			zone.deltaMin = event->delta < zone.deltaMin ? event->delta : zone.deltaMin;
+			zone.deltaMax = event->delta > zone.deltaMax ? event->delta : zone.deltaMax;
+			zone.deviceMin = event->device < zone.deviceMin ? event->device : zone.deviceMin;
+			zone.deviceMax = event->device > zone.deviceMax ? event->device : zone.deviceMax;
+			zone.codes |= 1UL << (event->code & 31);
+		}
+	}
+
+	std::string tmp = path + ".tmp";
+	FILE *file = fopen(tmp.c_str(), "wb");
+	if (file == NULL)
+		return false;
+	static const byte zeros[ALIGN] = { 0 };
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+			&& fwrite(zeros, 1, aligned(sizeof(Header)) - sizeof(Header), file)
+					== aligned(sizeof(Header)) - sizeof(Header);
+	for (int column = 0; ok && column < COLUMN_COUNT; column++)
+		ok = writeColumn(file, events, count, (Column) column);
+	if (ok && !zones.empty())
+		ok = fwrite(&zones[0], sizeof(Zone), zones.size(), file) == zones.size();
+	int error = errno;
+	if (fclose(file) != 0 && ok) {
+		ok = false;
+		error = errno;
+	}
+	if (ok && rename(tmp.c_str(), path.c_str()) != 0) {
+		ok = false;
+		error = errno;
+	}
+	if (!ok) {
+		unlink(tmp.c_str());
+		errno = error;
+	}
+	return ok;
+}
+
+bool ColumnFile::open(const std::string &path) {
+	close();
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(Header)) {
+		::close(fd);
+		return false;
+	}
+	void *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (mapped == MAP_FAILED)
+		return false;
+	base = (const byte *) mapped;
+	size = st.st_size;
+	header = (const Header *) base;
+	//Checks the layout fits in the file before trusting any offset.
+	bool valid = memcmp(header->magic, MAGIC, sizeof(MAGIC)) == 0
+			&& header->version == VERSION && header->blockRows == BLOCK_ROWS
+			&& header->blocks == (header->rows + BLOCK_ROWS - 1) / BLOCK_ROWS
+			&& header->zonesOffset <= size
+			&& header->blocks <= (size - header->zonesOffset) / sizeof(Zone);
+	for (int column = 0; valid && column < COLUMN_COUNT; column++)
+		valid = header->columnOffset[column] % ALIGN == 0
+				&& header->columnOffset[column] <= size
+				&& header->rows
+						<= (size - header->columnOffset[column])
+								/ COLUMN_WIDTH[column];
+	if (!valid) {
+		close();
+		return false;
+	}
+	zones = (const Zone *) (base + header->zonesOffset);
+	madvise(mapped, size, MADV_SEQUENTIAL);
+	return true;
+}
+
+void ColumnFile::close() {
+	if (base != NULL)
+		munmap((void *) base, size);
+	base = NULL;
+	size = 0;
+	header = NULL;
+	zones = NULL;
+}
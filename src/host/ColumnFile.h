@@ -0,0 +1,122 @@
+/*
+ * ColumnFile.h
+ * Columnar file of station events, for reports over months of them: the events of a partition of
+ * EventStore, column after column, read by mapping the file in memory.
+ *
+ * Layout, little endian, each part starting on 64 bytes:
+ *   Header
+ *   time    int64  x rows    Host time received, us since the epoch.
+ *   store   uint32 x rows
+ *   device  uint16 x rows
+ *   uid     uint32 x rows    Log::packUid(), a hash of the UID.
+ *   code    uint8  x rows    Log::EventCode.
+ *   delta   int32  x rows
+ *   Zone    x blocks         Bounds of each block of BLOCK_ROWS rows, to skip those a query can't match.
+ * Files are written once, next to their EventStore partition: <dir>/store-<id>/<YYYY-MM-DD>.cols
+ */
+#ifndef ColumnFile_h
+#define ColumnFile_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <EventStore.h>
+
+class ColumnFile {
+public:
+	static const uint32_t VERSION = 1;
+	static const uint32_t BLOCK_ROWS = 65536;
+
+	enum Column {
+		COLUMN_TIME, COLUMN_STORE, COLUMN_DEVICE, COLUMN_UID, COLUMN_CODE, COLUMN_DELTA, COLUMN_COUNT,
+	};
+
+	typedef struct {
+		char magic[8];						// "EVCOLS\0\0".
+		uint32_t version;
+		uint32_t blockRows;
+		uint64_t rows;
+		uint64_t blocks;
+		uint64_t zonesOffset;
+		uint64_t columnOffset[COLUMN_COUNT];
+		byte reserved[40];
+	} Header;
+
+	/**
+	 * Bounds of the values in a block.
+	 */
+	typedef struct {
+		int64_t timeMin;
+		int64_t timeMax;
+		uint32_t storeMin;
+		uint32_t storeMax;
+		int32_t deltaMin;
+		int32_t deltaMax;
+		uint16_t deviceMin;
+		uint16_t deviceMax;
+		uint32_t codes;						// Bit set of the codes in the block.
+	} Zone;
+
+	static const size_t ALIGN = 64;
+
+	ColumnFile();
+	~ColumnFile();
+
+	/**
+	 * Writes events, count of them, to path as a columnar file, replacing it at once when complete.
+	 * Returns false if it can't be written, errno telling why.
+	 */
+	static bool write(const std::string &path, const StoredEvent *events,
+			size_t count);
+
+	/**
+	 * Maps a columnar file. Returns false if it can't be read, or isn't one.
+	 */
+	bool open(const std::string &path);
+
+	void close();
+
+	uint64_t rows() const {
+		return header->rows;
+	}
+	uint64_t blocks() const {
+		return header->blocks;
+	}
+	const Zone &zone(uint64_t block) const {
+		return zones[block];
+	}
+
+	const int64_t *time() const {
+		return (const int64_t *) column(COLUMN_TIME);
+	}
+	const uint32_t *store() const {
+		return (const uint32_t *) column(COLUMN_STORE);
+	}
+	const uint16_t *device() const {
+		return (const uint16_t *) column(COLUMN_DEVICE);
+	}
+	const uint32_t *uid() const {
+		return (const uint32_t *) column(COLUMN_UID);
+	}
+	const byte *code() const {
+		return (const byte *) column(COLUMN_CODE);
+	}
+	const int32_t *delta() const {
+		return (const int32_t *) column(COLUMN_DELTA);
+	}
+
+private:
+	ColumnFile(const ColumnFile&);
+	ColumnFile &operator=(const ColumnFile&);
+
+	const byte *column(Column column) const {
+		return base + header->columnOffset[column];
+	}
+
+	const byte *base;
+	size_t size;
+	const Header *header;
+	const Zone *zones;
+};
+
+#endif /* ColumnFile_h */
@@ -0,0 +1,222 @@
+/*
+ * ColumnQuery.cpp
+ * Filtered group-by over columnar event files. See ColumnQuery.h.
+ */
+
+#include "ColumnQuery.h"
+#include <string.h>
+#include <atomic>
+#include <thread>
+
+static const size_t BATCH = 2048;			// Rows whose slots are computed at once.
+static const uint32_t MAX_GROUPS = 4096;	// Groups of a block taken in a dense table.
+
+static void merge(ColumnQuery::Group &into, const ColumnQuery::Group &group) {
+	for (int code = 0; code < ColumnQuery::CODES; code++) {
+		into.codes[code].count += group.codes[code].count;
+		into.codes[code].sum += group.codes[code].sum;
+		into.codes[code].negative += group.codes[code].negative;
+	}
+}
+
+/**
+ * The state of a thread: its tables and its part of the result.
+ */
+class ColumnQuery::Scanner {
+public:
+	Scanner(const ColumnQuery &query) :
+			query(query) {
+		memset(&stats, 0, sizeof(stats));
+	}
+
+	void scan(const ColumnFile &file, uint64_t block);
+
+	Result result;
+	Stats stats;
+
+private:
+	template<GroupBy GROUP_BY>
+	void slots(const ColumnFile &file, uint64_t first, size_t count,
+			const ColumnFile::Zone &zone, uint32_t bucketMin, uint32_t buckets);
+
+	const ColumnQuery &query;
+	std::vector<Aggregate> table;	// Per store, bucket and code, then the sink.
+	uint32_t slot[BATCH];
+};
+
+/**
+ * Computes the slot of each row of the batch: kept or not is a select, not a branch.
+ */
+template<ColumnQuery::GroupBy GROUP_BY>
+void ColumnQuery::Scanner::slots(const ColumnFile &file, uint64_t first,
+		size_t count, const ColumnFile::Zone &zone, uint32_t bucketMin,
+		uint32_t buckets) {
+	const int64_t *time = file.time() + first;
+	const uint32_t *store = file.store() + first;
+	const uint16_t *device = file.device() + first;
+	const byte *code = file.code() + first;
+	const int64_t fromUs = query.fromUs, toUs = query.toUs;
+	const uint32_t storeMin = query.storeMin, storeMax = query.storeMax;
+	const uint32_t codes = query.codes;
+	const uint32_t sink = (uint32_t) table.size() - 1;
+	for (size_t i = 0; i < count; i++) {
+		uint32_t c = code[i] & (CODES - 1);
+		bool keep = (time[i] >= fromUs) & (time[i] < toUs)
+				& (store[i] >= storeMin) & (store[i] <= storeMax)
+				& ((codes >> c) & 1);
+		uint32_t bucket = GROUP_BY == GROUP_HOUR ?
+				(uint32_t) (time[i] / US_PER_HOUR) - bucketMin :
+				(uint32_t) device[i] - bucketMin;
+		uint32_t at = ((store[i] - zone.storeMin) * buckets + bucket) * CODES + c;
+		slot[i] = keep ? at : sink;
+	}
+}
+
+void ColumnQuery::Scanner::scan(const ColumnFile &file, uint64_t block) {
+	const ColumnFile::Zone &zone = file.zone(block);
+	stats.blocks++;
+	if (zone.timeMax < query.fromUs || zone.timeMin >= query.toUs
+			|| zone.storeMax < query.storeMin || zone.storeMin > query.storeMax
+			|| (zone.codes & query.codes) == 0) {
+		stats.blocksSkipped++;
+		return;
+	}
+	uint64_t first = block * ColumnFile::BLOCK_ROWS;
+	uint64_t rows = file.rows() - first;
+	if (rows > ColumnFile::BLOCK_ROWS)
+		rows = ColumnFile::BLOCK_ROWS;
+	stats.rows += rows;
+
+	uint32_t bucketMin, buckets;
+	if (query.groupBy == GROUP_HOUR) {
+		bucketMin = (uint32_t) (zone.timeMin / US_PER_HOUR);
+		buckets = (uint32_t) (zone.timeMax / US_PER_HOUR) - bucketMin + 1;
+	} else {
+		bucketMin = zone.deviceMin;
+		buckets = zone.deviceMax - zone.deviceMin + 1u;
+	}
+	uint64_t stores = (uint64_t) zone.storeMax - zone.storeMin + 1;
+	if (stores * buckets > MAX_GROUPS) {
+		//Too spread for a table: row by row. Not from EventStore's partitions, of one store each.
+		for (uint64_t row = first; row < first + rows; row++) {
+			StoredEvent event;
+			memset(&event, 0, sizeof(event));
+			event.receivedUs = (uint64_t) file.time()[row];
+			event.store = file.store()[row];
+			event.device = file.device()[row];
+			event.code = file.code()[row];
+			event.delta = file.delta()[row];
+			stats.matched += query.add(event, result);
+		}
+		return;
+	}
+
+	size_t groups = (size_t) (stores * buckets);
+	Aggregate zero = { 0, 0, 0 };
+	table.assign(groups * CODES + 1, zero);
+	const int32_t *delta = file.delta() + first;
+	for (uint64_t done = 0; done < rows; done += BATCH) {
+		size_t count = rows - done < BATCH ? rows - done : BATCH;
+		if (query.groupBy == GROUP_HOUR)
+			slots<GROUP_HOUR>(file, first + done, count, zone, bucketMin,
+					buckets);
+		else
+			slots<GROUP_DEVICE>(file, first + done, count, zone, bucketMin,
+					buckets);
+		Aggregate *aggregates = &table[0];
+		for (size_t i = 0; i < count; i++) {
+			Aggregate &aggregate = aggregates[slot[i]];
+			int32_t value = delta[done + i];
+			aggregate.count++;
+			aggregate.sum += value;
+			aggregate.negative += value < 0;
+		}
+	}
+	stats.matched += rows - table.back().count;
+
+	for (size_t group = 0; group < groups; group++) {
+		const Aggregate *aggregates = &table[group * CODES];
+		bool any = false;
+		for (int code = 0; code < CODES; code++)
+			any |= aggregates[code].count != 0;
+		if (!any)
+			continue;
+		Key key(zone.storeMin + (uint32_t) (group / buckets),
+				bucketMin + (uint32_t) (group % buckets));
+		Group &into = result[key];
+		for (int code = 0; code < CODES; code++) {
+			into.codes[code].count += aggregates[code].count;
+			into.codes[code].sum += aggregates[code].sum;
+			into.codes[code].negative += aggregates[code].negative;
+		}
+	}
+}
+
+ColumnQuery::ColumnQuery() :
+		fromUs(INT64_MIN), toUs(INT64_MAX), storeMin(0), storeMax(UINT32_MAX), codes(
+				UINT32_MAX), groupBy(GROUP_HOUR) {
+	memset(&lastStats, 0, sizeof(lastStats));
+}
+
+bool ColumnQuery::add(const StoredEvent &event, Result &result) const {
+	int64_t time = (int64_t) event.receivedUs;
+	uint32_t code = event.code & (CODES - 1);
+	if (time < fromUs || time >= toUs || event.store < storeMin
+			|| event.store > storeMax || ((codes >> code) & 1) == 0)
+		return false;
+	Key key(event.store,
+			groupBy == GROUP_HOUR ? (uint32_t) (time / US_PER_HOUR) : event.device);
+	Aggregate &aggregate = result[key].codes[code];
+	aggregate.count++;
+	aggregate.sum += event.delta;
+	aggregate.negative += event.delta < 0;
+	return true;
+}
+
+bool ColumnQuery::run(const std::vector<std::string> &paths, unsigned threads,
+		Result &result) {
+	memset(&lastStats, 0, sizeof(lastStats));
+	std::vector<ColumnFile*> files;
+	std::vector<std::pair<size_t, uint64_t> > blocks;	// File and block.
+	bool ok = true;
+	for (size_t i = 0; ok && i < paths.size(); i++) {
+		ColumnFile *file = new ColumnFile();
+		files.push_back(file);
+		ok = file->open(paths[i]);
+		for (uint64_t block = 0; ok && block < file->blocks(); block++)
+			blocks.push_back(std::make_pair(i, block));
+	}
+	if (ok) {
+		if (threads == 0)
+			threads = 1;
+		std::vector<Scanner*> scanners;
+		for (unsigned i = 0; i < threads; i++)
+			scanners.push_back(new Scanner(*this));
+		std::atomic<size_t> next(0);
+		std::vector<std::thread> pool;
+		for (unsigned i = 0; i < threads; i++)
+			pool.push_back(std::thread([&, i]() {
+				for (size_t at; (at = next++) < blocks.size();)
+					scanners[i]->scan(*files[blocks[at].first], blocks[at].second);
+			}));
+		for (unsigned i = 0; i < threads; i++) {
+			pool[i].join();
+			for (Result::const_iterator it = scanners[i]->result.begin();
+					it != scanners[i]->result.end(); it++) {
+				std::pair<Result::iterator, bool> at = result.insert(*it);
+				if (!at.second)
+					merge(at.first->second, it->second);
+			}
+			const Stats &stats = scanners[i]->stats;
+			lastStats.blocks += stats.blocks;
+			lastStats.blocksSkipped += stats.blocksSkipped;
+			lastStats.rows += stats.rows;
+			lastStats.matched += stats.matched;
+			delete scanners[i];
+		}
+		lastStats.files = files.size();
+	}
+	for (size_t i = 0; i < files.size(); i++)
+		delete files[i];
+	return ok;
+}
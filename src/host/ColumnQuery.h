@@ -0,0 +1,113 @@
+/*
+ * ColumnQuery.h
+ * Filtered group-by over columnar event files (see ColumnFile.h), on all cores.
+ *
+ * A query keeps the events in a time range, a range of stores and a set of codes, groups them by
+ * store and hour or by store and device, and counts and sums the deltas of each code in each group.
+ * The blocks are shared out to the threads; those whose zone can't match are skipped unread.
+ * Within a block the columns are read in batches by two branch-free loops: the first computes the
+ * slot of each row in a small dense table (the group and the code, or a sink for the rows filtered
+ * out), the second adds the row to its slot. Each thread merges its tables once at the end.
+ */
+#ifndef ColumnQuery_h
+#define ColumnQuery_h
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <ColumnFile.h>
+
+class ColumnQuery {
+public:
+	static const int CODES = 32;			// Log::EventCode values, as bits of a mask.
+	static const int64_t US_PER_HOUR = 3600000000LL;
+
+	enum GroupBy {
+		GROUP_HOUR,			// Hours since the epoch.
+		GROUP_DEVICE,
+	};
+
+	typedef struct {
+		uint64_t count;
+		int64_t sum;						// Sum of the deltas.
+		uint64_t negative;					// Deltas below 0.
+	} Aggregate;
+
+	/**
+	 * Aggregates of a group, per code.
+	 */
+	typedef struct {
+		Aggregate codes[CODES];
+	} Group;
+
+	typedef std::pair<uint32_t, uint32_t> Key;	// Store and hour or device.
+	typedef std::map<Key, Group> Result;
+
+	typedef struct {
+		unsigned long files;
+		uint64_t blocks;
+		uint64_t blocksSkipped;				// By their zone.
+		uint64_t rows;						// Rows of the blocks read.
+		uint64_t matched;
+	} Stats;
+
+	ColumnQuery();
+
+	/**
+	 * Keeps the events received in [fromUs, toUs).
+	 */
+	void setTimeRange(int64_t fromUs, int64_t toUs) {
+		this->fromUs = fromUs;
+		this->toUs = toUs;
+	}
+
+	/**
+	 * Keeps the events of stores min to max.
+	 */
+	void setStores(uint32_t min, uint32_t max) {
+		storeMin = min;
+		storeMax = max;
+	}
+
+	/**
+	 * Keeps the events whose code is in the mask, bit n for code n.
+	 */
+	void setCodes(uint32_t codes) {
+		this->codes = codes;
+	}
+
+	void setGroupBy(GroupBy groupBy) {
+		this->groupBy = groupBy;
+	}
+
+	/**
+	 * Runs the query over the files on threads threads, adding to result.
+	 * Returns false if a file can't be read, in which case nothing is run.
+	 */
+	bool run(const std::vector<std::string> &paths, unsigned threads,
+			Result &result);
+
+	const Stats &stats() const {
+		return lastStats;
+	}
+
+	/**
+	 * Adds a single event to result, if the query keeps it. Returns true if it does.
+	 * The reference the scans are checked against.
+	 */
+	bool add(const StoredEvent &event, Result &result) const;
+
+private:
+	class Scanner;
+
+	int64_t fromUs;
+	int64_t toUs;
+	uint32_t storeMin;
+	uint32_t storeMax;
+	uint32_t codes;
+	GroupBy groupBy;
+	Stats lastStats;
+};
+
+#endif /* ColumnQuery_h */
@@ -0,0 +1,520 @@
+/**
+ * Event Daemon
+ * Collects the event frames (see Log.h) of many stations at once from their serial ports,
+ * into an on-disk log partitioned by store and day (see EventStore.h).
+ *
+ * Build (from src/):
+ *   g++ -std=c++11 -O2 -pthread -Ihost -Ilib host/EventFrame.cpp host/EventStore.cpp \
+ *       host/EventDaemon/EventDaemon.cpp -o event_daemon
+ * Usage:
+ *   event_daemon -d dir [-b baud] [-w parsers] [-f flushMs] [-i seconds] [-m file] [-s] port[=store]...
+ *   -d  Directory of the log.
+ *   -b  Baud rate of the ports (default 9600).
+ *   -w  Parser threads (default 2).
+ *   -f  Longest time an event waits to be written, in ms (default 200).
+ *   -i  Interval of the metrics, in seconds (default 10).
+ *   -m  File the metrics are written to at each interval, in the Prometheus text format.
+ *       A line of totals goes to stderr either way.
+ *   -s  Flush the log to the disk after each batch.
+ *   port=store gives the store of the station on that port until its EVENT_STARTED is received,
+ *   e.g. when the daemon starts after the station. Ports may be pseudo-terminals, see StationEmu.cpp.
+ *
+ * Threads:
+ *   - a reader per port, reading what the station sends in time stamped chunks, and reopening the
+ *     port when it goes away (a USB adapter unplugged, a station reset);
+ *   - parsers, each port belonging to one: the readers queue their chunks to the parser of their port
+ *     through its MpscQueue, and the parser finds the frames, checks their CRC and sequence numbers,
+ *     and queues the events to the writer through another;
+ *   - the writer, appending the events in batches, with one write per partition.
+ * The queues are bounded, so memory is fixed. When one is full its producers wait rather than drop:
+ * a waiting reader leaves the bytes in the kernel buffer of its port, a waiting parser in its queue.
+ * The waits are counted in the metrics, with the highest depth of each queue, to see how close to
+ * its capacity the daemon runs. Frames lost on a station (its Log ring full) show as seq gaps.
+ * SIGINT or SIGTERM stops it, once every byte read is written.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <EventFrame.h>
+#include <EventStore.h>
+#include <MpscQueue.h>
+
+static const size_t CHUNK_DATA = 244;
+static const size_t CHUNK_QUEUE_SIZE = 1024;	// Per parser, 256 KiB.
+static const size_t EVENT_QUEUE_SIZE = 16384;	// 512 KiB.
+static const size_t MAX_BATCH = 4096;			// Events appended at once.
+static const byte READ_MIN = 64;				// Bytes a read waits for, unless the line goes quiet.
+
+/**
+ * Bytes read from a port at once.
+ */
+typedef struct {
+	uint64_t receivedUs;	// Wall clock when read, us since the epoch.
+	uint16_t port;
+	uint16_t length;
+	byte data[CHUNK_DATA];
+} Chunk;
+
+typedef MpscQueue<Chunk, CHUNK_QUEUE_SIZE> ChunkQueue;
+typedef MpscQueue<StoredEvent, EVENT_QUEUE_SIZE> EventQueue;
+
+typedef struct Port {
+	std::string path;
+	uint16_t index;
+	size_t parser;
+	std::atomic<uint32_t> store;
+	std::thread thread;
+	//Counted by the reader.
+	std::atomic<uint64_t> bytes;
+	std::atomic<uint64_t> fullWaits;		// Chunks that waited for room in the parser's queue.
+	std::atomic<uint64_t> reopens;
+	std::atomic<bool> connected;
+	//Owned by the parser.
+	EventFrame::Decoder decoder;
+	bool seqSeen;
+	byte lastSeq;
+	std::atomic<uint64_t> frames;
+	std::atomic<uint64_t> crcErrors;
+	std::atomic<uint64_t> seqGaps;			// Records lost on the station.
+	std::atomic<uint64_t> restarts;			// EVENT_STARTED received.
+
+	Port() :
+			index(0), parser(0), store(0), bytes(0), fullWaits(0), reopens(0), connected(
+					false), seqSeen(false), lastSeq(0), frames(0), crcErrors(0), seqGaps(
+					0), restarts(0) {
+	}
+} Port;
+
+typedef struct Parser {
+	ChunkQueue queue;
+	std::thread thread;
+	std::atomic<size_t> maxDepth;
+	std::atomic<uint64_t> fullWaits;		// Events that waited for room in the writer's queue.
+
+	Parser() :
+			maxDepth(0), fullWaits(0) {
+	}
+} Parser;
+
+static std::vector<Port*> ports;
+static std::vector<Parser*> parsers;
+static EventQueue events;
+static std::atomic<size_t> eventsMaxDepth(0);
+static std::atomic<uint64_t> written(0);
+static std::atomic<uint64_t> batches(0);
+static std::atomic<uint64_t> writeErrors(0);
+static std::atomic<uint64_t> maxWriteUs(0);
+
+static std::atomic<bool> readersStop(false);
+static std::atomic<bool> parsersStop(false);
+static std::atomic<bool> writerStop(false);
+static volatile sig_atomic_t interrupted = 0;
+
+static void onInterrupt(int) {
+	interrupted = 1;
+}
+
+static uint64_t wallUs() {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+static uint64_t monotonicUs() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+static speed_t toSpeed(unsigned long baud) {
+	switch (baud) {
+	case 9600:
+		return B9600;
+	case 19200:
+		return B19200;
+	case 38400:
+		return B38400;
+	case 57600:
+		return B57600;
+	case 115200:
+		return B115200;
+	default:
+		return B0;
+	}
+}
+
+static void raiseMax(std::atomic<size_t> &max, size_t value) {
+	size_t current = max.load(std::memory_order_relaxed);
+	while (value > current
+			&& !max.compare_exchange_weak(current, value,
+					std::memory_order_relaxed))
+		;
+}
+
+/**
+ * Queues value, waiting for room as long as needed. Returns false if it had to wait.
+ */
+template<typename Queue, typename T>
+static bool push(Queue &queue, const T &value) {
+	if (queue.tryPush(value))
+		return true;
+	for (unsigned spins = 0; !queue.tryPush(value); spins++) {
+		if (spins < 64)
+			std::this_thread::yield();
+		else
+			usleep(200);
+	}
+	return false;
+}
+
+/**
+ * Opens a port raw, for reading. -1 if it can't be.
+ * Unlike StationClient::open(), what the station sent before isn't flushed: it is events too.
+ */
+static int openPort(const char *path, speed_t speed) {
+	int fd = open(path, O_RDONLY | O_NOCTTY | O_CLOEXEC);
+	if (fd < 0 || !isatty(fd))
+		return fd;
+	struct termios tio;
+	if (tcgetattr(fd, &tio) != 0) {
+		close(fd);
+		return -1;
+	}
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+	tio.c_cflag |= CLOCAL | CREAD;
+	//A read returns READ_MIN bytes, or what came before a 100 ms silence.
+	tio.c_cc[VMIN] = READ_MIN;
+	tio.c_cc[VTIME] = 1;
+	if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void readPort(Port *port, speed_t speed) {
+	ChunkQueue &queue = parsers[port->parser]->queue;
+	int fd = -1;
+	Chunk chunk;
+	chunk.port = port->index;
+	while (!readersStop) {
+		if (fd < 0) {
+			fd = openPort(port->path.c_str(), speed);
+			if (fd < 0) {
+				usleep(200000);
+				continue;
+			}
+			port->connected = true;
+		}
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		int ready = poll(&pfd, 1, 200);
+		if (ready <= 0)
+			continue;
+		ssize_t n = read(fd, chunk.data, CHUNK_DATA);
+		if (n < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (n <= 0) {
+			//Hung up: the station goes away, wait for it to come back.
+			close(fd);
+			fd = -1;
+			port->connected = false;
+			port->reopens++;
+			continue;
+		}
+		chunk.receivedUs = wallUs();
+		chunk.length = (uint16_t) n;
+		port->bytes += n;
+		if (!push(queue, chunk))
+			port->fullWaits++;
+	}
+	if (fd >= 0)
+		close(fd);
+	port->connected = false;
+}
+
+/**
+ * Checks an event from port and queues it to the writer.
+ */
+static void queueEvent(Parser *parser, Port *port, const Log::Record &record,
+		uint64_t receivedUs) {
+	if (record.code == Log::EVENT_STARTED) {
+		//The station restarted: its sequence starts over, and the delta is its store.
+		port->store = (uint32_t) record.delta;
+		port->restarts++;
+	} else if (port->seqSeen) {
+		port->seqGaps += (byte) (record.seq - port->lastSeq - 1);
+	}
+	port->seqSeen = true;
+	port->lastSeq = record.seq;
+	port->frames++;
+
+	StoredEvent event;
+	event.receivedUs = receivedUs;
+	event.time = record.time;
+	event.uid = record.uid;
+	event.delta = record.delta;
+	event.store = port->store;
+	event.device = record.device;
+	event.code = record.code;
+	event.seq = record.seq;
+	event.port = port->index;
+	event.reserved = 0;
+	if (!push(events, event))
+		parser->fullWaits++;
+}
+
+static void parse(Parser *parser) {
+	Chunk chunk;
+	for (;;) {
+		//Stopped once the readers are, and everything they queued is parsed.
+		bool stop = parsersStop;
+		size_t depth = parser->queue.size();
+		if (!parser->queue.tryPop(chunk)) {
+			if (stop)
+				break;
+			usleep(1000);
+			continue;
+		}
+		raiseMax(parser->maxDepth, depth);
+		Port *port = ports[chunk.port];
+		unsigned long errors = port->decoder.crcErrors();
+		Log::Record record;
+		for (uint16_t i = 0; i < chunk.length; i++)
+			if (port->decoder.feed(chunk.data[i], record))
+				queueEvent(parser, port, record, chunk.receivedUs);
+		port->crcErrors += port->decoder.crcErrors() - errors;
+	}
+}
+
+static void writeLog(EventStore *store, unsigned long flushMs, bool syncs) {
+	std::vector<StoredEvent> batch;
+	batch.reserve(MAX_BATCH);
+	uint64_t oldestUs = 0;	// When the first event of the batch was taken.
+	for (;;) {
+		bool stop = writerStop;
+		size_t depth = events.size();
+		StoredEvent event;
+		bool taken = false;
+		while (batch.size() < MAX_BATCH && events.tryPop(event)) {
+			if (batch.empty())
+				oldestUs = monotonicUs();
+			batch.push_back(event);
+			taken = true;
+		}
+		raiseMax(eventsMaxDepth, depth);
+		bool stopping = stop && !taken;
+		if (!batch.empty()
+				&& (batch.size() == MAX_BATCH || stopping
+						|| monotonicUs() - oldestUs >= flushMs * 1000)) {
+			uint64_t start = monotonicUs();
+			if (!store->append(&batch[0], batch.size())) {
+				writeErrors++;
+				fprintf(stderr, "Can't append to the log: %s\n", strerror(errno));
+			}
+			if (syncs)
+				store->sync();
+			uint64_t took = monotonicUs() - start;
+			if (took > maxWriteUs)
+				maxWriteUs = took;
+			written += batch.size();
+			batches++;
+			batch.clear();
+		}
+		if (stopping && batch.empty())
+			break;
+		if (!taken)
+			usleep(1000);
+	}
+	store->sync();
+}
+
+/**
+ * Writes the metrics in the Prometheus text format to path, replacing it at once,
+ * and a line of totals to stderr.
+ */
+static void report(const char *path) {
+	uint64_t frames = 0, crcErrors = 0, seqGaps = 0, readerWaits = 0,
+			parserWaits = 0;
+	size_t chunksMax = 0;
+	for (size_t i = 0; i < ports.size(); i++) {
+		frames += ports[i]->frames;
+		crcErrors += ports[i]->crcErrors;
+		seqGaps += ports[i]->seqGaps;
+		readerWaits += ports[i]->fullWaits;
+	}
+	for (size_t i = 0; i < parsers.size(); i++) {
+		parserWaits += parsers[i]->fullWaits;
+		if (parsers[i]->maxDepth > chunksMax)
+			chunksMax = parsers[i]->maxDepth;
+	}
+	fprintf(stderr, "frames %llu, crc errors %llu, seq gaps %llu, "
+			"waits %llu/%llu, queue max %lu/%lu, written %llu in %llu batches\n",
+			(unsigned long long) frames, (unsigned long long) crcErrors,
+			(unsigned long long) seqGaps, (unsigned long long) readerWaits,
+			(unsigned long long) parserWaits, (unsigned long) chunksMax,
+			(unsigned long) eventsMaxDepth.load(),
+			(unsigned long long) written.load(),
+			(unsigned long long) batches.load());
+	if (path == NULL)
+		return;
+	std::string tmp = std::string(path) + ".tmp";
+	FILE *file = fopen(tmp.c_str(), "w");
+	if (file == NULL)
+		return;
+	static const char *const portMetrics[] = { "bytes_total", "frames_total",
+			"crc_errors_total", "seq_gaps_total", "queue_full_waits_total",
+			"reopens_total", "restarts_total", "connected" };
+	for (size_t m = 0; m < sizeof(portMetrics) / sizeof(portMetrics[0]); m++) {
+		fprintf(file, "# TYPE event_daemon_port_%s %s\n", portMetrics[m],
+				m == 7 ? "gauge" : "counter");
+		for (size_t i = 0; i < ports.size(); i++) {
+			Port *port = ports[i];
+			uint64_t values[] = { port->bytes, port->frames, port->crcErrors,
+					port->seqGaps, port->fullWaits, port->reopens,
+					port->restarts, port->connected };
+			fprintf(file, "event_daemon_port_%s{port=\"%s\",store=\"%lu\"} %llu\n",
+					portMetrics[m], port->path.c_str(),
+					(unsigned long) port->store.load(),
+					(unsigned long long) values[m]);
+		}
+	}
+	fprintf(file, "# TYPE event_daemon_parser_queue_max gauge\n");
+	for (size_t i = 0; i < parsers.size(); i++)
+		fprintf(file, "event_daemon_parser_queue_max{parser=\"%lu\"} %lu\n",
+				(unsigned long) i, (unsigned long) parsers[i]->maxDepth.load());
+	fprintf(file, "# TYPE event_daemon_parser_queue_depth gauge\n");
+	for (size_t i = 0; i < parsers.size(); i++)
+		fprintf(file, "event_daemon_parser_queue_depth{parser=\"%lu\"} %lu\n",
+				(unsigned long) i, (unsigned long) parsers[i]->queue.size());
+	fprintf(file, "# TYPE event_daemon_parser_queue_full_waits_total counter\n");
+	for (size_t i = 0; i < parsers.size(); i++)
+		fprintf(file,
+				"event_daemon_parser_queue_full_waits_total{parser=\"%lu\"} %llu\n",
+				(unsigned long) i,
+				(unsigned long long) parsers[i]->fullWaits.load());
+	fprintf(file, "# TYPE event_daemon_queue_capacity gauge\n"
+			"event_daemon_queue_capacity{queue=\"parser\"} %lu\n"
+			"event_daemon_queue_capacity{queue=\"writer\"} %lu\n",
+			(unsigned long) ChunkQueue::capacity(),
+			(unsigned long) EventQueue::capacity());
+	fprintf(file, "# TYPE event_daemon_writer_queue_max gauge\n"
+			"event_daemon_writer_queue_max %lu\n"
+			"# TYPE event_daemon_writer_queue_depth gauge\n"
+			"event_daemon_writer_queue_depth %lu\n"
+			"# TYPE event_daemon_events_written_total counter\n"
+			"event_daemon_events_written_total %llu\n"
+			"# TYPE event_daemon_batches_total counter\n"
+			"event_daemon_batches_total %llu\n"
+			"# TYPE event_daemon_write_errors_total counter\n"
+			"event_daemon_write_errors_total %llu\n"
+			"# TYPE event_daemon_batch_write_us_max gauge\n"
+			"event_daemon_batch_write_us_max %llu\n",
+			(unsigned long) eventsMaxDepth.load(),
+			(unsigned long) events.size(),
+			(unsigned long long) written.load(),
+			(unsigned long long) batches.load(),
+			(unsigned long long) writeErrors.load(),
+			(unsigned long long) maxWriteUs.load());
+	fclose(file);
+	rename(tmp.c_str(), path);
+}
+
+int main(int argc, char **argv) {
+	const char *dir = NULL;
+	const char *metricsPath = NULL;
+	unsigned long baud = 9600;
+	unsigned long parserCount = 2;
+	unsigned long flushMs = 200;
+	unsigned long intervalS = 10;
+	bool syncs = false;
+	int i = 1;
+	for (; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+			dir = argv[++i];
+		else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+			baud = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+			parserCount = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+			flushMs = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+			intervalS = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+			metricsPath = argv[++i];
+		else if (strcmp(argv[i], "-s") == 0)
+			syncs = true;
+		else {
+			dir = NULL;
+			break;
+		}
+	}
+	speed_t speed = toSpeed(baud);
+	if (dir == NULL || i == argc || speed == B0 || parserCount == 0
+			|| intervalS == 0 || argc - i > 65535) {
+		fprintf(stderr, "Usage: %s -d dir [-b baud] [-w parsers] [-f flushMs] "
+				"[-i seconds] [-m file] [-s] port[=store]...\n", argv[0]);
+		return 1;
+	}
+
+	for (size_t p = 0; p < parserCount; p++)
+		parsers.push_back(new Parser());
+	for (; i < argc; i++) {
+		Port *port = new Port();
+		std::string arg = argv[i];
+		size_t equals = arg.rfind('=');
+		port->path = arg.substr(0, equals);
+		if (equals != std::string::npos)
+			port->store = strtoul(arg.c_str() + equals + 1, NULL, 0);
+		port->index = (uint16_t) ports.size();
+		port->parser = ports.size() % parserCount;
+		ports.push_back(port);
+	}
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = onInterrupt;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	EventStore store(dir);
+	std::thread writer(writeLog, &store, flushMs, syncs);
+	for (size_t p = 0; p < parsers.size(); p++)
+		parsers[p]->thread = std::thread(parse, parsers[p]);
+	for (size_t p = 0; p < ports.size(); p++)
+		ports[p]->thread = std::thread(readPort, ports[p], speed);
+
+	uint64_t nextReport = monotonicUs() + intervalS * 1000000ULL;
+	while (!interrupted) {
+		usleep(100000);
+		if (monotonicUs() >= nextReport) {
+			report(metricsPath);
+			nextReport += intervalS * 1000000ULL;
+		}
+	}
+
+	//Stopped from the sources on, each stage draining what the previous one queued.
+	readersStop = true;
+	for (size_t p = 0; p < ports.size(); p++)
+		ports[p]->thread.join();
+	parsersStop = true;
+	for (size_t p = 0; p < parsers.size(); p++)
+		parsers[p]->thread.join();
+	writerStop = true;
+	writer.join();
+	report(metricsPath);
+	return writeErrors > 0 ? 1 : 0;
+}
@@ -0,0 +1,202 @@
+/**
+ * Station Emulator
+ * Stands in for loading stations on pseudo-terminals, to try EventDaemon without the hardware:
+ * each sends Log event frames, mixed with the text a station prints, as fast as its baud rate allows.
+ *
+ * Build (from src/):
+ *   g++ -std=c++11 -O2 -pthread -Ihost -Ilib host/EventFrame.cpp \
+ *       host/EventDaemon/StationEmu.cpp -o station_emu
+ * Usage:
+ *   station_emu [-n stations] [-S stores] [-b baud] [-r framesPerSecond] [-d seconds] [-c perMille] [-s seed]
+ *   -n  Stations (default 32), one pseudo-terminal each.
+ *   -S  Stores the stations are spread over (default 4).
+ *   -b  Baud rate emulated (default 9600), 0 for as fast as the reader takes them.
+ *   -r  Frames per second per station (default: as many as the baud rate allows).
+ *   -d  Seconds to send for (default 10).
+ *   -c  Frames corrupted, in 1/1000 (default 0).
+ *   -s  Seed of the events (default 1).
+ * Prints the path of each pseudo-terminal on a line, then a blank line once they are all open,
+ * so the daemon can be started with them:
+ *   station_emu -d 60 > ports & sleep 1; event_daemon -d log $(cat ports)
+ * Once done, prints on stderr the frames sent, corrupted frames included, and waits a second before
+ * closing the pseudo-terminals, for the daemon to read the last ones.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <EventFrame.h>
+
+static const char TEXT[] = "Card UID: 04 A2 19 5C\r\nBalance: 120 points\r\n";
+
+typedef struct {
+	int master;
+	int slave;			// Kept open, so the line stays up while the daemon reopens it.
+	std::string path;
+	uint16_t device;
+	uint32_t store;
+	unsigned long sent;
+	unsigned long corrupted;
+} Station;
+
+static uint64_t monotonicUs() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+/**
+ * Opens a pseudo-terminal, raw from the start so no byte is taken for a control character.
+ */
+static bool openPty(Station &station) {
+	station.master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (station.master < 0 || grantpt(station.master) != 0
+			|| unlockpt(station.master) != 0)
+		return false;
+	station.path = ptsname(station.master);
+	station.slave = open(station.path.c_str(), O_RDWR | O_NOCTTY);
+	if (station.slave < 0)
+		return false;
+	struct termios tio;
+	if (tcgetattr(station.slave, &tio) != 0)
+		return false;
+	cfmakeraw(&tio);
+	return tcsetattr(station.slave, TCSANOW, &tio) == 0;
+}
+
+static bool writeAll(int fd, const byte *data, size_t size) {
+	while (size > 0) {
+		ssize_t n = write(fd, data, size);
+		if (n <= 0)
+			return false;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+static void run(Station *station, unsigned long baud, unsigned long rate,
+		unsigned long seconds, unsigned perMille, uint32_t seed) {
+	uint64_t start = monotonicUs();
+	uint64_t end = start + seconds * 1000000ULL;
+	uint64_t bytes = 0;
+	uint64_t frames = 0;
+	Log::Record record;
+	memset(&record, 0, sizeof(record));
+	record.device = station->device;
+	record.code = Log::EVENT_STARTED;
+	record.delta = (int32_t) station->store;
+	seed ^= station->device * 2654435761U;
+	for (uint64_t now = start; now < end; now = monotonicUs()) {
+		//Paced on the line rate, and the frame rate, whichever is slower.
+		uint64_t due = start;
+		if (baud > 0)
+			due = start + bytes * 10 * 1000000ULL / baud;
+		if (rate > 0 && start + frames * 1000000ULL / rate > due)
+			due = start + frames * 1000000ULL / rate;
+		if (due > now) {
+			usleep(due - now);
+			continue;
+		}
+		byte frame[EventFrame::SIZE];
+		record.time = (uint32_t) ((now - start) / 1000);
+		EventFrame::encode(frame, record);
+		seed = seed * 1103515245 + 12345;
+		if (perMille > 0 && (seed >> 8) % 1000 < perMille) {
+			frame[1 + (seed >> 20) % (EventFrame::SIZE - 1)] ^= 0x10;
+			station->corrupted++;
+		}
+		if (!writeAll(station->master, frame, sizeof(frame)))
+			break;
+		bytes += sizeof(frame);
+		frames++;
+		station->sent++;
+		//Now and then the text a station prints, to be skipped.
+		if ((seed >> 16) % 8 == 0) {
+			if (!writeAll(station->master, (const byte *) TEXT,
+					sizeof(TEXT) - 1))
+				break;
+			bytes += sizeof(TEXT) - 1;
+		}
+		record.seq++;
+		seed = seed * 1103515245 + 12345;
+		record.code = Log::EVENT_CONFIGURED + (seed >> 16) % 10;
+		record.uid = seed ^ 0x5A5A0000;
+		record.delta = (int32_t) ((seed >> 4) % 200) - 100;
+	}
+}
+
+int main(int argc, char **argv) {
+	unsigned long stations = 32;
+	unsigned long stores = 4;
+	unsigned long baud = 9600;
+	unsigned long rate = 0;
+	unsigned long seconds = 10;
+	unsigned perMille = 0;
+	uint32_t seed = 1;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			stations = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc)
+			stores = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+			baud = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			rate = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+			seconds = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			perMille = (unsigned) strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			seed = (uint32_t) strtoul(argv[++i], NULL, 0);
+		else {
+			fprintf(stderr, "Usage: %s [-n stations] [-S stores] [-b baud] "
+					"[-r framesPerSecond] [-d seconds] [-c perMille] [-s seed]\n",
+					argv[0]);
+			return 1;
+		}
+	}
+	if (stations == 0 || stores == 0)
+		return 1;
+
+	std::vector<Station> all(stations);
+	for (size_t i = 0; i < all.size(); i++) {
+		all[i].device = (uint16_t) (i + 1);
+		all[i].store = (uint32_t) (i % stores + 1);
+		all[i].sent = all[i].corrupted = 0;
+		if (!openPty(all[i])) {
+			perror("Can't open a pseudo-terminal");
+			return 1;
+		}
+		printf("%s\n", all[i].path.c_str());
+	}
+	printf("\n");
+	fflush(stdout);
+
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < all.size(); i++)
+		threads.push_back(
+				std::thread(run, &all[i], baud, rate, seconds, perMille, seed));
+	unsigned long sent = 0, corrupted = 0;
+	for (size_t i = 0; i < all.size(); i++) {
+		threads[i].join();
+		sent += all[i].sent;
+		corrupted += all[i].corrupted;
+	}
+	fprintf(stderr, "%lu stations sent %lu frames, %lu corrupted\n",
+			(unsigned long) all.size(), sent, corrupted);
+	sleep(1);
+	for (size_t i = 0; i < all.size(); i++) {
+		close(all[i].slave);
+		close(all[i].master);
+	}
+	return 0;
+}
@@ -0,0 +1,96 @@
+/*
+ * EventFrame.cpp
+ * Host side of Log's event frames. See EventFrame.h.
+ */
+
+#include "EventFrame.h"
+#include <string.h>
+
+/**
+ * Table of the CRC-8, polynomial 0x07, of every byte.
+ */
+struct CrcTable {
+	byte crc[256];
+
+	CrcTable() {
+		for (int i = 0; i < 256; i++) {
+			byte value = (byte) i;
+			for (byte bit = 0; bit < 8; bit++)
+				value = (value & 0x80) ?
+						(byte) ((value << 1) ^ 0x07) : (byte) (value << 1);
+			crc[i] = value;
+		}
+	}
+};
+
+static const CrcTable crcTable;
+
+static byte *put32(byte *buffer, uint32_t value) {
+	for (byte i = 0; i < 4; i++, value >>= 8)
+		*buffer++ = (byte) value;
+	return buffer;
+}
+
+static uint32_t get32(const byte *buffer) {
+	return buffer[0] | (uint32_t) buffer[1] << 8 | (uint32_t) buffer[2] << 16
+			| (uint32_t) buffer[3] << 24;
+}
+
+byte EventFrame::crc8(const byte *data, size_t length) {
+	byte crc = 0;
+	for (size_t i = 0; i < length; i++)
+		crc = crcTable.crc[crc ^ data[i]];
+	return crc;
+}
+
+void EventFrame::encode(byte *frame, const Log::Record &record) {
+	byte *buffer = frame;
+	*buffer++ = Log::FRAME_SYNC;
+	buffer = put32(buffer, record.time);
+	buffer = put32(buffer, record.uid);
+	buffer = put32(buffer, (uint32_t) record.delta);
+	*buffer++ = (byte) record.device;
+	*buffer++ = (byte) (record.device >> 8);
+	*buffer++ = record.code;
+	*buffer++ = record.seq;
+	*buffer = crc8(frame + 1, SIZE - 2);
+}
+
+bool EventFrame::decode(const byte *frame, Log::Record &record) {
+	if (frame[0] != Log::FRAME_SYNC || crc8(frame + 1, SIZE - 2) != frame[SIZE - 1])
+		return false;
+	record.time = get32(frame + 1);
+	record.uid = get32(frame + 5);
+	record.delta = (int32_t) get32(frame + 9);
+	record.device = frame[13] | (uint16_t) frame[14] << 8;
+	record.code = frame[15];
+	record.seq = frame[16];
+	return true;
+}
+
+EventFrame::Decoder::Decoder() :
+		pos(0), errors(0), skippedBytes(0) {
+}
+
+bool EventFrame::Decoder::feed(byte c, Log::Record &record) {
+	if (pos == 0 && c != Log::FRAME_SYNC) {
+		skippedBytes++;
+		return false;
+	}
+	frame[pos++] = c;
+	if (pos < SIZE)
+		return false;
+	if (decode(frame, record)) {
+		pos = 0;
+		return true;
+	}
+	errors++;
+	//The frame may start at a later sync byte.
+	byte next = 1;
+	while (next < SIZE && frame[next] != Log::FRAME_SYNC)
+		next++;
+	skippedBytes += next;
+	pos = SIZE - next;
+	memmove(frame, frame + next, pos);
+	return false;
+}
@@ -0,0 +1,67 @@
+/*
+ * EventFrame.h
+ * Host side of Log's event frames: finds them in the Serial stream of a station,
+ * skipping the text printed in between, and checks them.
+ */
+#ifndef EventFrame_h
+#define EventFrame_h
+
+#include <stddef.h>
+#include <Log.h>
+
+class EventFrame {
+public:
+	static const byte SIZE = Log::FRAME_SIZE;
+
+	/**
+	 * Writes the frame of a record, as Log sends it, in frame (SIZE bytes).
+	 */
+	static void encode(byte *frame, const Log::Record &record);
+
+	/**
+	 * Reads a frame. Returns false if the sync byte or the CRC is wrong.
+	 */
+	static bool decode(const byte *frame, Log::Record &record);
+
+	/**
+	 * CRC-8, polynomial 0x07.
+	 */
+	static byte crc8(const byte *data, size_t length);
+
+	/**
+	 * Finds the frames in a stream, a byte at a time.
+	 * A frame failing its CRC is searched for the next sync byte, so a frame is found again right
+	 * after a corrupted one, or after the stream was joined in the middle of a frame.
+	 */
+	class Decoder {
+	public:
+		Decoder();
+
+		/**
+		 * Takes the next byte of the stream. Returns true when it completes a valid frame, read into record.
+		 */
+		bool feed(byte c, Log::Record &record);
+
+		/**
+		 * Frames that failed their CRC since start.
+		 */
+		unsigned long crcErrors() const {
+			return errors;
+		}
+
+		/**
+		 * Bytes outside of the frames since start.
+		 */
+		unsigned long skipped() const {
+			return skippedBytes;
+		}
+
+	private:
+		byte frame[SIZE];
+		byte pos;				// Bytes of the frame received, 0 while looking for the sync.
+		unsigned long errors;
+		unsigned long skippedBytes;
+	};
+};
+
+#endif /* EventFrame_h */
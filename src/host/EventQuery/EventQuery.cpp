@@ -0,0 +1,476 @@
+/**
+ * Event Query
+ * Reports over the event log of EventDaemon, from its partitions turned into columnar files
+ * (see ColumnFile.h and ColumnQuery.h).
+ *
+ * Build (from src/):
+ *   g++ -std=c++11 -O3 -march=native -pthread -Ihost -Ilib host/EventStore.cpp host/ColumnFile.cpp \
+ *       host/ColumnQuery.cpp host/EventQuery/EventQuery.cpp -o event_query
+ * Usage:
+ *   event_query compact -d dir
+ *     Writes the columnar file of each partition, next to it, unless already up to date.
+ *     Run before the reports: they only read the columnar files.
+ *   event_query report -d dir [-t threads] [-from YYYY-MM-DD] [-to YYYY-MM-DD] [-store id] [-R] REPORT
+ *     -t  Threads (default: every core).
+ *     -from, -to  First and last day reported, UTC (default: all).
+ *     -store  Only this store.
+ *     -R  Reads the partitions row by row instead, on one thread: the reference, to check against.
+ *     REPORT is one of:
+ *       points-by-hour    store,hour,points_sold,sales
+ *                         Points loaded on the cards: configured, and added.
+ *       rewards-by-game   store,device,rewards_won,rewards_redeemed,redemptions
+ *                         Per device: each game is a station.
+ *       seq-completion    store,device,started,steps,completed,completion_rate
+ *                         Per station, the sequence games started there, the steps played there and the
+ *                         games completed there; the games of a store going over several stations,
+ *                         completion_rate is on the store's line, device "*".
+ *   event_query generate -d dir -n rows [-S stores] [-D days] [-s seed] [-e]
+ *     Writes columnar files of made-up events to try the reports on: rows events spread over stores
+ *     (default 4) and the days (default 30) up to yesterday. -e writes the partitions too, for -R.
+ * The reports are CSV on stdout; the files, blocks and rows read, and the time taken, go to stderr.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+#include <ColumnFile.h>
+#include <ColumnQuery.h>
+#include <EventStore.h>
+
+#define BIT(code) (1U << (code))
+
+typedef struct {
+	std::string path;		// Without the extension.
+	uint32_t store;
+	uint32_t day;			// Days since the epoch.
+} Partition;
+
+static double nowS() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Days since the epoch of a YYYY-MM-DD date, -1 if it isn't one.
+ */
+static long parseDay(const char *text) {
+	struct tm date;
+	memset(&date, 0, sizeof(date));
+	if (sscanf(text, "%4d-%2d-%2d", &date.tm_year, &date.tm_mon, &date.tm_mday)
+			!= 3)
+		return -1;
+	date.tm_year -= 1900;
+	date.tm_mon -= 1;
+	return (long) (timegm(&date) / 86400);
+}
+
+/**
+ * Lists the partitions of dir with a file of extension ext.
+ */
+static std::vector<Partition> partitions(const std::string &dir,
+		const char *ext) {
+	std::vector<Partition> found;
+	DIR *top = opendir(dir.c_str());
+	if (top == NULL)
+		return found;
+	for (struct dirent *entry; (entry = readdir(top)) != NULL;) {
+		unsigned long store;
+		char end;
+		if (sscanf(entry->d_name, "store-%lu%c", &store, &end) != 1)
+			continue;
+		std::string storeDir = dir + "/" + entry->d_name;
+		DIR *files = opendir(storeDir.c_str());
+		if (files == NULL)
+			continue;
+		for (struct dirent *file; (file = readdir(files)) != NULL;) {
+			std::string name = file->d_name;
+			size_t dot = name.rfind('.');
+			if (dot == std::string::npos || name.substr(dot + 1) != ext)
+				continue;
+			long day = parseDay(name.c_str());
+			if (day < 0)
+				continue;
+			Partition partition;
+			partition.path = storeDir + "/" + name.substr(0, dot);
+			partition.store = (uint32_t) store;
+			partition.day = (uint32_t) day;
+			found.push_back(partition);
+		}
+		closedir(files);
+	}
+	closedir(top);
+	return found;
+}
+
+/**
+ * Maps the events of a partition. NULL if empty or it can't be read.
+ */
+static const StoredEvent *mapEvents(const std::string &path, size_t *count) {
+	*count = 0;
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct stat st;
+	void *mapped = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(StoredEvent))
+		mapped = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED)
+		return NULL;
+	*count = st.st_size / sizeof(StoredEvent);
+	return (const StoredEvent *) mapped;
+}
+
+static int compact(const std::string &dir) {
+	std::vector<Partition> all = partitions(dir, "events");
+	int status = 0;
+	unsigned long written = 0;
+	for (size_t i = 0; i < all.size(); i++) {
+		std::string events = all[i].path + ".events";
+		std::string cols = all[i].path + ".cols";
+		struct stat from, to;
+		if (stat(events.c_str(), &from) != 0)
+			continue;
+		if (stat(cols.c_str(), &to) == 0 && to.st_mtime > from.st_mtime)
+			continue;
+		size_t count;
+		const StoredEvent *mapped = mapEvents(events, &count);
+		if (mapped == NULL)
+			continue;
+		if (!ColumnFile::write(cols, mapped, count)) {
+			fprintf(stderr, "Can't write %s: %s\n", cols.c_str(), strerror(errno));
+			status = 1;
+		} else {
+			written++;
+		}
+		munmap((void *) mapped, count * sizeof(StoredEvent));
+	}
+	fprintf(stderr, "%lu of %lu partitions compacted\n", written,
+			(unsigned long) all.size());
+	return status;
+}
+
+/**
+ * Makes up the events of a store's day, as a store with a loading station (device 0), two games
+ * (1, 2), a sequence game started on device 3 and played on 4 and 5, and a rewards counter (6).
+ */
+static void makeDay(uint32_t store, uint32_t day, size_t rows, uint32_t &seed,
+		std::vector<StoredEvent> &events) {
+	events.resize(rows);
+	for (size_t i = 0; i < rows; i++) {
+		StoredEvent &event = events[i];
+		memset(&event, 0, sizeof(event));
+		//Open from 10:00 to 22:00, the events in order.
+		event.receivedUs = (uint64_t) day * EventStore::US_PER_DAY
+				+ 36000000000ULL + (uint64_t) (43200000000.0 * i / rows);
+		seed = seed * 1103515245 + 12345;
+		uint32_t r = seed >> 8;
+		event.store = store;
+		event.uid = r * 2654435761U;
+		event.time = (uint32_t) (event.receivedUs / 1000);
+		event.seq = (byte) i;
+		switch (r % 16) {
+		case 0:
+			event.device = 0;
+			event.code = Log::EVENT_CONFIGURED;
+			event.delta = 100;
+			break;
+		case 1:
+		case 2:
+			event.device = 0;
+			event.code = Log::EVENT_POINTS_ADDED;
+			event.delta = 10 * (1 + r / 16 % 10);
+			break;
+		case 3:
+		case 4:
+		case 5:
+		case 6:
+			event.device = 1 + r / 16 % 2;
+			event.code = Log::EVENT_POINTS_CHARGED;
+			event.delta = -5;
+			break;
+		case 7:
+			event.device = 1 + r / 16 % 2;
+			event.code = Log::EVENT_INSUFFICIENT_POINTS;
+			event.delta = 5;
+			break;
+		case 8:
+			event.device = 3;
+			event.code = Log::EVENT_SEQ_STARTED;
+			event.delta = 3;
+			break;
+		case 9:
+		case 10:
+			event.device = 4;
+			event.code = Log::EVENT_SEQ_STEP;
+			event.delta = 2;
+			break;
+		case 11:
+			event.device = 5;
+			event.code = Log::EVENT_SEQ_STEP;
+			event.delta = r / 16 % 3 == 0 ? 3 : -1;
+			break;
+		case 12:
+			event.device = 5;
+			event.code = Log::EVENT_REWARDS_ADDED;
+			event.delta = 3;
+			break;
+		case 13:
+			event.device = 6;
+			event.code = Log::EVENT_REWARDS_CHARGED;
+			event.delta = -(int32_t) (1 + r / 16 % 5);
+			break;
+		default:
+			event.device = 1 + r / 16 % 6;
+			event.code = Log::EVENT_CARD_ERROR;
+			event.delta = 1 + r / 16 % 4;
+			break;
+		}
+	}
+}
+
+static int generate(const std::string &dir, uint64_t rows, uint32_t stores,
+		uint32_t days, uint32_t seed, bool rowsToo) {
+	uint32_t today = (uint32_t) (time(NULL) / 86400);
+	size_t perDay = (size_t) (rows / ((uint64_t) stores * days));
+	if (perDay == 0)
+		perDay = 1;
+	EventStore store(dir);
+	std::vector<StoredEvent> events;
+	for (uint32_t s = 1; s <= stores; s++)
+		for (uint32_t day = today - days; day < today; day++) {
+			makeDay(s, day, perDay, seed, events);
+			std::string path = EventStore::partitionPath(dir, s, day);
+			path = path.substr(0, path.rfind('.'));
+			if (rowsToo) {
+				unlink((path + ".events").c_str());
+				if (!store.append(&events[0], events.size())) {
+					fprintf(stderr, "Can't write %s.events: %s\n", path.c_str(),
+							strerror(errno));
+					return 1;
+				}
+				store.close();
+			} else {
+				char storeDir[32];
+				snprintf(storeDir, sizeof(storeDir), "/store-%lu",
+						(unsigned long) s);
+				mkdir((dir + storeDir).c_str(), 0755);
+			}
+			if (!ColumnFile::write(path + ".cols", &events[0], events.size())) {
+				fprintf(stderr, "Can't write %s.cols: %s\n", path.c_str(),
+						strerror(errno));
+				return 1;
+			}
+		}
+	fprintf(stderr, "%llu events in %lu partitions\n",
+			(unsigned long long) perDay * stores * days,
+			(unsigned long) stores * days);
+	return 0;
+}
+
+static void printHour(uint32_t hour) {
+	time_t seconds = (time_t) hour * 3600;
+	struct tm date;
+	gmtime_r(&seconds, &date);
+	printf("%04d-%02d-%02d %02d:00", date.tm_year + 1900, date.tm_mon + 1,
+			date.tm_mday, date.tm_hour);
+}
+
+static void print(const std::string &report, const ColumnQuery::Result &result) {
+	ColumnQuery::Result::const_iterator it;
+	if (report == "points-by-hour") {
+		printf("store,hour,points_sold,sales\n");
+		for (it = result.begin(); it != result.end(); it++) {
+			const ColumnQuery::Aggregate *codes = it->second.codes;
+			printf("%lu,", (unsigned long) it->first.first);
+			printHour(it->first.second);
+			printf(",%lld,%llu\n",
+					(long long) (codes[Log::EVENT_CONFIGURED].sum
+							+ codes[Log::EVENT_POINTS_ADDED].sum),
+					(unsigned long long) (codes[Log::EVENT_CONFIGURED].count
+							+ codes[Log::EVENT_POINTS_ADDED].count));
+		}
+	} else if (report == "rewards-by-game") {
+		printf("store,device,rewards_won,rewards_redeemed,redemptions\n");
+		for (it = result.begin(); it != result.end(); it++) {
+			const ColumnQuery::Aggregate *codes = it->second.codes;
+			printf("%lu,%lu,%lld,%lld,%llu\n", (unsigned long) it->first.first,
+					(unsigned long) it->first.second,
+					(long long) codes[Log::EVENT_REWARDS_ADDED].sum,
+					(long long) -codes[Log::EVENT_REWARDS_CHARGED].sum,
+					(unsigned long long) codes[Log::EVENT_REWARDS_CHARGED].count);
+		}
+	} else {
+		printf("store,device,started,steps,completed,completion_rate\n");
+		uint64_t started = 0, steps = 0, completed = 0;
+		for (it = result.begin(); it != result.end(); it++) {
+			const ColumnQuery::Aggregate *codes = it->second.codes;
+			printf("%lu,%lu,%llu,%llu,%llu,\n", (unsigned long) it->first.first,
+					(unsigned long) it->first.second,
+					(unsigned long long) codes[Log::EVENT_SEQ_STARTED].count,
+					(unsigned long long) codes[Log::EVENT_SEQ_STEP].count,
+					(unsigned long long) codes[Log::EVENT_SEQ_STEP].negative);
+			started += codes[Log::EVENT_SEQ_STARTED].count;
+			steps += codes[Log::EVENT_SEQ_STEP].count;
+			completed += codes[Log::EVENT_SEQ_STEP].negative;
+			ColumnQuery::Result::const_iterator next = it;
+			if (++next == result.end() || next->first.first != it->first.first) {
+				printf("%lu,*,%llu,%llu,%llu,%.4f\n",
+						(unsigned long) it->first.first,
+						(unsigned long long) started, (unsigned long long) steps,
+						(unsigned long long) completed,
+						started > 0 ? (double) completed / started : 0.0);
+				started = steps = completed = 0;
+			}
+		}
+	}
+}
+
+static int report(const std::string &dir, const std::string &name,
+		unsigned threads, long fromDay, long toDay, long store, bool reference) {
+	ColumnQuery query;
+	if (name == "points-by-hour") {
+		query.setGroupBy(ColumnQuery::GROUP_HOUR);
+		query.setCodes(BIT(Log::EVENT_CONFIGURED) | BIT(Log::EVENT_POINTS_ADDED));
+	} else if (name == "rewards-by-game") {
+		query.setGroupBy(ColumnQuery::GROUP_DEVICE);
+		query.setCodes(
+				BIT(Log::EVENT_REWARDS_ADDED) | BIT(Log::EVENT_REWARDS_CHARGED));
+	} else if (name == "seq-completion") {
+		query.setGroupBy(ColumnQuery::GROUP_DEVICE);
+		query.setCodes(BIT(Log::EVENT_SEQ_STARTED) | BIT(Log::EVENT_SEQ_STEP));
+	} else {
+		fprintf(stderr, "Unknown report: %s\n", name.c_str());
+		return 1;
+	}
+	int64_t fromUs = fromDay < 0 ? INT64_MIN : fromDay * 86400000000LL;
+	int64_t toUs = toDay < 0 ? INT64_MAX : (toDay + 1) * 86400000000LL;
+	query.setTimeRange(fromUs, toUs);
+	if (store >= 0)
+		query.setStores((uint32_t) store, (uint32_t) store);
+
+	//Partitions out of the range aren't even opened.
+	std::vector<Partition> all = partitions(dir,
+			reference ? "events" : "cols");
+	std::vector<std::string> paths;
+	for (size_t i = 0; i < all.size(); i++)
+		if ((fromDay < 0 || all[i].day >= fromDay)
+				&& (toDay < 0 || all[i].day <= toDay)
+				&& (store < 0 || all[i].store == store))
+			paths.push_back(all[i].path + (reference ? ".events" : ".cols"));
+	std::sort(paths.begin(), paths.end());
+
+	ColumnQuery::Result result;
+	double start = nowS();
+	uint64_t rows = 0;
+	if (reference) {
+		for (size_t i = 0; i < paths.size(); i++) {
+			size_t count;
+			const StoredEvent *events = mapEvents(paths[i], &count);
+			if (events == NULL)
+				continue;
+			for (size_t row = 0; row < count; row++)
+				query.add(events[row], result);
+			munmap((void *) events, count * sizeof(StoredEvent));
+			rows += count;
+		}
+		double took = nowS() - start;
+		fprintf(stderr, "%lu files, %llu rows, %.3f s, %.1f Mrows/s\n",
+				(unsigned long) paths.size(), (unsigned long long) rows, took,
+				rows / took / 1e6);
+	} else {
+		if (!query.run(paths, threads, result)) {
+			fprintf(stderr, "Can't read the columnar files\n");
+			return 1;
+		}
+		double took = nowS() - start;
+		const ColumnQuery::Stats &stats = query.stats();
+		fprintf(stderr, "%lu files, %llu blocks (%llu skipped), %llu rows, "
+				"%llu matched, %u threads, %.3f s, %.1f Mrows/s\n", stats.files,
+				(unsigned long long) stats.blocks,
+				(unsigned long long) stats.blocksSkipped,
+				(unsigned long long) stats.rows,
+				(unsigned long long) stats.matched, threads, took,
+				stats.rows / took / 1e6);
+	}
+	print(name, result);
+	return 0;
+}
+
+static int usage(const char *name) {
+	fprintf(stderr, "Usage:\n"
+			"  %s compact -d dir\n"
+			"  %s report -d dir [-t threads] [-from YYYY-MM-DD] [-to YYYY-MM-DD] "
+			"[-store id] [-R] points-by-hour|rewards-by-game|seq-completion\n"
+			"  %s generate -d dir -n rows [-S stores] [-D days] [-s seed] [-e]\n",
+			name, name, name);
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2)
+		return usage(argv[0]);
+	std::string command = argv[1];
+	std::string dir;
+	std::string name;
+	unsigned threads = std::thread::hardware_concurrency();
+	long fromDay = -1, toDay = -1, store = -1;
+	bool reference = false, rowsToo = false;
+	uint64_t rows = 0;
+	unsigned long stores = 4, days = 30;
+	uint32_t seed = 1;
+	for (int i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+			dir = argv[++i];
+		else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			threads = (unsigned) strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-from") == 0 && i + 1 < argc) {
+			if ((fromDay = parseDay(argv[++i])) < 0)
+				return usage(argv[0]);
+		} else if (strcmp(argv[i], "-to") == 0 && i + 1 < argc) {
+			if ((toDay = parseDay(argv[++i])) < 0)
+				return usage(argv[0]);
+		} else if (strcmp(argv[i], "-store") == 0 && i + 1 < argc)
+			store = atol(argv[++i]);
+		else if (strcmp(argv[i], "-R") == 0)
+			reference = true;
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			rows = strtoull(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc)
+			stores = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-D") == 0 && i + 1 < argc)
+			days = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			seed = (uint32_t) strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-e") == 0)
+			rowsToo = true;
+		else if (argv[i][0] != '-' && name.empty())
+			name = argv[i];
+		else
+			return usage(argv[0]);
+	}
+	if (dir.empty())
+		return usage(argv[0]);
+	if (threads == 0)
+		threads = 1;
+	if (command == "compact")
+		return compact(dir);
+	if (command == "report" && !name.empty())
+		return report(dir, name, threads, fromDay, toDay, store, reference);
+	if (command == "generate" && rows > 0 && stores > 0 && days > 0)
+		return generate(dir, rows, (uint32_t) stores, (uint32_t) days, seed,
+				rowsToo);
+	return usage(argv[0]);
+}
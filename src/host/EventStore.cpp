@@ -0,0 +1,105 @@
+/*
+ * EventStore.cpp
+ * On-disk log of the station events. See EventStore.h.
+ */
+
+#include "EventStore.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+EventStore::EventStore(const std::string &dir) :
+		dir(dir) {
+	mkdir(dir.c_str(), 0755);
+}
+
+EventStore::~EventStore() {
+	close();
+}
+
+std::string EventStore::partitionPath(const std::string &dir, uint32_t store,
+		uint32_t day) {
+	time_t seconds = (time_t) day * 86400;
+	struct tm date;
+	gmtime_r(&seconds, &date);
+	char name[64];
+	snprintf(name, sizeof(name), "/store-%lu/%04d-%02d-%02d.events",
+			(unsigned long) store, date.tm_year + 1900, date.tm_mon + 1,
+			date.tm_mday);
+	return dir + name;
+}
+
+/**
+ * Returns the descriptor of a partition, opening it for appending if needed. -1 if it can't be.
+ */
+int EventStore::open(const Partition &partition) {
+	std::map<Partition, int>::iterator it = files.find(partition);
+	if (it != files.end())
+		return it->second;
+	//Partitions of past days are seldom written again: start over rather than track their use.
+	if (files.size() >= MAX_OPEN_FILES)
+		close();
+	char storeDir[32];
+	snprintf(storeDir, sizeof(storeDir), "/store-%lu",
+			(unsigned long) partition.first);
+	mkdir((dir + storeDir).c_str(), 0755);
+	std::string path = partitionPath(dir, partition.first, partition.second);
+	int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+			0644);
+	if (fd >= 0)
+		files[partition] = fd;
+	return fd;
+}
+
+bool EventStore::append(const StoredEvent *events, size_t count) {
+	for (size_t i = 0; i < count; i++)
+		pending[Partition(events[i].store,
+				(uint32_t) (events[i].receivedUs / US_PER_DAY))].push_back(
+				events[i]);
+	bool ok = true;
+	int error = 0;
+	for (std::map<Partition, std::vector<StoredEvent> >::iterator it =
+			pending.begin(); it != pending.end(); it++) {
+		if (it->second.empty())
+			continue;
+		int fd = open(it->first);
+		const char *data = (const char *) &it->second[0];
+		size_t size = it->second.size() * sizeof(StoredEvent);
+		while (fd >= 0 && size > 0) {
+			ssize_t n = ::write(fd, data, size);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n < 0)
+				break;
+			data += n;
+			size -= n;
+		}
+		if (fd < 0 || size > 0) {
+			ok = false;
+			error = errno;
+		}
+		//The vectors are kept, with their capacity, for the next batches.
+		it->second.clear();
+	}
+	if (pending.size() > MAX_OPEN_FILES)
+		pending.clear();
+	if (!ok)
+		errno = error;
+	return ok;
+}
+
+void EventStore::sync() {
+	for (std::map<Partition, int>::iterator it = files.begin();
+			it != files.end(); it++)
+		fdatasync(it->second);
+}
+
+void EventStore::close() {
+	for (std::map<Partition, int>::iterator it = files.begin();
+			it != files.end(); it++)
+		::close(it->second);
+	files.clear();
+}
@@ -0,0 +1,78 @@
+/*
+ * EventStore.h
+ * On-disk log of the events received from the stations, partitioned by store and day:
+ *   <dir>/store-<store id>/<YYYY-MM-DD>.events
+ * Each file is a sequence of StoredEvent, appended in the order received, the day being the UTC day
+ * the event was received on. The stations only have millis(), so the host clock dates the events.
+ */
+#ifndef EventStore_h
+#define EventStore_h
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <Log.h>
+
+/**
+ * An event as stored: the Log::Record with where and when it was received. 32 bytes, host endian.
+ */
+typedef struct {
+	uint64_t receivedUs;	// Host wall clock when the frame was read, us since the epoch.
+	uint32_t time;			// millis() on the station when recorded.
+	uint32_t uid;			// Card UID, see Log::packUid(). 0 for device events.
+	int32_t delta;
+	uint32_t store;			// Store id, from the station's EVENT_STARTED. 0 if not known yet.
+	uint16_t device;
+	byte code;				// Log::EventCode.
+	byte seq;
+	uint16_t port;			// Index of the port received on.
+	uint16_t reserved;
+} StoredEvent;
+
+static_assert(sizeof(StoredEvent) == 32, "StoredEvent must be 32 bytes");
+
+class EventStore {
+public:
+	static const unsigned long US_PER_DAY = 86400000000UL;
+	static const size_t MAX_OPEN_FILES = 64;	// Partitions kept open for appending.
+
+	/**
+	 * Stores under dir, which is created if needed.
+	 */
+	explicit EventStore(const std::string &dir);
+	~EventStore();
+
+	/**
+	 * Appends events to their partitions, with one write per partition.
+	 * Returns false if a write failed, errno telling why; the events of the other partitions are written.
+	 */
+	bool append(const StoredEvent *events, size_t count);
+
+	/**
+	 * Flushes the open partitions to the disk.
+	 */
+	void sync();
+
+	/**
+	 * Closes the open partitions.
+	 */
+	void close();
+
+	/**
+	 * Path of the partition of store on day (days since the epoch).
+	 */
+	static std::string partitionPath(const std::string &dir, uint32_t store,
+			uint32_t day);
+
+private:
+	typedef std::pair<uint32_t, uint32_t> Partition;	// Store and day.
+
+	int open(const Partition &partition);
+
+	std::string dir;
+	std::map<Partition, int> files;						// Open partitions.
+	std::map<Partition, std::vector<StoredEvent> > pending;	// Batch being appended, per partition.
+};
+
+#endif /* EventStore_h */
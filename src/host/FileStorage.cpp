@@ -0,0 +1,50 @@
+/*
+ * FileStorage.cpp
+ * See FileStorage.h.
+ */
+
+#include <string.h>
+#include "FileStorage.h"
+
+FileStorage::FileStorage(const char *path, uint16_t length) :
+		file(NULL), data(new byte[length]), size(length), written(0) {
+	memset(data, 0xFF, size);
+	file = fopen(path, "r+b");
+	if (file != NULL) {
+		size_t n = fread(data, 1, size, file);
+		(void) n;
+		return;
+	}
+	file = fopen(path, "w+b");
+	if (file != NULL) {
+		fwrite(data, 1, size, file);
+		fflush(file);
+	}
+}
+
+FileStorage::~FileStorage() {
+	if (file != NULL)
+		fclose(file);
+	delete[] data;
+}
+
+uint16_t FileStorage::length() {
+	return size;
+}
+
+byte FileStorage::read(uint16_t addr) {
+	return addr < size ? data[addr] : 0xFF;
+}
+
+void FileStorage::update(uint16_t addr, byte value) {
+	if (addr >= size || data[addr] == value)
+		return;
+	data[addr] = value;
+	written++;
+	simAdvanceMicros(WRITE_US);
+	if (file != NULL) {
+		fseek(file, addr, SEEK_SET);
+		fputc(value, file);
+		fflush(file);
+	}
+}
@@ -0,0 +1,48 @@
+/*
+ * FileStorage.h
+ * Host-side Storage backed by a file, standing in for the EEPROM.
+ * Each update goes to the file at once, so the content survives the process being killed,
+ * and takes the time of an EEPROM byte write on the virtual clock.
+ */
+#ifndef FileStorage_h
+#define FileStorage_h
+
+#include <stdio.h>
+#include <Storage.h>
+
+class FileStorage: public Storage {
+public:
+	static const unsigned long WRITE_US = 3300;	// AVR EEPROM byte write time.
+
+	/**
+	 * Opens the file, creating it erased (0xFF) with the given length if it doesn't exist.
+	 */
+	FileStorage(const char *path, uint16_t length);
+	~FileStorage();
+
+	/**
+	 * Returns false if the file couldn't be opened.
+	 */
+	bool isOpen() const {
+		return file != NULL;
+	}
+
+	uint16_t length();
+	byte read(uint16_t addr);
+	void update(uint16_t addr, byte value);
+
+	/**
+	 * Number of bytes actually written since start.
+	 */
+	unsigned long bytesWritten() const {
+		return written;
+	}
+
+private:
+	FILE *file;
+	byte *data;
+	uint16_t size;
+	unsigned long written;
+};
+
+#endif /* FileStorage_h */
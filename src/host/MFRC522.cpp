@@ -0,0 +1,391 @@
+/*
+ * MFRC522.cpp
+ * Host-side stand-in for the MFRC522 library. See MFRC522.h.
+ */
+
+#include "MFRC522.h"
+
+/**
+ * CRC_A as appended by the card to every block read (ISO/IEC 14443-3, Annex B).
+ */
+static uint16_t crcA(const byte *data, byte length) {
+	uint16_t crc = 0x6363;
+	for (byte i = 0; i < length; i++) {
+		byte b = data[i] ^ (byte) (crc & 0xFF);
+		b ^= b << 4;
+		crc = (crc >> 8) ^ ((uint16_t) b << 8) ^ ((uint16_t) b << 3) ^ (b >> 4);
+	}
+	return crc;
+}
+
+/**
+ * Bit of a UID, most significant first.
+ */
+static bool bitOf(const byte *uid, byte bit) {
+	return (uid[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+MFRC522::MFRC522() :
+		reader(&SimReader::forPin(DEFAULT_SS_PIN)) {
+	memset(&uid, 0, sizeof(uid));
+}
+
+MFRC522::MFRC522(byte resetPowerDownPin) :
+		reader(&SimReader::forPin(DEFAULT_SS_PIN)) {
+	(void) resetPowerDownPin;
+	memset(&uid, 0, sizeof(uid));
+}
+
+MFRC522::MFRC522(byte chipSelectPin, byte resetPowerDownPin) :
+		reader(&SimReader::forPin(chipSelectPin)) {
+	(void) resetPowerDownPin;
+	memset(&uid, 0, sizeof(uid));
+}
+
+void MFRC522::PCD_Init(byte chipSelectPin, byte resetPowerDownPin) {
+	(void) resetPowerDownPin;
+	reader = &SimReader::forPin(chipSelectPin);
+}
+
+MFRC522::StatusCode MFRC522::result(SimReader::Command cmd,
+		SimCard::Result result) {
+	switch (result) {
+	case SimCard::RESULT_OK:
+		return STATUS_OK;
+	case SimCard::RESULT_NAK:
+		reader->failed(cmd, false);
+		return STATUS_MIFARE_NACK;
+	default:
+		reader->failed(cmd, true);
+		return STATUS_TIMEOUT;
+	}
+}
+
+MFRC522::StatusCode MFRC522::request(byte command, byte *bufferATQA,
+		byte *bufferSize) {
+	if (bufferATQA == NULL || *bufferSize < 2)
+		return STATUS_NO_ROOM;
+	if (!reader->transmit(SimReader::CMD_REQUEST, reader->latency.requestUs, 3))
+		return STATUS_TIMEOUT;
+	//Cards still powering up, or without a field, don't answer.
+	if (!reader->powered())
+		return result(SimReader::CMD_REQUEST, SimCard::RESULT_SILENT);
+	byte answers = 0;
+	for (byte i = 0; i < reader->numCards; i++) {
+		SimCard *card = reader->field[i];
+		if (card->state == SimCard::STATE_HALT && command == PICC_CMD_WUPA) {
+			card->state = SimCard::STATE_IDLE;
+			card->woken = true;
+		}
+		if (card->state == SimCard::STATE_IDLE)
+			answers++;
+	}
+	if (answers == 0)
+		return result(SimReader::CMD_REQUEST, SimCard::RESULT_SILENT);
+	bufferATQA[0] = 0x04;
+	bufferATQA[1] = 0x00;
+	*bufferSize = 2;
+	return STATUS_OK;
+}
+
+MFRC522::StatusCode MFRC522::PICC_RequestA(byte *bufferATQA,
+		byte *bufferSize) {
+	return request(PICC_CMD_REQA, bufferATQA, bufferSize);
+}
+
+MFRC522::StatusCode MFRC522::PICC_WakeupA(byte *bufferATQA,
+		byte *bufferSize) {
+	return request(PICC_CMD_WUPA, bufferATQA, bufferSize);
+}
+
+/**
+ * Whether the ready cards sharing the bits of the card before the given one differ on it.
+ */
+bool MFRC522::collision(const SimCard *card, byte bit) {
+	bool zero = false;
+	bool one = false;
+	for (byte i = 0; i < reader->numCards; i++) {
+		const SimCard *other = reader->field[i];
+		if (other->state != SimCard::STATE_IDLE)
+			continue;
+		byte b;
+		for (b = 0; b < bit; b++)
+			if (bitOf(other->uid, b) != bitOf(card->uid, b))
+				break;
+		if (b < bit)
+			continue;
+		if (bitOf(other->uid, bit))
+			one = true;
+		else
+			zero = true;
+	}
+	return zero && one;
+}
+
+MFRC522::StatusCode MFRC522::PICC_Select(Uid *uid, byte validBits) {
+	if (!reader->transmit(SimReader::CMD_SELECT, reader->latency.selectUs, 19))
+		return STATUS_TIMEOUT;
+	//Anticollision settles on the highest UID among the ready cards, unless a UID prefix is given.
+	SimCard *card = NULL;
+	for (byte i = 0; i < reader->numCards; i++) {
+		SimCard *candidate = reader->field[i];
+		if (candidate->state != SimCard::STATE_IDLE)
+			continue;
+		if (validBits > 0) {
+			if (memcmp(candidate->uid, uid->uidByte, validBits / 8) == 0) {
+				card = candidate;
+				break;
+			}
+		} else if (card == NULL
+				|| memcmp(candidate->uid, card->uid, sizeof(card->uid)) > 0) {
+			card = candidate;
+		}
+	}
+	if (card == NULL)
+		return result(SimReader::CMD_SELECT, SimCard::RESULT_SILENT);
+	//Each bit the ready cards differ on along the way costs one more anticollision round.
+	if (validBits == 0) {
+		for (byte bit = 0; bit < card->uidSize * 8; bit++) {
+			if (!collision(card, bit))
+				continue;
+			if (!reader->transmit(SimReader::CMD_SELECT,
+					reader->latency.selectUs / 2, 7))
+				return STATUS_TIMEOUT;
+		}
+	}
+	if (reader->selected != NULL && reader->selected != card)
+		reader->selected->drop();
+	//The cards woken up but not selected go back to HALT.
+	for (byte i = 0; i < reader->numCards; i++) {
+		SimCard *other = reader->field[i];
+		if (other != card && other->state == SimCard::STATE_IDLE && other->woken)
+			other->halt();
+	}
+	card->state = SimCard::STATE_ACTIVE;
+	card->stopCrypto();
+	reader->selected = card;
+	uid->size = card->uidSize;
+	memcpy(uid->uidByte, card->uid, sizeof(uid->uidByte));
+	uid->sak = card->sak;
+	return STATUS_OK;
+}
+
+MFRC522::StatusCode MFRC522::PICC_HaltA() {
+	//No answer is the expected answer to HLTA.
+	reader->transmit(SimReader::CMD_HALT, reader->latency.haltUs, 4);
+	if (reader->selected != NULL) {
+		reader->selected->halt();
+		reader->selected = NULL;
+	}
+	return STATUS_OK;
+}
+
+MFRC522::StatusCode MFRC522::PCD_Authenticate(byte command, byte blockAddr,
+		MIFARE_Key *key, Uid *uid) {
+	if (!reader->transmit(SimReader::CMD_AUTHENTICATE, reader->latency.authUs,
+			20))
+		return STATUS_TIMEOUT;
+	if (reader->selected == NULL)
+		return result(SimReader::CMD_AUTHENTICATE, SimCard::RESULT_SILENT);
+	return result(SimReader::CMD_AUTHENTICATE,
+			reader->selected->authenticate(command == PICC_CMD_MF_AUTH_KEY_B,
+					blockAddr, key->keyByte,
+					&uid->uidByte[uid->size - 4]));
+}
+
+void MFRC522::PCD_StopCrypto1() {
+	if (reader->selected != NULL)
+		reader->selected->stopCrypto();
+}
+
+MFRC522::StatusCode MFRC522::MIFARE_Read(byte blockAddr, byte *buffer,
+		byte *bufferSize) {
+	if (buffer == NULL || *bufferSize < 18)
+		return STATUS_NO_ROOM;
+	if (!reader->transmit(SimReader::CMD_READ, reader->latency.readUs, 22,
+			blockAddr))
+		return STATUS_TIMEOUT;
+	if (reader->selected == NULL)
+		return result(SimReader::CMD_READ, SimCard::RESULT_SILENT);
+	StatusCode status = result(SimReader::CMD_READ,
+			reader->selected->read(blockAddr, buffer));
+	if (status == STATUS_OK) {
+		uint16_t crc = crcA(buffer, 16);
+		buffer[16] = crc & 0xFF;
+		buffer[17] = crc >> 8;
+		*bufferSize = 18;
+	}
+	return status;
+}
+
+MFRC522::StatusCode MFRC522::MIFARE_Write(byte blockAddr, byte *buffer,
+		byte bufferSize) {
+	if (buffer == NULL || bufferSize < 16)
+		return STATUS_INVALID;
+	if (!reader->transmit(SimReader::CMD_WRITE, reader->latency.writeUs, 24,
+			blockAddr))
+		return STATUS_TIMEOUT;
+	if (reader->selected == NULL)
+		return result(SimReader::CMD_WRITE, SimCard::RESULT_SILENT);
+	return result(SimReader::CMD_WRITE,
+			reader->selected->write(blockAddr, buffer));
+}
+
+MFRC522::StatusCode MFRC522::valueCommand(SimReader::Command cmd,
+		byte blockAddr, int32_t delta) {
+	if (!reader->transmit(cmd, reader->latency.valueUs, 11, blockAddr))
+		return STATUS_TIMEOUT;
+	SimCard *card = reader->selected;
+	if (card == NULL)
+		return result(cmd, SimCard::RESULT_SILENT);
+	switch (cmd) {
+	case SimReader::CMD_INCREMENT:
+		return result(cmd, card->increment(blockAddr, delta));
+	case SimReader::CMD_DECREMENT:
+		return result(cmd, card->decrement(blockAddr, delta));
+	default:
+		return result(cmd, card->restore(blockAddr));
+	}
+}
+
+MFRC522::StatusCode MFRC522::MIFARE_Decrement(byte blockAddr, int32_t delta) {
+	return valueCommand(SimReader::CMD_DECREMENT, blockAddr, delta);
+}
+
+MFRC522::StatusCode MFRC522::MIFARE_Increment(byte blockAddr, int32_t delta) {
+	return valueCommand(SimReader::CMD_INCREMENT, blockAddr, delta);
+}
+
+MFRC522::StatusCode MFRC522::MIFARE_Restore(byte blockAddr) {
+	return valueCommand(SimReader::CMD_RESTORE, blockAddr, 0);
+}
+
+MFRC522::StatusCode MFRC522::MIFARE_Transfer(byte blockAddr) {
+	if (!reader->transmit(SimReader::CMD_TRANSFER, reader->latency.transferUs,
+			5, blockAddr))
+		return STATUS_TIMEOUT;
+	if (reader->selected == NULL)
+		return result(SimReader::CMD_TRANSFER, SimCard::RESULT_SILENT);
+	return result(SimReader::CMD_TRANSFER,
+			reader->selected->transfer(blockAddr));
+}
+
+MFRC522::StatusCode MFRC522::MIFARE_GetValue(byte blockAddr, int32_t *value) {
+	if (!reader->transmit(SimReader::CMD_GET_VALUE, reader->latency.readUs, 22,
+			blockAddr))
+		return STATUS_TIMEOUT;
+	if (reader->selected == NULL)
+		return result(SimReader::CMD_GET_VALUE, SimCard::RESULT_SILENT);
+	byte buffer[16];
+	StatusCode status = result(SimReader::CMD_GET_VALUE,
+			reader->selected->read(blockAddr, buffer));
+	//Like the library, only the first copy of the value is looked at.
+	if (status == STATUS_OK)
+		*value = (int32_t) ((uint32_t) buffer[0] | ((uint32_t) buffer[1] << 8)
+				| ((uint32_t) buffer[2] << 16) | ((uint32_t) buffer[3] << 24));
+	return status;
+}
+
+MFRC522::StatusCode MFRC522::MIFARE_SetValue(byte blockAddr, int32_t value) {
+	if (!reader->transmit(SimReader::CMD_SET_VALUE, reader->latency.writeUs, 24,
+			blockAddr))
+		return STATUS_TIMEOUT;
+	if (reader->selected == NULL)
+		return result(SimReader::CMD_SET_VALUE, SimCard::RESULT_SILENT);
+	byte buffer[16];
+	for (byte i = 0; i < 4; i++) {
+		buffer[i] = buffer[8 + i] = (value >> (8 * i)) & 0xFF;
+		buffer[4 + i] = ~buffer[i];
+	}
+	buffer[12] = buffer[14] = blockAddr;
+	buffer[13] = buffer[15] = ~blockAddr;
+	return result(SimReader::CMD_SET_VALUE,
+			reader->selected->write(blockAddr, buffer));
+}
+
+const __FlashStringHelper *MFRC522::GetStatusCodeName(byte code) {
+	switch (code) {
+	case STATUS_OK:
+		return F("Success.");
+	case STATUS_ERROR:
+		return F("Error in communication.");
+	case STATUS_COLLISION:
+		return F("Collission detected.");
+	case STATUS_TIMEOUT:
+		return F("Timeout in communication.");
+	case STATUS_NO_ROOM:
+		return F("A buffer is not big enough.");
+	case STATUS_INTERNAL_ERROR:
+		return F("Internal error in the code. Should not happen.");
+	case STATUS_INVALID:
+		return F("Invalid argument.");
+	case STATUS_CRC_WRONG:
+		return F("The CRC_A does not match.");
+	case STATUS_MIFARE_NACK:
+		return F("A MIFARE PICC responded with NAK.");
+	default:
+		return F("Unknown error");
+	}
+}
+
+MFRC522::PICC_Type MFRC522::PICC_GetType(byte sak) {
+	switch (sak & 0x7F) {
+	case 0x04:
+		return PICC_TYPE_NOT_COMPLETE;
+	case 0x09:
+		return PICC_TYPE_MIFARE_MINI;
+	case 0x08:
+		return PICC_TYPE_MIFARE_1K;
+	case 0x18:
+		return PICC_TYPE_MIFARE_4K;
+	case 0x00:
+		return PICC_TYPE_MIFARE_UL;
+	case 0x10:
+	case 0x11:
+		return PICC_TYPE_MIFARE_PLUS;
+	case 0x01:
+		return PICC_TYPE_TNP3XXX;
+	case 0x20:
+		return PICC_TYPE_ISO_14443_4;
+	case 0x40:
+		return PICC_TYPE_ISO_18092;
+	default:
+		return PICC_TYPE_UNKNOWN;
+	}
+}
+
+const __FlashStringHelper *MFRC522::PICC_GetTypeName(byte piccType) {
+	switch (piccType) {
+	case PICC_TYPE_ISO_14443_4:
+		return F("PICC compliant with ISO/IEC 14443-4");
+	case PICC_TYPE_ISO_18092:
+		return F("PICC compliant with ISO/IEC 18092 (NFC)");
+	case PICC_TYPE_MIFARE_MINI:
+		return F("MIFARE Mini, 320 bytes");
+	case PICC_TYPE_MIFARE_1K:
+		return F("MIFARE 1KB");
+	case PICC_TYPE_MIFARE_4K:
+		return F("MIFARE 4KB");
+	case PICC_TYPE_MIFARE_UL:
+		return F("MIFARE Ultralight or Ultralight C");
+	case PICC_TYPE_MIFARE_PLUS:
+		return F("MIFARE Plus");
+	case PICC_TYPE_TNP3XXX:
+		return F("MIFARE TNP3XXX");
+	case PICC_TYPE_NOT_COMPLETE:
+		return F("SAK indicates UID is not complete.");
+	default:
+		return F("Unknown type");
+	}
+}
+
+bool MFRC522::PICC_IsNewCardPresent() {
+	byte bufferATQA[2];
+	byte bufferSize = sizeof(bufferATQA);
+	StatusCode result = PICC_RequestA(bufferATQA, &bufferSize);
+	return (result == STATUS_OK || result == STATUS_COLLISION);
+}
+
+bool MFRC522::PICC_ReadCardSerial() {
+	return PICC_Select(&uid) == STATUS_OK;
+}
@@ -0,0 +1,145 @@
+/*
+ * MFRC522.h
+ * Host-side stand-in for the MFRC522 library, backed by a simulated field (SimReader)
+ * holding simulated MIFARE Classic 1K cards (SimCard).
+ *
+ * It offers the subset of the MFRC522 API used by this project with the same signatures,
+ * so CardUtil and friends compile unchanged on Linux. The type and status code values
+ * match the ones of the Arduino library.
+ */
+#ifndef MFRC522_h
+#define MFRC522_h
+
+#include <Arduino.h>
+#include "SimReader.h"
+
+class MFRC522 {
+public:
+	static const byte MF_KEY_SIZE = 6;
+
+	// Commands sent to the PICC.
+	enum PICC_Command
+		: byte {
+			PICC_CMD_REQA = 0x26,
+		PICC_CMD_WUPA = 0x52,
+		PICC_CMD_CT = 0x88,
+		PICC_CMD_SEL_CL1 = 0x93,
+		PICC_CMD_SEL_CL2 = 0x95,
+		PICC_CMD_SEL_CL3 = 0x97,
+		PICC_CMD_HLTA = 0x50,
+		PICC_CMD_MF_AUTH_KEY_A = 0x60,
+		PICC_CMD_MF_AUTH_KEY_B = 0x61,
+		PICC_CMD_MF_READ = 0x30,
+		PICC_CMD_MF_WRITE = 0xA0,
+		PICC_CMD_MF_DECREMENT = 0xC0,
+		PICC_CMD_MF_INCREMENT = 0xC1,
+		PICC_CMD_MF_RESTORE = 0xC2,
+		PICC_CMD_MF_TRANSFER = 0xB0,
+	};
+
+	// PICC types we can detect.
+	enum PICC_Type
+		: byte {
+			PICC_TYPE_UNKNOWN,
+		PICC_TYPE_ISO_14443_4,
+		PICC_TYPE_ISO_18092,
+		PICC_TYPE_MIFARE_MINI,
+		PICC_TYPE_MIFARE_1K,
+		PICC_TYPE_MIFARE_4K,
+		PICC_TYPE_MIFARE_UL,
+		PICC_TYPE_MIFARE_PLUS,
+		PICC_TYPE_TNP3XXX,
+		PICC_TYPE_NOT_COMPLETE = 0xff
+	};
+
+	// Return codes from the functions in this class.
+	enum StatusCode
+		: byte {
+			STATUS_OK,
+		STATUS_ERROR,
+		STATUS_COLLISION,
+		STATUS_TIMEOUT,
+		STATUS_NO_ROOM,
+		STATUS_INTERNAL_ERROR,
+		STATUS_INVALID,
+		STATUS_CRC_WRONG,
+		STATUS_MIFARE_NACK = 0xff
+	};
+
+	// A struct used for passing the UID of a PICC.
+	typedef struct {
+		byte size;
+		byte uidByte[10];
+		byte sak;
+	} Uid;
+
+	// A struct used for passing a MIFARE Crypto1 key
+	typedef struct {
+		byte keyByte[MF_KEY_SIZE];
+	} MIFARE_Key;
+
+	// Default SS pin, as on the Uno.
+	static const byte DEFAULT_SS_PIN = 10;
+
+	Uid uid;
+
+	MFRC522();
+	MFRC522(byte resetPowerDownPin);
+	MFRC522(byte chipSelectPin, byte resetPowerDownPin);
+
+	void PCD_Init() {
+	}
+	void PCD_Init(byte chipSelectPin, byte resetPowerDownPin);
+	void PCD_AntennaOn() {
+		reader->setAntenna(true);
+	}
+	void PCD_AntennaOff() {
+		reader->setAntenna(false);
+	}
+
+	//PICC commands.
+	StatusCode PICC_RequestA(byte *bufferATQA, byte *bufferSize);
+	StatusCode PICC_WakeupA(byte *bufferATQA, byte *bufferSize);
+	StatusCode PICC_Select(Uid *uid, byte validBits = 0);
+	StatusCode PICC_HaltA();
+
+	//MIFARE commands.
+	StatusCode PCD_Authenticate(byte command, byte blockAddr, MIFARE_Key *key,
+			Uid *uid);
+	void PCD_StopCrypto1();
+	StatusCode MIFARE_Read(byte blockAddr, byte *buffer, byte *bufferSize);
+	StatusCode MIFARE_Write(byte blockAddr, byte *buffer, byte bufferSize);
+	StatusCode MIFARE_Decrement(byte blockAddr, int32_t delta);
+	StatusCode MIFARE_Increment(byte blockAddr, int32_t delta);
+	StatusCode MIFARE_Restore(byte blockAddr);
+	StatusCode MIFARE_Transfer(byte blockAddr);
+	StatusCode MIFARE_GetValue(byte blockAddr, int32_t *value);
+	StatusCode MIFARE_SetValue(byte blockAddr, int32_t value);
+
+	//Support functions.
+	static const __FlashStringHelper *GetStatusCodeName(byte code);
+	static PICC_Type PICC_GetType(byte sak);
+	static const __FlashStringHelper *PICC_GetTypeName(byte type);
+
+	//Convenience functions.
+	bool PICC_IsNewCardPresent();
+	bool PICC_ReadCardSerial();
+
+	/**
+	 * Returns the simulated field of this reader. Host only.
+	 */
+	SimReader &sim() {
+		return *reader;
+	}
+
+private:
+	StatusCode request(byte command, byte *bufferATQA, byte *bufferSize);
+	bool collision(const SimCard *card, byte bit);
+	StatusCode result(SimReader::Command cmd, SimCard::Result result);
+	StatusCode valueCommand(SimReader::Command cmd, byte blockAddr,
+			int32_t delta);
+
+	SimReader *reader;
+};
+
+#endif /* MFRC522_h */
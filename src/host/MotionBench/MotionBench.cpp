@@ -0,0 +1,343 @@
+/**
+ * Motion Detector Benchmark
+ * Replays labelled traces of sensor samples through the motion detectors and reports, per trace
+ * and detector, the motions detected and missed, the false triggers, the detection latency and
+ * the CPU time per sample. Meant to be run before and after a change of a detector, or of its
+ * settings, to compare them on the same recordings.
+ *
+ * Build (from src/):
+ *   g++ -std=c++11 -O2 -Ihost -Ilib host/Arduino.cpp lib/AdaptiveDetector.cpp lib/MotionDetector.cpp \
+ *       host/MotionBench/MotionBench.cpp -o motion_bench
+ * Usage:
+ *   motion_bench [-w window] [-n repeats] [-S on,off,minDelta] [-T baseline,noise,maxDip] [-J] trace...
+ *   motion_bench -G samples [-s seed]
+ *   -w  Latest a detection may come after the start of a motion, in samples (default 1000).
+ *   -n  Times each trace is run for the timing (default 10).
+ *   -S  Sensitivity of the adaptive detector, see AdaptiveDetector::setSensitivity().
+ *   -T  Time constants of the adaptive detector, see AdaptiveDetector::setTimeConstants().
+ *   -J  JSON output instead of CSV.
+ *   -G  Writes a synthetic labelled trace of that many samples at 1 kHz to stdout, with slowly
+ *       drifting ambient light, mains ripple, noise and shadows passing, then exits.
+ *   -s  Seed of the synthetic trace.
+ *
+ * A trace has one sample (0 to 1023) per line, as for MotionReplay. A second field, not 0, marks
+ * the sample at which a motion starts, e.g. as noted while recording:
+ *   512
+ *   509,1
+ * The first detection within the window of a motion detects it, at a latency in samples from the
+ * mark. Every other detection is a false trigger. The detectors are the one Motion_Detector used
+ * first (legacy, which detects a shadow when it is gone) and AdaptiveDetector in toggle mode.
+ *
+ * The CPU time is taken with the time stamp counter on x86 (cycles_per_sample), in nanoseconds
+ * elsewhere (ns_per_sample). These are host figures, to compare detectors with each other; the
+ * board's own figure is the processing time per sample in Motion_Detector's SAMPLES report.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+#include <Arduino.h>
+#include <MotionDetector.h>
+#include <AdaptiveDetector.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CPU_TIME_NAME "cycles_per_sample"
+static inline uint64_t cpuTime() {
+	return __rdtsc();
+}
+#else
+#define CPU_TIME_NAME "ns_per_sample"
+static inline uint64_t cpuTime() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+#endif
+
+/**
+ * A recorded trace, with the samples at which the motions start.
+ */
+typedef struct {
+	const char *path;
+	std::vector<uint16_t> samples;
+	std::vector<unsigned long> motions;
+} Trace;
+
+/**
+ * Results of a detector over a trace.
+ */
+typedef struct {
+	const char *trace;
+	const char *detector;
+	unsigned long samples;
+	unsigned long motions;
+	unsigned long detected;
+	unsigned long falseTriggers;
+	std::vector<unsigned long> latencies;
+	double cpuPerSample;
+} Result;
+
+typedef struct {
+	byte onSigma, offSigma;
+	uint16_t minDelta;
+	byte baselineShift, noiseShift;
+	uint16_t maxDipSamples;
+} Settings;
+
+static volatile unsigned long sink;	// Keeps the timed runs from being optimised away.
+
+static bool readTrace(const char *path, Trace &trace) {
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		fprintf(stderr, "Can't open %s\n", path);
+		return false;
+	}
+	trace.path = path;
+	char line[256];
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if (!isdigit((unsigned char) line[0]))
+			continue;
+		char *end;
+		long sample = strtol(line, &end, 10);
+		if (sample > 1023) {
+			fprintf(stderr, "%s: samples are 10 bits, 0 to 1023\n", path);
+			fclose(file);
+			return false;
+		}
+		if (*end == ',' && strtol(end + 1, NULL, 10) != 0)
+			trace.motions.push_back(trace.samples.size());
+		trace.samples.push_back((uint16_t) sample);
+	}
+	fclose(file);
+	return true;
+}
+
+static void newDetector(MotionDetector *&detector, const Settings &) {
+	detector = new MotionDetector();
+}
+
+static void newDetector(AdaptiveDetector *&detector, const Settings &settings) {
+	detector = new AdaptiveDetector(AdaptiveDetector::MODE_TOGGLE);
+	detector->setSensitivity(settings.onSigma, settings.offSigma,
+			settings.minDelta);
+	detector->setTimeConstants(settings.baselineShift, settings.noiseShift,
+			settings.maxDipSamples);
+	detector->reset();
+}
+
+/**
+ * Runs a fresh detector of type D over the trace: once to score it, repeats times for the timing.
+ */
+template<typename D> static Result run(const char *name, const Trace &trace,
+		const Settings &settings, unsigned long window, int repeats) {
+	Result result;
+	result.trace = trace.path;
+	result.detector = name;
+	result.samples = trace.samples.size();
+	result.motions = trace.motions.size();
+	result.detected = 0;
+	result.falseTriggers = 0;
+
+	D *detector;
+	newDetector(detector, settings);
+	size_t next = 0;		// Next motion not started yet.
+	bool matched = true;	// The last motion started is detected.
+	for (unsigned long i = 0; i < trace.samples.size(); i++) {
+		while (next < trace.motions.size() && trace.motions[next] <= i) {
+			next++;
+			matched = false;
+		}
+		if (!detector->update(trace.samples[i]))
+			continue;
+		unsigned long start = next > 0 ? trace.motions[next - 1] : 0;
+		if (!matched && i - start <= window) {
+			matched = true;
+			result.detected++;
+			result.latencies.push_back(i - start);
+		} else {
+			result.falseTriggers++;
+		}
+	}
+	delete detector;
+	std::sort(result.latencies.begin(), result.latencies.end());
+
+	uint64_t total = 0;
+	for (int r = 0; r < repeats; r++) {
+		newDetector(detector, settings);
+		unsigned long detections = 0;
+		uint64_t start = cpuTime();
+		for (size_t i = 0; i < trace.samples.size(); i++)
+			detections += detector->update(trace.samples[i]);
+		total += cpuTime() - start;
+		sink = detections;
+		delete detector;
+	}
+	unsigned long runs = repeats * trace.samples.size();
+	result.cpuPerSample = runs > 0 ? (double) total / runs : 0;
+	return result;
+}
+
+/**
+ * Nearest-rank percentile of the sorted latencies.
+ */
+static unsigned long percentile(const std::vector<unsigned long> &sorted,
+		unsigned int percent) {
+	if (sorted.empty())
+		return 0;
+	size_t rank = (sorted.size() * percent + 99) / 100;
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void printCsv(const std::vector<Result> &results) {
+	printf("trace,detector,samples,motions,detected,missed,false_triggers,"
+			"latency_p50,latency_p99,latency_max," CPU_TIME_NAME "\n");
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result &result = results[i];
+		printf("%s,%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%.1f\n", result.trace,
+				result.detector, result.samples, result.motions, result.detected,
+				result.motions - result.detected, result.falseTriggers,
+				percentile(result.latencies, 50),
+				percentile(result.latencies, 99),
+				percentile(result.latencies, 100), result.cpuPerSample);
+	}
+}
+
+static void printJson(const std::vector<Result> &results) {
+	printf("[\n");
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result &result = results[i];
+		printf("  {\"trace\": \"%s\", \"detector\": \"%s\", \"samples\": %lu",
+				result.trace, result.detector, result.samples);
+		printf(", \"motions\": %lu, \"detected\": %lu, \"missed\": %lu"
+				", \"false_triggers\": %lu", result.motions, result.detected,
+				result.motions - result.detected, result.falseTriggers);
+		printf(", \"latency_p50\": %lu, \"latency_p99\": %lu, \"latency_max\": %lu",
+				percentile(result.latencies, 50),
+				percentile(result.latencies, 99),
+				percentile(result.latencies, 100));
+		printf(", \"" CPU_TIME_NAME "\": %.1f}%s\n", result.cpuPerSample,
+				i + 1 < results.size() ? "," : "");
+	}
+	printf("]\n");
+}
+
+/**
+ * Standard normal deviate, Box-Muller.
+ */
+static double gaussian() {
+	double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+	double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+	return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+/**
+ * Writes a synthetic labelled trace at 1 kHz: ambient light drifting by up to 80 counts over
+ * 40 s, a 100 Hz ripple from the mains lighting, noise of 3 counts, and every 2 to 6 s a shadow
+ * 20 to 150 counts deep, 100 to 800 ms long, with 20 to 80 ms edges.
+ */
+static void generate(unsigned long samples, unsigned int seed) {
+	srand(seed);
+	unsigned long nextMotion = 2000 + rand() % 4000;
+	unsigned long motionStart = 0, motionEdge = 0, motionLength = 0;
+	int motionDepth = 0;
+	printf("# Synthetic trace, 1 kHz, seed %u\n", seed);
+	for (unsigned long i = 0; i < samples; i++) {
+		bool start = false;
+		if (i == nextMotion) {
+			start = true;
+			motionStart = i;
+			motionEdge = 20 + rand() % 61;
+			motionLength = 100 + rand() % 701;
+			motionDepth = 20 + rand() % 131;
+			nextMotion = i + motionLength + 2000 + rand() % 4000;
+		}
+		double level = 600 + 80 * sin(2 * M_PI * i / 40000.0)
+				+ 2 * sin(2 * M_PI * i / 10.0) + 3 * gaussian();
+		unsigned long t = i - motionStart;
+		if (motionDepth > 0 && t < motionLength) {
+			double depth = motionDepth;
+			if (t < motionEdge)
+				depth *= (double) (t + 1) / motionEdge;
+			else if (motionLength - t <= motionEdge)
+				depth *= (double) (motionLength - t) / motionEdge;
+			level -= depth;
+		}
+		int sample = constrain((int) lround(level), 0, 1023);
+		if (start)
+			printf("%d,1\n", sample);
+		else
+			printf("%d\n", sample);
+	}
+}
+
+int main(int argc, char **argv) {
+	unsigned long window = 1000;
+	int repeats = 10;
+	bool json = false;
+	unsigned long generateSamples = 0;
+	unsigned int seed = 1;
+	Settings settings = { 4, 2, 8, 8, 10, 3000 };
+	std::vector<Trace> traces;
+	for (int i = 1; i < argc; i++) {
+		unsigned int a, b, c;
+		if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+			window = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			repeats = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc
+				&& sscanf(argv[i + 1], "%u,%u,%u", &a, &b, &c) == 3) {
+			settings.onSigma = a;
+			settings.offSigma = b;
+			settings.minDelta = c;
+			i++;
+		} else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc
+				&& sscanf(argv[i + 1], "%u,%u,%u", &a, &b, &c) == 3) {
+			settings.baselineShift = a;
+			settings.noiseShift = b;
+			settings.maxDipSamples = c;
+			i++;
+		} else if (strcmp(argv[i], "-J") == 0)
+			json = true;
+		else if (strcmp(argv[i], "-G") == 0 && i + 1 < argc)
+			generateSamples = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			seed = strtoul(argv[++i], NULL, 0);
+		else if (argv[i][0] != '-') {
+			traces.push_back(Trace());
+			if (!readTrace(argv[i], traces.back()))
+				return 1;
+		} else {
+			traces.clear();
+			break;
+		}
+	}
+	if (generateSamples > 0) {
+		generate(generateSamples, seed);
+		return 0;
+	}
+	if (traces.empty()) {
+		fprintf(stderr,
+				"Usage: %s [-w window] [-n repeats] [-S on,off,minDelta] [-T baseline,noise,maxDip] [-J] trace...\n"
+						"       %s -G samples [-s seed]\n", argv[0], argv[0]);
+		return 1;
+	}
+
+	std::vector<Result> results;
+	for (size_t i = 0; i < traces.size(); i++) {
+		results.push_back(
+				run<MotionDetector>("legacy", traces[i], settings, window,
+						repeats));
+		results.push_back(
+				run<AdaptiveDetector>("adaptive", traces[i], settings, window,
+						repeats));
+	}
+	if (json)
+		printJson(results);
+	else
+		printCsv(results);
+	return 0;
+}
@@ -0,0 +1,127 @@
+/**
+ * Motion Replay
+ * Runs Motion_Detector's detection on a recorded trace of sensor samples, on the host,
+ * through the same SampleRing and batches as the sketch.
+ *
+ * Build (from src/):
+ *   g++ -std=c++11 -Ihost -Ilib host/Arduino.cpp lib/AdaptiveDetector.cpp \
+ *       host/MotionReplay/MotionReplay.cpp -o motion_replay
+ * Usage:
+ *   motion_replay [-p pulseSamples] [-r rateHz] [-b samplesPerPass] [trace]
+ *   -p  Pulse mode: the output is on for that many samples from a detection. Toggles otherwise.
+ *   -r  Rate the trace was sampled at, for the times printed (default 1000).
+ *   -b  Samples taken between two passes of the processing task (default 1). More than
+ *       SAMPLE_RING_SIZE stands for a loop() held up for too long: samples are dropped.
+ *
+ * The trace is read from the file, or stdin: one sample (0 to 1023) per line, the first field
+ * of CSV lines. Lines not starting with a digit, e.g. # comments, are skipped.
+ * Output is one CSV line per detection or switch of the output, then the counts on stderr.
+ * See MotionBench to score the detection against labelled traces.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <vector>
+#include <deque>
+#include <Arduino.h>
+#include <SampleRing.h>
+#include <AdaptiveDetector.h>
+
+static const byte BATCH = 16;	// Samples processed at most per pass, as the sketch.
+
+static bool readTrace(FILE *file, std::vector<uint16_t> &trace) {
+	char line[256];
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if (!isdigit((unsigned char) line[0]))
+			continue;
+		long sample = strtol(line, NULL, 10);
+		if (sample > 1023)
+			return false;
+		trace.push_back((uint16_t) sample);
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	unsigned long pulseSamples = 0;
+	unsigned long rateHz = 1000;
+	unsigned long perPass = 1;
+	const char *path = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+			pulseSamples = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			rateHz = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+			perPass = strtoul(argv[++i], NULL, 0);
+		else if (argv[i][0] != '-' && path == NULL)
+			path = argv[i];
+		else {
+			fprintf(stderr,
+					"Usage: %s [-p pulseSamples] [-r rateHz] [-b samplesPerPass] [trace]\n",
+					argv[0]);
+			return 1;
+		}
+	}
+	if (rateHz == 0 || perPass == 0) {
+		fprintf(stderr, "The rate and samples per pass must be positive\n");
+		return 1;
+	}
+	FILE *file = path != NULL ? fopen(path, "r") : stdin;
+	if (file == NULL) {
+		fprintf(stderr, "Can't open %s\n", path);
+		return 1;
+	}
+	std::vector<uint16_t> trace;
+	bool valid = readTrace(file, trace);
+	if (file != stdin)
+		fclose(file);
+	if (!valid) {
+		fprintf(stderr, "Samples are 10 bits, 0 to 1023\n");
+		return 1;
+	}
+
+	SampleRing ring;
+	AdaptiveDetector detector(
+			pulseSamples > 0 ?
+					AdaptiveDetector::MODE_PULSE : AdaptiveDetector::MODE_TOGGLE,
+			pulseSamples);
+	unsigned long taken = 0;		// Trace samples the "interrupt" went through.
+	unsigned long processed = 0;	// Samples the detector ran on.
+	unsigned long detections = 0;
+	unsigned long dropped = 0;
+	std::deque<unsigned long> indices;	// Trace index of the samples in the ring.
+	printf("sample,time_ms,value,baseline,detected,output\n");
+	while (taken < trace.size() || ring.available() > 0) {
+		//The interrupt handler, between two passes.
+		for (unsigned long i = 0; i < perPass && taken < trace.size(); i++) {
+			if (ring.push(trace[taken]))
+				indices.push_back(taken);
+			else
+				dropped++;
+			taken++;
+		}
+		//The processing task.
+		uint16_t samples[BATCH];
+		byte count;
+		while ((count = ring.pop(samples, BATCH)) > 0) {
+			for (byte i = 0; i < count; i++) {
+				unsigned long index = indices.front();
+				indices.pop_front();
+				bool output = detector.output();
+				bool detected = detector.update(samples[i]);
+				if (detected)
+					detections++;
+				if (detected || detector.output() != output)
+					printf("%lu,%.1f,%u,%u,%d,%d\n", index, index * 1000.0 / rateHz,
+							samples[i], detector.baseline(), detected,
+							detector.output());
+			}
+			processed += count;
+		}
+	}
+	fprintf(stderr, "samples=%lu processed=%lu dropped=%lu detections=%lu\n",
+			(unsigned long) trace.size(), processed, dropped, detections);
+	return 0;
+}
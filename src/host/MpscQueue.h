@@ -0,0 +1,97 @@
+/*
+ * MpscQueue.h
+ * Bounded lock-free queue, many producer threads, one consumer thread.
+ *
+ * Each cell carries a sequence number telling whose turn it is: the producers claim a cell by
+ * moving the tail with a compare and swap, fill it, then publish it by setting its sequence;
+ * the consumer takes the cells in order once published, then hands them back to the producers
+ * one lap later. Neither side ever waits on a lock, and the memory is fixed at construction.
+ * When the queue is full tryPush() returns false: what to do then, wait or drop, is the caller's.
+ */
+#ifndef MpscQueue_h
+#define MpscQueue_h
+
+#include <stddef.h>
+#include <atomic>
+
+template<typename T, size_t CAPACITY>
+class MpscQueue {
+	static_assert((CAPACITY & (CAPACITY - 1)) == 0 && CAPACITY >= 2,
+			"CAPACITY must be a power of 2");
+
+public:
+	MpscQueue() :
+			tail(0), head(0) {
+		for (size_t i = 0; i < CAPACITY; i++)
+			cells[i].seq.store(i, std::memory_order_relaxed);
+	}
+
+	/**
+	 * Queues value, from any thread. Returns false if the queue is full.
+	 */
+	bool tryPush(const T &value) {
+		size_t pos = tail.load(std::memory_order_relaxed);
+		Cell *cell;
+		for (;;) {
+			cell = &cells[pos & (CAPACITY - 1)];
+			size_t seq = cell->seq.load(std::memory_order_acquire);
+			ptrdiff_t diff = (ptrdiff_t) seq - (ptrdiff_t) pos;
+			if (diff == 0) {
+				if (tail.compare_exchange_weak(pos, pos + 1,
+						std::memory_order_relaxed))
+					break;
+			} else if (diff < 0) {
+				return false;	// The consumer hasn't taken this cell yet.
+			} else {
+				pos = tail.load(std::memory_order_relaxed);
+			}
+		}
+		cell->value = value;
+		cell->seq.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * Takes the oldest value, from the consumer thread only. Returns false if the queue is empty.
+	 */
+	bool tryPop(T &value) {
+		size_t pos = head.load(std::memory_order_relaxed);
+		Cell *cell = &cells[pos & (CAPACITY - 1)];
+		if (cell->seq.load(std::memory_order_acquire) != pos + 1)
+			return false;
+		value = cell->value;
+		cell->seq.store(pos + CAPACITY, std::memory_order_release);
+		head.store(pos + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	/**
+	 * Values queued, from any thread. Approximate while the queue is in use.
+	 */
+	size_t size() const {
+		size_t queued = tail.load(std::memory_order_relaxed)
+				- head.load(std::memory_order_relaxed);
+		return queued > CAPACITY ? CAPACITY : queued;
+	}
+
+	static size_t capacity() {
+		return CAPACITY;
+	}
+
+private:
+	struct Cell {
+		std::atomic<size_t> seq;	// pos + 1 once filled, pos + CAPACITY once taken.
+		T value;
+	};
+
+	//Producers and consumer on separate cache lines, padded rather than aligned, so the queue can
+	//be allocated with new before C++17.
+	char padTail[64];
+	std::atomic<size_t> tail;	// Free running index of the next cell to fill.
+	char padHead[64 - sizeof(std::atomic<size_t>)];
+	std::atomic<size_t> head;	// Free running index of the next cell to take.
+	char padCells[64 - sizeof(std::atomic<size_t>)];
+	Cell cells[CAPACITY];
+};
+
+#endif /* MpscQueue_h */
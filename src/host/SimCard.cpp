@@ -0,0 +1,270 @@
+/*
+ * SimCard.cpp
+ * In-memory model of a MIFARE Classic 1K card. See SimCard.h.
+ */
+
+#include "SimCard.h"
+
+//Access conditions for data blocks, indexed by C1C2C3: read, write, increment, decrement/transfer/restore.
+static const byte dataAccess[8][4] = {
+//	read  write increment decrement
+		{ 3, 3, 3, 3 },	// 000 transport configuration
+		{ 3, 0, 0, 3 },	// 001 value block, decrement only
+		{ 3, 0, 0, 0 },	// 010 read only
+		{ 2, 2, 0, 0 },	// 011 read/write key B
+		{ 3, 2, 0, 0 },	// 100 read A|B, write key B
+		{ 2, 0, 0, 0 },	// 101 read key B
+		{ 3, 2, 2, 3 },	// 110 value block
+		{ 0, 0, 0, 0 },	// 111 locked
+		};
+
+//Access conditions for sector trailers, indexed by C1C2C3: key A write, access bits read/write, key B read/write.
+static const byte trailerAccess[8][5] = {
+//	keyA-w acc-r acc-w keyB-r keyB-w
+		{ 1, 1, 0, 1, 1 },	// 000
+		{ 1, 1, 1, 1, 1 },	// 001 transport configuration
+		{ 0, 1, 0, 1, 0 },	// 010
+		{ 2, 3, 2, 0, 2 },	// 011
+		{ 2, 3, 0, 0, 2 },	// 100
+		{ 0, 3, 2, 0, 0 },	// 101
+		{ 0, 3, 0, 0, 0 },	// 110
+		{ 0, 3, 0, 0, 0 },	// 111
+		};
+
+static const byte transportAccessBits[4] = { 0xFF, 0x07, 0x80, 0x69 };
+
+/**
+ * Checks that the inverted copies of the access bits match.
+ */
+static bool accessBitsValid(const byte *bits) {
+	return (bits[0] & 0x0F) == ((~bits[1] >> 4) & 0x0F)
+			&& (bits[0] >> 4) == ((~bits[2]) & 0x0F)
+			&& (bits[1] & 0x0F) == ((~bits[2] >> 4) & 0x0F);
+}
+
+SimCard::SimCard(const byte *uid, byte uidSize) :
+		uidSize(uidSize), sak(0x08), state(STATE_IDLE), woken(false), authSector(
+				-1), authKeyB(false), transferBuffer(0), transferAddr(0), transferValid(
+				false) {
+	memset(this->uid, 0, sizeof(this->uid));
+	memcpy(this->uid, uid, uidSize);
+	memset(blocks, 0, sizeof(blocks));
+	//Manufacturer block: UID, BCC, SAK, ATQA.
+	memcpy(blocks[0], uid, uidSize < 4 ? uidSize : 4);
+	blocks[0][4] = uid[0] ^ uid[1] ^ uid[2] ^ uid[3];
+	blocks[0][5] = sak;
+	blocks[0][6] = 0x04;
+	const byte transportKey[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+	for (byte sector = 0; sector < NUM_SECTORS; sector++)
+		setTrailer(sector, transportKey, transportAccessBits, transportKey);
+}
+
+void SimCard::setTrailer(byte sector, const byte *keyA, const byte *accessBits,
+		const byte *keyB) {
+	byte *trailer = blocks[trailerOf(sector)];
+	memcpy(trailer, keyA, 6);
+	memcpy(trailer + 6, accessBits, 4);
+	memcpy(trailer + 10, keyB, 6);
+}
+
+bool SimCard::accessBits(byte blockAddr, byte *c1c2c3) const {
+	const byte *bits = blocks[trailerOf(sectorOf(blockAddr))] + 6;
+	if (!accessBitsValid(bits))
+		return false;
+	byte b = blockAddr % 4;
+	byte c1 = (bits[1] >> (4 + b)) & 1;
+	byte c2 = (bits[2] >> b) & 1;
+	byte c3 = (bits[2] >> (4 + b)) & 1;
+	*c1c2c3 = (c1 << 2) | (c2 << 1) | c3;
+	return true;
+}
+
+bool SimCard::keyBReadable(byte sector) const {
+	byte cond;
+	if (!accessBits(trailerOf(sector), &cond))
+		return false;
+	return cond == 0 || cond == 1 || cond == 2;
+}
+
+bool SimCard::allowedBy(byte access) const {
+	if (authKeyB && keyBReadable(authSector))
+		return false;	//Key B readable: it can't be used as a key.
+	return access & (authKeyB ? ACCESS_KEY_B : ACCESS_KEY_A);
+}
+
+bool SimCard::allowed(byte blockAddr, DataOp op) const {
+	byte cond;
+	if (!accessBits(blockAddr, &cond))
+		return false;
+	return allowedBy(dataAccess[cond][op]);
+}
+
+SimCard::Result SimCard::fail(Result result) {
+	drop();
+	return result;
+}
+
+void SimCard::drop() {
+	if (state == STATE_ACTIVE)
+		state = woken ? STATE_HALT : STATE_IDLE;
+	authSector = -1;
+	transferValid = false;
+}
+
+void SimCard::halt() {
+	state = STATE_HALT;
+	woken = false;
+	authSector = -1;
+	transferValid = false;
+}
+
+SimCard::Result SimCard::checkSession(byte blockAddr) {
+	if (state != STATE_ACTIVE)
+		return RESULT_SILENT;
+	if (blockAddr >= NUM_BLOCKS || authSector != sectorOf(blockAddr))
+		return fail(RESULT_NAK);
+	return RESULT_OK;
+}
+
+SimCard::Result SimCard::authenticate(bool keyB, byte blockAddr,
+		const byte *key, const byte *uid4) {
+	if (state != STATE_ACTIVE || blockAddr >= NUM_BLOCKS)
+		return fail(RESULT_SILENT);
+	if (memcmp(uid4, uid + uidSize - 4, 4) != 0)
+		return fail(RESULT_SILENT);
+	const byte *trailer = blocks[trailerOf(sectorOf(blockAddr))];
+	if (memcmp(key, keyB ? trailer + 10 : trailer, 6) != 0)
+		return fail(RESULT_SILENT);	//The reader can't decrypt the card's answer.
+	authSector = sectorOf(blockAddr);
+	authKeyB = keyB;
+	transferValid = false;
+	return RESULT_OK;
+}
+
+SimCard::Result SimCard::read(byte blockAddr, byte *data) {
+	Result result = checkSession(blockAddr);
+	if (result != RESULT_OK)
+		return result;
+	if (blockAddr != trailerOf(sectorOf(blockAddr))) {
+		if (!allowed(blockAddr, OP_READ))
+			return fail(RESULT_NAK);
+		memcpy(data, blocks[blockAddr], 16);
+		return RESULT_OK;
+	}
+	//Key A is never readable. Access bits and Key B as the access conditions allow.
+	byte cond;
+	accessBits(blockAddr, &cond);
+	memset(data, 0, 16);
+	if (allowedBy(trailerAccess[cond][1]))
+		memcpy(data + 6, blocks[blockAddr] + 6, 4);
+	if (allowedBy(trailerAccess[cond][3]))
+		memcpy(data + 10, blocks[blockAddr] + 10, 6);
+	return RESULT_OK;
+}
+
+SimCard::Result SimCard::write(byte blockAddr, const byte *data) {
+	Result result = checkSession(blockAddr);
+	if (result != RESULT_OK)
+		return result;
+	if (blockAddr == 0)
+		return fail(RESULT_NAK);	//Manufacturer block.
+	if (blockAddr != trailerOf(sectorOf(blockAddr))) {
+		if (!allowed(blockAddr, OP_WRITE))
+			return fail(RESULT_NAK);
+		memcpy(blocks[blockAddr], data, 16);
+		return RESULT_OK;
+	}
+	byte cond;
+	accessBits(blockAddr, &cond);
+	byte *trailer = blocks[blockAddr];
+	//Every part being changed must be writable with the current key.
+	if (memcmp(trailer, data, 6) != 0 && !allowedBy(trailerAccess[cond][0]))
+		return fail(RESULT_NAK);
+	if (memcmp(trailer + 6, data + 6, 4) != 0
+			&& !allowedBy(trailerAccess[cond][2]))
+		return fail(RESULT_NAK);
+	if (memcmp(trailer + 10, data + 10, 6) != 0
+			&& !allowedBy(trailerAccess[cond][4]))
+		return fail(RESULT_NAK);
+	//A real card would lock the sector for good. Refuse instead, the simulator is for finding such bugs.
+	if (!accessBitsValid(data + 6))
+		return fail(RESULT_NAK);
+	memcpy(trailer, data, 16);
+	return RESULT_OK;
+}
+
+SimCard::Result SimCard::increment(byte blockAddr, int32_t delta) {
+	Result result = checkSession(blockAddr);
+	if (result != RESULT_OK)
+		return result;
+	int32_t value;
+	if (!allowed(blockAddr, OP_INCREMENT) || !getValueBlock(blockAddr, &value))
+		return fail(RESULT_NAK);
+	transferBuffer = value + delta;
+	transferAddr = blocks[blockAddr][12];
+	transferValid = true;
+	return RESULT_OK;
+}
+
+SimCard::Result SimCard::decrement(byte blockAddr, int32_t delta) {
+	Result result = checkSession(blockAddr);
+	if (result != RESULT_OK)
+		return result;
+	int32_t value;
+	if (!allowed(blockAddr, OP_DECREMENT) || !getValueBlock(blockAddr, &value))
+		return fail(RESULT_NAK);
+	transferBuffer = value - delta;
+	transferAddr = blocks[blockAddr][12];
+	transferValid = true;
+	return RESULT_OK;
+}
+
+SimCard::Result SimCard::restore(byte blockAddr) {
+	return decrement(blockAddr, 0);
+}
+
+SimCard::Result SimCard::transfer(byte blockAddr) {
+	Result result = checkSession(blockAddr);
+	if (result != RESULT_OK)
+		return result;
+	if (!transferValid || blockAddr == trailerOf(sectorOf(blockAddr))
+			|| !allowed(blockAddr, OP_DECREMENT))
+		return fail(RESULT_NAK);
+	setValueBlock(blockAddr, transferBuffer);
+	byte *block = blocks[blockAddr];
+	block[12] = block[14] = transferAddr;
+	block[13] = block[15] = ~transferAddr;
+	transferValid = false;
+	return RESULT_OK;
+}
+
+void SimCard::setValueBlock(byte blockAddr, int32_t value) {
+	byte *block = blocks[blockAddr];
+	for (byte i = 0; i < 4; i++) {
+		block[i] = block[8 + i] = (value >> (8 * i)) & 0xFF;
+		block[4 + i] = ~block[i];
+	}
+	block[12] = block[14] = blockAddr;
+	block[13] = block[15] = ~blockAddr;
+}
+
+bool SimCard::getValueBlock(byte blockAddr, int32_t *value) const {
+	const byte *block = blocks[blockAddr];
+	for (byte i = 0; i < 4; i++) {
+		if (block[i] != block[8 + i] || block[i] != (byte) ~block[4 + i])
+			return false;
+	}
+	if (block[12] != block[14] || block[12] != (byte) ~block[13]
+			|| block[12] != (byte) ~block[15])
+		return false;
+	*value = (int32_t) ((uint32_t) block[0] | ((uint32_t) block[1] << 8)
+			| ((uint32_t) block[2] << 16) | ((uint32_t) block[3] << 24));
+	return true;
+}
+
+void SimCard::corrupt(byte blockAddr, uint32_t seed) {
+	for (byte i = 0; i < 16; i++) {
+		seed = seed * 1103515245UL + 12345UL;
+		blocks[blockAddr][i] = seed >> 16;
+	}
+}
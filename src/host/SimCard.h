@@ -0,0 +1,125 @@
+/*
+ * SimCard.h
+ * In-memory model of a MIFARE Classic 1K card for the host-side simulator.
+ *
+ * The card keeps 64 blocks of 16 bytes. Sector trailers hold Key A, the access bits and Key B,
+ * and every command is checked against the access conditions of the addressed block
+ * in the same way the card does it (NXP MF1S50YYX, section 8.7):
+ * - Authentication with Key A or Key B against the sector trailer.
+ * - Read/Write/Increment/Decrement/Restore/Transfer permissions per block.
+ * - Value block format checks for the value commands.
+ * A failed command (NAK or no answer) drops the card back to the IDLE state, as on real cards.
+ * A card woken up from HALT by WUPA goes back to HALT instead (the READY* and ACTIVE* states).
+ */
+#ifndef SimCard_h
+#define SimCard_h
+
+#include <Arduino.h>
+
+class SimCard {
+public:
+	static const byte NUM_SECTORS = 16;
+	static const byte NUM_BLOCKS = 64;
+
+	//Result of a command sent to the card.
+	enum Result
+		: byte {
+			RESULT_OK,		// Command executed.
+		RESULT_NAK,			// Card answered with a NAK.
+		RESULT_SILENT,		// Card did not answer.
+	};
+
+	//State of the card in the field.
+	enum State
+		: byte {
+			STATE_IDLE,		// Answers REQA and WUPA.
+		STATE_HALT,			// Answers WUPA only.
+		STATE_ACTIVE,		// Selected.
+	};
+
+	/**
+	 * Creates a card in factory state: transport keys FFFFFFFFFFFFh and access bits FF 07 80 69.
+	 */
+	SimCard(const byte *uid, byte uidSize);
+
+	//Commands as sent by the reader.
+	Result authenticate(bool keyB, byte blockAddr, const byte *key,
+			const byte *uid4);
+	Result read(byte blockAddr, byte *data);
+	Result write(byte blockAddr, const byte *data);
+	Result increment(byte blockAddr, int32_t delta);
+	Result decrement(byte blockAddr, int32_t delta);
+	Result restore(byte blockAddr);
+	Result transfer(byte blockAddr);
+	void halt();
+
+	/**
+	 * Stops the crypto session (the reader stopped encrypting).
+	 */
+	void stopCrypto() {
+		authSector = -1;
+	}
+
+	/**
+	 * Puts the card in IDLE state, HALT if woken. A failed or torn command does the same.
+	 */
+	void drop();
+
+	//Direct access to the card image, for setting up and inspecting test cards.
+	byte *block(byte blockAddr) {
+		return blocks[blockAddr];
+	}
+	void setValueBlock(byte blockAddr, int32_t value);
+	bool getValueBlock(byte blockAddr, int32_t *value) const;
+
+	/**
+	 * Writes a sector trailer without any access check.
+	 */
+	void setTrailer(byte sector, const byte *keyA, const byte *accessBits,
+			const byte *keyB);
+
+	/**
+	 * Fills the given block with garbage, as a write torn by leaving the field may do.
+	 */
+	void corrupt(byte blockAddr, uint32_t seed);
+
+	static byte sectorOf(byte blockAddr) {
+		return blockAddr / 4;
+	}
+	static byte trailerOf(byte sector) {
+		return sector * 4 + 3;
+	}
+
+	byte uid[10];
+	byte uidSize;
+	byte sak;
+	State state;
+	bool woken;			// Woken up from HALT by WUPA, goes back to HALT.
+
+private:
+	enum Access
+		: byte {
+			ACCESS_NEVER = 0, ACCESS_KEY_A = 1, ACCESS_KEY_B = 2, ACCESS_KEY_AB = 3,
+	};
+	//Permissions of a data block.
+	enum DataOp
+		: byte {
+			OP_READ, OP_WRITE, OP_INCREMENT, OP_DECREMENT,
+	};
+
+	bool accessBits(byte blockAddr, byte *c1c2c3) const;
+	bool keyBReadable(byte sector) const;
+	bool allowed(byte blockAddr, DataOp op) const;
+	bool allowedBy(byte access) const;
+	Result fail(Result result);
+	Result checkSession(byte blockAddr);
+
+	byte blocks[NUM_BLOCKS][16];
+	int authSector;				// Authenticated sector or -1.
+	bool authKeyB;				// Key used for the authenticated sector.
+	int32_t transferBuffer;		// Internal value register used by Increment/Decrement/Restore.
+	byte transferAddr;			// Address bytes of the block loaded into the value register.
+	bool transferValid;
+};
+
+#endif /* SimCard_h */
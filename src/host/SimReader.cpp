@@ -0,0 +1,164 @@
+/*
+ * SimReader.cpp
+ * The RF field of a simulated MFRC522 reader. See SimReader.h.
+ */
+
+#include "SimReader.h"
+
+static const char *const commandNames[SimReader::CMD_COUNT] = { "request",
+		"select", "authenticate", "read", "write", "get_value", "set_value",
+		"increment", "decrement", "restore", "transfer", "halt" };
+
+SimReader::SimReader() :
+		numCards(0), selected(NULL), rng(0), seeded(false), antenna(true), fieldSince(
+				0), poweredAt(0) {
+	latency.requestUs = 600;
+	latency.selectUs = 1800;
+	latency.authUs = 3500;
+	latency.readUs = 1200;
+	latency.writeUs = 5000;
+	latency.valueUs = 1500;
+	latency.transferUs = 4000;
+	latency.haltUs = 500;
+	latency.perByteUs = 90;
+	latency.timeoutUs = 25000;
+	latency.powerUpUs = 5000;
+	errors.failurePerMille = 0;
+	errors.tearAfter = -1;
+	errors.corruptOnTear = false;
+	errors.seed = 1;
+	for (byte i = 0; i < MAX_CARDS; i++)
+		field[i] = NULL;
+	resetStats();
+}
+
+SimReader &SimReader::forPin(byte chipSelectPin) {
+	static SimReader readers[MAX_READERS];
+	static byte pins[MAX_READERS];
+	static byte numReaders = 0;
+	for (byte i = 0; i < numReaders; i++) {
+		if (pins[i] == chipSelectPin)
+			return readers[i];
+	}
+	if (numReaders == MAX_READERS)
+		return readers[MAX_READERS - 1];
+	pins[numReaders] = chipSelectPin;
+	return readers[numReaders++];
+}
+
+const char *SimReader::commandName(Command cmd) {
+	return cmd < CMD_COUNT ? commandNames[cmd] : "unknown";
+}
+
+bool SimReader::placeCard(SimCard *card) {
+	if (numCards == MAX_CARDS)
+		return false;
+	card->state = SimCard::STATE_IDLE;
+	card->woken = false;
+	card->stopCrypto();
+	field[numCards++] = card;
+	return true;
+}
+
+void SimReader::removeCard(SimCard *card) {
+	for (byte i = 0; i < numCards; i++) {
+		if (field[i] == card) {
+			field[i] = field[--numCards];
+			field[numCards] = NULL;
+			break;
+		}
+	}
+	//Leaving the field powers the card down.
+	card->drop();
+	card->state = SimCard::STATE_IDLE;
+	card->woken = false;
+	if (selected == card)
+		selected = NULL;
+}
+
+void SimReader::removeAll() {
+	while (numCards > 0)
+		removeCard(field[0]);
+}
+
+void SimReader::setAntenna(bool on) {
+	if (on == antenna)
+		return;
+	antenna = on;
+	if (on) {
+		fieldSince = simMicros();
+		poweredAt = fieldSince + latency.powerUpUs;
+		return;
+	}
+	stats.fieldUs += simMicros() - fieldSince;
+	for (byte i = 0; i < numCards; i++) {
+		field[i]->drop();
+		field[i]->state = SimCard::STATE_IDLE;
+		field[i]->woken = false;
+	}
+	selected = NULL;
+}
+
+uint64_t SimReader::fieldOnUs() const {
+	return stats.fieldUs + (antenna ? simMicros() - fieldSince : 0);
+}
+
+void SimReader::resetStats() {
+	memset(&stats, 0, sizeof(stats));
+	fieldSince = simMicros();
+}
+
+unsigned long SimReader::totalCalls() const {
+	unsigned long total = 0;
+	for (byte i = 0; i < CMD_COUNT; i++)
+		total += stats.calls[i];
+	return total;
+}
+
+bool SimReader::random(uint16_t perMille) {
+	if (!seeded) {
+		rng = errors.seed;
+		seeded = true;
+	}
+	rng = rng * 1103515245UL + 12345UL;
+	return ((rng >> 16) % 1000) < perMille;
+}
+
+bool SimReader::transmit(Command cmd, unsigned long baseUs, byte bytesOnAir,
+		byte blockAddr) {
+	stats.calls[cmd]++;
+	if (errors.tearAfter >= 0 && selected != NULL) {
+		if (errors.tearAfter == 0) {
+			errors.tearAfter = -1;
+			if (errors.corruptOnTear
+					&& (cmd == CMD_WRITE || cmd == CMD_SET_VALUE
+							|| cmd == CMD_TRANSFER))
+				selected->corrupt(blockAddr, errors.seed);
+			removeCard(selected);
+			failed(cmd, true);
+			return false;
+		}
+		errors.tearAfter--;
+	}
+	if (errors.failurePerMille > 0 && random(errors.failurePerMille)) {
+		if (selected != NULL)
+			selected->drop();
+		failed(cmd, true);
+		return false;
+	}
+	unsigned long us = baseUs + latency.perByteUs * bytesOnAir;
+	simAdvanceMicros(us);
+	stats.busyUs += us;
+	stats.bytesOnAir += bytesOnAir;
+	stats.spiBytes += SPI_SETUP_BYTES + bytesOnAir + 2 * (us / SPI_POLL_US);
+	return true;
+}
+
+void SimReader::failed(Command cmd, bool silent) {
+	stats.failures[cmd]++;
+	if (silent) {
+		simAdvanceMicros(latency.timeoutUs);
+		stats.busyUs += latency.timeoutUs;
+		stats.spiBytes += SPI_SETUP_BYTES + 2 * (latency.timeoutUs / SPI_POLL_US);
+	}
+}
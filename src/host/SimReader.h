@@ -0,0 +1,168 @@
+/*
+ * SimReader.h
+ * The RF field of a simulated MFRC522 reader: the cards placed on it, the latency model,
+ * the error injection model and the command counters.
+ *
+ * Readers are looked up by their SS pin, so every MFRC522 object (and every copy of one)
+ * constructed with the same pin talks to the same field and shares the same counters.
+ */
+#ifndef SimReader_h
+#define SimReader_h
+
+#include <Arduino.h>
+#include "SimCard.h"
+
+/**
+ * Time taken by each command, from the reader writing it into the FIFO to the answer being read back.
+ * The defaults approximate an MFRC522 on a 4 MHz SPI bus talking to a MIFARE Classic card at 106 kBd.
+ */
+typedef struct {
+	unsigned long requestUs;	// REQA/WUPA.
+	unsigned long selectUs;		// Anticollision and select.
+	unsigned long authUs;		// Three pass authentication.
+	unsigned long readUs;		// Read.
+	unsigned long writeUs;		// Both write phases, including EEPROM programming on the card.
+	unsigned long valueUs;		// Increment/Decrement/Restore.
+	unsigned long transferUs;	// Transfer, including EEPROM programming on the card.
+	unsigned long haltUs;		// HLTA.
+	unsigned long perByteUs;	// Per byte on air, both directions.
+	unsigned long timeoutUs;	// Time the reader waits for a card that doesn't answer.
+	unsigned long powerUpUs;	// Time the cards take to answer once the field is switched on.
+} SimLatencyModel;
+
+/**
+ * Error injection. Deterministic for a given seed.
+ */
+typedef struct {
+	uint16_t failurePerMille;	// Chance of a command getting no answer, in 1/1000.
+	long tearAfter;				// The card leaves the field on this command (0 = next one). -1 for never.
+	bool corruptOnTear;			// A torn write leaves garbage in the block instead of the old data.
+	uint32_t seed;				// Seed for the failure generator.
+} SimErrorModel;
+
+class SimReader {
+public:
+	//Commands counted by the reader.
+	enum Command
+		: byte {
+			CMD_REQUEST,
+		CMD_SELECT,
+		CMD_AUTHENTICATE,
+		CMD_READ,
+		CMD_WRITE,
+		CMD_GET_VALUE,
+		CMD_SET_VALUE,
+		CMD_INCREMENT,
+		CMD_DECREMENT,
+		CMD_RESTORE,
+		CMD_TRANSFER,
+		CMD_HALT,
+		CMD_COUNT,
+	};
+
+	//Command counters.
+	typedef struct {
+		unsigned long calls[CMD_COUNT];		// Commands sent.
+		unsigned long failures[CMD_COUNT];	// Commands that got a NAK or no answer.
+		unsigned long bytesOnAir;			// Bytes exchanged with the card, both directions.
+		unsigned long busyUs;				// Time spent on RF commands.
+		unsigned long spiBytes;				// Bytes between the controller and the MFRC522, estimated.
+		unsigned long fieldUs;				// Time the field was on, up to its last switch off.
+	} Stats;
+
+	/*
+	 * SPI traffic model. Every command sets up the MFRC522 (command, IRQ, FIFO flush, framing and
+	 * start registers, then error and FIFO level reads), moves its bytes through the FIFO, and polls
+	 * the IRQ register until the card answers or the reader gives up.
+	 */
+	static const byte SPI_SETUP_BYTES = 20;			// Register accesses around a command, 2 bytes each.
+	static const unsigned long SPI_POLL_US = 20;	// Time between two 2 byte polls of the IRQ register.
+
+	static const byte MAX_READERS = 8;
+	static const byte MAX_CARDS = 4;
+
+	/**
+	 * Returns the field of the reader wired to the given SS pin.
+	 */
+	static SimReader &forPin(byte chipSelectPin);
+
+	/**
+	 * Returns the name of a command, for reports.
+	 */
+	static const char *commandName(Command cmd);
+
+	/**
+	 * Puts a card on the reader. It answers the next REQA.
+	 */
+	bool placeCard(SimCard *card);
+
+	/**
+	 * Takes the card away from the reader.
+	 */
+	void removeCard(SimCard *card);
+	void removeAll();
+
+	/**
+	 * Switches the RF field on or off (PCD_AntennaOn()/PCD_AntennaOff()). The cards lose power
+	 * with the field, their HALT state and session with it.
+	 */
+	void setAntenna(bool on);
+
+	bool antennaOn() const {
+		return antenna;
+	}
+
+	/**
+	 * Whether the cards in the field are powered up, and answer commands.
+	 */
+	bool powered() const {
+		return antenna && simMicros() >= poweredAt;
+	}
+
+	/**
+	 * Time the field has been on since the last resetStats(), in microseconds.
+	 */
+	uint64_t fieldOnUs() const;
+
+	/**
+	 * Resets the counters.
+	 */
+	void resetStats();
+
+	/**
+	 * Total number of commands sent since the last resetStats().
+	 */
+	unsigned long totalCalls() const;
+
+	SimLatencyModel latency;
+	SimErrorModel errors;
+	Stats stats;
+
+	SimCard *field[MAX_CARDS];	// Cards in the field.
+	byte numCards;
+	SimCard *selected;			// Card selected by the last PICC_Select, if still in the field.
+
+	/**
+	 * Accounts for a command: counts it, advances the virtual clock and injects errors.
+	 * Returns false if the command is lost, in which case the caller must report STATUS_TIMEOUT.
+	 */
+	bool transmit(Command cmd, unsigned long baseUs, byte bytesOnAir,
+			byte blockAddr = 0);
+
+	/**
+	 * Accounts for a command that failed on the card.
+	 */
+	void failed(Command cmd, bool silent);
+
+private:
+	SimReader();
+	bool random(uint16_t perMille);
+
+	uint32_t rng;
+	bool seeded;
+	bool antenna;
+	uint64_t fieldSince;	// simMicros() the field was switched on, or the counters reset.
+	uint64_t poweredAt;		// simMicros() the cards answer from.
+};
+
+#endif /* SimReader_h */
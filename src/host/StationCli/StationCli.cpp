@@ -0,0 +1,232 @@
+/**
+ * Station CLI
+ * Drives a Load_Points station over its serial port with the binary command protocol
+ * (see CommandFrame.h), from the command line or a script.
+ *
+ * Build (from src/):
+ *   g++ -std=c++11 -Ihost -Ilib lib/CommandFrame.cpp host/StationClient.cpp \
+ *       host/StationCli/StationCli.cpp -o station_cli
+ * Usage:
+ *   station_cli -p port [-b baud] [-t timeoutMs] [-v] [command]
+ *   -p  Serial port of the station, e.g. /dev/ttyUSB0.
+ *   -b  Baud rate (default 9600).
+ *   -t  Time to wait for a result, in ms, after the last request (default: no limit).
+ *   -v  Echo the text the station prints, and the acknowledgements, on stderr.
+ * Commands, given as arguments for a single one, or one per line on stdin:
+ *   configure POINTS [CARDS]
+ *   recharge POINTS [CARDS]
+ *   balance [CARDS]
+ *   reset POINTS [CARDS]
+ *   status [CARDS]
+ *   ping
+ *   cancel
+ * CARDS is how many cards the operation is done on (default 1), 0 for every card until
+ * interrupted. The operations are sent at once, queued by the station for the next cards tapped,
+ * e.g. a till can send "recharge 50" as soon as a customer pays and tap the cards as fast as they come.
+ * Lines starting with # are skipped.
+ *
+ * Output is one CSV line per card, as the results come:
+ *   id,operation,code,mfrc522_status,uid,points,cards_left
+ * code is the CardUtil::StatusCode, 0 on success. A failed card doesn't count: the operation
+ * stays queued for the next one. The CLI exits once every operation is done on its cards, or on
+ * Ctrl-C, which cancels what is left. Exit status is 1 if a request got no acknowledgement,
+ * or was refused.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <map>
+#include <string>
+#include <StationClient.h>
+
+static const char *const operationNames[] = { "", "configure", "recharge",
+		"balance", "reset", "status" };
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void onInterrupt(int) {
+	interrupted = 1;
+}
+
+/**
+ * Prints a result, and forgets the operation once done on its cards.
+ */
+static void printResult(const StationClient::Response &result,
+		std::map<uint16_t, uint16_t> &pending) {
+	printf("%u,%s,%u,%u,%08lX,%ld,%u\n", result.id,
+			result.request <= CommandFrame::OP_STATUS ?
+					operationNames[result.request] : "?", result.code,
+			result.mfrc522Status, (unsigned long) result.uid,
+			(long) result.points, result.cards);
+	fflush(stdout);
+	std::map<uint16_t, uint16_t>::iterator it = pending.find(result.id);
+	if (it != pending.end() && it->second != 0 && result.code == 0
+			&& result.cards == 0)
+		pending.erase(it);
+}
+
+/**
+ * Parses a command. Returns false if it isn't one.
+ */
+static bool parse(char *line, byte *opcode, int32_t *points, uint16_t *cards) {
+	char *words[4];
+	int count = 0;
+	for (char *word = strtok(line, " \t\r\n"); word != NULL && count < 4;
+			word = strtok(NULL, " \t\r\n"))
+		words[count++] = word;
+	if (count == 0)
+		return false;
+	*opcode = 0;
+	for (byte op = CommandFrame::OP_CONFIGURE; op <= CommandFrame::OP_STATUS;
+			op++)
+		if (strcmp(words[0], operationNames[op]) == 0)
+			*opcode = op;
+	if (strcmp(words[0], "ping") == 0)
+		*opcode = CommandFrame::OP_PING;
+	else if (strcmp(words[0], "cancel") == 0)
+		*opcode = CommandFrame::OP_CANCEL;
+	if (*opcode == 0)
+		return false;
+	bool needsPoints = *opcode == CommandFrame::OP_CONFIGURE
+			|| *opcode == CommandFrame::OP_RECHARGE
+			|| *opcode == CommandFrame::OP_RESET;
+	bool takesCards = *opcode <= CommandFrame::OP_STATUS;
+	int arg = 1;
+	*points = 0;
+	*cards = 1;
+	if (needsPoints) {
+		if (count < 2)
+			return false;
+		*points = atol(words[arg++]);
+	}
+	if (takesCards && arg < count)
+		*cards = atoi(words[arg++]);
+	return arg == count;
+}
+
+int main(int argc, char **argv) {
+	const char *port = NULL;
+	unsigned long baud = 9600;
+	long timeoutMs = -1;
+	bool verbose = false;
+	int first = argc;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+			port = argv[++i];
+		else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+			baud = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			timeoutMs = atol(argv[++i]);
+		else if (strcmp(argv[i], "-v") == 0)
+			verbose = true;
+		else if (argv[i][0] != '-') {
+			first = i;
+			break;
+		} else {
+			port = NULL;
+			break;
+		}
+	}
+	if (port == NULL) {
+		fprintf(stderr,
+				"Usage: %s -p port [-b baud] [-t timeoutMs] [-v] [command]\n",
+				argv[0]);
+		return 1;
+	}
+	StationClient station;
+	if (!station.open(port, baud)) {
+		fprintf(stderr, "Can't open %s at %lu baud\n", port, baud);
+		return 1;
+	}
+	if (verbose)
+		station.setEcho(stderr);
+	signal(SIGINT, onInterrupt);
+
+	//The station may be starting, the port being just opened.
+	StationClient::Response response;
+	if (!station.request(CommandFrame::OP_PING, 0, 0, response, 1000, 5)) {
+		fprintf(stderr, "No answer from the station\n");
+		return 1;
+	}
+
+	std::map<uint16_t, uint16_t> pending;	// Cards left per operation id, 0 for every card.
+	int status = 0;
+	char line[256];
+	std::string joined;
+	for (int i = first; i < argc; i++)
+		joined += std::string(argv[i]) + " ";
+	bool fromArgs = first < argc;
+	printf("id,operation,code,mfrc522_status,uid,points,cards_left\n");
+	fflush(stdout);
+	while (!interrupted) {
+		if (fromArgs) {
+			if (joined.empty())
+				break;
+			strncpy(line, joined.c_str(), sizeof(line) - 1);
+			line[sizeof(line) - 1] = '\0';
+			joined.clear();
+		} else if (fgets(line, sizeof(line), stdin) == NULL) {
+			break;
+		}
+		if (line[0] == '#')
+			continue;
+		byte opcode;
+		int32_t points;
+		uint16_t cards;
+		if (!parse(line, &opcode, &points, &cards)) {
+			if (strspn(line, " \t\r\n") != strlen(line)) {
+				fprintf(stderr, "Not a command: %s\n", line);
+				status = 1;
+			}
+			continue;
+		}
+		uint16_t id = station.nextId();
+		//A full queue empties as cards are tapped: wait for the results meanwhile.
+		bool acked;
+		while ((acked = station.request(opcode, points, cards, response))
+				&& response.ackCode == CommandFrame::ACK_QUEUE_FULL
+				&& !interrupted) {
+			StationClient::Response result;
+			while (station.receive(result, 1000))
+				printResult(result, pending);
+			id = station.nextId();
+		}
+		if (!acked || (response.ackCode != CommandFrame::ACK_QUEUED
+				&& response.ackCode != CommandFrame::ACK_DONE)) {
+			fprintf(stderr, "Request %u %s\n", id,
+					acked ? "refused" : "not acknowledged");
+			status = 1;
+			continue;
+		}
+		if (verbose)
+			fprintf(stderr, "Request %u acknowledged, %u queued\n", id,
+					response.queued);
+		if (opcode == CommandFrame::OP_CANCEL)
+			pending.clear();
+		else if (response.ackCode == CommandFrame::ACK_QUEUED)
+			pending[id] = cards;
+		StationClient::Response result;
+		while (station.receive(result, 0))
+			printResult(result, pending);
+	}
+
+	//The results of the operations sent.
+	while (!pending.empty() && !interrupted) {
+		StationClient::Response result;
+		if (!station.receive(result, timeoutMs >= 0 ? timeoutMs : 1000)) {
+			if (timeoutMs >= 0) {
+				fprintf(stderr, "No result for %lu operations\n",
+						(unsigned long) pending.size());
+				status = 1;
+				break;
+			}
+			continue;
+		}
+		printResult(result, pending);
+	}
+	if (interrupted && !pending.empty())
+		station.request(CommandFrame::OP_CANCEL, 0, 0, response);
+	return status;
+}
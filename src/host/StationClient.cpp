@@ -0,0 +1,211 @@
+/*
+ * StationClient.cpp
+ * Host side of the binary command protocol. See StationClient.h.
+ */
+
+#include "StationClient.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <Log.h>
+
+static unsigned long nowMs() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000UL + now.tv_nsec / 1000000;
+}
+
+static speed_t toSpeed(unsigned long baud) {
+	switch (baud) {
+	case 9600:
+		return B9600;
+	case 19200:
+		return B19200;
+	case 38400:
+		return B38400;
+	case 57600:
+		return B57600;
+	case 115200:
+		return B115200;
+	default:
+		return B0;
+	}
+}
+
+StationClient::StationClient() :
+		inFd(-1), outFd(-1), owned(false), echo(NULL), id(1), parser(
+				CommandFrame::RESPONSE_SYNC), skip(0) {
+}
+
+StationClient::~StationClient() {
+	close();
+}
+
+bool StationClient::open(const char *path, unsigned long baud) {
+	close();
+	speed_t speed = toSpeed(baud);
+	if (speed == B0)
+		return false;
+	int fd = ::open(path, O_RDWR | O_NOCTTY);
+	if (fd < 0)
+		return false;
+	if (isatty(fd)) {
+		struct termios tio;
+		if (tcgetattr(fd, &tio) != 0) {
+			::close(fd);
+			return false;
+		}
+		cfmakeraw(&tio);
+		cfsetispeed(&tio, speed);
+		cfsetospeed(&tio, speed);
+		tio.c_cflag |= CLOCAL | CREAD;
+		tio.c_cc[VMIN] = 0;
+		tio.c_cc[VTIME] = 0;
+		if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+			::close(fd);
+			return false;
+		}
+		tcflush(fd, TCIOFLUSH);
+	}
+	inFd = outFd = fd;
+	owned = true;
+	return true;
+}
+
+void StationClient::attach(int inFd, int outFd) {
+	close();
+	this->inFd = inFd;
+	this->outFd = outFd;
+}
+
+void StationClient::close() {
+	if (owned)
+		::close(inFd);
+	inFd = outFd = -1;
+	owned = false;
+	parser.reset();
+	skip = 0;
+	results.clear();
+}
+
+bool StationClient::request(byte opcode, int32_t points, uint16_t cards,
+		Response &ack, unsigned long timeoutMs, int retries) {
+	byte payload[CommandFrame::CARD_PAYLOAD];
+	byte length = 0;
+	if (opcode >= CommandFrame::OP_CONFIGURE
+			&& opcode <= CommandFrame::OP_STATUS) {
+		CommandFrame::put16(
+				CommandFrame::put32(payload, (uint32_t) points), cards);
+		length = CommandFrame::CARD_PAYLOAD;
+	}
+	byte frame[CommandFrame::MAX_FRAME_SIZE];
+	uint16_t requestId = id++;
+	byte size = CommandFrame::encode(frame, CommandFrame::REQUEST_SYNC, opcode,
+			requestId, payload, length);
+	for (int attempt = 0; attempt <= retries; attempt++) {
+		if (!write(frame, size))
+			return false;
+		unsigned long deadline = nowMs() + timeoutMs;
+		unsigned long now;
+		while ((now = nowMs()) < deadline) {
+			Response response;
+			if (!read(response, deadline - now))
+				break;
+			if (response.opcode == CommandFrame::OP_RESULT)
+				results.push_back(response);
+			else if (response.id == requestId) {
+				ack = response;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+bool StationClient::receive(Response &result, unsigned long timeoutMs) {
+	unsigned long deadline = nowMs() + timeoutMs;
+	while (results.empty()) {
+		unsigned long now = nowMs();
+		Response response;
+		if (!read(response, now < deadline ? deadline - now : 0))
+			return false;
+		//Acknowledgements of requests given up on are dropped.
+		if (response.opcode == CommandFrame::OP_RESULT)
+			results.push_back(response);
+	}
+	result = results.front();
+	results.pop_front();
+	return true;
+}
+
+/**
+ * Reads the next response frame, skipping the rest.
+ */
+bool StationClient::read(Response &response, unsigned long timeoutMs) {
+	unsigned long deadline = nowMs() + timeoutMs;
+	for (;;) {
+		unsigned long now = nowMs();
+		struct pollfd pfd = { inFd, POLLIN, 0 };
+		int ready = poll(&pfd, 1, now < deadline ? deadline - now : 0);
+		if (ready < 0 && errno == EINTR)
+			continue;
+		if (ready <= 0)
+			return false;
+		byte c;
+		ssize_t n = ::read(inFd, &c, 1);
+		if (n < 0 && (errno == EAGAIN || errno == EINTR))
+			continue;
+		if (n <= 0)
+			return false;	// Closed.
+		if (skip > 0) {
+			skip--;
+			continue;
+		}
+		if (!parser.receiving() && c == Log::FRAME_SYNC) {
+			skip = Log::FRAME_SIZE - 1;
+			continue;
+		}
+		bool receiving = parser.receiving() || c == CommandFrame::RESPONSE_SYNC;
+		if (parser.feed(c)) {
+			const byte *payload = parser.payload();
+			memset(&response, 0, sizeof(response));
+			response.opcode = parser.opcode();
+			response.id = parser.id();
+			if (response.opcode == CommandFrame::OP_ACK
+					&& parser.length() == CommandFrame::ACK_PAYLOAD) {
+				response.ackCode = payload[0];
+				response.queued = payload[1];
+				return true;
+			}
+			if (response.opcode == CommandFrame::OP_RESULT
+					&& parser.length() == CommandFrame::RESULT_PAYLOAD) {
+				response.request = payload[0];
+				response.code = payload[1];
+				response.mfrc522Status = payload[2];
+				response.uid = CommandFrame::get32(payload + 3);
+				response.points = (int32_t) CommandFrame::get32(payload + 7);
+				response.cards = CommandFrame::get16(payload + 11);
+				return true;
+			}
+		} else if (!receiving && echo != NULL) {
+			fputc(c, echo);
+		}
+	}
+}
+
+bool StationClient::write(const byte *data, size_t size) {
+	while (size > 0) {
+		ssize_t n = ::write(outFd, data, size);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		data += n;
+		size -= n;
+	}
+	return true;
+}
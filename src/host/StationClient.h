@@ -0,0 +1,92 @@
+/*
+ * StationClient.h
+ * Host side of the binary command protocol (see CommandFrame.h): drives a loading station
+ * over its serial port, or any pair of file descriptors.
+ *
+ * Operations can be sent ahead of the cards: request() only waits for the OP_ACK, sending the
+ * request again with the same id when none comes. The OP_RESULT frames, one per card, are
+ * taken with receive(), those coming in while waiting for an acknowledgement are kept for it.
+ * Log's event frames and the text the station prints are skipped, or echoed with setEcho().
+ */
+#ifndef StationClient_h
+#define StationClient_h
+
+#include <stdio.h>
+#include <deque>
+#include <CommandFrame.h>
+
+class StationClient {
+public:
+	/**
+	 * A response: OP_ACK or OP_RESULT.
+	 */
+	typedef struct {
+		byte opcode;
+		uint16_t id;			// Id of the request.
+		byte ackCode;			// OP_ACK: CommandFrame::AckCode.
+		byte queued;			// OP_ACK: operations queued on the station.
+		byte request;			// OP_RESULT: opcode of the request.
+		byte code;				// OP_RESULT: CardUtil::StatusCode.
+		byte mfrc522Status;		// OP_RESULT: MFRC522::StatusCode.
+		uint32_t uid;			// OP_RESULT: UID, as Log::packUid().
+		int32_t points;			// OP_RESULT: points on the card, for configure, recharge and balance.
+		uint16_t cards;			// OP_RESULT: cards left for the operation, 0 for every card.
+	} Response;
+
+	StationClient();
+	~StationClient();
+
+	/**
+	 * Opens the serial port of the station, raw at baud. Returns false if it can't be opened.
+	 * Opening the port resets most Arduinos: the station answers once it has started.
+	 */
+	bool open(const char *path, unsigned long baud);
+
+	/**
+	 * Talks to the station through these file descriptors instead, e.g. a pipe or a pty.
+	 */
+	void attach(int inFd, int outFd);
+
+	void close();
+
+	/**
+	 * Echoes to file what the station sends besides the frames.
+	 */
+	void setEcho(FILE *file) {
+		echo = file;
+	}
+
+	/**
+	 * Sends a request and waits for its acknowledgement, sending it again up to retries times after
+	 * timeoutMs each. Returns false if none came.
+	 */
+	bool request(byte opcode, int32_t points, uint16_t cards, Response &ack,
+			unsigned long timeoutMs = 500, int retries = 3);
+
+	/**
+	 * Waits up to timeoutMs for the next OP_RESULT. Returns false if none came.
+	 */
+	bool receive(Response &result, unsigned long timeoutMs);
+
+	/**
+	 * Id the next request will be sent with.
+	 */
+	uint16_t nextId() const {
+		return id;
+	}
+
+private:
+	bool read(Response &response, unsigned long timeoutMs);
+	bool write(const byte *data, size_t size);
+
+	int inFd;
+	int outFd;
+	bool owned;					// The descriptors are closed with the client.
+	FILE *echo;
+	uint16_t id;
+	CommandFrame::Parser parser;
+	byte skip;					// Bytes left of an event frame.
+	std::deque<Response> results;	// Results received while waiting for an acknowledgement.
+};
+
+#endif /* StationClient_h */
@@ -0,0 +1,117 @@
+/*
+ * AdaptiveDetector.cpp
+ * Detects motion as dips below the ambient light. See AdaptiveDetector.h.
+ */
+
+#include "AdaptiveDetector.h"
+
+static const byte MAX_SIGMA = 8;
+static const byte MAX_SHIFT = 14;
+static const int16_t MAX_DEVIATION = 255;	// Largest deviation taken in the variance.
+
+/**
+ * Moves the average towards the value by 1 / 2^shift, rounded to the nearest.
+ */
+static inline int32_t average(int32_t average, int32_t value, byte shift) {
+	return average + ((value - average + (1L << (shift - 1))) >> shift);
+}
+
+AdaptiveDetector::AdaptiveDetector(Mode mode, uint16_t pulseSamples) :
+		mode(mode), pulseSamples(pulseSamples) {
+	setSensitivity(4, 2, 8);
+	setTimeConstants(8, 10, 3000);
+	setDebounce(2, 20);
+	reset();
+}
+
+void AdaptiveDetector::setSensitivity(byte onSigma, byte offSigma,
+		uint16_t minDelta) {
+	onSigma = constrain(onSigma, 1, MAX_SIGMA);
+	if (offSigma >= onSigma)
+		offSigma = onSigma - 1;
+	onSigma2 = onSigma * onSigma;
+	offSigma2 = offSigma * offSigma;
+	this->minDelta = minDelta > 0 ? minDelta : 1;
+}
+
+void AdaptiveDetector::setTimeConstants(byte baselineShift, byte noiseShift,
+		uint16_t maxDipSamples) {
+	this->baselineShift = constrain(baselineShift, 1, MAX_SHIFT);
+	this->noiseShift = constrain(noiseShift, 1, MAX_SHIFT);
+	this->maxDipSamples = maxDipSamples;
+}
+
+void AdaptiveDetector::setDebounce(byte enterSamples, byte exitSamples) {
+	this->enterSamples = enterSamples > 0 ? enterSamples : 1;
+	this->exitSamples = exitSamples > 0 ? exitSamples : 1;
+}
+
+void AdaptiveDetector::reset() {
+	baseQ8 = 0;
+	varQ8 = -1;
+	warmup = 1U << noiseShift;
+	dipSamples = 0;
+	run = 0;
+	pulseLeft = 0;
+	state = false;
+}
+
+bool AdaptiveDetector::update(uint16_t sample) {
+	if (pulseLeft > 0 && --pulseLeft == 0 && mode == MODE_PULSE)
+		state = false;
+	if (varQ8 < 0) {
+		baseQ8 = (int32_t) sample << 8;
+		varQ8 = 0;
+		return false;
+	}
+	int16_t level = baseQ8 >> 8;
+	int16_t dip = level - (int16_t) sample;	// How far below the baseline.
+	int32_t dip2Q8 = (int32_t) dip * dip << 8;
+
+	if (dipSamples > 0) {
+		if (++dipSamples >= maxDipSamples) {
+			//The light changed: start again from there, keeping the noise.
+			baseQ8 = (int32_t) sample << 8;
+			dipSamples = 0;
+			run = 0;
+			return false;
+		}
+		if (sample < floor)
+			floor = sample;
+		//Back within the noise, or most of the way back up if the light changed meanwhile.
+		if (dip < (int16_t) ((minDelta + 1) / 2) || dip2Q8 <= offSigma2 * varQ8
+				|| 4 * (sample - floor) >= 3 * (level - floor))
+			run++;
+		else
+			run = 0;
+		if (run < exitSamples)
+			return false;
+		//Back to the ambient light, learnt from again.
+		dipSamples = 0;
+		run = 0;
+	} else if (warmup == 0 && dip >= (int16_t) minDelta
+			&& dip2Q8 > onSigma2 * varQ8) {
+		//Not learnt from, in case it's the start of a dip.
+		if (++run < enterSamples)
+			return false;
+		dipSamples = 1;
+		floor = sample;
+		run = 0;
+		if (mode == MODE_TOGGLE) {
+			state = !state;
+		} else {
+			state = true;
+			pulseLeft = pulseSamples;
+		}
+		return true;
+	} else {
+		run = 0;
+	}
+
+	int16_t deviation = constrain(-dip, -MAX_DEVIATION, MAX_DEVIATION);
+	baseQ8 = average(baseQ8, (int32_t) sample << 8, baselineShift);
+	varQ8 = average(varQ8, (int32_t) deviation * deviation << 8, noiseShift);
+	if (warmup > 0)
+		warmup--;
+	return false;
+}
@@ -0,0 +1,118 @@
+/*
+ * AdaptiveDetector.h
+ * Detects motion in the samples of a photosensitive diode, as the dips a passing shadow makes,
+ * measured against the ambient light rather than a fixed threshold.
+ *
+ * The detector follows the ambient level (baseline) and the noise around it with two exponential
+ * moving averages, of the samples and of their squared deviation (variance). A dip starts when a
+ * sample falls onSigma standard deviations below the baseline, and at least minDelta ADC counts,
+ * for enterSamples samples in a row; it ends when the samples come back within offSigma deviations
+ * (hysteresis), or within minDelta / 2 counts, or three quarters of the way from the bottom of the
+ * dip, for exitSamples in a row. Both averages are frozen during a dip, so that the dip doesn't
+ * pull them: the last test ends the dips during which the ambient light went down.
+ * A dip lasting maxDipSamples is a change of the ambient light, not motion: the baseline is set
+ * to the current level.
+ *
+ * Integer arithmetic only: the baseline is kept in 1/256 counts, the variance in 1/256 counts
+ * squared, and the averages are updated with rounded shifts. The time constants are
+ * 2^baselineShift and 2^noiseShift samples. Deviations are taken up to 255 counts in the variance,
+ * which keeps every product in 32 bits. No detection is made in the first 2^noiseShift samples,
+ * while the noise is learnt.
+ *
+ * Output modes:
+ *   MODE_TOGGLE  The output toggles at the start of each dip.
+ *   MODE_PULSE   The output is on for pulseSamples from the start of the last dip.
+ *
+ * Only the samples are looked at, no clock, so the same code runs on the board and on the host,
+ * fed with recorded traces (see host/MotionReplay and host/MotionBench).
+ */
+#ifndef AdaptiveDetector_h
+#define AdaptiveDetector_h
+
+#include <Arduino.h>
+
+class AdaptiveDetector {
+public:
+	enum Mode
+		: byte {
+			MODE_TOGGLE, MODE_PULSE,
+	};
+
+	AdaptiveDetector(Mode mode = MODE_TOGGLE, uint16_t pulseSamples = 500);
+
+	/**
+	 * Sets how far a sample must fall to start a dip and come back to end it, in standard
+	 * deviations of the noise (at most 8), and the least fall to start one, in ADC counts.
+	 * offSigma must be below onSigma. The defaults are 4, 2 and 8.
+	 */
+	void setSensitivity(byte onSigma, byte offSigma, uint16_t minDelta);
+
+	/**
+	 * Sets the time constants of the baseline and of the noise, as powers of 2 samples (at most 14),
+	 * and the longest dip, in samples. The defaults are 8, 10 and 3000: at 1 kHz, a quarter of
+	 * a second for the ambient light to be followed, a second for the noise, 3 seconds for a dip.
+	 */
+	void setTimeConstants(byte baselineShift, byte noiseShift,
+			uint16_t maxDipSamples);
+
+	/**
+	 * Sets the samples in a row a dip must be seen to start, and not seen to end.
+	 * The defaults are 2, against single noise spikes, and 20, against the noise at the edges
+	 * of a shadow starting a second dip.
+	 */
+	void setDebounce(byte enterSamples, byte exitSamples);
+
+	/**
+	 * Forgets the light learnt, starting again from the next sample.
+	 */
+	void reset();
+
+	/**
+	 * Takes the next sample, 0 to 1023. Returns true if motion was detected: a dip started.
+	 */
+	bool update(uint16_t sample);
+
+	/**
+	 * Current output: the LED state.
+	 */
+	bool output() const {
+		return state;
+	}
+
+	/**
+	 * Ambient level, in ADC counts.
+	 */
+	uint16_t baseline() const {
+		return baseQ8 >> 8;
+	}
+
+	/**
+	 * Variance of the noise, in 1/256 ADC counts squared.
+	 */
+	int32_t variance() const {
+		return varQ8;
+	}
+
+private:
+	Mode mode;
+	uint16_t pulseSamples;
+	byte onSigma2;			// onSigma squared.
+	byte offSigma2;			// offSigma squared.
+	uint16_t minDelta;
+	byte baselineShift;
+	byte noiseShift;
+	uint16_t maxDipSamples;
+	byte enterSamples;
+	byte exitSamples;
+
+	int32_t baseQ8;			// Baseline, in 1/256 counts.
+	int32_t varQ8;			// Variance, in 1/256 counts squared, -1 before the first sample.
+	uint16_t warmup;		// Samples left before detecting.
+	uint16_t dipSamples;	// Length of the current dip, 0 out of a dip.
+	byte run;				// Samples in a row starting or ending a dip.
+	int16_t floor;			// Lowest sample of the current dip.
+	uint16_t pulseLeft;		// Samples left of the pulse.
+	bool state;				// Output.
+};
+
+#endif /* AdaptiveDetector_h */
@@ -0,0 +1,171 @@
+/*
+ * AdaptivePoller.cpp
+ * See AdaptivePoller.h.
+ */
+
+#include "AdaptivePoller.h"
+
+AdaptivePoller::AdaptivePoller(MFRC522 &mfrc522, Scheduler &scheduler) :
+		mfrc522(mfrc522), scheduler(scheduler), task(Scheduler::NO_TASK), fastMs(
+				POLL_FAST_MS), idleMs(POLL_IDLE_MS), holdMs(POLL_HOLD_MS), fieldOff(
+				true), field(true), handled(false), pollMs(POLL_FAST_MS), activityMs(
+				0), lastPollMs(0), pollStartMs(0), fieldOnMs(0) {
+	memset(&pollStats, 0, sizeof(pollStats));
+}
+
+void AdaptivePoller::setTiming(unsigned long fastMs, unsigned long idleMs,
+		unsigned long holdMs) {
+	this->fastMs = fastMs;
+	this->idleMs = idleMs > fastMs ? idleMs : fastMs;
+	this->holdMs = holdMs;
+	pollMs = fastMs;
+}
+
+void AdaptivePoller::begin(byte task) {
+	this->task = task;
+	unsigned long now = millis();
+	//PCD_Init() switched the field on.
+	field = true;
+	handled = false;
+	pollMs = fastMs;
+	activityMs = lastPollMs = pollStartMs = now;
+	resetStats();
+}
+
+bool AdaptivePoller::ready() {
+	if (field) {
+		pollStartMs = millis();
+		return true;
+	}
+	//Poll once the cards are powered up.
+	switchField(true, millis());
+	scheduler.sleep(task, POLL_POWER_UP_MS);
+	return false;
+}
+
+bool AdaptivePoller::poll() {
+	if (!ready())
+		return false;
+	if (!mfrc522.PICC_IsNewCardPresent()) {
+		polled(false);
+		return false;
+	}
+	if (mfrc522.PICC_ReadCardSerial()) {
+		polled(true);
+		return true;
+	}
+	//A card answered, but wasn't selected: look again at once.
+	pollStats.polls++;
+	activity();
+	return false;
+}
+
+void AdaptivePoller::polled(bool found) {
+	unsigned long now = millis();
+	pollStats.polls++;
+	if (found) {
+		detected(now);
+		return;
+	}
+	lastPollMs = pollStartMs;
+	backOff(now);
+}
+
+void AdaptivePoller::detected(unsigned long now) {
+	//The card was placed after the poll before started, at the earliest.
+	unsigned long gap = now - lastPollMs;
+	pollStats.cards++;
+	pollStats.gapSumMs += gap;
+	if (gap > pollStats.maxGapMs)
+		pollStats.maxGapMs = gap;
+	lastPollMs = pollStartMs;
+	handled = true;
+	activityMs = now;
+	pollMs = fastMs;
+	scheduler.sleep(task, fastMs);
+}
+
+void AdaptivePoller::activity() {
+	activityMs = millis();
+	pollMs = fastMs;
+	if (task == Scheduler::NO_TASK)
+		return;
+	if (field) {
+		scheduler.sleep(task, 0);
+	} else {
+		switchField(true, activityMs);
+		scheduler.sleep(task, POLL_POWER_UP_MS);
+	}
+}
+
+void AdaptivePoller::backOff(unsigned long now) {
+	if (now - activityMs < holdMs) {
+		scheduler.sleep(task, pollMs);
+		return;
+	}
+	unsigned long next = pollMs > 0 ? pollMs * 2 : 1;
+	pollMs = next < idleMs ? next : idleMs;
+	if (fieldOff && pollMs > POLL_POWER_UP_MS && cardLeft()) {
+		switchField(false, now);
+		scheduler.sleep(task, pollMs - POLL_POWER_UP_MS);
+	} else {
+		scheduler.sleep(task, pollMs);
+	}
+}
+
+bool AdaptivePoller::cardLeft() {
+	if (!handled)
+		return true;
+	byte bufferATQA[2];
+	byte bufferSize = sizeof(bufferATQA);
+	MFRC522::StatusCode status = mfrc522.PICC_WakeupA(bufferATQA, &bufferSize);
+	if (status != MFRC522::STATUS_OK && status != MFRC522::STATUS_COLLISION) {
+		handled = false;
+		return true;
+	}
+	//Still on the reader: back to HALT, so the next request doesn't find it as a new card.
+	pollStats.checks++;
+	if (mfrc522.PICC_ReadCardSerial())
+		mfrc522.PICC_HaltA();
+	return false;
+}
+
+void AdaptivePoller::switchField(bool on, unsigned long now) {
+	if (on) {
+		mfrc522.PCD_AntennaOn();
+		fieldOnMs = now;
+		pollStats.wakeups++;
+	} else {
+		mfrc522.PCD_AntennaOff();
+		pollStats.fieldMs += now - fieldOnMs;
+		handled = false;
+	}
+	field = on;
+}
+
+void AdaptivePoller::resetStats() {
+	memset(&pollStats, 0, sizeof(pollStats));
+	pollStats.startMs = fieldOnMs = millis();
+}
+
+void AdaptivePoller::printStats() {
+	unsigned long now = millis();
+	unsigned long elapsedS = (now - pollStats.startMs) / 1000;
+	unsigned long onMs = pollStats.fieldMs + (field ? now - fieldOnMs : 0);
+	Serial.print(F("POLL,"));
+	Serial.print(pollStats.polls);
+	Serial.print(',');
+	Serial.print(pollStats.cards);
+	Serial.print(',');
+	Serial.print(pollStats.cards > 0 ? pollStats.gapSumMs / pollStats.cards : 0);
+	Serial.print(',');
+	Serial.print(pollStats.maxGapMs);
+	Serial.print(',');
+	//Milliseconds on per second.
+	unsigned long perMille = elapsedS > 0 ? onMs / elapsedS : 1000;
+	Serial.print(perMille < 1000 ? perMille : 1000);
+	Serial.print(',');
+	Serial.print(pollStats.wakeups);
+	Serial.print(',');
+	Serial.println(pollMs);
+}
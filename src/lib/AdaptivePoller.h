@@ -0,0 +1,158 @@
+/*
+ * AdaptivePoller.h
+ * Polls a reader for cards at a rate following the activity, instead of in a tight loop, so the
+ * RF field and the CPU rest while nobody is near, e.g. on battery run stations.
+ *
+ * Right after a card or other activity, the reader is polled every fastMs, for holdMs. Then the
+ * time between two polls doubles at each poll finding nothing, up to idleMs. Idle, the field is
+ * switched off between polls, and on again powerUpMs before the next one, the time cards take to
+ * answer. With Scheduler::setSleep(), the CPU sleeps meanwhile.
+ * Shorter idleMs notice a card sooner; longer ones draw less current. activity() goes back to
+ * fast polling at once, e.g. on a button, console input or the end of a game.
+ *
+ * Cards lose their HALT state with the field: a card left on the reader after its tap would be
+ * found again as a new one. Before switching the field off, a card handled since it was switched
+ * on is looked for with a wake up; if it's still there, it's halted again and the field kept on.
+ *
+ * The poll task is run by the scheduler, poll() takes the card the way PICC_IsNewCardPresent()
+ * and PICC_ReadCardSerial() do, or ready() and polled() wrap the task's own search:
+ *   AdaptivePoller poller(mfrc522, scheduler);
+ *   poller.begin(scheduler.add(pollCard, 0));
+ *   void pollCard() { if (!poller.poll()) return; ... }	// A card is selected.
+ */
+#ifndef AdaptivePoller_h
+#define AdaptivePoller_h
+
+#include <MFRC522.h>
+#include <Scheduler.h>
+
+/**
+ * Default timing, see setTiming().
+ */
+#ifndef POLL_FAST_MS
+#define POLL_FAST_MS 20
+#endif
+#ifndef POLL_IDLE_MS
+#define POLL_IDLE_MS 250
+#endif
+#ifndef POLL_HOLD_MS
+#define POLL_HOLD_MS 10000
+#endif
+
+/**
+ * Time cards take to answer once the field is on. ISO/IEC 14443-3 gives them 5 ms.
+ */
+#ifndef POLL_POWER_UP_MS
+#define POLL_POWER_UP_MS 5
+#endif
+
+class AdaptivePoller {
+public:
+	// Counters, since begin() or resetStats().
+	typedef struct {
+		uint32_t polls;			// Requests sent.
+		uint32_t cards;			// Cards found.
+		uint32_t gapSumMs;		// Sum over the cards of the time since the poll before started.
+		uint32_t maxGapMs;		// Longest time since the poll before started: worst delay to notice a card.
+		uint32_t fieldMs;		// Time the field was on, up to its last switch off.
+		uint32_t wakeups;		// Times the field was switched on again.
+		uint32_t checks;		// Cards found still on the reader before switching the field off.
+		unsigned long startMs;	// millis() the counters start from.
+	} Stats;
+
+	AdaptivePoller(MFRC522 &mfrc522, Scheduler &scheduler);
+
+	/**
+	 * Sets the timing, in milliseconds.
+	 */
+	void setTiming(unsigned long fastMs,	//Time between two polls, after activity.
+			unsigned long idleMs,	//Longest time between two polls, idle.
+			unsigned long holdMs	//Time polling fast after activity.
+			);
+
+	/**
+	 * Switches the field off between polls when idle. On by default.
+	 */
+	void setFieldOff(bool enable) {
+		fieldOff = enable;
+	}
+
+	/**
+	 * Takes over the timing of the poll task, added to the scheduler by the sketch.
+	 * To be called once after PCD_Init().
+	 */
+	void begin(byte task);
+
+	/**
+	 * Polls the reader, to be called by the poll task. Returns true if a new card is selected:
+	 * the task handles it and halts it.
+	 */
+	bool poll();
+
+	/**
+	 * For a poll task looking for the cards itself, e.g. with CardScanner: returns true if the
+	 * field is up, false if it's being switched on, in which case the task returns at once.
+	 */
+	bool ready();
+
+	/**
+	 * For a poll task looking for the cards itself, after ready(): reports whether it found one.
+	 */
+	void polled(bool found);
+
+	/**
+	 * Goes back to polling fast, at once.
+	 */
+	void activity();
+
+	/**
+	 * Current time between two polls, in milliseconds.
+	 */
+	unsigned long interval() const {
+		return pollMs;
+	}
+
+	bool fieldOn() const {
+		return field;
+	}
+
+	const Stats &stats() const {
+		return pollStats;
+	}
+
+	/**
+	 * Prints the counters as a CSV line "POLL,<polls>,<cards>,<mean gap ms>,<max gap ms>,
+	 * <field on per mille>,<wakeups>,<interval ms>". The gaps bound the delay from a card being
+	 * placed to it being found.
+	 */
+	void printStats();
+
+	/**
+	 * Clears the counters.
+	 */
+	void resetStats();
+
+private:
+	void detected(unsigned long now);
+	void backOff(unsigned long now);
+	bool cardLeft();
+	void switchField(bool on, unsigned long now);
+
+	MFRC522 &mfrc522;
+	Scheduler &scheduler;
+	byte task;
+	unsigned long fastMs;
+	unsigned long idleMs;
+	unsigned long holdMs;
+	bool fieldOff;
+	bool field;				// The field is on.
+	bool handled;			// A card was found since the field was switched on.
+	unsigned long pollMs;	// Current time between two polls.
+	unsigned long activityMs;	// millis() of the last activity.
+	unsigned long lastPollMs;	// millis() the last poll started.
+	unsigned long pollStartMs;	// millis() the current poll started.
+	unsigned long fieldOnMs;	// millis() the field was switched on.
+	Stats pollStats;
+};
+
+#endif /* AdaptivePoller_h */
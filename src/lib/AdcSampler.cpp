@@ -0,0 +1,72 @@
+/*
+ * AdcSampler.cpp
+ * Fixed rate sampling of one analog input. See AdcSampler.h.
+ */
+
+#include "AdcSampler.h"
+
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__)
+#include <avr/interrupt.h>
+#endif
+
+static const uint32_t TIMER_HZ = F_CPU / 8;	// Timer1 clock, prescaled by 8.
+
+SampleRing AdcSampler::ring;
+uint32_t AdcSampler::actualRateMilliHz = 0;
+
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__)
+
+void AdcSampler::begin(byte pin, unsigned int rateHz) {
+	if (rateHz < MIN_RATE_HZ)
+		rateHz = MIN_RATE_HZ;
+	else if (rateHz > MAX_RATE_HZ)
+		rateHz = MAX_RATE_HZ;
+	uint16_t top = TIMER_HZ / rateHz - 1;
+	actualRateMilliHz = TIMER_HZ * 1000ULL / (top + 1UL);
+
+	noInterrupts();
+	//Timer1: CTC mode up to OCR1A, clock / 8, outputs disconnected. Compare B starts the ADC.
+	TCCR1A = 0;
+	TCCR1B = 0;
+	TCNT1 = 0;
+	OCR1A = top;
+	OCR1B = top;
+	TIFR1 = _BV(OCF1B);
+	//ADC: AVcc reference, clock / 128, auto triggered by Timer1 compare B, interrupt on completion.
+	ADMUX = _BV(REFS0) | (pin & 0x07);
+	ADCSRB = _BV(ADTS2) | _BV(ADTS0);
+	ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1)
+			| _BV(ADPS0);
+	TCCR1B = _BV(WGM12) | _BV(CS11);
+	interrupts();
+}
+
+void AdcSampler::end() {
+	noInterrupts();
+	TCCR1B = 0;
+	ADCSRA = _BV(ADEN) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+	ADCSRB = 0;
+	interrupts();
+}
+
+ISR(ADC_vect) {
+	//The trigger is the rising edge of the compare flag: clear it for the next tick to start a conversion.
+	TIFR1 = _BV(OCF1B);
+	AdcSampler::ring.push(ADC);
+}
+
+#else
+
+void AdcSampler::begin(byte pin, unsigned int rateHz) {
+	(void) pin;
+	if (rateHz < MIN_RATE_HZ)
+		rateHz = MIN_RATE_HZ;
+	else if (rateHz > MAX_RATE_HZ)
+		rateHz = MAX_RATE_HZ;
+	actualRateMilliHz = TIMER_HZ * 1000ULL / (TIMER_HZ / rateHz);
+}
+
+void AdcSampler::end() {
+}
+
+#endif
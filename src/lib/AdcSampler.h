@@ -0,0 +1,51 @@
+/*
+ * AdcSampler.h
+ * Fixed rate sampling of one analog input into a SampleRing, for the sensor sketches.
+ *
+ * Timer1 runs in CTC mode at the sample rate and its compare match B starts the ADC conversions
+ * (auto trigger), so the rate depends neither on loop() nor on the Serial output: the conversions
+ * start on the timer tick, with no jitter from the code. The ADC interrupt pushes each result
+ * into the ring, which loop() drains in batches. The handler takes around 5 us at 16 MHz.
+ *
+ * Once begin() is called analogRead() must not be used, and Timer1 is taken: no PWM on pins 9
+ * and 10, no Servo library. The ADC clock is 125 kHz, a conversion takes 104 us, so rates up to
+ * 9 kHz can be sampled.
+ *
+ * Only ATmega328P/168 (Uno, Nano, Pro Mini) are supported. On the host begin() and end() do
+ * nothing: the replay harness pushes recorded samples into the ring itself.
+ */
+#ifndef AdcSampler_h
+#define AdcSampler_h
+
+#include <SampleRing.h>
+
+class AdcSampler {
+public:
+	static const unsigned int MIN_RATE_HZ = 31;		// Slowest rate Timer1 can tick at, prescaled by 8.
+	static const unsigned int MAX_RATE_HZ = 9000;	// Fastest rate the ADC converts at.
+
+	/**
+	 * Starts sampling the analog pin (0 to 7, as for analogRead()) at rateHz, clamped to
+	 * MIN_RATE_HZ..MAX_RATE_HZ. The reference is AVcc, as for analogRead().
+	 */
+	static void begin(byte pin, unsigned int rateHz);
+
+	/**
+	 * Stops sampling, giving back Timer1 and the ADC.
+	 */
+	static void end();
+
+	/**
+	 * Rate the timer actually ticks at, in millihertz, after rounding its period to the timer clock.
+	 */
+	static uint32_t rateMilliHz() {
+		return actualRateMilliHz;
+	}
+
+	static SampleRing ring;		// Samples taken and not processed yet.
+
+private:
+	static uint32_t actualRateMilliHz;
+};
+
+#endif /* AdcSampler_h */
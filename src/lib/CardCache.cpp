@@ -0,0 +1,76 @@
+/*
+ * CardCache.cpp
+ * See CardCache.h.
+ */
+
+#include "CardCache.h"
+
+CardCache::CardCache() {
+	clear();
+}
+
+void CardCache::clear() {
+	for (byte i = 0; i < CARD_CACHE_SIZE; i++) {
+		entries[i].uidSize = 0;
+		entries[i].fields = 0;
+		order[i] = i;
+	}
+	hits = 0;
+	misses = 0;
+}
+
+byte CardCache::indexOf(const MFRC522::Uid &uid) {
+	for (byte i = 0; i < CARD_CACHE_SIZE; i++) {
+		Entry &entry = entries[i];
+		if (entry.uidSize == uid.size
+				&& memcmp(entry.uid, uid.uidByte, uid.size) == 0)
+			return i;
+	}
+	return CARD_CACHE_SIZE;
+}
+
+void CardCache::touch(byte index) {
+	byte i = 0;
+	while (order[i] != index)
+		i++;
+	for (; i > 0; i--)
+		order[i] = order[i - 1];
+	order[0] = index;
+}
+
+CardCache::Entry *CardCache::find(const MFRC522::Uid &uid) {
+	byte index = indexOf(uid);
+	if (index == CARD_CACHE_SIZE)
+		return NULL;
+	touch(index);
+	return &entries[index];
+}
+
+CardCache::Entry *CardCache::insert(const MFRC522::Uid &uid) {
+	Entry *entry = find(uid);
+	if (entry != NULL)
+		return entry;
+	//The least recently used is last. Free entries are kept last as well.
+	byte index = order[CARD_CACHE_SIZE - 1];
+	touch(index);
+	entry = &entries[index];
+	entry->uidSize = uid.size;
+	memcpy(entry->uid, uid.uidByte, uid.size);
+	entry->fields = 0;
+	return entry;
+}
+
+void CardCache::remove(const MFRC522::Uid &uid) {
+	byte index = indexOf(uid);
+	if (index == CARD_CACHE_SIZE)
+		return;
+	entries[index].uidSize = 0;
+	entries[index].fields = 0;
+	//Make it the first to be reused.
+	byte i = 0;
+	while (order[i] != index)
+		i++;
+	for (; i < CARD_CACHE_SIZE - 1; i++)
+		order[i] = order[i + 1];
+	order[CARD_CACHE_SIZE - 1] = index;
+}
@@ -0,0 +1,76 @@
+/*
+ * CardCache.h
+ * Last known state of the cards seen by this station, keyed by UID, least recently used evicted first.
+ *
+ * An entry is only trusted after checking it against the write counter on the card
+ * (CardUtil::WRITE_COUNTER_BLOCK), which every station changes before changing the balances.
+ * That costs a single block read, instead of reading the balances in two sectors.
+ * CardUtil does the checking; see CardUtil::setCache().
+ */
+#ifndef CardCache_h
+#define CardCache_h
+
+#include <MFRC522.h>
+
+/**
+ * Number of cards cached. Each takes 28 bytes of SRAM.
+ */
+#ifndef CARD_CACHE_SIZE
+#define CARD_CACHE_SIZE 4
+#endif
+
+class CardCache {
+public:
+	// Fields an entry can hold. Same values as CardUtil::Transaction::Field.
+	enum Field
+		: byte {
+			FIELD_POINTS = 0x01,
+		FIELD_REWARDS = 0x02,
+		FIELD_CUR_SEQ = 0x04,
+		ALL_FIELDS = FIELD_POINTS | FIELD_REWARDS | FIELD_CUR_SEQ,
+	};
+
+	typedef struct {
+		byte uid[10];
+		byte uidSize;			// 0 for a free entry.
+		byte fields;			// Fields known.
+		int32_t writeCounter;	// Write counter on the card when the fields were known.
+		int32_t points;
+		int32_t rewards;
+		int32_t curSeq;			// State block of sequence game 0.
+	} Entry;
+
+	CardCache();
+
+	/**
+	 * Returns the entry of the card, NULL if not cached. The entry becomes the most recently used.
+	 */
+	Entry *find(const MFRC522::Uid &uid);
+
+	/**
+	 * Returns the entry of the card, adding an empty one in place of the least recently used if not cached.
+	 */
+	Entry *insert(const MFRC522::Uid &uid);
+
+	/**
+	 * Forgets the card.
+	 */
+	void remove(const MFRC522::Uid &uid);
+
+	/**
+	 * Forgets all the cards.
+	 */
+	void clear();
+
+	uint16_t hits;		// Lookups answered from the cache.
+	uint16_t misses;	// Lookups with the card not cached, or the entry out of date.
+
+private:
+	byte indexOf(const MFRC522::Uid &uid);
+	void touch(byte index);
+
+	Entry entries[CARD_CACHE_SIZE];
+	byte order[CARD_CACHE_SIZE];	// Entry indexes, most recently used first.
+};
+
+#endif /* CardCache_h */
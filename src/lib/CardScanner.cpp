@@ -0,0 +1,110 @@
+/*
+ * CardScanner.cpp
+ * See CardScanner.h.
+ */
+
+#include "CardScanner.h"
+
+CardScanner::CardScanner(MFRC522 &mfrc522) :
+		mfrc522(mfrc522), cards(0), processedCards(0), lastScanUs(0), lastProcessUs(
+				0) {
+	resetStats();
+}
+
+void CardScanner::resetStats() {
+	memset(&scanStats, 0, sizeof(scanStats));
+}
+
+bool CardScanner::found(const MFRC522::Uid &uid) {
+	for (byte card = 0; card < cards; card++)
+		if (uids[card].size == uid.size
+				&& memcmp(uids[card].uidByte, uid.uidByte, uid.size) == 0)
+			return true;
+	return false;
+}
+
+byte CardScanner::find(CardHandler handler) {
+	unsigned long start = micros();
+	unsigned long handlerUs = 0;
+	cards = 0;
+	processedCards = 0;
+	//A card dropped by a failed command answers the next request again: a few more attempts than cards.
+	for (byte attempt = 0; cards < SCAN_MAX_CARDS && attempt < 2 * SCAN_MAX_CARDS;
+			attempt++) {
+		if (!mfrc522.PICC_IsNewCardPresent())
+			break;
+		if (!mfrc522.PICC_ReadCardSerial())
+			continue;
+		//A card found again isn't handled twice.
+		bool known = found(mfrc522.uid);
+		if (!known)
+			uids[cards++] = mfrc522.uid;
+		if (handler == NULL || known) {
+			mfrc522.PICC_HaltA();
+			continue;
+		}
+		unsigned long handlerStart = micros();
+		if (handler(cards - 1, mfrc522))
+			processedCards++;
+		handlerUs += micros() - handlerStart;
+	}
+	lastScanUs = micros() - start - handlerUs;
+	lastProcessUs = handlerUs;
+	if (cards > 0) {
+		scanStats.scans++;
+		scanStats.seen += cards;
+		scanStats.scanUs += lastScanUs;
+		if (cards > scanStats.maxCards)
+			scanStats.maxCards = cards;
+	}
+	scanStats.processed += processedCards;
+	scanStats.processUs += handlerUs;
+	return processedCards;
+}
+
+bool CardScanner::select(const MFRC522::Uid &uid) {
+	byte bufferATQA[2];
+	//The card may have missed the wake up, try it once more.
+	for (byte attempt = 0; attempt < 2; attempt++) {
+		byte bufferSize = sizeof(bufferATQA);
+		MFRC522::StatusCode status = mfrc522.PICC_WakeupA(bufferATQA,
+				&bufferSize);
+		if (status != MFRC522::STATUS_OK && status != MFRC522::STATUS_COLLISION)
+			continue;
+		//The cards woken up but not selected go back to the HALT state.
+		mfrc522.uid = uid;
+		if (mfrc522.PICC_Select(&mfrc522.uid, uid.size * 8)
+				== MFRC522::STATUS_OK)
+			return true;
+	}
+	return false;
+}
+
+byte CardScanner::process(CardHandler handler) {
+	unsigned long start = micros();
+	processedCards = 0;
+	for (byte card = 0; card < cards; card++) {
+		if (select(uids[card]) && handler(card, mfrc522))
+			processedCards++;
+	}
+	lastProcessUs = micros() - start;
+	scanStats.processed += processedCards;
+	scanStats.processUs += lastProcessUs;
+	return processedCards;
+}
+
+void CardScanner::printStats() {
+	Serial.print(F("SCAN,"));
+	Serial.print(scanStats.scans);
+	Serial.print(',');
+	Serial.print(scanStats.seen);
+	Serial.print(',');
+	Serial.print(scanStats.processed);
+	Serial.print(',');
+	Serial.print(scanStats.maxCards);
+	Serial.print(',');
+	Serial.print(scanStats.scans > 0 ? scanStats.scanUs / scanStats.scans : 0);
+	Serial.print(',');
+	Serial.println(
+			scanStats.seen > 0 ? scanStats.processUs / scanStats.seen : 0);
+}
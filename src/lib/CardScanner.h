@@ -0,0 +1,140 @@
+/*
+ * CardScanner.h
+ * Handles every card in the field of a reader in one pass, e.g. the cards of a team held on the
+ * reader together, where PICC_IsNewCardPresent() and PICC_ReadCardSerial() only get the one
+ * winning the anticollision.
+ *
+ * Cards are found by requests, each answered by the cards not found yet, and selects, whose
+ * anticollision settles on one of them. Halted once handled, a card doesn't answer the next request.
+ * A pass ends when no card answers any more, or SCAN_MAX_CARDS are found; the others are left
+ * for the next pass. The handler halts the card, as for a single card (CardUtil::stop()):
+ * cards left on the reader are not found again by the next pass.
+ *
+ * run() hands each card to the handler as soon as it's selected: it costs what polling the cards
+ * one by one does. When the cards must be counted first, e.g. a team game needing every player,
+ * scan() finds and halts them, then process() wakes them up and selects them again by their UID,
+ * one more request, select and halt per card. A card that left the field meanwhile isn't processed.
+ *
+ * e.g.
+ *   CardScanner scanner(mfrc522);
+ *   bool rechargeCard(byte card, MFRC522 &mfrc522) { ... }	// rebind(), addPoints(), stop().
+ *   if (scanner.run(rechargeCard) < scanner.count()) ...	// Some cards failed.
+ */
+#ifndef CardScanner_h
+#define CardScanner_h
+
+#include <MFRC522.h>
+
+/**
+ * Cards a scan finds at most. Each takes 12 bytes of SRAM.
+ */
+#ifndef SCAN_MAX_CARDS
+#define SCAN_MAX_CARDS 4
+#endif
+
+class CardScanner {
+public:
+	/**
+	 * Called with each card found, selected on mfrc522. The handler runs the CardUtil operations
+	 * and halts the card. Returns true if the card was processed.
+	 */
+	typedef bool (*CardHandler)(byte card, MFRC522 &mfrc522);
+
+	// Counters, since construction or resetStats().
+	typedef struct {
+		uint32_t scans;			// Passes that found a card.
+		uint32_t seen;			// Cards found.
+		uint32_t processed;		// Cards the handler processed.
+		byte maxCards;			// Most cards found by a pass.
+		uint32_t scanUs;		// Time spent finding the cards.
+		uint32_t processUs;		// Time spent in the handler, and selecting the cards again.
+	} Stats;
+
+	CardScanner(MFRC522 &mfrc522);
+
+	/**
+	 * Hands every card in the field to the handler, in one pass. Returns the number processed.
+	 */
+	byte run(CardHandler handler) {
+		return find(handler);
+	}
+
+	/**
+	 * Finds the cards in the field, and halts them. Returns the number found.
+	 */
+	byte scan() {
+		find(NULL);
+		return cards;
+	}
+
+	/**
+	 * Selects each card found by the last scan, and hands it to the handler.
+	 * Returns the number of cards processed.
+	 */
+	byte process(CardHandler handler);
+
+	/**
+	 * Cards found by the last pass.
+	 */
+	byte count() const {
+		return cards;
+	}
+
+	/**
+	 * Cards processed by the last pass.
+	 */
+	byte processed() const {
+		return processedCards;
+	}
+
+	/**
+	 * UID of a card found by the last pass.
+	 */
+	const MFRC522::Uid &uid(byte card) const {
+		return uids[card];
+	}
+
+	/**
+	 * Time the last pass took finding the cards, in microseconds.
+	 */
+	unsigned long scanUs() const {
+		return lastScanUs;
+	}
+
+	/**
+	 * Time the last pass took processing the cards, in microseconds.
+	 */
+	unsigned long processUs() const {
+		return lastProcessUs;
+	}
+
+	const Stats &stats() const {
+		return scanStats;
+	}
+
+	/**
+	 * Prints the counters as a CSV line
+	 * "SCAN,<scans>,<seen>,<processed>,<max cards>,<mean scan us>,<mean process us per card>".
+	 */
+	void printStats();
+
+	/**
+	 * Clears the counters.
+	 */
+	void resetStats();
+
+private:
+	byte find(CardHandler handler);
+	bool found(const MFRC522::Uid &uid);
+	bool select(const MFRC522::Uid &uid);
+
+	MFRC522 &mfrc522;
+	MFRC522::Uid uids[SCAN_MAX_CARDS];
+	byte cards;
+	byte processedCards;
+	unsigned long lastScanUs;
+	unsigned long lastProcessUs;
+	Stats scanStats;
+};
+
+#endif /* CardScanner_h */
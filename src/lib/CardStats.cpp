@@ -0,0 +1,150 @@
+/*
+ * CardStats.cpp
+ * Timing and failure counters of CardUtil. See CardStats.h.
+ */
+
+#include "CardStats.h"
+
+#if CARD_STATS
+
+CardStats::Entry CardStats::entries[PROBE_COUNT];
+uint16_t CardStats::statusCounts[9];
+uint16_t CardStats::failures = 0;
+unsigned long CardStats::startUs = 0;
+
+static const __FlashStringHelper *probeName(byte probe) {
+	switch (probe) {
+	case CardStats::PROBE_AUTHENTICATE:
+		return F("authenticate");
+	case CardStats::PROBE_READ:
+		return F("read");
+	case CardStats::PROBE_WRITE:
+		return F("write");
+	case CardStats::PROBE_GET_VALUE:
+		return F("get_value");
+	case CardStats::PROBE_SET_VALUE:
+		return F("set_value");
+	case CardStats::PROBE_INCREMENT:
+		return F("increment");
+	case CardStats::PROBE_DECREMENT:
+		return F("decrement");
+	case CardStats::PROBE_TRANSFER:
+		return F("transfer");
+	case CardStats::PROBE_SELECT:
+		return F("select");
+	case CardStats::PROBE_CONFIGURE:
+		return F("configure");
+	case CardStats::PROBE_RESET:
+		return F("reset");
+	case CardStats::PROBE_PROVISION:
+		return F("provision");
+	case CardStats::PROBE_CHECK_STATUS:
+		return F("checkStatus");
+	case CardStats::PROBE_GET_POINTS:
+		return F("getPoints");
+	case CardStats::PROBE_ADD_POINTS:
+		return F("addPoints");
+	case CardStats::PROBE_CHARGE_POINTS:
+		return F("chargePoints");
+	case CardStats::PROBE_GET_REWARDS:
+		return F("getRewards");
+	case CardStats::PROBE_ADD_REWARDS:
+		return F("addRewards");
+	case CardStats::PROBE_CHARGE_REWARDS:
+		return F("chargeRewards");
+	case CardStats::PROBE_INIT_SEQUENCE:
+		return F("initSequence");
+	case CardStats::PROBE_CHECK_SEQUENCE:
+		return F("checkSequence");
+	case CardStats::PROBE_TX_LOAD:
+		return F("tx_load");
+	case CardStats::PROBE_TX_COMMIT:
+		return F("tx_commit");
+	case CardStats::PROBE_UPGRADE_KEYS:
+		return F("upgradeKeys");
+	case CardStats::PROBE_MIGRATE_LAYOUT:
+		return F("migrateLayout");
+	default:
+		return F("recoverCommit");
+	}
+}
+
+CardStats::Timer::Timer(Probe probe) :
+		probe(probe), startUs(micros()), startFailures(failures) {
+}
+
+CardStats::Timer::~Timer() {
+	record(probe, micros() - startUs, failures != startFailures);
+}
+
+MFRC522::StatusCode CardStats::stop(Probe probe, MFRC522::StatusCode status) {
+	bool failed = status != MFRC522::STATUS_OK;
+	record(probe, micros() - startUs, failed);
+	if (failed) {
+		failures++;
+		statusCounts[status == MFRC522::STATUS_MIFARE_NACK ? 8 : status & 0x07]++;
+	}
+	return status;
+}
+
+void CardStats::record(Probe probe, unsigned long us, bool failed) {
+	Entry &entry = entries[probe];
+	if (entry.count == 0 || us < entry.minUs)
+		entry.minUs = us;
+	if (us > entry.maxUs)
+		entry.maxUs = us;
+	entry.sumUs += us;
+	entry.count++;
+	if (failed)
+		entry.failures++;
+}
+
+void CardStats::print() {
+	for (byte probe = 0; probe < PROBE_COUNT; probe++) {
+		Entry &entry = entries[probe];
+		if (entry.count == 0)
+			continue;
+		Serial.print(F("STATS,"));
+		Serial.print(probeName(probe));
+		Serial.print(',');
+		Serial.print(entry.count);
+		Serial.print(',');
+		Serial.print(entry.failures);
+		Serial.print(',');
+		Serial.print(entry.minUs);
+		Serial.print(',');
+		Serial.print(entry.maxUs);
+		Serial.print(',');
+		Serial.println(entry.sumUs / entry.count);
+	}
+	for (byte i = 0; i < 9; i++) {
+		if (statusCounts[i] == 0)
+			continue;
+		Serial.print(F("STATUS,"));
+		Serial.print(
+				MFRC522::GetStatusCodeName(
+						i == 8 ? MFRC522::STATUS_MIFARE_NACK : (MFRC522::StatusCode) i));
+		Serial.print(',');
+		Serial.println(statusCounts[i]);
+	}
+}
+
+void CardStats::reset() {
+	memset(entries, 0, sizeof(entries));
+	memset(statusCounts, 0, sizeof(statusCounts));
+	failures = 0;
+}
+
+void CardStats::serve() {
+	if (Serial.available() == 0)
+		return;
+	int c = Serial.read();
+	if (c == 'S' || c == 's') {
+		print();
+	} else if (c == 'R' || c == 'r') {
+		reset();
+		Serial.println(F("STATS RESET"));
+	}
+}
+
+#endif
@@ -0,0 +1,134 @@
+/*
+ * CardStats.h
+ * Timing and failure counters of CardUtil, to tell in the field what makes a station slow:
+ * authentication retries, RF errors, or the operations themselves.
+ *
+ * Every RF command CardUtil sends and every public operation is timed with micros(), keeping the
+ * count, min, max and sum per probe. RF command failures are also counted by MFRC522::StatusCode.
+ * The tables are static, shared by all the CardUtil instances of the sketch: 16 bytes per probe.
+ * An operation is counted as failed if any of its RF commands failed.
+ *
+ * Off by default: the tables take PROBE_COUNT * 16 + 18 bytes, about 430 bytes of the 2 KB of SRAM
+ * of an Uno, too much next to the readers of Multi_SEQ_Game. Enable them with CARD_STATS for the
+ * whole build, as LOG_LEVEL (see Log.h), e.g. in platform.local.txt:
+ *   compiler.cpp.extra_flags=-DCARD_STATS=1
+ * With CARD_STATS 0 the counters, the timing and the tables are compiled out, and print(), reset()
+ * and serve() do nothing.
+ *
+ * A sketch which doesn't otherwise read Serial runs serve() as a task: 'S' prints the counters,
+ * 'R' resets them. Output is one line per probe used:
+ *   STATS,<probe>,<count>,<failures>,<min us>,<max us>,<mean us>
+ * and one per MFRC522 status code returned by failed commands:
+ *   STATUS,<status>,<count>
+ */
+#ifndef CardStats_h
+#define CardStats_h
+
+#include <MFRC522.h>
+
+#ifndef CARD_STATS
+#define CARD_STATS 0
+#endif
+
+class CardStats {
+public:
+	//What is timed.
+	enum Probe
+		: byte {
+			//RF commands.
+			PROBE_AUTHENTICATE,
+		PROBE_READ,
+		PROBE_WRITE,
+		PROBE_GET_VALUE,
+		PROBE_SET_VALUE,
+		PROBE_INCREMENT,
+		PROBE_DECREMENT,
+		PROBE_TRANSFER,
+		PROBE_SELECT,		//Selecting the card again, after a failed authentication.
+		//CardUtil operations.
+		PROBE_CONFIGURE,
+		PROBE_RESET,
+		PROBE_PROVISION,
+		PROBE_CHECK_STATUS,
+		PROBE_GET_POINTS,
+		PROBE_ADD_POINTS,
+		PROBE_CHARGE_POINTS,
+		PROBE_GET_REWARDS,
+		PROBE_ADD_REWARDS,
+		PROBE_CHARGE_REWARDS,
+		PROBE_INIT_SEQUENCE,
+		PROBE_CHECK_SEQUENCE,
+		PROBE_TX_LOAD,
+		PROBE_TX_COMMIT,
+		PROBE_UPGRADE_KEYS,
+		PROBE_MIGRATE_LAYOUT,
+		PROBE_RECOVER_COMMIT,
+		PROBE_COUNT,
+	};
+
+#if CARD_STATS
+	typedef struct {
+		uint16_t count;
+		uint16_t failures;
+		uint32_t minUs;
+		uint32_t maxUs;
+		uint32_t sumUs;
+	} Entry;
+
+	/**
+	 * Times an operation, from construction to destruction.
+	 */
+	class Timer {
+	public:
+		Timer(Probe probe);
+		~Timer();
+	private:
+		Probe probe;
+		unsigned long startUs;
+		uint16_t startFailures;
+	};
+
+	/**
+	 * Starts timing an RF command. See CARD_TIMED.
+	 */
+	static void start() {
+		startUs = micros();
+	}
+
+	/**
+	 * Accounts for the RF command started last, returning its status.
+	 */
+	static MFRC522::StatusCode stop(Probe probe, MFRC522::StatusCode status);
+
+	static void print();
+	static void reset();
+	static void serve();
+
+	static Entry entries[PROBE_COUNT];
+	static uint16_t statusCounts[9];	// Failed RF commands by status code, STATUS_MIFARE_NACK last.
+	static uint16_t failures;			// Failed RF commands.
+
+private:
+	static void record(Probe probe, unsigned long us, bool failed);
+	static unsigned long startUs;
+#else
+	static void print() {
+	}
+	static void reset() {
+	}
+	static void serve() {
+	}
+#endif
+};
+
+#if CARD_STATS
+//Times an RF command, an expression returning MFRC522::StatusCode.
+#define CARD_TIMED(probe, call) (CardStats::start(), CardStats::stop(probe, (call)))
+//Times the enclosing operation.
+#define CARD_TIMER(probe) CardStats::Timer cardStatsTimer(probe)
+#else
+#define CARD_TIMED(probe, call) (call)
+#define CARD_TIMER(probe) do {} while (0)
+#endif
+
+#endif /* CardStats_h */
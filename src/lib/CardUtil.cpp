@@ -4,45 +4,180 @@
  */
 
 #include "CardUtil.h"
+#include "Log.h"
+#include "CardStats.h"
 extern HardwareSerial Serial;
 
-//Constructor
-CardUtil::CardUtil(MFRC522 _mfrc522) {
-	mfrc522 = _mfrc522;
-	// Prepare the default key (used both as key A and as key B)
-	// using FFFFFFFFFFFFh which is the default at chip delivery from the factory
-	for (byte i = 0; i < 6; i++) {
-		default_key.keyByte[i] = 0xFF;
-	}
-	// Prepare the secret key (used as key B)
-	for (int i = 0; i < 6; ++i) {
-		secret_key.keyByte[i] = secret_key_array_v1[i];
-	}
-	//Trailer Block
-	//secret key A
-	for (byte i = 0; i < 6; i++) {
-		trailerBlockData[i] = 0xFF;
-	}
-	//access bits
-	//Block Access 110
-	//Trailer Access 011
-	//0 1 1 never key B key A|B key B never key B
-	//1 1 0 key A|B key B key B key A|B value block[1]
-	//C1  C2  C3
-	//0   1   1
-	//1   1   0
-	//1   1   0
-	//1   1   0
-	//08 77 8F  
-	trailerBlockData[6] = 0x08;
-	trailerBlockData[7] = 0x77;
-	trailerBlockData[8] = 0x8F;
-	trailerBlockData[9] = 0x69;
-	//default Secret key B
-	for (byte i = 10; i < 16; i++) {
-		trailerBlockData[i] = secret_key_array_v1[i - 10];
+constexpr byte CardUtil::secret_key_array_v1[6];
+
+const MFRC522::MIFARE_Key CardUtil::secret_keys[1] = { { {
+		secret_key_array_v1[0], secret_key_array_v1[1], secret_key_array_v1[2],
+		secret_key_array_v1[3], secret_key_array_v1[4], secret_key_array_v1[5] } } };
+
+const MFRC522::MIFARE_Key &CardUtil::secret_key = CardUtil::secret_keys[secret_key_version - 1];
+
+// The default key (used both as key A and as key B)
+// FFFFFFFFFFFFh which is the default at chip delivery from the factory
+const MFRC522::MIFARE_Key CardUtil::default_key = { { 0xFF, 0xFF, 0xFF, 0xFF,
+		0xFF, 0xFF } };
+
+//Access conditions, as C1 C2 C3.
+#define ACCESS_DATA_VALUE	0x6	// 110 Data blocks: key A|B read/decrement, key B write/increment. Value blocks.
+#define ACCESS_TRAILER		0x3	// 011 Trailer: key A|B read access bits, key B writes keys and access bits.
+
+/**
+ * Bit c (C1 = 2, C2 = 1, C3 = 0) of the access conditions of the 4 blocks of a sector, block 0 in bit 0.
+ */
+static constexpr byte accessBits(byte c, byte block0, byte block1, byte block2,
+		byte trailer) {
+	return ((block0 >> c) & 1) | ((block1 >> c) & 1) << 1
+			| ((block2 >> c) & 1) << 2 | ((trailer >> c) & 1) << 3;
+}
+
+/**
+ * Bytes 6 to 8 of a trailer for the given access conditions, each bit stored inverted and straight.
+ */
+static constexpr byte accessByte6(byte b0, byte b1, byte b2, byte t) {
+	return (~accessBits(1, b0, b1, b2, t) & 0x0F) << 4
+			| (~accessBits(2, b0, b1, b2, t) & 0x0F);
+}
+static constexpr byte accessByte7(byte b0, byte b1, byte b2, byte t) {
+	return accessBits(2, b0, b1, b2, t) << 4
+			| (~accessBits(0, b0, b1, b2, t) & 0x0F);
+}
+static constexpr byte accessByte8(byte b0, byte b1, byte b2, byte t) {
+	return accessBits(0, b0, b1, b2, t) << 4 | accessBits(1, b0, b1, b2, t);
+}
+
+//Trailer Block: secret key A, access bits 08 77 8F, user byte, secret key B.
+const byte CardUtil::trailerBlockData[16] PROGMEM = { 0xFF, 0xFF, 0xFF, 0xFF,
+		0xFF, 0xFF,
+		accessByte6(ACCESS_DATA_VALUE, ACCESS_DATA_VALUE, ACCESS_DATA_VALUE, ACCESS_TRAILER),
+		accessByte7(ACCESS_DATA_VALUE, ACCESS_DATA_VALUE, ACCESS_DATA_VALUE, ACCESS_TRAILER),
+		accessByte8(ACCESS_DATA_VALUE, ACCESS_DATA_VALUE, ACCESS_DATA_VALUE, ACCESS_TRAILER),
+		0x69, secret_key_array_v1[0], secret_key_array_v1[1],
+		secret_key_array_v1[2], secret_key_array_v1[3], secret_key_array_v1[4],
+		secret_key_array_v1[5] };
+
+/**
+ * State block value of a sequence game, see CardUtil.h.
+ */
+static int32_t seqState(byte game, int32_t step, byte length) {
+	if (step < 0)
+		return -1;
+	return step | (int32_t) length << 8 | (int32_t) game << 16;
+}
+
+/**
+ * Current step in a state block value, -1 if the game isn't in progress. Sets the length.
+ * Cards configured before the games had a length hold a step only: no game is in progress on them.
+ */
+static int32_t seqStep(int32_t state, byte game, byte *length) {
+	byte step = state & 0xFF;
+	*length = (state >> 8) & 0xFF;
+	if (state < 0 || (state >> 16) != game || *length == 0 || step >= *length) {
+		*length = 0;
+		return -1;
 	}
+	return step;
+}
+
+/**
+ * Block holding the given step of the game starting at the given sector.
+ * Steps are counted after the 8 nibbles of the rewards, over the data blocks but the state.
+ */
+static byte seqStepBlock(byte sector, int32_t step) {
+	byte index = 1 + (step + 8) / 32;
+	return (sector + index / 3) * 4 + index % 3;
+}
+
+/**
+ * The given step, out of the block holding it.
+ */
+static byte seqStepOf(const byte *block, int32_t step) {
+	byte nibble = (step + 8) % 32;
+	return nibble & 1 ? block[nibble / 2] & 0x0F : block[nibble / 2] >> 4;
+}
+
+//Bytes of the hot block of a v2 card, see CardUtil.h.
+static const byte HOT_COUNTER = 0;
+static const byte HOT_STEP = 4;
+static const byte HOT_LENGTH = 5;
+static const byte HOT_REWARDS = 6;
+static const byte HOT_STEPS = 10;
+static const byte HOT_LAYOUT = 15;
+
+static int32_t getInt32(const byte *bytes) {
+	return (int32_t) ((uint32_t) bytes[0] | (uint32_t) bytes[1] << 8
+			| (uint32_t) bytes[2] << 16 | (uint32_t) bytes[3] << 24);
+}
+
+static void putInt32(byte *bytes, int32_t value) {
+	for (byte i = 0; i < 4; i++)
+		bytes[i] = value >> (8 * i);
+}
+
+//Byte HOT_LAYOUT: the layout in the low nibble, the balance whose commit the hot block records
+//in the high one, see CardUtil::Transaction.
+static const byte HOT_LAYOUT_MASK = 0x0F;
+static const byte HOT_RECORD_SHIFT = 4;
+
+/**
+ * State block value of sequence game 0, out of a hot block.
+ */
+static int32_t hotState(const byte *hot) {
+	return seqState(0, hot[HOT_STEP] < hot[HOT_LENGTH] ? hot[HOT_STEP] : -1,
+			hot[HOT_LENGTH]);
+}
+
+static void setHotState(byte *hot, int32_t step, byte length) {
+	hot[HOT_STEP] = step < 0 ? 0xFF : step;
+	hot[HOT_LENGTH] = step < 0 ? 0 : length;
+}
+
+/**
+ * The given step, out of a hot block. Step below HOT_SEQ_STEPS.
+ */
+static byte hotStepOf(const byte *hot, int32_t step) {
+	byte steps = hot[HOT_STEPS + step / 2];
+	return step & 1 ? steps & 0x0F : steps >> 4;
+}
+
+static void setHotStep(byte *hot, int32_t step, byte value) {
+	byte &steps = hot[HOT_STEPS + step / 2];
+	steps = step & 1 ? (steps & 0xF0) | value : (steps & 0x0F) | value << 4;
+}
+
+//Constructor
+CardUtil::CardUtil(MFRC522 &_mfrc522) :
+		mfrc522(_mfrc522) {
+	clearAuthentication();
+	nativeValueOps = true;
+	journal = NULL;
+	log = NULL;
+	cache = NULL;
+	writeCounter = 0;
+	writeCounterKnown = false;
+	keyRing = NULL;
+	keyVersion = 0;
+	staleKeys = false;
+	layout = LAYOUT_V2;
+	cardLayout = LAYOUT_UNKNOWN;
+	recovered = false;
+	journalFailed = false;
+}
+
+void CardUtil::rebind() {
+	clearAuthentication();
+	writeCounterKnown = false;
+	cardLayout = LAYOUT_UNKNOWN;
+	keyVersion = 0;
+	staleKeys = false;
+	recovered = false;
+	journalFailed = false;
 }
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
 /**
  *  Helper routine to dump a byte array as hex values to Serial.
  */
@@ -52,13 +187,427 @@ void dump_byte_array(byte *buffer, byte bufferSize) {
 		Serial.print(buffer[i], HEX);
 	}
 }
+#endif
 
 CardUtil::Status CardUtil::stop() {
+	if (cardLayout == LAYOUT_V1 && layout == LAYOUT_V2) {
+		CARD_TIMER(CardStats::PROBE_MIGRATE_LAYOUT);
+		MFRC522::StatusCode status = migrateLayout();
+		if (status != MFRC522::STATUS_OK) {
+			//The card is still a v1 one, the next tap tries again.
+			LOG_ERROR(F("Migrating the layout failed: "));
+			LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
+		}
+	}
+	if (staleKeys) {
+		CARD_TIMER(CardStats::PROBE_UPGRADE_KEYS);
+		MFRC522::StatusCode status = upgradeKeys();
+		if (status != MFRC522::STATUS_OK) {
+			//The card works on its old keys, the next tap tries again.
+			LOG_ERROR(F("Upgrading the keys failed: "));
+			LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
+		}
+	}
 	//Finish
 	// Halt PICC
 	mfrc522.PICC_HaltA();
 	// Stop encryption on PCD
 	mfrc522.PCD_StopCrypto1();
+	clearAuthentication();
+	writeCounterKnown = false;
+	cardLayout = LAYOUT_UNKNOWN;
+	keyVersion = 0;
+	staleKeys = false;
+	recovered = false;
+	journalFailed = false;
+	Status returnStatus;
+	memset(&returnStatus, 0, sizeof(returnStatus));
+	returnStatus.code = STATUS_OK;
+	return returnStatus;
+}
+
+MFRC522::StatusCode CardUtil::authenticate(MFRC522::PICC_Command cmd,
+		byte trailerBlock, const MFRC522::MIFARE_Key* key) {
+	//The card holds one authenticated sector at a time. Skip the exchange if it's the one asked for.
+	if (authenticatedBlock == trailerBlock && authenticatedCmd == cmd
+			&& memcmp(authenticatedKey.keyByte, key->keyByte,
+					MFRC522::MF_KEY_SIZE) == 0
+			&& authenticatedUid.size == mfrc522.uid.size
+			&& memcmp(authenticatedUid.uidByte, mfrc522.uid.uidByte,
+					mfrc522.uid.size) == 0) {
+		return MFRC522::STATUS_OK;
+	}
+	clearAuthentication();
+	//The library takes the key as non const, but only reads it.
+	MFRC522::StatusCode status = CARD_TIMED(CardStats::PROBE_AUTHENTICATE,
+			mfrc522.PCD_Authenticate(cmd, trailerBlock,
+					const_cast<MFRC522::MIFARE_Key*>(key), &(mfrc522.uid)));
+	if (status == MFRC522::STATUS_OK) {
+		authenticatedBlock = trailerBlock;
+		authenticatedCmd = cmd;
+		authenticatedKey = *key;
+		authenticatedUid = mfrc522.uid;
+	}
+	return status;
+}
+
+void CardUtil::clearAuthentication() {
+	authenticatedBlock = NO_BLOCK;
+}
+
+MFRC522::StatusCode CardUtil::authenticateSecured(byte trailerBlock) {
+	if (keyRing == NULL)
+		return authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_B, trailerBlock,
+				&secret_key);
+	//The version of the previous sector, else the one remembered for the card, else the current one.
+	byte expected =
+			keyVersion != 0 ? keyVersion : keyRing->versionOf(mfrc522.uid);
+	MFRC522::StatusCode status = MFRC522::STATUS_ERROR;
+	bool failed = false;
+	//The expected version, then the others newest first.
+	for (byte i = 0; i <= KEY_RING_SIZE; i++) {
+		byte version = i == 0 ? expected : KEY_RING_SIZE + 1 - i;
+		const MFRC522::MIFARE_Key *key = keyRing->key(version);
+		if (key == NULL || (i > 0 && version == expected))
+			continue;
+		if (failed) {
+			status = reselect();
+			if (status != MFRC522::STATUS_OK)
+				return status;
+			keyRing->retries++;
+			LOG_DEBUG(F("Trying key version "));
+			LOG_DEBUGLN(version);
+		}
+		status = authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_B, trailerBlock,
+				key);
+		if (status == MFRC522::STATUS_OK) {
+			if (keyVersion == 0 && i == 0 && version != keyRing->current())
+				keyRing->hits++;
+			if (version != keyVersion) {
+				keyVersion = version;
+				keyRing->remember(mfrc522.uid, version);
+			}
+			if (version != keyRing->current() && keyRing->upgrading())
+				staleKeys = true;
+			return status;
+		}
+		failed = true;
+	}
+	return status;
+}
+
+MFRC522::StatusCode CardUtil::reselect() {
+	clearAuthentication();
+	mfrc522.PCD_StopCrypto1();
+	byte atqa[2];
+	byte size = sizeof(atqa);
+	MFRC522::StatusCode status = CARD_TIMED(CardStats::PROBE_SELECT,
+			mfrc522.PICC_WakeupA(atqa, &size));
+	//All the bits of the UID known: only this card answers.
+	if (status == MFRC522::STATUS_OK)
+		status = CARD_TIMED(CardStats::PROBE_SELECT,
+				mfrc522.PICC_Select(&mfrc522.uid, mfrc522.uid.size * 8));
+	return status;
+}
+
+const MFRC522::MIFARE_Key *CardUtil::secretKey(byte version) {
+	return version >= 1
+			&& version <= sizeof(secret_keys) / sizeof(secret_keys[0]) ?
+			&secret_keys[version - 1] : NULL;
+}
+
+const MFRC522::MIFARE_Key *CardUtil::currentKey() {
+	return keyRing != NULL ? keyRing->key(keyRing->current()) : &secret_key;
+}
+
+byte CardUtil::currentKeyVersion() {
+	return keyRing != NULL ? keyRing->current() : secret_key_version;
+}
+
+MFRC522::StatusCode CardUtil::upgradeKeys() {
+	byte version = keyRing->current();
+	LOG_DEBUG(F("Upgrading the keys to version "));
+	LOG_DEBUGLN(version);
+	byte trailer[16];
+	memcpy_P(trailer, trailerBlockData, sizeof(trailer));
+	memcpy(trailer + 10, currentKey()->keyByte, MFRC522::MF_KEY_SIZE);
+	MFRC522::StatusCode status;
+	for (byte trailerBlock = PLAYER_SECTOR * 4 + 3; trailerBlock < 64;
+			trailerBlock += 4) {
+		status = authenticateSecured(trailerBlock);
+		if (status != MFRC522::STATUS_OK)
+			return status;
+		//Upgraded already, by a tap torn during the upgrade.
+		if (keyVersion == version)
+			continue;
+		status = CARD_TIMED(CardStats::PROBE_WRITE,
+				mfrc522.MIFARE_Write(trailerBlock, trailer, 16));
+		//The sector's keys changed, authenticate again for further access.
+		clearAuthentication();
+		if (status != MFRC522::STATUS_OK)
+			return status;
+	}
+	staleKeys = false;
+	keyVersion = version;
+	keyRing->remember(mfrc522.uid, version);
+	keyRing->upgrades++;
+	//The key version block, that provision() tells configured cards by.
+	status = authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_A,
+			GLOBAL_SECTOR * 4 + 3, &default_key);
+	if (status == MFRC522::STATUS_OK)
+		status = CARD_TIMED(CardStats::PROBE_SET_VALUE,
+				mfrc522.MIFARE_SetValue(GLOBAL_SECTOR * 4 + 2, version));
+	return status;
+}
+
+MFRC522::StatusCode CardUtil::readKeyVersion(int32_t *keyVersion) {
+	//The global sector keeps the default keys, its key A reads the version.
+	LOG_DEBUGLN(F("Authenticating using key A..."));
+	MFRC522::StatusCode status = authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_A,
+			GLOBAL_SECTOR * 4 + 3, &default_key);
+	if (status != MFRC522::STATUS_OK)
+		return status;
+	//Read Key Version used last time encoded.
+	status = CARD_TIMED(CardStats::PROBE_GET_VALUE,
+			mfrc522.MIFARE_GetValue(GLOBAL_SECTOR * 4 + 2, keyVersion));
+	if (status != MFRC522::STATUS_OK)
+		return status;
+	LOG_DEBUG(F("Key version: "));
+	LOG_DEBUGLN((int) *keyVersion);
+	//A new card has anything but a known version there.
+	if (*keyVersion < 1 || *keyVersion > 0xFF
+			|| (keyRing != NULL ?
+					keyRing->key(*keyVersion) : secretKey(*keyVersion)) == NULL)
+		*keyVersion = 0;
+	return status;
+}
+
+void CardUtil::setNativeValueOps(bool enable) {
+	nativeValueOps = enable;
+}
+
+void CardUtil::setJournal(Journal *journal) {
+	this->journal = journal;
+}
+
+void CardUtil::setLog(Log *log) {
+	this->log = log;
+}
+
+void CardUtil::setCache(CardCache *cache) {
+	this->cache = cache;
+}
+
+void CardUtil::setLayout(Layout layout) {
+	this->layout = layout;
+}
+
+void CardUtil::setKeyRing(KeyRing *keyRing) {
+	this->keyRing = keyRing;
+	keyVersion = 0;
+	staleKeys = false;
+}
+
+MFRC522::StatusCode CardUtil::readWriteCounter() {
+	if (writeCounterKnown)
+		return MFRC522::STATUS_OK;
+	MFRC522::StatusCode status = authenticateSecured(PLAYER_SECTOR * 4 + 3);
+	byte size = sizeof(hotBlock);
+	//As much as MIFARE_GetValue, and the whole hot block of a v2 card.
+	if (status == MFRC522::STATUS_OK)
+		status = CARD_TIMED(CardStats::PROBE_READ,
+				mfrc522.MIFARE_Read(WRITE_COUNTER_BLOCK, hotBlock, &size));
+	writeCounterKnown = status == MFRC522::STATUS_OK;
+	cardLayout = LAYOUT_UNKNOWN;
+	if (writeCounterKnown) {
+		writeCounter = getInt32(hotBlock + HOT_COUNTER);
+		cardLayout = (hotBlock[HOT_LAYOUT] & HOT_LAYOUT_MASK) == LAYOUT_V2 ?
+				LAYOUT_V2 : LAYOUT_V1;
+		//The commit the hot block records may be torn: finish it before anything else is read.
+		if (commitRecorded())
+			status = recoverCommit();
+	}
+	return status;
+}
+
+bool CardUtil::commitRecorded() {
+	return cardLayout == LAYOUT_V2
+			&& (hotBlock[HOT_LAYOUT] >> HOT_RECORD_SHIFT) != 0;
+}
+
+MFRC522::StatusCode CardUtil::recoverCommit() {
+	CARD_TIMER(CardStats::PROBE_RECOVER_COMMIT);
+	byte field = hotBlock[HOT_LAYOUT] >> HOT_RECORD_SHIFT;
+	byte blockAddr = PLAYER_SECTOR * 4
+			+ (field == Transaction::FIELD_REWARDS ? 1 : 0);
+	int32_t target = getInt32(hotBlock + HOT_COUNTER);
+	int32_t value;
+	LOG_DEBUGLN(F("Checking the balance of the commit recorded"));
+	MFRC522::StatusCode status = CARD_TIMED(CardStats::PROBE_GET_VALUE,
+			mfrc522.MIFARE_GetValue(blockAddr, &value));
+	if (status == MFRC522::STATUS_OK && value != target) {
+		status = CARD_TIMED(CardStats::PROBE_SET_VALUE,
+				mfrc522.MIFARE_SetValue(blockAddr, target));
+		if (status == MFRC522::STATUS_OK) {
+			journalChange(blockAddr, target - value);
+			recovered = true;
+			LOG_EVENT(F("Torn commit recovered, balance written: "));
+			LOG_EVENTLN(field);
+			if (log != NULL)
+				log->event(Log::EVENT_COMMIT_RECOVERED, mfrc522.uid, field);
+		}
+	}
+	if (status != MFRC522::STATUS_OK) {
+		//Still recorded: the next tap tries again.
+		writeCounterKnown = false;
+		cardLayout = LAYOUT_UNKNOWN;
+	}
+	return status;
+}
+
+MFRC522::StatusCode CardUtil::migrateLayout() {
+	LOG_DEBUGLN(F("Migrating the card to layout v2"));
+	//Game 0 as v1 keeps it: the state, then the rewards and the first steps.
+	MFRC522::StatusCode status = authenticateSecured(SEQ_GAME_SECTOR * 4 + 3);
+	int32_t state = -1;
+	if (status == MFRC522::STATUS_OK)
+		status = CARD_TIMED(CardStats::PROBE_GET_VALUE,
+				mfrc522.MIFARE_GetValue(SEQ_GAME_SECTOR * 4, &state));
+	byte seqBlock[18];
+	byte size = sizeof(seqBlock);
+	if (status == MFRC522::STATUS_OK)
+		status = CARD_TIMED(CardStats::PROBE_READ,
+				mfrc522.MIFARE_Read(SEQ_GAME_SECTOR * 4 + 1, seqBlock, &size));
+	if (status != MFRC522::STATUS_OK)
+		return status;
+
+	byte block[16];
+	memset(block, 0, sizeof(block));
+	int32_t counter = writeCounter + 1;
+	putInt32(block + HOT_COUNTER, counter);
+	byte length;
+	int32_t curStep = seqStep(state, 0, &length);
+	setHotState(block, curStep, length);
+	memcpy(block + HOT_REWARDS, seqBlock, 4);
+	for (byte step = 0; step < HOT_SEQ_STEPS && step < length; step++)
+		setHotStep(block, step, seqStepOf(seqBlock, step));
+	block[HOT_LAYOUT] = LAYOUT_V2;
+
+	status = authenticateSecured(PLAYER_SECTOR * 4 + 3);
+	if (status != MFRC522::STATUS_OK)
+		return status;
+	uncache();
+	status = CARD_TIMED(CardStats::PROBE_WRITE,
+			mfrc522.MIFARE_Write(WRITE_COUNTER_BLOCK, block, sizeof(block)));
+	if (status == MFRC522::STATUS_OK) {
+		memcpy(hotBlock, block, sizeof(block));
+		writeCounter = counter;
+		cardLayout = LAYOUT_V2;
+	} else {
+		writeCounterKnown = false;
+		cardLayout = LAYOUT_UNKNOWN;
+	}
+	return status;
+}
+
+MFRC522::StatusCode CardUtil::bumpWriteCounter(byte recordField,
+		int32_t target) {
+	MFRC522::StatusCode status = readWriteCounter();
+	//Read earlier in the tap, the sector of a game may be authenticated since.
+	if (status == MFRC522::STATUS_OK)
+		status = authenticateSecured(PLAYER_SECTOR * 4 + 3);
+	if (status != MFRC522::STATUS_OK)
+		return status;
+	LOG_DEBUGLN(F("Changing the write counter"));
+	uncache();
+	//The counter a record took the place of is lost: start anywhere again, as configure() does.
+	int32_t counter =
+			recordField != 0 ? target :
+			commitRecorded() ? (int32_t) micros() : writeCounter + 1;
+	if (cardLayout == LAYOUT_V2) {
+		putInt32(hotBlock + HOT_COUNTER, counter);
+		hotBlock[HOT_LAYOUT] = LAYOUT_V2 | recordField << HOT_RECORD_SHIFT;
+		status = CARD_TIMED(CardStats::PROBE_WRITE,
+				mfrc522.MIFARE_Write(WRITE_COUNTER_BLOCK, hotBlock, 16));
+	} else {
+		status = CARD_TIMED(CardStats::PROBE_SET_VALUE,
+				mfrc522.MIFARE_SetValue(WRITE_COUNTER_BLOCK, counter));
+	}
+	if (status == MFRC522::STATUS_OK) {
+		writeCounter = counter;
+	} else {
+		writeCounterKnown = false;
+		cardLayout = LAYOUT_UNKNOWN;
+	}
+	return status;
+}
+
+MFRC522::StatusCode CardUtil::cachedEntry(CardCache::Entry **entry) {
+	*entry = NULL;
+	if (cache == NULL)
+		return MFRC522::STATUS_OK;
+	MFRC522::StatusCode status = readWriteCounter();
+	//A recorded commit holds no counter to tell the entry is up to date by.
+	if (status != MFRC522::STATUS_OK || commitRecorded())
+		return status;
+	*entry = cache->insert(mfrc522.uid);
+	if ((*entry)->fields != 0 && (*entry)->writeCounter == writeCounter) {
+		cache->hits++;
+		LOG_DEBUGLN(F("Card state cached"));
+	} else {
+		cache->misses++;
+		(*entry)->fields = 0;
+		(*entry)->writeCounter = writeCounter;
+	}
+	return MFRC522::STATUS_OK;
+}
+
+void CardUtil::uncache() {
+	if (cache != NULL)
+		cache->remove(mfrc522.uid);
+}
+
+MFRC522::StatusCode CardUtil::changeValue(byte blockAddr, int32_t delta,
+		int32_t newValue) {
+	MFRC522::StatusCode status;
+	if (!nativeValueOps) {
+		status = CARD_TIMED(CardStats::PROBE_SET_VALUE,
+				mfrc522.MIFARE_SetValue(blockAddr, newValue));
+	} else {
+		//Let the card do the arithmetic in its value register and commit it in one Transfer.
+		if (delta >= 0)
+			status = CARD_TIMED(CardStats::PROBE_INCREMENT,
+					mfrc522.MIFARE_Increment(blockAddr, delta));
+		else
+			status = CARD_TIMED(CardStats::PROBE_DECREMENT,
+					mfrc522.MIFARE_Decrement(blockAddr, -delta));
+		if (status == MFRC522::STATUS_OK)
+			status = CARD_TIMED(CardStats::PROBE_TRANSFER,
+					mfrc522.MIFARE_Transfer(blockAddr));
+	}
+	if (status == MFRC522::STATUS_OK)
+		journalChange(blockAddr, delta);
+	return status;
+}
+
+void CardUtil::journalChange(byte blockAddr, int32_t delta, bool set) {
+	if (journal == NULL)
+		return;
+	Journal::EntryType type;
+	if (blockAddr == PLAYER_SECTOR * 4)
+		type = set ? Journal::ENTRY_POINTS_SET : Journal::ENTRY_POINTS;
+	else
+		type = set ? Journal::ENTRY_REWARDS_SET : Journal::ENTRY_REWARDS;
+	if (!journal->append(type, Log::packUid(mfrc522.uid), delta)) {
+		LOG_ERRORLN(F("Journal write failed"));
+		journalFailed = true;
+	}
+}
+
+CardUtil::StatusCode CardUtil::successCode() {
+	StatusCode code = journalFailed ? STATUS_JOURNAL_FAILED : STATUS_OK;
+	journalFailed = false;
+	return code;
 }
 
 CardUtil::Status CardUtil::configure() {
@@ -69,22 +618,18 @@ CardUtil::Status CardUtil::configure(int32_t numPoints) {
 	return configure(numPoints, &default_key, MFRC522::PICC_CMD_MF_AUTH_KEY_A);
 }
 
-CardUtil::Status CardUtil::configure(int32_t numPoints,
-		MFRC522::MIFARE_Key* auth_key, MFRC522::PICC_Command cmd) {
-	Status returnStatus;
+MFRC522::StatusCode CardUtil::writeGlobalInfo() {
 	//Global Info
 	byte trailerBlock = GLOBAL_SECTOR * 4 + 3;
-	byte status;
+	MFRC522::StatusCode status;
 	// Authenticate using global_key as Key A
-	Serial.println(F("Authenticating using key A..."));
-	status = mfrc522.PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_A,
-			trailerBlock, &default_key, &(mfrc522.uid));
+	LOG_DEBUGLN(F("Authenticating using key A..."));
+	status = authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_A, trailerBlock,
+			&default_key);
 	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("PCD_Authenticate() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
-		returnStatus.mfrc522StatusCode = status;
-		returnStatus.code = STATUS_ERROR_WITH_CARD;
-		return returnStatus;
+		LOG_ERROR(F("PCD_Authenticate() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
+		return status;
 	}
 
 	byte blockAddr = 1;
@@ -93,148 +638,188 @@ CardUtil::Status CardUtil::configure(int32_t numPoints,
 			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
 
 	// Write date and version
-	Serial.print(F("Writing date into block "));
-	Serial.print(blockAddr);
-	Serial.println(F(" ..."));
-	dump_byte_array(dataBlock, 16);
-	Serial.println();
-	status = mfrc522.MIFARE_Write(blockAddr, dataBlock, 16);
+	LOG_DEBUG(F("Writing date into block "));
+	LOG_DEBUG(blockAddr);
+	LOG_DEBUGLN(F(" ..."));
+	LOG_DEBUG_BYTES(dataBlock, 16);
+	LOG_DEBUGLN();
+	status = CARD_TIMED(CardStats::PROBE_WRITE,
+			mfrc522.MIFARE_Write(blockAddr, dataBlock, 16));
 	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("MIFARE_Write() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
-		returnStatus.mfrc522StatusCode = status;
-		returnStatus.code = STATUS_ERROR_WITH_CARD;
-		return returnStatus;
+		LOG_ERROR(F("MIFARE_Write() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
+		return status;
 	}
-	Serial.println();
+	LOG_DEBUGLN();
 
 	blockAddr++;
-	Serial.print(F("Writing key version into block "));
-	Serial.print(blockAddr);
-	Serial.println(F(" ..."));
-	status = mfrc522.MIFARE_SetValue(blockAddr, secret_key_version);
+	LOG_DEBUG(F("Writing key version into block "));
+	LOG_DEBUG(blockAddr);
+	LOG_DEBUGLN(F(" ..."));
+	status = CARD_TIMED(CardStats::PROBE_SET_VALUE,
+			mfrc522.MIFARE_SetValue(blockAddr, currentKeyVersion()));
 	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("MIFARE_Write() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
-		returnStatus.mfrc522StatusCode = status;
-		returnStatus.code = STATUS_ERROR_WITH_CARD;
-		return returnStatus;
+		LOG_ERROR(F("MIFARE_Write() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
+		return status;
 	}
-	Serial.println(secret_key_version);
-
-	//Player Info
-	trailerBlock = PLAYER_SECTOR * 4 + 3;
-	// Authenticate using auth_key
-	Serial.print(F("Authenticating using "));
-	Serial.println(cmd);
-	status = mfrc522.PCD_Authenticate(cmd, trailerBlock, auth_key,
-			&(mfrc522.uid));
-	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("PCD_Authenticate() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
-		returnStatus.mfrc522StatusCode = status;
-		returnStatus.code = STATUS_ERROR_WITH_CARD;
-		return returnStatus;
-	}
-
-	blockAddr = PLAYER_SECTOR * 4;
+	LOG_DEBUGLN(currentKeyVersion());
+	return status;
+}
 
-	// Write numPoints
-	Serial.print(F("Writing numPoints into block "));
-	Serial.print(blockAddr);
-	Serial.println(F(" ..."));
-	status = mfrc522.MIFARE_SetValue(blockAddr, numPoints);
-	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("MIFARE_Write() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
-		returnStatus.mfrc522StatusCode = status;
-		returnStatus.code = STATUS_ERROR_WITH_CARD;
-		return returnStatus;
+CardUtil::Status CardUtil::configure(int32_t numPoints,
+		const MFRC522::MIFARE_Key* auth_key, MFRC522::PICC_Command cmd) {
+	CARD_TIMER(CardStats::PROBE_CONFIGURE);
+	Status returnStatus;
+	memset(&returnStatus, 0, sizeof(returnStatus));
+	MFRC522::StatusCode status;
+	//The data blocks of a new card are blank, holding no game. Those of a card used before
+	//may hold other games than game 0 in progress.
+	bool reused = memcmp(auth_key->keyByte, default_key.keyByte,
+			sizeof(default_key.keyByte)) != 0;
+	//A card used before gets its global info last: its first secured sector tells it's one of ours,
+	//before anything is written.
+	if (!reused) {
+		status = writeGlobalInfo();
+		if (status != MFRC522::STATUS_OK) {
+			returnStatus.mfrc522StatusCode = status;
+			clearAuthentication();
+			returnStatus.code = STATUS_ERROR_WITH_CARD;
+			return returnStatus;
+		}
 	}
-	Serial.println(numPoints);
 
-	blockAddr++;
+	//Player Info, Seq Game Info and the trailers, sector by sector.
+	//The data of a sector is written under the same authentication as its trailer,
+	//so each sector is authenticated once.
+	byte trailer[16];
+	memcpy_P(trailer, trailerBlockData, sizeof(trailer));
+	memcpy(trailer + 10, currentKey()->keyByte, MFRC522::MF_KEY_SIZE);
 	int32_t numRewards = 0;
-	// Write numRewards
-	Serial.print(F("Writing numRewards into block "));
-	Serial.print(blockAddr);
-	Serial.println(F(" ..."));
-	status = mfrc522.MIFARE_SetValue(blockAddr, numRewards);
-	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("MIFARE_Write() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
-		returnStatus.mfrc522StatusCode = status;
-		returnStatus.code = STATUS_ERROR_WITH_CARD;
-		return returnStatus;
-	}
-	Serial.println(numRewards);
-
-	//Seq Game Info
-	trailerBlock = SEQ_GAME_SECTOR * 4 + 3;
-	// Authenticate using auth_key
-	Serial.print(F("Authenticating using "));
-	Serial.println(cmd);
-	status = mfrc522.PCD_Authenticate(cmd, trailerBlock, auth_key,
-			&(mfrc522.uid));
-	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("PCD_Authenticate() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
-		returnStatus.mfrc522StatusCode = status;
-		returnStatus.code = STATUS_ERROR_WITH_CARD;
-		return returnStatus;
-	}
+	int32_t cur_seq = -1;
+	byte trailerBlock = PLAYER_SECTOR * 4 + 3;
+	byte blockAddr;
+	while (trailerBlock <= 64) {
+		//Authenticate the sector. With a key ring, a card used before may be on any of its versions.
+		LOG_DEBUG(F("Authenticating using "));
+		LOG_DEBUGLN(cmd);
+		if (reused && keyRing != NULL)
+			status = authenticateSecured(trailerBlock);
+		else
+			status = authenticate(cmd, trailerBlock, auth_key);
+		if (status != MFRC522::STATUS_OK) {
+			LOG_ERROR(F("PCD_Authenticate() failed: "));
+			LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
+			returnStatus.mfrc522StatusCode = status;
+			clearAuthentication();
+			returnStatus.code = CardUtil::STATUS_ERROR_WITH_CARD;
+			return returnStatus;
+		}
 
-	blockAddr = SEQ_GAME_SECTOR * 4;
+		if (trailerBlock == PLAYER_SECTOR * 4 + 3) {
+			//Start the write counter anywhere, so that no cache takes the new state for an old one.
+			uncache();
+			writeCounter = (int32_t) micros();
+			if (layout == LAYOUT_V2) {
+				//No game 0 in progress.
+				memset(hotBlock, 0, sizeof(hotBlock));
+				putInt32(hotBlock + HOT_COUNTER, writeCounter);
+				setHotState(hotBlock, -1, 0);
+				hotBlock[HOT_LAYOUT] = LAYOUT_V2;
+				status = CARD_TIMED(CardStats::PROBE_WRITE,
+						mfrc522.MIFARE_Write(WRITE_COUNTER_BLOCK, hotBlock, 16));
+			} else {
+				status = CARD_TIMED(CardStats::PROBE_SET_VALUE,
+						mfrc522.MIFARE_SetValue(WRITE_COUNTER_BLOCK,
+								writeCounter));
+			}
+			writeCounterKnown = status == MFRC522::STATUS_OK;
+			cardLayout = writeCounterKnown ? layout : LAYOUT_UNKNOWN;
 
-	// Write Current seq
-	int32_t cur_seq = -1;
-	Serial.print(F("Writing Current Seq into block "));
-	Serial.print(blockAddr);
-	Serial.println(F(" ..."));
-	status = mfrc522.MIFARE_SetValue(blockAddr, cur_seq);
-	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("MIFARE_Write() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
-		returnStatus.mfrc522StatusCode = status;
-		returnStatus.code = STATUS_ERROR_WITH_CARD;
-		return returnStatus;
-	}
-	Serial.println(cur_seq);
+			// Write numPoints
+			blockAddr = PLAYER_SECTOR * 4;
+			if (status == MFRC522::STATUS_OK) {
+				LOG_DEBUG(F("Writing numPoints into block "));
+				LOG_DEBUG(blockAddr);
+				LOG_DEBUGLN(F(" ..."));
+				status = CARD_TIMED(CardStats::PROBE_SET_VALUE,
+						mfrc522.MIFARE_SetValue(blockAddr, numPoints));
+				if (status == MFRC522::STATUS_OK)
+					journalChange(blockAddr, numPoints, true);
+				LOG_DEBUGLN(numPoints);
+			}
 
-	//Encode all trailer blocks to be secured for Violet's use only.
-	trailerBlock = PLAYER_SECTOR * 4 + 3;
-	while (trailerBlock <= 64) {
-		//Authenticate the sector
-		// Authenticate using global_key as Key A
-		Serial.print(F("Authenticating using "));
-		Serial.println(cmd);
-		status = mfrc522.PCD_Authenticate(cmd, trailerBlock, auth_key,
-				&(mfrc522.uid));
+			// Write numRewards
+			blockAddr++;
+			if (status == MFRC522::STATUS_OK) {
+				LOG_DEBUG(F("Writing numRewards into block "));
+				LOG_DEBUG(blockAddr);
+				LOG_DEBUGLN(F(" ..."));
+				status = CARD_TIMED(CardStats::PROBE_SET_VALUE,
+						mfrc522.MIFARE_SetValue(blockAddr, numRewards));
+				if (status == MFRC522::STATUS_OK)
+					journalChange(blockAddr, numRewards, true);
+				LOG_DEBUGLN(numRewards);
+			}
+		} else if (trailerBlock == SEQ_GAME_SECTOR * 4 + 3
+				|| (reused && trailerBlock / 4 > SEQ_GAME_SECTOR
+				&& (trailerBlock / 4 - SEQ_GAME_SECTOR) % SEQ_GAME_SLOT_SECTORS == 0
+				&& (trailerBlock / 4 - SEQ_GAME_SECTOR) / SEQ_GAME_SLOT_SECTORS < SEQ_GAMES)) {
+			// Write Current seq, of every sequence game.
+			blockAddr = trailerBlock - 3;
+			LOG_DEBUG(F("Writing Current Seq into block "));
+			LOG_DEBUG(blockAddr);
+			LOG_DEBUGLN(F(" ..."));
+			status = CARD_TIMED(CardStats::PROBE_SET_VALUE,
+					mfrc522.MIFARE_SetValue(blockAddr, cur_seq));
+			LOG_DEBUGLN(cur_seq);
+		}
 		if (status != MFRC522::STATUS_OK) {
-			Serial.print(F("PCD_Authenticate() failed: "));
-			Serial.println(mfrc522.GetStatusCodeName(status));
+			LOG_ERROR(F("MIFARE_Write() failed: "));
+			LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 			returnStatus.mfrc522StatusCode = status;
+			clearAuthentication();
 			returnStatus.code = CardUtil::STATUS_ERROR_WITH_CARD;
 			return returnStatus;
 		}
-		//Rewrite the trailer blocks 
-		Serial.print(F("Writing trailer block "));
-		Serial.print(trailerBlock);
-		Serial.println(F(" ..."));
-		//dump_byte_array(dataBlock, 16);Serial.println();
-		status = mfrc522.MIFARE_Write(trailerBlock, trailerBlockData, 16);
+
+		//Encode the trailer block to be secured for Violet's use only.
+		LOG_DEBUG(F("Writing trailer block "));
+		LOG_DEBUG(trailerBlock);
+		LOG_DEBUGLN(F(" ..."));
+		status = CARD_TIMED(CardStats::PROBE_WRITE,
+				mfrc522.MIFARE_Write(trailerBlock, trailer, 16));
 		if (status != MFRC522::STATUS_OK) {
-			Serial.print(F("MIFARE_Write() failed: "));
-			Serial.println(mfrc522.GetStatusCodeName(status));
+			LOG_ERROR(F("MIFARE_Write() failed: "));
+			LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 			returnStatus.mfrc522StatusCode = status;
+			clearAuthentication();
 			returnStatus.code = CardUtil::STATUS_ERROR_WITH_CARD;
 			return returnStatus;
 		}
-		Serial.println("******");
+		//The sector's keys changed, authenticate again for further access.
+		clearAuthentication();
+		LOG_DEBUGLN(F("******"));
 		trailerBlock += 4; //Move to next trailer block
 	}
+	//Every sector is on the current key now.
+	staleKeys = false;
+	if (keyRing != NULL) {
+		keyVersion = keyRing->current();
+		keyRing->remember(mfrc522.uid, keyVersion);
+	}
 
-	returnStatus.code = STATUS_OK;
+	if (reused) {
+		status = writeGlobalInfo();
+		if (status != MFRC522::STATUS_OK) {
+			returnStatus.mfrc522StatusCode = status;
+			clearAuthentication();
+			returnStatus.code = STATUS_ERROR_WITH_CARD;
+			return returnStatus;
+		}
+	}
+
+	returnStatus.code = successCode();
 	returnStatus.currentPoints = numPoints;
 	returnStatus.currentRewards = numRewards;
 	returnStatus.currentSeq = cur_seq;
@@ -245,146 +830,208 @@ CardUtil::Status CardUtil::configure(int32_t numPoints,
 }
 
 CardUtil::Status CardUtil::reset(int32_t numPoints) {
-	Status returnStatus;
-	//Global Info
-	byte trailerBlock = GLOBAL_SECTOR * 4 + 3;
-	byte status;
-	// Authenticate using global_key as Key A
-	Serial.println(F("Authenticating using key A..."));
-	status = mfrc522.PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_A,
-			trailerBlock, &default_key, &(mfrc522.uid));
-	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("PCD_Authenticate() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
-		returnStatus.mfrc522StatusCode = status;
-		returnStatus.code = STATUS_ERROR_WITH_CARD;
-		return returnStatus;
-	}
+	CARD_TIMER(CardStats::PROBE_RESET);
+	//No need to read the key version first: configure() authenticates the first secured sector
+	//before writing anything, which fails on a card not configured.
+	return configure(numPoints, currentKey(), MFRC522::PICC_CMD_MF_AUTH_KEY_B);
+}
 
-	byte blockAddr = 2;
-	//Read Key Version used last time encoded.
-	int32_t key_version = 1;
-	status = mfrc522.MIFARE_GetValue(blockAddr, &key_version);
+CardUtil::Status CardUtil::provision(int32_t numPoints, bool resetConfigured) {
+	CARD_TIMER(CardStats::PROBE_PROVISION);
+	Status returnStatus;
+	memset(&returnStatus, 0, sizeof(returnStatus));
+	int32_t key_version;
+	MFRC522::StatusCode status = readKeyVersion(&key_version);
 	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("MIFARE_GetValue() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
+		LOG_ERROR(F("Reading key version failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
 		returnStatus.code = STATUS_ERROR_WITH_CARD;
 		return returnStatus;
 	}
-	//Serial.print(“Key Version Read:”); 
-	Serial.println((int) key_version);
-	if (!(key_version >= 1
-			&& key_version <= (sizeof(secret_keys) / sizeof(secret_keys[0])))) {
-		returnStatus.code = STATUS_ERROR_WITH_CARD;
+	//configure() goes on with the global sector already authenticated.
+	if (key_version == 0)
+		return configure(numPoints);
+	if (!resetConfigured) {
+		returnStatus.code = STATUS_ALREADY_CONFIGURED;
+		returnStatus.mfrc522StatusCode = MFRC522::STATUS_OK;
 		return returnStatus;
 	}
-	MFRC522::MIFARE_Key secret_key = secret_keys[key_version - 1];
-
-	returnStatus = configure(numPoints, &secret_key,
+	if (keyRing == NULL)
+		return configure(numPoints, secretKey(key_version),
+				MFRC522::PICC_CMD_MF_AUTH_KEY_B);
+	//The version read is the one to try first.
+	keyVersion = key_version;
+	return configure(numPoints, keyRing->key(key_version),
 			MFRC522::PICC_CMD_MF_AUTH_KEY_B);
-
-	return returnStatus;
 }
 
 CardUtil::Status CardUtil::checkStatus() {
+	CARD_TIMER(CardStats::PROBE_CHECK_STATUS);
 	Status returnStatus;
+	memset(&returnStatus, 0, sizeof(returnStatus));
 	//Player Info
 	byte trailerBlock = PLAYER_SECTOR * 4 + 3;
-	byte status;
-	// Authenticate using secret_key as Key B
-	Serial.println(F("Authenticating using key B..."));
-	status = mfrc522.PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_B,
-			trailerBlock, &secret_key, &(mfrc522.uid));
+	MFRC522::StatusCode status;
+	// Authenticate using the secret key as Key B
+	LOG_DEBUGLN(F("Authenticating using key B..."));
+	status = authenticateSecured(trailerBlock);
 	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("PCD_Authenticate() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
+		LOG_ERROR(F("PCD_Authenticate() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
 		returnStatus.code = STATUS_ERROR_WITH_CARD;
 		return returnStatus;
 	}
 
-	byte blockAddr = PLAYER_SECTOR * 4;
-	// Read numPoints
-	int32_t currentPoints = 0;
-	Serial.print(F("Reading numPoints from block "));
-	Serial.print(blockAddr);
-	Serial.println(F(" ..."));
-	status = mfrc522.MIFARE_GetValue(blockAddr, &currentPoints);
+	//The write counter first: it holds game 0 of a v2 card, and a commit torn on an earlier tap is
+	//recovered before anything else is read. The sector is authenticated already.
+	status = readWriteCounter();
 	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("MIFARE_Write() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
+		LOG_ERROR(F("MIFARE_Read() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
 		returnStatus.code = STATUS_ERROR_WITH_CARD;
 		return returnStatus;
 	}
-	Serial.println(currentPoints);
 
-	blockAddr++;
-	// Read numRewards
-	int32_t currentRewards = 0;
-	Serial.print(F("Reading numRewards from block "));
-	Serial.print(blockAddr);
-	Serial.println(F(" ..."));
-	status = mfrc522.MIFARE_GetValue(blockAddr, &currentRewards);
+	//The cached state, if the card hasn't been written since.
+	CardCache::Entry *entry;
+	status = cachedEntry(&entry);
 	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("MIFARE_Write() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
+		LOG_ERROR(F("MIFARE_GetValue() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
 		returnStatus.code = STATUS_ERROR_WITH_CARD;
 		return returnStatus;
 	}
-	Serial.println(currentRewards);
+	if (entry != NULL && entry->fields == CardCache::ALL_FIELDS) {
+		returnStatus.code = successCode();
+		returnStatus.currentPoints = entry->points;
+		returnStatus.currentRewards = entry->rewards;
+		byte length;
+		returnStatus.currentSeq = seqStep(entry->curSeq, 0, &length);
+		return returnStatus;
+	}
 
-	//Sequence Game Info
-	trailerBlock = SEQ_GAME_SECTOR * 4 + 3;
-	// Authenticate using secret_key as Key B
-	Serial.println(F("Authenticating using key B..."));
-	status = mfrc522.PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_B,
-			trailerBlock, &secret_key, &(mfrc522.uid));
+	byte blockAddr = PLAYER_SECTOR * 4;
+	// Read numPoints
+	int32_t currentPoints = 0;
+	LOG_DEBUG(F("Reading numPoints from block "));
+	LOG_DEBUG(blockAddr);
+	LOG_DEBUGLN(F(" ..."));
+	status = CARD_TIMED(CardStats::PROBE_GET_VALUE,
+			mfrc522.MIFARE_GetValue(blockAddr, &currentPoints));
 	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("PCD_Authenticate() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
+		LOG_ERROR(F("MIFARE_Write() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
 		returnStatus.code = STATUS_ERROR_WITH_CARD;
 		return returnStatus;
 	}
-	blockAddr = SEQ_GAME_SECTOR * 4;
-	//Read Current Sequence
-	int32_t cur_seq = -1;
-	Serial.print(F("Reading cur_seq from block "));
-	Serial.print(blockAddr);
-	Serial.println(F(" ..."));
-	status = mfrc522.MIFARE_GetValue(blockAddr, &cur_seq);
+	LOG_DEBUGLN(currentPoints);
+
+	blockAddr++;
+	// Read numRewards
+	int32_t currentRewards = 0;
+	LOG_DEBUG(F("Reading numRewards from block "));
+	LOG_DEBUG(blockAddr);
+	LOG_DEBUGLN(F(" ..."));
+	status = CARD_TIMED(CardStats::PROBE_GET_VALUE,
+			mfrc522.MIFARE_GetValue(blockAddr, &currentRewards));
 	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("MIFARE_Write() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
+		LOG_ERROR(F("MIFARE_Write() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
 		returnStatus.code = STATUS_ERROR_WITH_CARD;
 		return returnStatus;
 	}
-	Serial.println(cur_seq);
+	LOG_DEBUGLN(currentRewards);
 
-	returnStatus.code = STATUS_OK;
+	//Sequence Game Info. On a v2 card, in the hot block read with the write counter.
+	int32_t cur_seq = -1;
+	if (cardLayout == LAYOUT_V2) {
+		cur_seq = hotState(hotBlock);
+	} else {
+		trailerBlock = SEQ_GAME_SECTOR * 4 + 3;
+		// Authenticate using the secret key as Key B
+		LOG_DEBUGLN(F("Authenticating using key B..."));
+		status = authenticateSecured(trailerBlock);
+		if (status != MFRC522::STATUS_OK) {
+			LOG_ERROR(F("PCD_Authenticate() failed: "));
+			LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
+			returnStatus.mfrc522StatusCode = status;
+			clearAuthentication();
+			returnStatus.code = STATUS_ERROR_WITH_CARD;
+			return returnStatus;
+		}
+		blockAddr = SEQ_GAME_SECTOR * 4;
+		//Read Current Sequence
+		LOG_DEBUG(F("Reading cur_seq from block "));
+		LOG_DEBUG(blockAddr);
+		LOG_DEBUGLN(F(" ..."));
+		status = CARD_TIMED(CardStats::PROBE_GET_VALUE,
+				mfrc522.MIFARE_GetValue(blockAddr, &cur_seq));
+		if (status != MFRC522::STATUS_OK) {
+			LOG_ERROR(F("MIFARE_Write() failed: "));
+			LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
+			returnStatus.mfrc522StatusCode = status;
+			clearAuthentication();
+			returnStatus.code = STATUS_ERROR_WITH_CARD;
+			return returnStatus;
+		}
+	}
+	LOG_DEBUGLN(cur_seq);
+
+	if (entry != NULL) {
+		entry->points = currentPoints;
+		entry->rewards = currentRewards;
+		entry->curSeq = cur_seq;
+		entry->fields = CardCache::ALL_FIELDS;
+	}
+
+	returnStatus.code = successCode();
+	returnStatus.mfrc522StatusCode = MFRC522::STATUS_OK;
 	returnStatus.currentPoints = currentPoints;
-	returnStatus.currentSeq = cur_seq;
-	returnStatus.currentPoints = currentRewards;
+	byte length;
+	returnStatus.currentSeq = seqStep(cur_seq, 0, &length);
+	returnStatus.currentRewards = currentRewards;
 	return returnStatus;
 }
 
 CardUtil::Status CardUtil::chargePoints(int32_t numPoints) {
+	CARD_TIMER(CardStats::PROBE_CHARGE_POINTS);
 	Status returnStatus;
+	memset(&returnStatus, 0, sizeof(returnStatus));
 	//Player Info
 	byte trailerBlock = PLAYER_SECTOR * 4 + 3;
-	byte status;
-	// Authenticate using secret_key as Key B
-	Serial.println(F("Authenticating using key B..."));
-	status = mfrc522.PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_B,
-			trailerBlock, &secret_key, &(mfrc522.uid));
+	MFRC522::StatusCode status;
+	// Authenticate using the secret key as Key B
+	LOG_DEBUGLN(F("Authenticating using key B..."));
+	status = authenticateSecured(trailerBlock);
+	if (status != MFRC522::STATUS_OK) {
+		LOG_ERROR(F("PCD_Authenticate() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
+		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
+		returnStatus.code = STATUS_ERROR_WITH_CARD;
+		return returnStatus;
+	}
+
+	//A commit torn on an earlier tap is recovered before the balance is read.
+	//The write counter is read anyway to be changed, but on a low balance.
+	status = readWriteCounter();
 	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("PCD_Authenticate() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
+		LOG_ERROR(F("MIFARE_Read() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
 		returnStatus.code = STATUS_ERROR_WITH_CARD;
 		return returnStatus;
 	}
@@ -392,66 +1039,70 @@ CardUtil::Status CardUtil::chargePoints(int32_t numPoints) {
 	byte blockAddr = PLAYER_SECTOR * 4;
 	// Read numPoints
 	int32_t currentPoints = 0;
-	Serial.print(F("Reading numPoints from block "));
-	Serial.print(blockAddr);
-	Serial.println(F(" ..."));
-	status = mfrc522.MIFARE_GetValue(blockAddr, &currentPoints);
+	LOG_DEBUG(F("Reading numPoints from block "));
+	LOG_DEBUG(blockAddr);
+	LOG_DEBUGLN(F(" ..."));
+	status = CARD_TIMED(CardStats::PROBE_GET_VALUE,
+			mfrc522.MIFARE_GetValue(blockAddr, &currentPoints));
 	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("MIFARE_Write() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
+		LOG_ERROR(F("MIFARE_Write() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
 		returnStatus.code = STATUS_ERROR_WITH_CARD;
 		return returnStatus;
 	}
-	Serial.println(currentPoints);
+	LOG_DEBUGLN(currentPoints);
 
 	if (currentPoints < numPoints) {
-		Serial.println(
-				"Can't play the game as balance is low. Please recharge your card");
+		LOG_EVENTLN(
+				F("Can't play the game as balance is low. Please recharge your card"));
 		//show error.
 		//terminate
-		// Halt PICC
-		mfrc522.PICC_HaltA();
-		// Stop encryption on PCD
-		mfrc522.PCD_StopCrypto1();
+		stop();
 		returnStatus.code = STATUS_INSUFFICIENT_POINTS;
 		return returnStatus;
 	} else {
 		currentPoints -= numPoints;
 		//Write back the updated Points
-		Serial.print(F("Writing numPoints into block "));
-		Serial.print(blockAddr);
-		Serial.println(F(" ..."));
-		status = mfrc522.MIFARE_SetValue(blockAddr, currentPoints);
+		LOG_DEBUG(F("Writing numPoints into block "));
+		LOG_DEBUG(blockAddr);
+		LOG_DEBUGLN(F(" ..."));
+		status = bumpWriteCounter();
+		if (status == MFRC522::STATUS_OK)
+			status = changeValue(blockAddr, -numPoints, currentPoints);
 		if (status != MFRC522::STATUS_OK) {
-			Serial.print(F("MIFARE_Write() failed: "));
-			Serial.println(mfrc522.GetStatusCodeName(status));
+			LOG_ERROR(F("MIFARE_Write() failed: "));
+			LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 			returnStatus.mfrc522StatusCode = status;
+			clearAuthentication();
 			returnStatus.code = STATUS_ERROR_WITH_CARD;
 			return returnStatus;
 		}
-		Serial.println(currentPoints);
-		Serial.println("Success. You can Play. Enjoy!!!");
+		LOG_DEBUGLN(currentPoints);
+		LOG_EVENTLN(F("Success. You can Play. Enjoy!!!"));
 	}
 
-	returnStatus.code = STATUS_OK;
+	returnStatus.code = successCode();
 	returnStatus.currentPoints = currentPoints;
 	return returnStatus;
 }
 
 CardUtil::Status CardUtil::getPoints() {
+	CARD_TIMER(CardStats::PROBE_GET_POINTS);
 	Status returnStatus;
+	memset(&returnStatus, 0, sizeof(returnStatus));
 	//Player Info
 	byte trailerBlock = PLAYER_SECTOR * 4 + 3;
-	byte status;
-	// Authenticate using secret_key as Key B
-	Serial.println(F("Authenticating using key B..."));
-	status = mfrc522.PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_B,
-			trailerBlock, &secret_key, &(mfrc522.uid));
+	MFRC522::StatusCode status;
+	// Authenticate using the secret key as Key B
+	LOG_DEBUGLN(F("Authenticating using key B..."));
+	status = authenticateSecured(trailerBlock);
 	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("PCD_Authenticate() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
+		LOG_ERROR(F("PCD_Authenticate() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
 		returnStatus.code = STATUS_ERROR_WITH_CARD;
 		return returnStatus;
 	}
@@ -459,37 +1110,53 @@ CardUtil::Status CardUtil::getPoints() {
 	byte blockAddr = PLAYER_SECTOR * 4;
 	// Read numPoints
 	int32_t currentPoints = 0;
-	Serial.print(F("Reading numPoints from block "));
-	Serial.print(blockAddr);
-	Serial.println(F(" ..."));
-	status = mfrc522.MIFARE_GetValue(blockAddr, &currentPoints);
+	LOG_DEBUG(F("Reading numPoints from block "));
+	LOG_DEBUG(blockAddr);
+	LOG_DEBUGLN(F(" ..."));
+	status = CARD_TIMED(CardStats::PROBE_GET_VALUE,
+			mfrc522.MIFARE_GetValue(blockAddr, &currentPoints));
 	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("MIFARE_Write() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
+		LOG_ERROR(F("MIFARE_Write() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
 		returnStatus.code = STATUS_ERROR_WITH_CARD;
 		return returnStatus;
 	}
-	Serial.println(currentPoints);
+	LOG_DEBUGLN(currentPoints);
 
-	returnStatus.code = STATUS_OK;
+	returnStatus.code = successCode();
 	returnStatus.currentPoints = currentPoints;
 	return returnStatus;
 }
 
 CardUtil::Status CardUtil::addPoints(int32_t numPoints) {
+	CARD_TIMER(CardStats::PROBE_ADD_POINTS);
 	Status returnStatus;
+	memset(&returnStatus, 0, sizeof(returnStatus));
 	//Player Info
 	byte trailerBlock = PLAYER_SECTOR * 4 + 3;
-	byte status;
-	// Authenticate using secret_key as Key B
-	Serial.println(F("Authenticating using key B..."));
-	status = mfrc522.PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_B,
-			trailerBlock, &secret_key, &(mfrc522.uid));
+	MFRC522::StatusCode status;
+	// Authenticate using the secret key as Key B
+	LOG_DEBUGLN(F("Authenticating using key B..."));
+	status = authenticateSecured(trailerBlock);
+	if (status != MFRC522::STATUS_OK) {
+		LOG_ERROR(F("PCD_Authenticate() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
+		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
+		returnStatus.code = STATUS_ERROR_WITH_CARD;
+		return returnStatus;
+	}
+
+	//A commit torn on an earlier tap is recovered before the balance is read.
+	//The write counter is read anyway to be changed.
+	status = readWriteCounter();
 	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("PCD_Authenticate() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
+		LOG_ERROR(F("MIFARE_Read() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
 		returnStatus.code = STATUS_ERROR_WITH_CARD;
 		return returnStatus;
 	}
@@ -497,53 +1164,72 @@ CardUtil::Status CardUtil::addPoints(int32_t numPoints) {
 	byte blockAddr = PLAYER_SECTOR * 4;
 	// Read numPoints
 	int32_t currentPoints = 0;
-	Serial.print(F("Reading numPoints from block "));
-	Serial.print(blockAddr);
-	Serial.println(F(" ..."));
-	status = mfrc522.MIFARE_GetValue(blockAddr, &currentPoints);
+	LOG_DEBUG(F("Reading numPoints from block "));
+	LOG_DEBUG(blockAddr);
+	LOG_DEBUGLN(F(" ..."));
+	status = CARD_TIMED(CardStats::PROBE_GET_VALUE,
+			mfrc522.MIFARE_GetValue(blockAddr, &currentPoints));
 	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("MIFARE_Write() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
+		LOG_ERROR(F("MIFARE_Write() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
 		returnStatus.code = STATUS_ERROR_WITH_CARD;
 		return returnStatus;
 	}
-	Serial.println(currentPoints);
+	LOG_DEBUGLN(currentPoints);
 
 	currentPoints += numPoints;
 	//Write back the updated Points
-	Serial.print(F("Writing numPoints into block "));
-	Serial.print(blockAddr);
-	Serial.println(F(" ..."));
-	status = mfrc522.MIFARE_SetValue(blockAddr, currentPoints);
+	LOG_DEBUG(F("Writing numPoints into block "));
+	LOG_DEBUG(blockAddr);
+	LOG_DEBUGLN(F(" ..."));
+	status = bumpWriteCounter();
+	if (status == MFRC522::STATUS_OK)
+		status = changeValue(blockAddr, numPoints, currentPoints);
 	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("MIFARE_Write() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
+		LOG_ERROR(F("MIFARE_Write() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
 		returnStatus.code = STATUS_ERROR_WITH_CARD;
 		return returnStatus;
 	}
-	Serial.println(currentPoints);
-	Serial.println("Recharged Successfully");
+	LOG_DEBUGLN(currentPoints);
+	LOG_EVENTLN(F("Recharged Successfully"));
 
-	returnStatus.code = STATUS_OK;
+	returnStatus.code = successCode();
 	returnStatus.currentPoints = currentPoints;
 	return returnStatus;
 }
 
 CardUtil::Status CardUtil::chargeRewards(int32_t numRewards) {
+	CARD_TIMER(CardStats::PROBE_CHARGE_REWARDS);
 	Status returnStatus;
+	memset(&returnStatus, 0, sizeof(returnStatus));
 	//Player Info
 	byte trailerBlock = PLAYER_SECTOR * 4 + 3;
-	byte status;
-	// Authenticate using secret_key as Key B
-	Serial.println(F("Authenticating using key B..."));
-	status = mfrc522.PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_B,
-			trailerBlock, &secret_key, &(mfrc522.uid));
+	MFRC522::StatusCode status;
+	// Authenticate using the secret key as Key B
+	LOG_DEBUGLN(F("Authenticating using key B..."));
+	status = authenticateSecured(trailerBlock);
 	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("PCD_Authenticate() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
+		LOG_ERROR(F("PCD_Authenticate() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
+		returnStatus.code = STATUS_ERROR_WITH_CARD;
+		return returnStatus;
+	}
+
+	//A commit torn on an earlier tap is recovered before the balance is read.
+	//The write counter is read anyway to be changed, but on a low balance.
+	status = readWriteCounter();
+	if (status != MFRC522::STATUS_OK) {
+		LOG_ERROR(F("MIFARE_Read() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
+		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
 		returnStatus.code = STATUS_ERROR_WITH_CARD;
 		return returnStatus;
 	}
@@ -551,22 +1237,24 @@ CardUtil::Status CardUtil::chargeRewards(int32_t numRewards) {
 	byte blockAddr = PLAYER_SECTOR * 4 + 1;
 	// Read numRewards
 	int32_t currentRewards = 0;
-	Serial.print(F("Reading numRewards from block "));
-	Serial.print(blockAddr);
-	Serial.println(F(" ..."));
-	status = mfrc522.MIFARE_GetValue(blockAddr, &currentRewards);
+	LOG_DEBUG(F("Reading numRewards from block "));
+	LOG_DEBUG(blockAddr);
+	LOG_DEBUGLN(F(" ..."));
+	status = CARD_TIMED(CardStats::PROBE_GET_VALUE,
+			mfrc522.MIFARE_GetValue(blockAddr, &currentRewards));
 	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("MIFARE_Write() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
+		LOG_ERROR(F("MIFARE_Write() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
 		returnStatus.code = STATUS_ERROR_WITH_CARD;
 		return returnStatus;
 	}
-	Serial.println(currentRewards);
+	LOG_DEBUGLN(currentRewards);
 
 	if (currentRewards < numRewards) {
-		Serial.println(
-				"Can't reward as balance is low. Please play more games to earn rewards.");
+		LOG_EVENTLN(
+				F("Can't reward as balance is low. Please play more games to earn rewards."));
 		//show error.
 		//terminate
 		returnStatus.code = STATUS_INSUFFICIENT_REWARDS;
@@ -574,39 +1262,44 @@ CardUtil::Status CardUtil::chargeRewards(int32_t numRewards) {
 	} else {
 		currentRewards -= numRewards;
 		//Write back the updated Rewards
-		Serial.print(F("Writing numRewards into block "));
-		Serial.print(blockAddr);
-		Serial.println(F(" ..."));
-		status = mfrc522.MIFARE_SetValue(blockAddr, currentRewards);
+		LOG_DEBUG(F("Writing numRewards into block "));
+		LOG_DEBUG(blockAddr);
+		LOG_DEBUGLN(F(" ..."));
+		status = bumpWriteCounter();
+		if (status == MFRC522::STATUS_OK)
+			status = changeValue(blockAddr, -numRewards, currentRewards);
 		if (status != MFRC522::STATUS_OK) {
-			Serial.print(F("MIFARE_Write() failed: "));
-			Serial.println(mfrc522.GetStatusCodeName(status));
+			LOG_ERROR(F("MIFARE_Write() failed: "));
+			LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 			returnStatus.mfrc522StatusCode = status;
+			clearAuthentication();
 			returnStatus.code = STATUS_ERROR_WITH_CARD;
 			return returnStatus;
 		}
-		Serial.println(currentRewards);
-		Serial.println("Success. Enjoy your reward.");
+		LOG_DEBUGLN(currentRewards);
+		LOG_EVENTLN(F("Success. Enjoy your reward."));
 	}
 
-	returnStatus.code = STATUS_OK;
+	returnStatus.code = successCode();
 	returnStatus.currentPoints = currentRewards;
 	return returnStatus;
 }
 
 CardUtil::Status CardUtil::getRewards() {
+	CARD_TIMER(CardStats::PROBE_GET_REWARDS);
 	Status returnStatus;
+	memset(&returnStatus, 0, sizeof(returnStatus));
 	//Player Info
 	byte trailerBlock = PLAYER_SECTOR * 4 + 3;
-	byte status;
-	// Authenticate using secret_key as Key B
-	Serial.println(F("Authenticating using key B..."));
-	status = mfrc522.PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_B,
-			trailerBlock, &secret_key, &(mfrc522.uid));
+	MFRC522::StatusCode status;
+	// Authenticate using the secret key as Key B
+	LOG_DEBUGLN(F("Authenticating using key B..."));
+	status = authenticateSecured(trailerBlock);
 	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("PCD_Authenticate() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
+		LOG_ERROR(F("PCD_Authenticate() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
 		returnStatus.code = STATUS_ERROR_WITH_CARD;
 		return returnStatus;
 	}
@@ -614,37 +1307,53 @@ CardUtil::Status CardUtil::getRewards() {
 	byte blockAddr = PLAYER_SECTOR * 4 + 1;
 	// Read numRewards
 	int32_t currentRewards = 0;
-	Serial.print(F("Reading numRewards from block "));
-	Serial.print(blockAddr);
-	Serial.println(F(" ..."));
-	status = mfrc522.MIFARE_GetValue(blockAddr, &currentRewards);
+	LOG_DEBUG(F("Reading numRewards from block "));
+	LOG_DEBUG(blockAddr);
+	LOG_DEBUGLN(F(" ..."));
+	status = CARD_TIMED(CardStats::PROBE_GET_VALUE,
+			mfrc522.MIFARE_GetValue(blockAddr, &currentRewards));
 	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("MIFARE_Write() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
+		LOG_ERROR(F("MIFARE_Write() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
 		returnStatus.code = STATUS_ERROR_WITH_CARD;
 		return returnStatus;
 	}
-	Serial.println(currentRewards);
+	LOG_DEBUGLN(currentRewards);
 
-	returnStatus.code = STATUS_OK;
+	returnStatus.code = successCode();
 	returnStatus.currentRewards = currentRewards;
 	return returnStatus;
 }
 
 CardUtil::Status CardUtil::addRewards(int32_t numRewards) {
+	CARD_TIMER(CardStats::PROBE_ADD_REWARDS);
 	Status returnStatus;
+	memset(&returnStatus, 0, sizeof(returnStatus));
 	//Player Info
 	byte trailerBlock = PLAYER_SECTOR * 4 + 3;
-	byte status;
-	// Authenticate using secret_key as Key B
-	Serial.println(F("Authenticating using key B..."));
-	status = mfrc522.PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_B,
-			trailerBlock, &secret_key, &(mfrc522.uid));
+	MFRC522::StatusCode status;
+	// Authenticate using the secret key as Key B
+	LOG_DEBUGLN(F("Authenticating using key B..."));
+	status = authenticateSecured(trailerBlock);
 	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("PCD_Authenticate() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
+		LOG_ERROR(F("PCD_Authenticate() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
+		returnStatus.code = STATUS_ERROR_WITH_CARD;
+		return returnStatus;
+	}
+
+	//A commit torn on an earlier tap is recovered before the balance is read.
+	//The write counter is read anyway to be changed.
+	status = readWriteCounter();
+	if (status != MFRC522::STATUS_OK) {
+		LOG_ERROR(F("MIFARE_Read() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
+		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
 		returnStatus.code = STATUS_ERROR_WITH_CARD;
 		return returnStatus;
 	}
@@ -652,220 +1361,631 @@ CardUtil::Status CardUtil::addRewards(int32_t numRewards) {
 	byte blockAddr = PLAYER_SECTOR * 4 + 1;
 	// Read numRewards
 	int32_t currentRewards = 0;
-	Serial.print(F("Reading numRewards from block "));
-	Serial.print(blockAddr);
-	Serial.println(F(" ..."));
-	status = mfrc522.MIFARE_GetValue(blockAddr, &currentRewards);
+	LOG_DEBUG(F("Reading numRewards from block "));
+	LOG_DEBUG(blockAddr);
+	LOG_DEBUGLN(F(" ..."));
+	status = CARD_TIMED(CardStats::PROBE_GET_VALUE,
+			mfrc522.MIFARE_GetValue(blockAddr, &currentRewards));
 	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("MIFARE_Write() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
+		LOG_ERROR(F("MIFARE_Write() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
 		returnStatus.code = STATUS_ERROR_WITH_CARD;
 		return returnStatus;
 	}
-	Serial.println(currentRewards);
+	LOG_DEBUGLN(currentRewards);
 
 	currentRewards += numRewards;
 	//Write back the updated Rewards
-	Serial.print(F("Writing numRewards into block "));
-	Serial.print(blockAddr);
-	Serial.println(F(" ..."));
-	status = mfrc522.MIFARE_SetValue(blockAddr, currentRewards);
+	LOG_DEBUG(F("Writing numRewards into block "));
+	LOG_DEBUG(blockAddr);
+	LOG_DEBUGLN(F(" ..."));
+	status = bumpWriteCounter();
+	if (status == MFRC522::STATUS_OK)
+		status = changeValue(blockAddr, numRewards, currentRewards);
 	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("MIFARE_Write() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
+		LOG_ERROR(F("MIFARE_Write() failed: "));
+		LOG_ERRORLN(mfrc522.GetStatusCodeName(status));
 		returnStatus.mfrc522StatusCode = status;
+		clearAuthentication();
 		returnStatus.code = STATUS_ERROR_WITH_CARD;
 		return returnStatus;
 	}
-	Serial.println(currentRewards);
-	Serial.println("Awarded Successfully");
+	LOG_DEBUGLN(currentRewards);
+	LOG_EVENTLN(F("Awarded Successfully"));
 
-	returnStatus.code = STATUS_OK;
+	returnStatus.code = successCode();
 	returnStatus.currentRewards = currentRewards;
 	return returnStatus;
 }
 
 CardUtil::Status CardUtil::initSequence(byte* sequence, int32_t numRewards) {
+	CARD_TIMER(CardStats::PROBE_INIT_SEQUENCE);
+	Transaction transaction(*this);
+	Status returnStatus = transaction.initSequence(sequence, numRewards);
+	if (returnStatus.code == STATUS_OK)
+		returnStatus = transaction.commit();
+	if (returnStatus.code == STATUS_OK)
+		LOG_EVENTLN(F("Seq Game initiated. Enjoy!!"));
+	return returnStatus;
+}
+
+CardUtil::Status CardUtil::initSequence(byte gameId, const byte* steps,
+		byte length, int32_t numRewards) {
+	CARD_TIMER(CardStats::PROBE_INIT_SEQUENCE);
+	Transaction transaction(*this, gameId);
+	Status returnStatus = transaction.initSequence(steps, length, numRewards);
+	if (returnStatus.code == STATUS_OK)
+		returnStatus = transaction.commit();
+	if (returnStatus.code == STATUS_OK)
+		LOG_EVENTLN(F("Seq Game initiated. Enjoy!!"));
+	return returnStatus;
+}
+
+CardUtil::Status CardUtil::checkSequence(byte next) {
+	return checkSequence(0, next);
+}
+
+CardUtil::Status CardUtil::checkSequence(byte gameId, byte next) {
+	CARD_TIMER(CardStats::PROBE_CHECK_SEQUENCE);
+	Transaction transaction(*this, gameId);
+	Status returnStatus = transaction.load(
+			Transaction::FIELD_CUR_SEQ | Transaction::FIELD_SEQUENCE);
+	if (returnStatus.code == STATUS_OK)
+		returnStatus = transaction.checkSequence(next);
+	if (returnStatus.code == STATUS_OK)
+		returnStatus = transaction.commit();
+	return returnStatus;
+}
+
+//Fields of each sector handled by CardUtil::Transaction.
+static const byte PLAYER_FIELDS = CardUtil::Transaction::FIELD_POINTS
+		| CardUtil::Transaction::FIELD_REWARDS;
+static const byte SEQ_GAME_FIELDS = CardUtil::Transaction::FIELD_CUR_SEQ
+		| CardUtil::Transaction::FIELD_SEQUENCE
+		| CardUtil::Transaction::FIELD_SEQ_REWARDS;
+
+CardUtil::Transaction::Transaction(CardUtil &cardUtil, byte gameId) :
+		cardUtil(cardUtil), game(gameId), loaded(0), dirty(0), points(0), rewards(
+				0), curSeq(-1), seqLength(0), seqRewards(0), pointsDelta(0), rewardsDelta(
+				0), initSteps(NULL), seqBlockAddr(NO_BLOCK), recorded(0) {
+}
+
+byte CardUtil::Transaction::seqSector() {
+	return SEQ_GAME_SECTOR + game * SEQ_GAME_SLOT_SECTORS;
+}
+
+bool CardUtil::Transaction::hot() {
+	return game == 0 && cardUtil.cardLayout == LAYOUT_V2;
+}
+
+byte CardUtil::Transaction::sectorFields(byte sector) {
+	//The sequence steps of the sector are those after the hot ones.
+	if (hot())
+		return sector == PLAYER_SECTOR ?
+				PLAYER_FIELDS | SEQ_GAME_FIELDS : FIELD_SEQUENCE;
+	return sector == PLAYER_SECTOR ? PLAYER_FIELDS : SEQ_GAME_FIELDS;
+}
+
+byte CardUtil::Transaction::otherSector(byte sector) {
+	return sector == PLAYER_SECTOR ? seqSector() : PLAYER_SECTOR;
+}
+
+CardUtil::Status CardUtil::Transaction::result(StatusCode code) {
 	Status returnStatus;
-	//Sequence Game Info
-	byte trailerBlock = SEQ_GAME_SECTOR * 4 + 3;
-	byte status;
-	// Authenticate using secret_key as Key B
-	Serial.println(F("Authenticating using key B..."));
-	status = mfrc522.PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_B,
-			trailerBlock, &secret_key, &(mfrc522.uid));
-	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("PCD_Authenticate() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
-		returnStatus.mfrc522StatusCode = status;
-		returnStatus.code = STATUS_ERROR_WITH_CARD;
-		return returnStatus;
+	returnStatus.code = code;
+	returnStatus.mfrc522StatusCode = MFRC522::STATUS_OK;
+	returnStatus.currentPoints = points;
+	returnStatus.currentRewards = rewards;
+	returnStatus.currentSeq = curSeq;
+	return returnStatus;
+}
+
+CardUtil::Status CardUtil::Transaction::failed(MFRC522::StatusCode status) {
+	LOG_ERROR(F("Transaction failed: "));
+	LOG_ERRORLN(cardUtil.mfrc522.GetStatusCodeName(status));
+	cardUtil.clearAuthentication();
+	Status returnStatus = result(STATUS_ERROR_WITH_CARD);
+	returnStatus.mfrc522StatusCode = status;
+	return returnStatus;
+}
+
+byte CardUtil::Transaction::firstSector() {
+	//Start where the card is already authenticated, that saves an authentication.
+	//The hot block of a v2 card first: it tells which steps the sector of the game is read for.
+	return !hot() && cardUtil.authenticatedBlock == seqSector() * 4 + 3 ?
+			seqSector() : PLAYER_SECTOR;
+}
+
+CardUtil::Status CardUtil::Transaction::load(byte fields) {
+	CARD_TIMER(CardStats::PROBE_TX_LOAD);
+	//The cache can only save reads if it can hold all the fields.
+	CardCache::Entry *entry = NULL;
+	if ((fields & ~CardCache::ALL_FIELDS) == 0) {
+		MFRC522::StatusCode status = cardUtil.cachedEntry(&entry);
+		if (status != MFRC522::STATUS_OK)
+			return failed(status);
+	}
+	//The cache holds the state of sequence game 0 only.
+	byte cached = game == 0 ? (byte) CardCache::ALL_FIELDS : (byte) PLAYER_FIELDS;
+	if (entry != NULL) {
+		byte hit = fields & entry->fields & cached & ~loaded
+				& ~(dirty & SEQ_GAME_FIELDS);
+		if (hit & FIELD_POINTS)
+			points = entry->points + pointsDelta;
+		if (hit & FIELD_REWARDS)
+			rewards = entry->rewards + rewardsDelta;
+		if (hit & FIELD_CUR_SEQ)
+			curSeq = seqStep(entry->curSeq, game, &seqLength);
+		loaded |= hit;
+	}
+	//Where game 0 is depends on the layout of the card, told by the write counter. Read first,
+	//a commit torn on an earlier tap is recovered before the fields are read.
+	if ((fields & PLAYER_FIELDS & ~loaded)
+			|| (game == 0 && (fields & SEQ_GAME_FIELDS & ~loaded))) {
+		MFRC522::StatusCode status = cardUtil.readWriteCounter();
+		if (status != MFRC522::STATUS_OK)
+			return failed(status);
 	}
 
-	//Write Current Sequence
-	int32_t cur_seq = 0;
-	byte blockAddr = SEQ_GAME_SECTOR * 4;
-	Serial.print(F("Writing current sequence into block "));
-	Serial.print(blockAddr);
-	Serial.println(F(" ..."));
-	status = mfrc522.MIFARE_SetValue(blockAddr, cur_seq);
-	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("MIFARE_Write() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
-		returnStatus.mfrc522StatusCode = status;
-		returnStatus.code = STATUS_ERROR_WITH_CARD;
-		return returnStatus;
+	byte sector = firstSector();
+	for (byte i = 0; i < 2; i++) {
+		Status returnStatus = loadSector(sector, fields);
+		if (returnStatus.code != STATUS_OK)
+			return returnStatus;
+		sector = otherSector(sector);
 	}
 
-	//Write Game Sequence
-	blockAddr++;
-	Serial.print(F("Writing sequence into block "));
-	Serial.print(blockAddr);
-	Serial.println(F(" ..."));
-	status = mfrc522.MIFARE_Write(blockAddr, sequence, 16);
-	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("MIFARE_Write() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
-		returnStatus.mfrc522StatusCode = status;
-		returnStatus.code = STATUS_ERROR_WITH_CARD;
-		return returnStatus;
+	if (entry != NULL) {
+		//As on the card, without the changes pending.
+		if (loaded & FIELD_POINTS)
+			entry->points = points - pointsDelta;
+		if (loaded & FIELD_REWARDS)
+			entry->rewards = rewards - rewardsDelta;
+		if ((loaded & ~dirty & cached) & FIELD_CUR_SEQ)
+			entry->curSeq = seqState(game, curSeq, seqLength);
+		entry->fields |= loaded & ~(dirty & FIELD_CUR_SEQ) & cached;
 	}
+	return result(STATUS_OK);
+}
 
-	//Write Rewards
-	blockAddr++;
-	Serial.print(F("Writing rewards into block "));
-	Serial.print(blockAddr);
-	Serial.println(F(" ..."));
-	status = mfrc522.MIFARE_SetValue(blockAddr, numRewards);
-	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("MIFARE_Write() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
-		returnStatus.mfrc522StatusCode = status;
-		returnStatus.code = STATUS_ERROR_WITH_CARD;
-		return returnStatus;
+CardUtil::Status CardUtil::Transaction::loadSector(byte sector, byte fields) {
+	//Fields overwritten by this transaction don't need to be read.
+	fields &= sectorFields(sector) & ~loaded & ~(dirty & SEQ_GAME_FIELDS);
+	//The block of the current step is found from the state.
+	if ((fields & FIELD_SEQUENCE) && !(loaded & FIELD_CUR_SEQ))
+		fields |= FIELD_CUR_SEQ;
+	if (fields == 0)
+		return result(STATUS_OK);
+	if (sector != PLAYER_SECTOR && game >= SEQ_GAMES)
+		return result(STATUS_FAILURE);
+	MFRC522::StatusCode status = cardUtil.authenticateSecured(sector * 4 + 3);
+	if (status != MFRC522::STATUS_OK)
+		return failed(status);
+
+	MFRC522 &mfrc522 = cardUtil.mfrc522;
+	byte blockAddr = sector * 4;
+	LOG_DEBUG(F("Transaction loading sector "));
+	LOG_DEBUGLN(sector);
+	if (fields & FIELD_POINTS) {
+		status = CARD_TIMED(CardStats::PROBE_GET_VALUE,
+				mfrc522.MIFARE_GetValue(blockAddr, &points));
+		if (status != MFRC522::STATUS_OK)
+			return failed(status);
+		points += pointsDelta;
+	}
+	if (fields & FIELD_REWARDS) {
+		status = CARD_TIMED(CardStats::PROBE_GET_VALUE,
+				mfrc522.MIFARE_GetValue(blockAddr + 1, &rewards));
+		if (status != MFRC522::STATUS_OK)
+			return failed(status);
+		rewards += rewardsDelta;
 	}
+	if (sector == PLAYER_SECTOR && (fields & SEQ_GAME_FIELDS)) {
+		//Game 0 of a v2 card, in the hot block read with the write counter.
+		status = cardUtil.readWriteCounter();
+		if (status != MFRC522::STATUS_OK)
+			return failed(status);
+		const byte *hotBlock = cardUtil.hotBlock;
+		if (fields & FIELD_CUR_SEQ)
+			curSeq = seqStep(hotState(hotBlock), game, &seqLength);
+		if (fields & FIELD_SEQ_REWARDS)
+			seqRewards = getInt32(hotBlock + HOT_REWARDS);
+		//The steps after the hot ones are loaded from the sector of the game.
+		if (curSeq >= HOT_SEQ_STEPS)
+			fields &= ~FIELD_SEQUENCE;
+		loaded |= fields;
+		return result(STATUS_OK);
+	}
+	if (fields & FIELD_CUR_SEQ) {
+		int32_t state;
+		status = CARD_TIMED(CardStats::PROBE_GET_VALUE,
+				mfrc522.MIFARE_GetValue(blockAddr, &state));
+		if (status != MFRC522::STATUS_OK)
+			return failed(status);
+		curSeq = seqStep(state, game, &seqLength);
+	}
+	if (fields & FIELD_SEQ_REWARDS) {
+		status = readSeqBlock(blockAddr + 1);
+		if (status != MFRC522::STATUS_OK)
+			return failed(status);
+		seqRewards = (int32_t) seqBlock[0] | (int32_t) seqBlock[1] << 8
+				| (int32_t) seqBlock[2] << 16 | (int32_t) seqBlock[3] << 24;
+	}
+	if ((fields & FIELD_SEQUENCE) && curSeq >= 0) {
+		//Only the block holding the current step, not the whole sequence.
+		status = readSeqBlock(seqStepBlock(sector, curSeq));
+		if (status != MFRC522::STATUS_OK)
+			return failed(status);
+	}
+	loaded |= fields;
+	return result(STATUS_OK);
+}
 
-	Serial.println("Seq Game initiated. Enjoy!!");
+CardUtil::Status CardUtil::Transaction::chargePoints(int32_t numPoints) {
+	if (!(loaded & FIELD_POINTS))
+		return result(STATUS_FAILURE);
+	if (points < numPoints) {
+		LOG_EVENTLN(
+				F("Can't play the game as balance is low. Please recharge your card"));
+		return result(STATUS_INSUFFICIENT_POINTS);
+	}
+	points -= numPoints;
+	pointsDelta -= numPoints;
+	dirty |= FIELD_POINTS;
+	return result(STATUS_OK);
+}
 
-	returnStatus.currentSeq = cur_seq;
-	returnStatus.code = STATUS_OK;
-	return returnStatus;
+CardUtil::Status CardUtil::Transaction::addPoints(int32_t numPoints) {
+	points += numPoints;
+	pointsDelta += numPoints;
+	dirty |= FIELD_POINTS;
+	return result(STATUS_OK);
 }
 
-CardUtil::Status CardUtil::checkSequence(byte next) {
-	Status returnStatus;
-	//Sequence Game Info
-	byte trailerBlock = SEQ_GAME_SECTOR * 4 + 3;
-	byte status;
-	// Authenticate using secret_key as Key B
-	Serial.println(F("Authenticating using key B..."));
-	status = mfrc522.PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_B,
-			trailerBlock, &secret_key, &(mfrc522.uid));
-	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("PCD_Authenticate() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
-		returnStatus.mfrc522StatusCode = status;
-		returnStatus.code = STATUS_ERROR_WITH_CARD;
-		return returnStatus;
+CardUtil::Status CardUtil::Transaction::chargeRewards(int32_t numRewards) {
+	if (!(loaded & FIELD_REWARDS))
+		return result(STATUS_FAILURE);
+	if (rewards < numRewards) {
+		LOG_EVENTLN(
+				F("Can't reward as balance is low. Please play more games to earn rewards."));
+		return result(STATUS_INSUFFICIENT_REWARDS);
 	}
-	byte blockAddr = SEQ_GAME_SECTOR * 4;
-	//Read Current Sequence
-	int32_t cur_seq = -1;
-	Serial.print(F("Reading cur_seq from block "));
-	Serial.print(blockAddr);
-	Serial.println(F(" ..."));
-	status = mfrc522.MIFARE_GetValue(blockAddr, &cur_seq);
-	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("MIFARE_Write() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
-		returnStatus.mfrc522StatusCode = status;
-		returnStatus.code = STATUS_ERROR_WITH_CARD;
-		return returnStatus;
+	rewards -= numRewards;
+	rewardsDelta -= numRewards;
+	dirty |= FIELD_REWARDS;
+	return result(STATUS_OK);
+}
+
+CardUtil::Status CardUtil::Transaction::addRewards(int32_t numRewards) {
+	rewards += numRewards;
+	rewardsDelta += numRewards;
+	dirty |= FIELD_REWARDS;
+	return result(STATUS_OK);
+}
+
+CardUtil::Status CardUtil::Transaction::initSequence(const byte* sequence,
+		int32_t numRewards) {
+	byte length = 0;
+	while (length < 16 && sequence[length] != 0x00)
+		length++;
+	return initSequence(sequence, length, numRewards);
+}
+
+CardUtil::Status CardUtil::Transaction::initSequence(const byte* steps,
+		byte length, int32_t numRewards) {
+	if (game >= SEQ_GAMES || length == 0 || length > SEQ_MAX_STEPS)
+		return result(STATUS_FAILURE);
+	for (byte i = 0; i < length; i++) {
+		if (steps[i] > 0x0F)
+			return result(STATUS_FAILURE);
 	}
-	Serial.println(cur_seq);
-	if (cur_seq == -1) {
-		Serial.print(F("Current Sequence not initialized "));
-		returnStatus.currentSeq = cur_seq;
-		returnStatus.code = STATUS_FAILURE;
-		return returnStatus;
+	initSteps = steps;
+	seqLength = length;
+	curSeq = 0;
+	seqRewards = numRewards;
+	loaded |= SEQ_GAME_FIELDS;
+	dirty |= SEQ_GAME_FIELDS;
+	return result(STATUS_OK);
+}
+
+CardUtil::Status CardUtil::Transaction::checkSequence(byte next) {
+	if ((loaded & (FIELD_CUR_SEQ | FIELD_SEQUENCE))
+			!= (FIELD_CUR_SEQ | FIELD_SEQUENCE))
+		return result(STATUS_FAILURE);
+	if (curSeq < 0) {
+		LOG_EVENTLN(F("Current Sequence not initialized"));
+		return result(STATUS_FAILURE);
+	}
+	bool hotStep = hot() && curSeq < HOT_SEQ_STEPS;
+	byte expected =
+			initSteps != NULL ? initSteps[curSeq] :
+			hotStep ?
+					hotStepOf(cardUtil.hotBlock, curSeq) :
+					seqStepOf(seqBlock, curSeq);
+	LOG_DEBUG(F("check for Next Sequence: Expected:"));
+	LOG_DEBUG(expected);
+	LOG_DEBUG(F(", Actual:"));
+	LOG_DEBUGLN(next);
+	if (expected == next) {
+		curSeq++;
+		//The next step may be in the next block, read if checked in this transaction.
+		if (curSeq < seqLength && initSteps == NULL
+				&& !(hot() && curSeq < HOT_SEQ_STEPS)
+				&& seqStepBlock(seqSector(), curSeq) != seqBlockAddr)
+			loaded &= ~FIELD_SEQUENCE;
+		if (curSeq == seqLength) {
+			LOG_EVENT(
+					F("Correct Sequence. Game Finished. Player Won. Correct Attempts:"));
+			LOG_EVENTLN(curSeq);
+			curSeq = -1;
+			//Only a win needs the rewards. The sector is still authenticated, it's one more read,
+			//none for a v2 card, whose hot block is already read.
+			Status returnStatus = loadSector(
+					hot() ? PLAYER_SECTOR : seqSector(), FIELD_SEQ_REWARDS);
+			if (returnStatus.code != STATUS_OK)
+				return returnStatus;
+			if (seqRewards > 0)
+				addRewards(seqRewards);
+		}
+	} else {
+		LOG_EVENT(
+				F("Wrong Sequence. Game Finished. Player Lost. Correct Attempts:"));
+		LOG_EVENTLN(curSeq);
+		curSeq = -1;
 	}
+	dirty |= FIELD_CUR_SEQ;
+	return result(STATUS_OK);
+}
 
-	blockAddr++;
-	byte sequence[18];
-	int32_t numRewards = 0;
-	byte size = sizeof(sequence);
-	// Read Game Sequence
-	Serial.print(F("Reading Game Sequence from block "));
-	Serial.print(blockAddr);
-	Serial.println(F(" ..."));
-	status = mfrc522.MIFARE_Read(blockAddr, sequence, &size);
-	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("MIFARE_Read() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
-		returnStatus.mfrc522StatusCode = status;
-		returnStatus.code = STATUS_ERROR_WITH_CARD;
-		return returnStatus;
+CardUtil::Status CardUtil::Transaction::commit() {
+	CARD_TIMER(CardStats::PROBE_TX_COMMIT);
+	if (dirty != 0) {
+		//Also tells the layout, and finishes a commit torn on an earlier tap.
+		bool counterKnown = cardUtil.writeCounterKnown;
+		if (!counterKnown)
+			cardUtil.recovered = false;
+		MFRC522::StatusCode status = cardUtil.readWriteCounter();
+		if (status != MFRC522::STATUS_OK)
+			return failed(status);
+		const byte *hotBlock = cardUtil.hotBlock;
+		if (recorded != 0 && cardUtil.commitRecorded()
+				&& (hotBlock[HOT_LAYOUT] >> HOT_RECORD_SHIFT) == recorded
+				&& getInt32(hotBlock + HOT_COUNTER)
+						== (recorded == FIELD_POINTS ? points : rewards)
+				&& hotState(hotBlock) == seqState(0, curSeq, seqLength)) {
+			//This commit, failed once its hot block was on the card, is done: reading the counter
+			//finished its balance.
+			dirty = 0;
+			pointsDelta = 0;
+			rewardsDelta = 0;
+			initSteps = NULL;
+		} else if (!counterKnown && cardUtil.recovered
+				&& (loaded & ~(initSteps != NULL ? SEQ_GAME_FIELDS : 0))) {
+			//The fields loaded may be those before the recovery.
+			LOG_ERRORLN(F("Card recovered since the transaction loaded it"));
+			return result(STATUS_ERROR_WITH_CARD);
+		}
+		recorded = 0;
 	}
-	dump_byte_array(sequence, 16);
-	Serial.println();
-
-	Serial.print(F("check for Next Sequence: Expected:"));
-	Serial.print(sequence[cur_seq]);
-	Serial.print(F(", Actual:"));
-	Serial.print(next);
-	Serial.println();
-	//check for next sequence
-	if (sequence[cur_seq] == next) {
-		cur_seq++;
-		if (sequence[cur_seq] == 0x00) {
-			//terminate game.
-			Serial.print(
-					F(
-							"Correct Sequence. Game Finished. Player Won. Correct Attempts:"));
-			Serial.println(cur_seq);
-			cur_seq = -1;
-			blockAddr++;
-			Serial.print(F("Reading numRewards from block "));
-			Serial.print(blockAddr);
-			Serial.println(F(" ..."));
-			status = mfrc522.MIFARE_GetValue(blockAddr, &numRewards);
-			if (status != MFRC522::STATUS_OK) {
-				Serial.print(F("MIFARE_Write() failed: "));
-				Serial.println(mfrc522.GetStatusCodeName(status));
-				returnStatus.mfrc522StatusCode = status;
-				returnStatus.code = STATUS_ERROR_WITH_CARD;
+	if (dirty != 0) {
+		byte record = recordField();
+		if (record != 0 && !(loaded & record)) {
+			//The record holds the balance after the commit: read it under the authentication of the
+			//write counter.
+			int32_t *value = record == FIELD_POINTS ? &points : &rewards;
+			MFRC522::StatusCode status = cardUtil.authenticateSecured(
+					PLAYER_SECTOR * 4 + 3);
+			if (status == MFRC522::STATUS_OK)
+				status = CARD_TIMED(CardStats::PROBE_GET_VALUE,
+						cardUtil.mfrc522.MIFARE_GetValue(
+								PLAYER_SECTOR * 4 + (record == FIELD_POINTS ? 0 : 1),
+								value));
+			if (status != MFRC522::STATUS_OK)
+				return failed(status);
+			*value += record == FIELD_POINTS ? pointsDelta : rewardsDelta;
+			loaded |= record;
+		}
+		bool hotDirty = hot() && (dirty & SEQ_GAME_FIELDS);
+		if (hotDirty) {
+			//Game 0 of a v2 card is written with the write counter, after the steps that don't fit.
+			byte *hotBlock = cardUtil.hotBlock;
+			setHotState(hotBlock, curSeq, seqLength);
+			if (dirty & FIELD_SEQ_REWARDS)
+				putInt32(hotBlock + HOT_REWARDS, seqRewards);
+			if (dirty & FIELD_SEQUENCE)
+				for (byte step = 0; step < HOT_SEQ_STEPS; step++)
+					setHotStep(hotBlock, step,
+							step < seqLength ? initSteps[step] : 0);
+			Status returnStatus = commitSteps();
+			if (returnStatus.code != STATUS_OK) {
+				//hotBlock isn't what's on the card any more.
+				cardUtil.writeCounterKnown = false;
 				return returnStatus;
 			}
-			Serial.println(numRewards);
 		}
-	} else {
-		//terminate game.
-		Serial.print(
-				F(
-						"Wrong Sequence. Game Finished. Player Lost. Correct Attempts:"));
-		Serial.println(cur_seq);
-		cur_seq = -1;
-	}
-
-	//Write Current Sequence
-	blockAddr = SEQ_GAME_SECTOR * 4;
-	Serial.print(F("Writing current sequence into block "));
-	Serial.print(blockAddr);
-	Serial.println(F(" ..."));
-	status = mfrc522.MIFARE_SetValue(blockAddr, cur_seq);
-	if (status != MFRC522::STATUS_OK) {
-		Serial.print(F("MIFARE_Write() failed: "));
-		Serial.println(mfrc522.GetStatusCodeName(status));
-		returnStatus.mfrc522StatusCode = status;
-		returnStatus.code = STATUS_ERROR_WITH_CARD;
-		return returnStatus;
+		//Failing, the hot block may be on the card or not: the next try tells by reading it.
+		recorded = record;
+		MFRC522::StatusCode status = cardUtil.bumpWriteCounter(record,
+				record == FIELD_POINTS ? points : rewards);
+		if (status != MFRC522::STATUS_OK)
+			return failed(status);
+		//Only now is game 0 on the card, steps included: a failed try writes it again.
+		if (hotDirty) {
+			dirty &= ~SEQ_GAME_FIELDS;
+			initSteps = NULL;
+		}
+	}
+	//The game before the balance: torn in between, the commit leaves a game started without its
+	//charge or ended without its rewards, rather than one charged twice or to be won again.
+	byte sector = (dirty & SEQ_GAME_FIELDS) ? seqSector() : firstSector();
+	for (byte i = 0; i < 2; i++) {
+		Status returnStatus = commitSector(sector);
+		if (returnStatus.code != STATUS_OK) {
+			//The next try reads the hot block again, and finishes the commit it records.
+			if (recorded != 0)
+				cardUtil.writeCounterKnown = false;
+			return returnStatus;
+		}
+		sector = otherSector(sector);
+	}
+	recorded = 0;
+	//Everything loaded is what's on the card now: keep it for the next tap.
+	if (cardUtil.cache != NULL && cardUtil.writeCounterKnown
+			&& !cardUtil.commitRecorded()) {
+		CardCache::Entry *entry = cardUtil.cache->insert(cardUtil.mfrc522.uid);
+		entry->writeCounter = cardUtil.writeCounter;
+		entry->fields = loaded & (game == 0 ? (byte) CardCache::ALL_FIELDS : (byte) PLAYER_FIELDS);
+		entry->points = points;
+		entry->rewards = rewards;
+		entry->curSeq = seqState(game, curSeq, seqLength);
 	}
+	return result(cardUtil.successCode());
+}
 
-	if (numRewards > 0)
-		returnStatus = addRewards(numRewards);//award the reward to the player.
+byte CardUtil::Transaction::recordField() {
+	//Game 0 of a v2 card and one balance: the hot block written with the game can hold the balance.
+	if (!hot() || !(dirty & SEQ_GAME_FIELDS))
+		return 0;
+	byte fields = 0;
+	if ((dirty & FIELD_POINTS) && pointsDelta != 0)
+		fields |= FIELD_POINTS;
+	if ((dirty & FIELD_REWARDS) && rewardsDelta != 0)
+		fields |= FIELD_REWARDS;
+	return fields == FIELD_POINTS || fields == FIELD_REWARDS ? fields : 0;
+}
 
-	returnStatus.currentSeq = cur_seq;
-	returnStatus.code = STATUS_OK;
-	return returnStatus;
+bool CardUtil::Transaction::startRecovered() {
+	//A start records the points charged, with the game at its first step.
+	const byte *hotBlock = cardUtil.hotBlock;
+	return game == 0 && cardUtil.recovered && cardUtil.commitRecorded()
+			&& (hotBlock[HOT_LAYOUT] >> HOT_RECORD_SHIFT) == FIELD_POINTS
+			&& hotBlock[HOT_STEP] == 0 && hotBlock[HOT_LENGTH] != 0;
+}
+
+MFRC522::StatusCode CardUtil::Transaction::commitValue(byte blockAddr,
+		byte field, int32_t delta, int32_t *value) {
+	if (delta == 0)
+		return MFRC522::STATUS_OK;
+	//Writing the value with MIFARE_SetValue needs the current one.
+	if (!cardUtil.nativeValueOps && !(loaded & field)) {
+		MFRC522::StatusCode status = CARD_TIMED(CardStats::PROBE_GET_VALUE,
+				cardUtil.mfrc522.MIFARE_GetValue(blockAddr, value));
+		if (status != MFRC522::STATUS_OK)
+			return status;
+		*value += delta;
+		loaded |= field;
+	}
+	return cardUtil.changeValue(blockAddr, delta, *value);
+}
+
+MFRC522::StatusCode CardUtil::Transaction::readSeqBlock(byte blockAddr) {
+	if (blockAddr == seqBlockAddr)
+		return MFRC522::STATUS_OK;
+	MFRC522::StatusCode status = cardUtil.authenticateSecured(
+			blockAddr / 4 * 4 + 3);
+	if (status != MFRC522::STATUS_OK)
+		return status;
+	byte size = sizeof(seqBlock);
+	seqBlockAddr = NO_BLOCK;
+	status = CARD_TIMED(CardStats::PROBE_READ,
+			cardUtil.mfrc522.MIFARE_Read(blockAddr, seqBlock, &size));
+	if (status == MFRC522::STATUS_OK)
+		seqBlockAddr = blockAddr;
+	return status;
+}
+
+MFRC522::StatusCode CardUtil::Transaction::writeSeqBlock(byte blockAddr) {
+	//Index of the block among the data blocks of the game, the state being 0.
+	int16_t index = (blockAddr / 4 - seqSector()) * 3 + blockAddr % 4;
+	byte block[16];
+	memset(block, 0, sizeof(block));
+	if (index == 1) {
+		block[0] = seqRewards;
+		block[1] = seqRewards >> 8;
+		block[2] = seqRewards >> 16;
+		block[3] = seqRewards >> 24;
+	}
+	for (byte nibble = 0; nibble < 32; nibble++) {
+		int16_t step = (index - 1) * 32 + nibble - 8;
+		if (step >= 0 && step < seqLength)
+			block[nibble / 2] |=
+					nibble & 1 ? initSteps[step] : initSteps[step] << 4;
+	}
+	MFRC522::StatusCode status = cardUtil.authenticateSecured(
+			blockAddr / 4 * 4 + 3);
+	if (status != MFRC522::STATUS_OK)
+		return status;
+	seqBlockAddr = NO_BLOCK;
+	return CARD_TIMED(CardStats::PROBE_WRITE,
+			cardUtil.mfrc522.MIFARE_Write(blockAddr, block, sizeof(block)));
+}
+
+CardUtil::Status CardUtil::Transaction::commitSector(byte sector) {
+	byte fields = dirty & sectorFields(sector);
+	if (fields == 0)
+		return result(STATUS_OK);
+	if (fields & (FIELD_SEQUENCE | FIELD_SEQ_REWARDS)) {
+		//The state is written last, once the sequence is on the card.
+		Status returnStatus = commitSteps();
+		if (returnStatus.code != STATUS_OK)
+			return returnStatus;
+		fields &= ~(FIELD_SEQUENCE | FIELD_SEQ_REWARDS);
+		if (fields == 0)
+			return result(STATUS_OK);
+	}
+	MFRC522::StatusCode status = cardUtil.authenticateSecured(sector * 4 + 3);
+	if (status != MFRC522::STATUS_OK)
+		return failed(status);
+
+	MFRC522 &mfrc522 = cardUtil.mfrc522;
+	byte blockAddr = sector * 4;
+	LOG_DEBUG(F("Transaction writing sector "));
+	LOG_DEBUGLN(sector);
+	if (fields & FIELD_POINTS) {
+		status = commitValue(blockAddr, FIELD_POINTS, pointsDelta, &points);
+		if (status != MFRC522::STATUS_OK)
+			return failed(status);
+		pointsDelta = 0;
+		dirty &= ~FIELD_POINTS;
+	}
+	if (fields & FIELD_REWARDS) {
+		status = commitValue(blockAddr + 1, FIELD_REWARDS, rewardsDelta,
+				&rewards);
+		if (status != MFRC522::STATUS_OK)
+			return failed(status);
+		rewardsDelta = 0;
+		dirty &= ~FIELD_REWARDS;
+	}
+	if (fields & FIELD_CUR_SEQ) {
+		status = CARD_TIMED(CardStats::PROBE_SET_VALUE,
+				mfrc522.MIFARE_SetValue(blockAddr,
+						seqState(game, curSeq, seqLength)));
+		if (status != MFRC522::STATUS_OK)
+			return failed(status);
+		dirty &= ~FIELD_CUR_SEQ;
+	}
+	return result(STATUS_OK);
+}
+
+CardUtil::Status CardUtil::Transaction::commitSteps() {
+	if (!(dirty & (FIELD_SEQUENCE | FIELD_SEQ_REWARDS)))
+		return result(STATUS_OK);
+	//Last block first: the sectors after the first one are authenticated once each.
+	//On a v2 card, a sequence that fits the hot block has nothing in the sector of the game.
+	byte sector = seqSector();
+	for (byte index = 1 + (seqLength - 1 + 8) / 32;
+			index >= 1 && (!hot() || seqLength > HOT_SEQ_STEPS); index--) {
+		MFRC522::StatusCode status = writeSeqBlock(
+				(sector + index / 3) * 4 + index % 3);
+		if (status != MFRC522::STATUS_OK)
+			return failed(status);
+	}
+	//Game 0 of a v2 card is on the card once the hot block is, see commit().
+	if (!hot()) {
+		initSteps = NULL;
+		dirty &= ~(FIELD_SEQUENCE | FIELD_SEQ_REWARDS);
+	}
+	return result(STATUS_OK);
 }
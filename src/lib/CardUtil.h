@@ -7,17 +7,29 @@
 #define CardUtil_h
 
 #include <MFRC522.h>
+#include "Journal.h"
+#include "CardCache.h"
+#include "KeyRing.h"
+#include "Log.h"
 #define GLOBAL_SECTOR   0           // Open Sector, Default key read
 #define PLAYER_SECTOR   6           // Data sector for players 1
 #define MEMBER_SECTOR   7           // Data sector for members 2
-#define SEQ_GAME_SECTOR   8			// Data sector for Seq Game 3
+#define SEQ_GAME_SECTOR   8			// Data sector for Seq Game 3, first sector of sequence game 0.
+#ifndef SEQ_GAME_SLOT_SECTORS
+#define SEQ_GAME_SLOT_SECTORS   1	// Sectors of each sequence game. More allow longer sequences, but fewer games.
+#endif
+#define SEQ_GAMES   ((16 - SEQ_GAME_SECTOR) / SEQ_GAME_SLOT_SECTORS)	// Sequence games on a 1K card, by game id.
+#define SEQ_MAX_STEPS   (SEQ_GAME_SLOT_SECTORS * 96 - 40 < 255 ? SEQ_GAME_SLOT_SECTORS * 96 - 40 : 255)	// Longest sequence.
+#define WRITE_COUNTER_BLOCK   (PLAYER_SECTOR * 4 + 2)	// Block of the write counter, changed before every change of points, rewards or sequence.
+#define HOT_SEQ_STEPS   10	// Steps of sequence game 0 in the hot block of a layout v2 card.
 
 class CardUtil {
 public:
 	/**
-	 * Constructor. Takes MFRC522 object as input.
+	 * Constructor. Takes the MFRC522 reader the cards are read on. The reader is referenced, not copied:
+	 * the CardUtil is meant to live as long as the reader, and to be rebind() to every card selected.
 	 */
-	CardUtil(MFRC522 _mfrc522);
+	CardUtil(MFRC522 &_mfrc522);
 
 	// Status codes from the functions in this class.
 	enum StatusCode
@@ -27,7 +39,29 @@ public:
 		STATUS_INSUFFICIENT_POINTS,	// Insufficient points.
 		STATUS_INSUFFICIENT_REWARDS,	// Insufficient rewards.
 		STATUS_ERROR_WITH_CARD,	// Error communicating with the card.
+		STATUS_ALREADY_CONFIGURED,	// The card is configured already.
+		STATUS_JOURNAL_FAILED,	// The card was changed, but the change couldn't be journaled.
+	};
+	/*
+	 * Layouts of the card data.
+	 * v1: PLAYER_SECTOR holds points, rewards and the write counter, a value block. The state,
+	 *   rewards and steps of each sequence game are in the sectors of the game.
+	 * v2: the write counter block is the hot block, holding besides the counter the state and rewards
+	 *   of sequence game 0, and its first HOT_SEQ_STEPS steps:
+	 *     bytes 0-3: write counter, 4: current step, 5: length, 6-9: rewards, 10-14: steps,
+	 *     15: 2 | balance recorded << 4, see Transaction.
+	 *   A tap on game 0 is then done in PLAYER_SECTOR only, but for the steps after HOT_SEQ_STEPS,
+	 *   kept in the sector of the game as in v1. Other games are as in v1.
+	 * The hot block of a v1 card is a value block, byte 15 the inverted block address: reading the
+	 * write counter tells the layout, by the low nibble of byte 15.
+	 */
+	enum Layout
+		: byte {
+			LAYOUT_UNKNOWN,	// Not read yet.
+		LAYOUT_V1,
+		LAYOUT_V2,
 	};
+
 	//Status returned from the functions in this class.
 	typedef struct {
 		StatusCode code;
@@ -37,9 +71,70 @@ public:
 		int32_t currentSeq;
 	} Status;
 
+	/**
+	 * Selects how points and rewards are updated.
+	 * Native (default): MIFARE_Increment/MIFARE_Decrement followed by MIFARE_Transfer.
+	 * The card applies the change to the value block in one step and fewer bytes go on air.
+	 * Otherwise: the new balance is computed on the reader and written back with MIFARE_SetValue.
+	 */
+	void setNativeValueOps(bool enable);
+
+	/**
+	 * Sets the journal every change of points and rewards is appended to, before the operation
+	 * returns success. NULL (default) for none.
+	 * If an append fails, the operation returns STATUS_JOURNAL_FAILED instead of STATUS_OK:
+	 * the card holds the change, the journal doesn't.
+	 */
+	void setJournal(Journal *journal);
+
+	/**
+	 * Sets the event log the commits recovered are reported to, as Log::EVENT_COMMIT_RECOVERED.
+	 * NULL (default) for none.
+	 */
+	void setLog(Log *log);
+
+	/**
+	 * Sets the cache of card states. NULL (default) for none.
+	 * checkStatus() and Transaction::load() then read the write counter of the card and take
+	 * points, rewards and current sequence from the cache if it's unchanged.
+	 * getPoints() and getRewards() read the card as before: checking the cache costs the same read.
+	 */
+	void setCache(CardCache *cache);
+
+	/**
+	 * Sets the ring of secret keys. NULL (default) for the built-in key only, secretKey(1).
+	 * Cards are then configured with the current key of the ring, and those on another version of
+	 * the ring are still accepted. Unless the ring says otherwise, stop() upgrades them to the
+	 * current version, once their operations are done.
+	 */
+	void setKeyRing(KeyRing *keyRing);
+
+	/**
+	 * Built-in secret key of the given version, NULL if there's none. For the key rings.
+	 */
+	static const MFRC522::MIFARE_Key *secretKey(byte version);
+
+	/**
+	 * Sets the layout cards are configured with, LAYOUT_V2 (default) or LAYOUT_V1.
+	 * With LAYOUT_V2, a v1 card is migrated by stop() on a tap reading its write counter.
+	 * Cards of either layout are read and written as their write counter tells, whatever the setting.
+	 * Stations that don't know v2 break the state of game 0 on v2 cards: a fleet keeps LAYOUT_V1
+	 * until every station is updated.
+	 */
+	void setLayout(Layout layout);
+
 	//Global Operations
+	/**
+	 * Starts working on the card just selected on the reader, i.e. after PICC_ReadCardSerial().
+	 * Forgets what was known of the previous card.
+	 */
+	void rebind();
+
 	/**
 	 * Halt the card communication.
+	 * Also forgets the authenticated sector, the next operation authenticates again.
+	 * A card found on an older key version of the key ring is upgraded first, and a card on an
+	 * older layout migrated.
 	 */
 	Status stop();
 
@@ -60,19 +155,34 @@ public:
 	/**
 	 * Configures the card by writing Global information on the card and setting proper key access.
 	 * This function should be called once on the card after it is received from manufacturer.
+	 * A card authenticated with another key than the default one is used before: it gets its global
+	 * information last, and with a key ring it's authenticated with the keys of the ring.
 	 */
 	Status configure(int32_t numPoints,			//Points to be loaded initially.
-			MFRC522::MIFARE_Key* auth_key, //Auth key to be used for authentication
+			const MFRC522::MIFARE_Key* auth_key, //Auth key to be used for authentication
 			MFRC522::PICC_Command cmd //cmd to specify whether to use Key A or B for auth.
 			);
 
 	/**
 	 * Configures the card by writing Global information on the card and setting proper key access.
 	 * This function should be called in order to re-use a card.
+	 * With a key ring, the key version isn't read first: the card is authenticated with the key
+	 * it's expected on, the first sector rewritten telling if it's configured.
 	 */
 	Status reset(int32_t numPoints	//Points to be loaded initially.
 			);
 
+	/**
+	 * Configures a card of a batch, whether it's new or not, telling them apart by the key version block.
+	 * A new card is configured. A configured card is reset if resetConfigured, else left as is and
+	 * STATUS_ALREADY_CONFIGURED is returned.
+	 * The key version block is read under the authentication configure() writes it with, so this costs
+	 * a single read over configure().
+	 */
+	Status provision(int32_t numPoints,	//Points to be loaded initially.
+			bool resetConfigured	//Reset a configured card instead of skipping it.
+			);
+
 	/**
 	 * Returns the current status of the card.
 	 */
@@ -126,16 +236,35 @@ public:
 			);
 
 	//Sequence game related operations.	
+	/*
+	 * A card holds SEQ_GAMES independent sequence games, game id n taking the SEQ_GAME_SLOT_SECTORS
+	 * sectors from SEQ_GAME_SECTOR + n * SEQ_GAME_SLOT_SECTORS. In the first sector of a game:
+	 *   block 0: state, value block. -1 if no game is in progress, else current step | length << 8 | game id << 16.
+	 *   block 1: rewards (4 bytes, little endian), then steps 0 to 23.
+	 *   block 2 and the data blocks of the next sectors: 32 steps each.
+	 * Steps are 4 bits each, the first one in the high nibble, so a step is a station from 0 to 15.
+	 * A tap reads the state and the one block holding the current step.
+	 */
+
+	/**
+	 * Initialize the sequence game 0.
+	 */
+	Status initSequence(byte* sequence,	//16 byte Sequence to be followed for the game, ended by 0x00 if shorter.
+			int32_t numRewards	//Rewards to win at the end of the game.
+			);
 
 	/**
-	 * Initialize the sequence game.
+	 * Initialize the given sequence game.
+	 * Returns STATUS_FAILURE if the game id, the length or a step is out of range.
 	 */
-	Status initSequence(byte* sequence,	//16 byte Sequence to be followed for the game.
+	Status initSequence(byte gameId,	//Game, from 0 to SEQ_GAMES - 1.
+			const byte* steps,	//Steps to be followed for the game, from 0 to 15, one per byte.
+			byte length,		//Number of steps, from 1 to SEQ_MAX_STEPS.
 			int32_t numRewards	//Rewards to win at the end of the game.
 			);
 
 	/**
-	 * Checks the next byte in the sequence against the given input.
+	 * Checks the next step of the sequence game 0 against the given input.
 	 * If the input matches the next in sequence, then current sequence is updated and success returned.
 	 * An error is returned if the next byte in sequence doesn't match the given input.
 	 * If this is the last in sequence, the game is finished and rewards awarded.
@@ -143,19 +272,323 @@ public:
 	Status checkSequence(byte next	//Next value in sequence to be checked.
 			);
 
+	/**
+	 * Checks the next step of the given sequence game, as checkSequence(next) does.
+	 */
+	Status checkSequence(byte gameId,	//Game, from 0 to SEQ_GAMES - 1.
+			byte next	//Next value in sequence to be checked.
+			);
+
+	/**
+	 * A batch of operations done in one pass over the card.
+	 * load() reads the fields the operations need, the operations are then applied to the loaded
+	 * values on the reader, and commit() writes back only the blocks that changed.
+	 * Sectors are visited starting with the one already authenticated, so each sector is
+	 * authenticated at most once by load() and once by commit().
+	 * On a v2 card, sequence game 0 is in PLAYER_SECTOR, but for its steps after HOT_SEQ_STEPS.
+	 * The returned Status carries the values of the loaded fields with the pending changes applied.
+	 * The sequence fields are those of the game given to the constructor.
+	 * e.g. charge and start a sequence game:
+	 *   CardUtil::Transaction transaction(cardUtil);
+	 *   status = transaction.load(CardUtil::Transaction::FIELD_POINTS);
+	 *   if (status.code == CardUtil::STATUS_OK) status = transaction.chargePoints(numPoints);
+	 *   if (status.code == CardUtil::STATUS_OK) status = transaction.initSequence(sequence, numRewards);
+	 *   if (status.code == CardUtil::STATUS_OK) status = transaction.commit();
+	 *
+	 * A commit changing game 0 of a v2 card and one balance is made tear safe by the hot block, written
+	 * first: it then records the commit, holding the balance after it in place of the write counter,
+	 * and which balance in the high nibble of byte 15. The balance is written next.
+	 * A later tap reading the write counter finds the record, and writes the balance if it differs,
+	 * before anything else is read. The record is left on the card until the next change, which
+	 * writes the hot block again and starts the counter anew: each tap reading the counter until then
+	 * costs one MIFARE_GetValue. Meanwhile the card isn't cached.
+	 * The balance must be known: a balance not loaded, e.g. the rewards of a win, is read by commit()
+	 * under the authentication of the write counter, one MIFARE_GetValue.
+	 * A start finished so by load() on the next tap is told by startRecovered(): the game is on and
+	 * charged, the tap mustn't charge it again.
+	 * The commits of v1 cards, of other games, or changing both balances aren't recorded: the blocks
+	 * they write span two sectors, or PLAYER_SECTOR has no room for more. They write the game first:
+	 * torn before the balance, the game is started without its charge, which the next tap charges
+	 * and starts again, or ended without its rewards, but never paid twice.
+	 */
+	class Transaction {
+	public:
+		// Fields of the card handled by a transaction.
+		enum Field
+			: byte {
+				FIELD_POINTS = 0x01,	// Points. PLAYER_SECTOR
+			FIELD_REWARDS = 0x02,		// Rewards. PLAYER_SECTOR
+			FIELD_CUR_SEQ = 0x04,		// Current step and length of the sequence game.
+			FIELD_SEQUENCE = 0x08,		// Block of the sequence holding the current step. Loaded after FIELD_CUR_SEQ.
+			FIELD_SEQ_REWARDS = 0x10,	// Rewards for winning the sequence game.
+		};
+
+		/**
+		 * Constructor. Takes the CardUtil of the selected card, and the sequence game worked on.
+		 */
+		Transaction(CardUtil &cardUtil, byte gameId = 0);
+
+		/**
+		 * Reads the given fields (a combination of Field) from the card.
+		 * Fields already loaded are not read again.
+		 */
+		Status load(byte fields	//Fields to be read.
+				);
+
+		/**
+		 * Charges the given points. FIELD_POINTS must be loaded.
+		 * Returns STATUS_INSUFFICIENT_POINTS if the balance is lower than numPoints.
+		 */
+		Status chargePoints(int32_t numPoints	//Points to be charged.
+				);
+
+		/**
+		 * Adds the given points.
+		 */
+		Status addPoints(int32_t numPoints	//Points to be added.
+				);
+
+		/**
+		 * Charges the given rewards. FIELD_REWARDS must be loaded.
+		 * Returns STATUS_INSUFFICIENT_REWARDS if the balance is lower than numRewards.
+		 */
+		Status chargeRewards(int32_t numRewards	//Rewards to be charged.
+				);
+
+		/**
+		 * Adds the given rewards.
+		 */
+		Status addRewards(int32_t numRewards	//Rewards to be added.
+				);
+
+		/**
+		 * Initializes the sequence game.
+		 */
+		Status initSequence(const byte* sequence,//16 byte Sequence to be followed for the game, ended by 0x00 if shorter.
+				int32_t numRewards	//Rewards to win at the end of the game.
+				);
+
+		/**
+		 * Initializes the sequence game, as CardUtil::initSequence(gameId, ...) does.
+		 * The steps are read by commit(): they must stay valid until then.
+		 */
+		Status initSequence(const byte* steps,	//Steps to be followed for the game, from 0 to 15, one per byte.
+				byte length,	//Number of steps, from 1 to SEQ_MAX_STEPS.
+				int32_t numRewards	//Rewards to win at the end of the game.
+				);
+
+		/**
+		 * Checks the next byte in the sequence, as CardUtil::checkSequence() does.
+		 * FIELD_CUR_SEQ and FIELD_SEQUENCE must be loaded.
+		 * Winning the game reads FIELD_SEQ_REWARDS if needed and adds the rewards in the same commit.
+		 */
+		Status checkSequence(byte next	//Next value in sequence to be checked.
+				);
+
+		/**
+		 * Writes the changed blocks to the card.
+		 * On failure the blocks not written yet stay pending, so commit() can be called again.
+		 * A recorded commit that failed once its hot block was on the card is finished by reading the
+		 * write counter, so calling commit() again then writes nothing more.
+		 * Returns STATUS_ERROR_WITH_CARD, writing nothing, if a commit torn on an earlier tap was
+		 * recovered since the fields were loaded.
+		 */
+		Status commit();
+
+		/**
+		 * True if load() finished a commit of game 0 torn on an earlier tap, which charged the points
+		 * and started the game: the game is on, and the tap starting it mustn't charge it again.
+		 */
+		bool startRecovered();
+
+	private:
+		Status result(StatusCode code);
+		Status failed(MFRC522::StatusCode status);
+		Status loadSector(byte sector, byte fields);
+		Status commitSector(byte sector);
+		MFRC522::StatusCode commitValue(byte blockAddr, byte field,
+				int32_t delta, int32_t *value);
+		MFRC522::StatusCode readSeqBlock(byte blockAddr);
+		MFRC522::StatusCode writeSeqBlock(byte blockAddr);
+		Status commitSteps();
+		byte recordField();
+		byte firstSector();
+		byte otherSector(byte sector);
+		byte sectorFields(byte sector);
+		byte seqSector();
+		bool hot();
+
+		CardUtil &cardUtil;
+		byte game;				//Sequence game worked on.
+		byte loaded;			//Fields read from the card.
+		byte dirty;				//Fields changed since load.
+		int32_t points;
+		int32_t rewards;
+		int32_t curSeq;			//Current step, -1 if no game is in progress.
+		byte seqLength;			//Number of steps of the game.
+		int32_t seqRewards;
+		int32_t pointsDelta;	//Pending change of points.
+		int32_t rewardsDelta;	//Pending change of rewards.
+		const byte *initSteps;	//Steps of the game initialized, until committed.
+		byte seqBlockAddr;		//Block of the sequence in seqBlock, NO_BLOCK if none.
+		byte seqBlock[18];		//Block of the sequence holding the current step.
+		byte recorded;			//Balance the hot block written by this commit records, until it's done.
+	};
+
 	//Membership related operations.
 	/**
 	 */
 protected:
+	/**
+	 * Authenticates the sector of the given trailer block, unless it's already
+	 * authenticated with the same key for the current UID.
+	 */
+	MFRC522::StatusCode authenticate(MFRC522::PICC_Command cmd, //Key A or B
+			byte trailerBlock,	//Trailer block of the sector.
+			const MFRC522::MIFARE_Key* key	//Key to authenticate with.
+			);
+
+	/**
+	 * Forgets the authenticated sector. Called when the card session is lost or the keys change.
+	 */
+	void clearAuthentication();
+
+	/**
+	 * Authenticates a secured sector with key B, unless it's already authenticated.
+	 * With a key ring, the key version the card is expected on is tried first, then the others,
+	 * the card being selected again after each failure. The version found is kept in keyVersion.
+	 */
+	MFRC522::StatusCode authenticateSecured(byte trailerBlock	//Trailer block of the sector.
+			);
+
+	/**
+	 * Selects the card again after a failed authentication, which put it back to IDLE.
+	 */
+	MFRC522::StatusCode reselect();
+
+	/**
+	 * Writes the date and the key version of the current secret key into the global sector.
+	 */
+	MFRC522::StatusCode writeGlobalInfo();
+
+	/**
+	 * Rewrites the trailers of the secured sectors not on the current key version, then the
+	 * key version block.
+	 */
+	MFRC522::StatusCode upgradeKeys();
+
+	/**
+	 * Current secret key: of the key ring, else the built-in one.
+	 */
+	const MFRC522::MIFARE_Key *currentKey();
+
+	/**
+	 * Version of currentKey().
+	 */
+	byte currentKeyVersion();
+
+	/**
+	 * Reads the version of the secret key the card is configured with, 0 if it's not configured.
+	 */
+	MFRC522::StatusCode readKeyVersion(int32_t *keyVersion);
+
+	/**
+	 * Updates a value block by delta, natively or with MIFARE_SetValue(newValue) as set by setNativeValueOps().
+	 * The change is journaled once on the card.
+	 */
+	MFRC522::StatusCode changeValue(byte blockAddr,	//Value block to update.
+			int32_t delta,	//Change to apply.
+			int32_t newValue	//Value after the change.
+			);
+
+	/**
+	 * Appends a change of points or rewards to the journal, if any.
+	 * A failed append is reported by successCode().
+	 */
+	void journalChange(byte blockAddr,	//Value block changed.
+			int32_t delta,	//Change applied, or the new balance if set.
+			bool set = false	//The balance was written over, by configure().
+			);
+
+	/**
+	 * Code of an operation done: STATUS_OK, or STATUS_JOURNAL_FAILED if a change couldn't be
+	 * journaled since the last one.
+	 */
+	StatusCode successCode();
+
+	/**
+	 * Reads the write counter, unless already known for this tap.
+	 * The block holding it tells the layout of the card, and is kept in hotBlock.
+	 * A hot block recording a commit has its balance checked, see recoverCommit().
+	 */
+	MFRC522::StatusCode readWriteCounter();
+
+	/**
+	 * Whether the hot block read or written records a commit, see Transaction.
+	 */
+	bool commitRecorded();
+
+	/**
+	 * Writes the balance recorded by the hot block if it differs, the commit being torn before it.
+	 * PLAYER_SECTOR is authenticated.
+	 */
+	MFRC522::StatusCode recoverCommit();
+
+	/**
+	 * Moves the state, rewards and first steps of sequence game 0 of a v1 card to the hot block.
+	 * The sector of the game keeps them, so that a torn migration leaves a working v1 card.
+	 */
+	MFRC522::StatusCode migrateLayout();
+
+	/**
+	 * Changes the write counter, so that the caches of all the stations see their entry is out of date.
+	 * Called before changing points, rewards or the sequence game: if the change is torn,
+	 * the caches are out of date anyway.
+	 * Written with MIFARE_SetValue, which works as well on cards configured before the counter existed.
+	 * On a v2 card, the hot block is written as it is in hotBlock, with the counter changed.
+	 */
+	MFRC522::StatusCode bumpWriteCounter(byte recordField = 0,	//v2 only: balance recorded by the hot block, see Transaction.
+			int32_t target = 0	//Balance after the commit, written in place of the counter.
+			);
+
+	/**
+	 * Returns the cache entry of the card in *entry, with no fields if it's out of date.
+	 * *entry is NULL if there's no cache.
+	 */
+	MFRC522::StatusCode cachedEntry(CardCache::Entry **entry);
+
+	/**
+	 * Forgets the card in the cache, if any. For the operations that don't keep it up to date.
+	 */
+	void uncache();
+
+	static const byte NO_BLOCK = 0xFF;
 	static const int32_t secret_key_version = 1;
-	MFRC522::MIFARE_Key secret_key;				//Secret key
-	MFRC522::MIFARE_Key default_key;			//Default Key
-	MFRC522 mfrc522;							//MFRC522 instance
-	byte trailerBlockData[16];
-	const MFRC522::MIFARE_Key secret_keys[1] = {//Secret key Array containing all secret keys.
-			secret_key };
-	static const byte secret_key_array_v1[6] = {		//Secret key
+	static constexpr byte secret_key_array_v1[6] = {		//Secret key
 			0xab, 0x28, 0x29, 0x44, 0x2b, 0xFF };
+	static const MFRC522::MIFARE_Key secret_keys[1];	//Secret key Array containing all secret keys.
+	static const MFRC522::MIFARE_Key &secret_key;		//Secret key of secret_key_version.
+	static const MFRC522::MIFARE_Key default_key;		//Default Key
+	static const byte trailerBlockData[16];				//Trailer of the secured sectors, in PROGMEM.
+	MFRC522 &mfrc522;							//MFRC522 instance
+	byte authenticatedBlock;					//Trailer block of the authenticated sector, NO_BLOCK if none.
+	MFRC522::PICC_Command authenticatedCmd;		//Key A or B used for it.
+	MFRC522::MIFARE_Key authenticatedKey;		//Key used for it.
+	MFRC522::Uid authenticatedUid;				//Card it was authenticated on.
+	bool nativeValueOps;						//Update values with Increment/Decrement and Transfer.
+	Journal *journal;							//Journal of the balance changes, NULL if none.
+	Log *log;									//Event log of the recoveries, NULL if none.
+	CardCache *cache;							//Cache of card states, NULL if none.
+	int32_t writeCounter;						//Write counter of the card, if writeCounterKnown.
+	bool writeCounterKnown;						//Write counter read or written in this tap.
+	KeyRing *keyRing;							//Secret keys by version, NULL for secret_key only.
+	byte keyVersion;							//Version the card was last authenticated with in this tap, 0 if none.
+	bool staleKeys;								//A sector of the card is on an older version, to be upgraded by stop().
+	Layout layout;								//Layout cards are configured with and migrated to.
+	Layout cardLayout;							//Layout of the card, LAYOUT_UNKNOWN until the write counter is read.
+	byte hotBlock[18];							//Hot block of a v2 card, as on the card once writeCounterKnown.
+	bool recovered;								//A torn commit was recovered in this tap.
+	bool journalFailed;							//A change wasn't journaled, not reported yet.
 
 };
 #endif
@@ -0,0 +1,73 @@
+/*
+ * CommandFrame.cpp
+ * Frame format of the binary command protocol. See CommandFrame.h.
+ */
+
+#include "CommandFrame.h"
+
+/**
+ * CRC-8, polynomial 0x07, as Log's frames.
+ */
+static byte crc8(const byte *data, byte length) {
+	byte crc = 0;
+	for (byte i = 0; i < length; i++) {
+		crc ^= data[i];
+		for (byte bit = 0; bit < 8; bit++)
+			crc = (crc & 0x80) ? (byte) ((crc << 1) ^ 0x07) : (byte) (crc << 1);
+	}
+	return crc;
+}
+
+CommandFrame::Parser::Parser(byte sync) :
+		sync(sync), pos(0) {
+}
+
+bool CommandFrame::Parser::feed(byte c) {
+	if (pos == 0) {
+		if (c == sync)
+			frame[pos++] = c;
+		return false;
+	}
+	if (pos == 1 && c > MAX_PAYLOAD) {
+		pos = 0;	// Not a frame.
+		return false;
+	}
+	frame[pos++] = c;
+	byte crcPos = HEADER_SIZE + frame[1];
+	if (pos <= crcPos)
+		return false;
+	pos = 0;
+	return crc8(frame + 1, crcPos - 1) == frame[crcPos];
+}
+
+byte CommandFrame::encode(byte *buffer, byte sync, byte opcode, uint16_t id,
+		const byte *payload, byte length) {
+	buffer[0] = sync;
+	buffer[1] = length;
+	buffer[2] = opcode;
+	put16(buffer + 3, id);
+	memcpy(buffer + HEADER_SIZE, payload, length);
+	buffer[HEADER_SIZE + length] = crc8(buffer + 1, HEADER_SIZE - 1 + length);
+	return HEADER_SIZE + length + 1;
+}
+
+byte *CommandFrame::put16(byte *buffer, uint16_t value) {
+	*buffer++ = (byte) value;
+	*buffer++ = (byte) (value >> 8);
+	return buffer;
+}
+
+byte *CommandFrame::put32(byte *buffer, uint32_t value) {
+	for (byte i = 0; i < 4; i++, value >>= 8)
+		*buffer++ = (byte) value;
+	return buffer;
+}
+
+uint16_t CommandFrame::get16(const byte *buffer) {
+	return buffer[0] | (uint16_t) buffer[1] << 8;
+}
+
+uint32_t CommandFrame::get32(const byte *buffer) {
+	return buffer[0] | (uint32_t) buffer[1] << 8 | (uint32_t) buffer[2] << 16
+			| (uint32_t) buffer[3] << 24;
+}
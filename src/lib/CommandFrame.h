@@ -0,0 +1,126 @@
+/*
+ * CommandFrame.h
+ * Binary command protocol of the loading station, for a host to drive it from a script
+ * (see host/StationCli) instead of an operator typing in the console.
+ * The frame format, shared by the station (see CommandLink) and the host.
+ *
+ * Frames, both ways:
+ *   sync, length, opcode, id (2), payload (length bytes), CRC-8 of length to the end of payload.
+ * Fields are little endian, the CRC as Log's (polynomial 0x07). Requests start with REQUEST_SYNC,
+ * responses with RESPONSE_SYNC: neither is ASCII, so frames and typed text share the console,
+ * and the host tells responses from Log's event frames (Log::FRAME_SYNC) and text.
+ * The id is chosen by the host and sent back in the responses to the request.
+ *
+ * Requests:
+ *   OP_CONFIGURE, OP_RECHARGE, OP_BALANCE, OP_RESET, OP_STATUS
+ *       points (4), cards (2). The operation of the console menu with that number, queued for the
+ *       next cards tapped. cards is how many cards it is done on, 0 for every card until OP_CANCEL.
+ *       points is ignored by OP_BALANCE and OP_STATUS.
+ *   OP_PING    No payload. Answered with ACK_DONE.
+ *   OP_CANCEL  No payload. Drops the queued operations.
+ * Responses:
+ *   OP_ACK     code (AckCode), operations queued (1). Sent for every valid request.
+ *   OP_RESULT  request opcode, CardUtil::StatusCode, MFRC522::StatusCode, UID (4, Log::packUid()),
+ *              points (4), cards left (2). Sent for every card an operation is done on.
+ * A frame with a bad CRC or length is dropped unanswered: the host sends it again with the same id
+ * when no OP_ACK comes, and a request with the id of the last one queued is not queued again.
+ *
+ * The operations are queued, so the host can send them ahead of the cards (pipelining): an
+ * operation failing on a card stays at the head of the queue for the next card.
+ */
+#ifndef CommandFrame_h
+#define CommandFrame_h
+
+#include <Arduino.h>
+
+class CommandFrame {
+public:
+	static const byte REQUEST_SYNC = 0xA6;
+	static const byte RESPONSE_SYNC = 0xA7;
+	static const byte HEADER_SIZE = 5;		// Sync, length, opcode and id.
+	static const byte MAX_PAYLOAD = 13;
+	static const byte MAX_FRAME_SIZE = HEADER_SIZE + MAX_PAYLOAD + 1;
+	static const byte CARD_PAYLOAD = 6;		// Payload of the card operations.
+	static const byte ACK_PAYLOAD = 2;
+	static const byte RESULT_PAYLOAD = 13;
+
+	enum Opcode
+		: byte {
+			OP_CONFIGURE = 1,
+		OP_RECHARGE = 2,
+		OP_BALANCE = 3,
+		OP_RESET = 4,
+		OP_STATUS = 5,
+		OP_PING = 0x20,
+		OP_CANCEL = 0x21,
+		OP_ACK = 0x80,
+		OP_RESULT = 0x81,
+	};
+
+	enum AckCode
+		: byte {
+			ACK_QUEUED,				// Operation queued for the next card.
+		ACK_DONE,				// Ping or cancel done.
+		ACK_QUEUE_FULL,			// Operation not queued, send it again later.
+		ACK_BAD_REQUEST,		// Unknown opcode, or wrong payload length for it.
+	};
+
+	/**
+	 * Finds the frames in a byte stream. Used for the requests by the station
+	 * and for the responses by the host.
+	 */
+	class Parser {
+	public:
+		Parser(byte sync);
+
+		/**
+		 * Takes the next byte. Returns true when it completes a valid frame.
+		 */
+		bool feed(byte c);
+
+		/**
+		 * Drops the frame being received.
+		 */
+		void reset() {
+			pos = 0;
+		}
+
+		/**
+		 * True in the middle of a frame.
+		 */
+		bool receiving() const {
+			return pos > 0;
+		}
+
+		byte opcode() const {
+			return frame[2];
+		}
+		uint16_t id() const {
+			return frame[3] | (uint16_t) frame[4] << 8;
+		}
+		byte length() const {
+			return frame[1];
+		}
+		const byte *payload() const {
+			return frame + HEADER_SIZE;
+		}
+
+	private:
+		byte sync;
+		byte pos;				// Bytes of the frame received, 0 while looking for the sync.
+		byte frame[MAX_FRAME_SIZE];
+	};
+
+	/**
+	 * Writes a frame in buffer, at least MAX_FRAME_SIZE bytes. Returns its size.
+	 */
+	static byte encode(byte *buffer, byte sync, byte opcode, uint16_t id,
+			const byte *payload, byte length);
+
+	static byte *put16(byte *buffer, uint16_t value);
+	static byte *put32(byte *buffer, uint32_t value);
+	static uint16_t get16(const byte *buffer);
+	static uint32_t get32(const byte *buffer);
+};
+
+#endif /* CommandFrame_h */
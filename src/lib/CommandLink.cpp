@@ -0,0 +1,100 @@
+/*
+ * CommandLink.cpp
+ * Station side of the binary command protocol. See CommandLink.h.
+ */
+
+#include "CommandLink.h"
+
+CommandLink::CommandLink() :
+		parser(CommandFrame::REQUEST_SYNC), lastByteMs(0), head(0), tail(
+				0), lastId(0), anyQueued(false) {
+}
+
+bool CommandLink::receive() {
+	bool received = false;
+	if (parser.receiving() && millis() - lastByteMs > FRAME_TIMEOUT_MS)
+		parser.reset();
+	while (Serial.available() > 0
+			&& (parser.receiving()
+					|| Serial.peek() == CommandFrame::REQUEST_SYNC)) {
+		lastByteMs = millis();
+		if (parser.feed(Serial.read())) {
+			handle(parser);
+			received = true;
+		}
+	}
+	return received;
+}
+
+void CommandLink::handle(const CommandFrame::Parser &request) {
+	byte opcode = request.opcode();
+	uint16_t id = request.id();
+	if (opcode == CommandFrame::OP_PING && request.length() == 0) {
+		ack(id, CommandFrame::ACK_DONE);
+	} else if (opcode == CommandFrame::OP_CANCEL && request.length() == 0) {
+		tail = head;
+		ack(id, CommandFrame::ACK_DONE);
+	} else if (opcode >= CommandFrame::OP_CONFIGURE
+			&& opcode <= CommandFrame::OP_STATUS
+			&& request.length() == CommandFrame::CARD_PAYLOAD) {
+		if (anyQueued && id == lastId) {
+			//Sent again, the acknowledgement was lost.
+			ack(id, CommandFrame::ACK_QUEUED);
+		} else if (queued() == COMMAND_QUEUE_SIZE) {
+			ack(id, CommandFrame::ACK_QUEUE_FULL);
+		} else {
+			Command &command = queue[head & (COMMAND_QUEUE_SIZE - 1)];
+			command.id = id;
+			command.opcode = opcode;
+			command.points = (int32_t) CommandFrame::get32(request.payload());
+			command.cards = CommandFrame::get16(request.payload() + 4);
+			head++;
+			lastId = id;
+			anyQueued = true;
+			ack(id, CommandFrame::ACK_QUEUED);
+		}
+	} else {
+		ack(id, CommandFrame::ACK_BAD_REQUEST);
+	}
+}
+
+void CommandLink::done(const CardUtil::Status &status,
+		const MFRC522::Uid &uid) {
+	Command *command = front();
+	if (command == NULL)
+		return;
+	bool ok = status.code == CardUtil::STATUS_OK;
+	bool last = ok && command->cards == 1;
+	if (ok && command->cards > 0)
+		command->cards--;
+	//Only these operations set the points.
+	bool points = ok
+			&& (command->opcode == CommandFrame::OP_CONFIGURE
+					|| command->opcode == CommandFrame::OP_RECHARGE
+					|| command->opcode == CommandFrame::OP_BALANCE);
+	byte payload[CommandFrame::RESULT_PAYLOAD];
+	byte *buffer = payload;
+	*buffer++ = command->opcode;
+	*buffer++ = status.code;
+	*buffer++ = ok ? MFRC522::STATUS_OK : status.mfrc522StatusCode;
+	buffer = CommandFrame::put32(buffer, Log::packUid(uid));
+	buffer = CommandFrame::put32(buffer,
+			(uint32_t) (points ? status.currentPoints : 0));
+	CommandFrame::put16(buffer, command->cards);
+	send(CommandFrame::OP_RESULT, command->id, payload, sizeof(payload));
+	if (last)
+		tail++;
+}
+
+void CommandLink::ack(uint16_t id, CommandFrame::AckCode code) {
+	byte payload[CommandFrame::ACK_PAYLOAD] = { code, queued() };
+	send(CommandFrame::OP_ACK, id, payload, sizeof(payload));
+}
+
+void CommandLink::send(byte opcode, uint16_t id, const byte *payload,
+		byte length) {
+	byte frame[CommandFrame::MAX_FRAME_SIZE];
+	byte size = CommandFrame::encode(frame, CommandFrame::RESPONSE_SYNC, opcode,
+			id, payload, length);
+	Serial.write(frame, size);
+}
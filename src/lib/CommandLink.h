@@ -0,0 +1,80 @@
+/*
+ * CommandLink.h
+ * Station side of the binary command protocol (see CommandFrame.h): receives the requests from
+ * Serial, queues the card operations for the next cards tapped and sends the responses.
+ */
+#ifndef CommandLink_h
+#define CommandLink_h
+
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <CardUtil.h>
+#include <Log.h>
+#include <CommandFrame.h>
+
+/**
+ * Operations the queue holds. A power of 2, at most 128. Each takes 10 bytes of SRAM.
+ */
+#ifndef COMMAND_QUEUE_SIZE
+#define COMMAND_QUEUE_SIZE 8
+#endif
+
+class CommandLink {
+public:
+	static const unsigned long FRAME_TIMEOUT_MS = 100;	// Longest gap within a frame.
+
+	/**
+	 * An operation, as queued.
+	 */
+	typedef struct {
+		uint16_t id;			// Id of the request.
+		byte opcode;
+		int32_t points;
+		uint16_t cards;			// Cards left, 0 for every card.
+	} Command;
+
+	CommandLink();
+
+	/**
+	 * Reads the requests available on Serial, up to a byte not part of a frame.
+	 * Card operations are queued, pings and cancels done, and every valid request answered.
+	 * Returns true if a request was received.
+	 */
+	bool receive();
+
+	/**
+	 * Next operation to be done, NULL if none.
+	 */
+	Command *front() {
+		return head == tail ? NULL : &queue[tail & (COMMAND_QUEUE_SIZE - 1)];
+	}
+
+	/**
+	 * Accounts for the front operation done on a card, and sends CommandFrame::OP_RESULT.
+	 * The operation is dequeued once done on its cards.
+	 * A failed card doesn't count: the operation stays for the next one.
+	 */
+	void done(const CardUtil::Status &status, const MFRC522::Uid &uid);
+
+	/**
+	 * Number of operations queued.
+	 */
+	byte queued() const {
+		return head - tail;
+	}
+
+private:
+	void handle(const CommandFrame::Parser &request);
+	void send(byte opcode, uint16_t id, const byte *payload, byte length);
+	void ack(uint16_t id, CommandFrame::AckCode code);
+
+	CommandFrame::Parser parser;
+	unsigned long lastByteMs;	// millis() when the last byte of a frame was received.
+	Command queue[COMMAND_QUEUE_SIZE];
+	byte head;					// Free running index of the next operation to be queued.
+	byte tail;					// Free running index of the front operation.
+	uint16_t lastId;			// Id of the last operation queued.
+	bool anyQueued;				// lastId is set.
+};
+
+#endif /* CommandLink_h */
@@ -0,0 +1,27 @@
+/*
+ * EEPROMStorage.h
+ * Storage on the AVR EEPROM. Arduino only.
+ * A byte written takes about 3.3 ms and each cell stands about 100,000 writes.
+ */
+#ifndef EEPROMStorage_h
+#define EEPROMStorage_h
+
+#include <EEPROM.h>
+#include "Storage.h"
+
+class EEPROMStorage: public Storage {
+public:
+	uint16_t length() {
+		return EEPROM.length();
+	}
+
+	byte read(uint16_t addr) {
+		return EEPROM.read(addr);
+	}
+
+	void update(uint16_t addr, byte value) {
+		EEPROM.update(addr, value);
+	}
+};
+
+#endif /* EEPROMStorage_h */
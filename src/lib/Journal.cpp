@@ -0,0 +1,166 @@
+/*
+ * Journal.cpp
+ * See Journal.h.
+ */
+
+#include "Journal.h"
+
+Journal::Journal(Storage &storage, uint16_t start, uint16_t length) :
+		storage(storage), start(start), slots(0), head(0), nextSeq(0), ackedSeq(
+				0xFFFF), lostCount(0) {
+	if (length == 0)
+		length = storage.length() - start;
+	slots = length / ENTRY_SIZE;
+}
+
+void Journal::begin() {
+	bool found = false;
+	bool ackFound = false;
+	uint16_t headSeq = 0;
+	uint16_t ackSeq = 0;
+	Entry entry;
+	head = 0;
+	lostCount = 0;
+	for (uint16_t slot = 0; slot < slots; slot++) {
+		if (!readEntry(slot, entry))
+			continue;
+		//Sequence numbers wrap around: compare the difference.
+		if (!found || (int16_t) (entry.seq - headSeq) > 0) {
+			headSeq = entry.seq;
+			head = slot;
+			found = true;
+		}
+		if (entry.type == ENTRY_ACK
+				&& (!ackFound || (int16_t) (entry.seq - ackSeq) > 0)) {
+			ackSeq = entry.seq;
+			ackedSeq = (uint16_t) entry.delta;
+			ackFound = true;
+		}
+	}
+	if (found) {
+		head = (head + 1) % slots;
+		nextSeq = headSeq + 1;
+	} else {
+		nextSeq = 0;
+	}
+	//The last acknowledgement was overwritten: everything left is pending.
+	if (!ackFound)
+		ackedSeq = nextSeq - slots - 1;
+}
+
+bool Journal::append(EntryType type, uint32_t uid, int32_t delta) {
+	if (slots == 0)
+		return false;
+	Entry entry;
+	if (readEntry(head, entry) && entry.type != ENTRY_ACK
+			&& isPending(entry.seq))
+		lostCount++;
+	entry.seq = nextSeq;
+	entry.type = type;
+	entry.uid = uid;
+	entry.delta = delta;
+	writeEntry(head, entry);
+	Entry check;
+	bool ok = readEntry(head, check) && check.seq == entry.seq;
+	head = (head + 1) % slots;
+	nextSeq++;
+	return ok;
+}
+
+uint16_t Journal::replay(Visitor visitor) {
+	uint16_t count = 0;
+	Entry entry;
+	//The head is the oldest slot.
+	for (uint16_t i = 0; i < slots; i++) {
+		uint16_t slot = (head + i) % slots;
+		if (!readEntry(slot, entry) || entry.type == ENTRY_ACK
+				|| !isPending(entry.seq))
+			continue;
+		if (visitor != NULL)
+			visitor(entry);
+		count++;
+	}
+	return count;
+}
+
+/**
+ * Prints an entry for exportEntries().
+ */
+static void printEntry(const Journal::Entry &entry) {
+	Serial.print(F("JOURNAL,"));
+	Serial.print(entry.seq);
+	Serial.print(',');
+	Serial.print((byte) entry.type);
+	Serial.print(',');
+	Serial.print(entry.uid, HEX);
+	Serial.print(',');
+	Serial.println(entry.delta);
+}
+
+uint16_t Journal::exportEntries() {
+	uint16_t count = replay(printEntry);
+	Serial.print(F("JOURNAL END,"));
+	Serial.println(count);
+	if (count > 0)
+		acknowledge(lastSeq());
+	return count;
+}
+
+bool Journal::acknowledge(uint16_t seq) {
+	if (!append(ENTRY_ACK, 0, seq))
+		return false;
+	ackedSeq = seq;
+	return true;
+}
+
+bool Journal::isPending(uint16_t seq) {
+	//Newer than the last exported, and still in the ring.
+	return (int16_t) (seq - ackedSeq) > 0
+			&& (uint16_t) (nextSeq - seq) <= slots;
+}
+
+bool Journal::readEntry(uint16_t slot, Entry &entry) {
+	byte buffer[ENTRY_SIZE];
+	uint16_t addr = start + slot * ENTRY_SIZE;
+	for (byte i = 0; i < ENTRY_SIZE; i++)
+		buffer[i] = storage.read(addr + i);
+	if (crc8(buffer, ENTRY_SIZE - 1) != buffer[ENTRY_SIZE - 1])
+		return false;
+	if (buffer[2] < ENTRY_POINTS || buffer[2] > ENTRY_REWARDS_SET)
+		return false;
+	entry.seq = buffer[0] | (uint16_t) buffer[1] << 8;
+	entry.type = (EntryType) buffer[2];
+	entry.uid = 0;
+	entry.delta = 0;
+	for (byte i = 0; i < 4; i++) {
+		entry.uid |= (uint32_t) buffer[3 + i] << (8 * i);
+		entry.delta |= (uint32_t) buffer[7 + i] << (8 * i);
+	}
+	return true;
+}
+
+void Journal::writeEntry(uint16_t slot, const Entry &entry) {
+	byte buffer[ENTRY_SIZE];
+	buffer[0] = (byte) entry.seq;
+	buffer[1] = (byte) (entry.seq >> 8);
+	buffer[2] = entry.type;
+	for (byte i = 0; i < 4; i++) {
+		buffer[3 + i] = (byte) (entry.uid >> (8 * i));
+		buffer[7 + i] = (byte) ((uint32_t) entry.delta >> (8 * i));
+	}
+	buffer[ENTRY_SIZE - 1] = crc8(buffer, ENTRY_SIZE - 1);
+	uint16_t addr = start + slot * ENTRY_SIZE;
+	for (byte i = 0; i < ENTRY_SIZE; i++)
+		storage.update(addr + i, buffer[i]);
+}
+
+byte Journal::crc8(const byte *buffer, byte size) {
+	//CRC-8, polynomial 0x07, as the Log frames.
+	byte crc = 0;
+	for (byte i = 0; i < size; i++) {
+		crc ^= buffer[i];
+		for (byte bit = 0; bit < 8; bit++)
+			crc = (crc & 0x80) ? (byte) ((crc << 1) ^ 0x07) : (byte) (crc << 1);
+	}
+	return crc;
+}
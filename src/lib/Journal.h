@@ -0,0 +1,131 @@
+/*
+ * Journal.h
+ * Append-only journal of the balance changes, kept in persistent Storage so that
+ * the audit trail survives reboots and uplink outages until it's exported.
+ *
+ * The storage is a ring of fixed size entries, each with a sequence number and a CRC-8.
+ * There's no head or tail pointer stored at a fixed address, which would wear out first:
+ * begin() finds the head as the valid entry with the highest sequence number, and the tail is
+ * recorded as an ENTRY_ACK entry in the ring itself. So every cell is written once per lap.
+ * An entry torn by a reset fails its CRC and is skipped. When the ring is full the oldest entry
+ * is overwritten, exported or not; gaps in the sequence numbers show it on the host.
+ *
+ * Appending writes ENTRY_SIZE bytes at most, only the ones differing from the entry overwritten:
+ * on the AVR EEPROM at most 12 x 3.3 ms = 40 ms, which fits in a tap.
+ *
+ * e.g.
+ *   EEPROMStorage storage;
+ *   Journal journal(storage);
+ *   journal.begin();
+ *   cardUtil.setJournal(&journal);
+ */
+#ifndef Journal_h
+#define Journal_h
+
+#include <Arduino.h>
+#include "Storage.h"
+
+class Journal {
+public:
+	// Kinds of entries.
+	enum EntryType
+		: byte {
+			ENTRY_POINTS = 1,	// Points changed. delta: change.
+		ENTRY_REWARDS,		// Rewards changed. delta: change.
+		ENTRY_ACK,			// Entries exported. delta: sequence number of the last one.
+		ENTRY_POINTS_SET,	// Points written over any balance, by a configure or reset. delta: new balance.
+		ENTRY_REWARDS_SET,	// Rewards written over any balance, as above. delta: new balance.
+	};
+
+	// An entry of the journal.
+	typedef struct {
+		uint16_t seq;		// Sequence number.
+		EntryType type;
+		uint32_t uid;		// Card UID, packed as by Log::packUid().
+		int32_t delta;
+	} Entry;
+
+	// Bytes taken by an entry in the storage: seq (2), type, uid (4), delta (4), CRC-8.
+	static const byte ENTRY_SIZE = 12;
+
+	typedef void (*Visitor)(const Entry &entry);
+
+	/**
+	 * Constructor. The journal takes length bytes of the storage from start, all of it by default.
+	 */
+	Journal(Storage &storage, uint16_t start = 0, uint16_t length = 0);
+
+	/**
+	 * Finds the head and the tail of the journal in the storage. To be called once before use.
+	 */
+	void begin();
+
+	/**
+	 * Appends an entry. Returns false if it doesn't read back correctly.
+	 */
+	bool append(EntryType type, uint32_t uid, int32_t delta);
+
+	/**
+	 * Calls the visitor with each entry not exported yet, oldest first.
+	 * Returns the number of entries.
+	 */
+	uint16_t replay(Visitor visitor);
+
+	/**
+	 * Prints the entries not exported yet to Serial, one per line:
+	 *   JOURNAL,<seq>,<type>,<uid hex>,<delta>
+	 * followed by "JOURNAL END,<count>", then marks them as exported.
+	 * The entries stay in the storage until overwritten.
+	 * Returns the number of entries.
+	 */
+	uint16_t exportEntries();
+
+	/**
+	 * Marks the entries up to seq as exported.
+	 */
+	bool acknowledge(uint16_t seq);
+
+	/**
+	 * Number of entries not exported yet.
+	 */
+	uint16_t pending() {
+		return replay(NULL);
+	}
+
+	/**
+	 * Sequence number of the last entry appended.
+	 */
+	uint16_t lastSeq() {
+		return nextSeq - 1;
+	}
+
+	/**
+	 * Number of entries the storage holds.
+	 */
+	uint16_t capacity() {
+		return slots;
+	}
+
+	/**
+	 * Entries overwritten before being exported, since begin().
+	 */
+	uint16_t lost() {
+		return lostCount;
+	}
+
+private:
+	bool readEntry(uint16_t slot, Entry &entry);
+	void writeEntry(uint16_t slot, const Entry &entry);
+	bool isPending(uint16_t seq);
+	static byte crc8(const byte *buffer, byte size);
+
+	Storage &storage;
+	uint16_t start;			// First byte of the journal in the storage.
+	uint16_t slots;			// Number of entries the journal holds.
+	uint16_t head;			// Slot of the next entry.
+	uint16_t nextSeq;		// Sequence number of the next entry.
+	uint16_t ackedSeq;		// Entries up to this one are exported.
+	uint16_t lostCount;
+};
+
+#endif /* Journal_h */
@@ -0,0 +1,66 @@
+/*
+ * KeyRing.cpp
+ * See KeyRing.h.
+ */
+
+#include "KeyRing.h"
+#include "Log.h"
+
+KeyRing::KeyRing() :
+		hits(0), retries(0), upgrades(0), currentVersion(0), upgrade(true), next(
+				0) {
+	for (byte i = 0; i < KEY_RING_SIZE; i++)
+		keys[i] = NULL;
+	for (byte i = 0; i < KEY_VERSION_CACHE_SIZE; i++)
+		versions[i] = 0;
+}
+
+bool KeyRing::add(byte version, const MFRC522::MIFARE_Key *key) {
+	if (version < 1 || version > KEY_RING_SIZE || key == NULL)
+		return false;
+	keys[version - 1] = key;
+	if (currentVersion == 0)
+		currentVersion = version;
+	return true;
+}
+
+bool KeyRing::setCurrent(byte version) {
+	if (key(version) == NULL)
+		return false;
+	currentVersion = version;
+	return true;
+}
+
+byte KeyRing::indexOf(uint32_t uid) {
+	for (byte i = 0; i < KEY_VERSION_CACHE_SIZE; i++)
+		if (versions[i] != 0 && uids[i] == uid)
+			return i;
+	return KEY_VERSION_CACHE_SIZE;
+}
+
+byte KeyRing::versionOf(const MFRC522::Uid &uid) {
+	byte index = indexOf(Log::packUid(uid));
+	return index == KEY_VERSION_CACHE_SIZE ? currentVersion : versions[index];
+}
+
+void KeyRing::remember(const MFRC522::Uid &uid, byte version) {
+	uint32_t packed = Log::packUid(uid);
+	byte index = indexOf(packed);
+	if (version == currentVersion) {
+		if (index != KEY_VERSION_CACHE_SIZE)
+			versions[index] = 0;
+		return;
+	}
+	if (index == KEY_VERSION_CACHE_SIZE) {
+		for (index = 0; index < KEY_VERSION_CACHE_SIZE && versions[index] != 0;
+				index++)
+			;
+		//None free: replace in turn, the cards on old versions being few and soon upgraded.
+		if (index == KEY_VERSION_CACHE_SIZE) {
+			index = next;
+			next = (next + 1) % KEY_VERSION_CACHE_SIZE;
+		}
+	}
+	uids[index] = packed;
+	versions[index] = version;
+}
@@ -0,0 +1,96 @@
+/*
+ * KeyRing.h
+ * The secret keys of the secured sectors, by version, for rotating them: cards on an older version
+ * keep working, and are moved to the current version on a tap (see CardUtil::setKeyRing()).
+ *
+ * CardUtil authenticates with the current version first, so a card already moved to it costs nothing
+ * more than with a single key. A card on another version fails that authentication, and is selected
+ * again to try the other versions. Its version is then remembered by UID, so the next taps on this
+ * station, until it's upgraded, authenticate with the right key on the first attempt too.
+ * Only the cards on another version than the current one are remembered: they are the exceptions.
+ */
+#ifndef KeyRing_h
+#define KeyRing_h
+
+#include <MFRC522.h>
+
+/**
+ * Key versions a ring holds, 1 to KEY_RING_SIZE.
+ */
+#ifndef KEY_RING_SIZE
+#define KEY_RING_SIZE 4
+#endif
+
+/**
+ * Number of cards whose key version is remembered. Each takes 5 bytes of SRAM.
+ */
+#ifndef KEY_VERSION_CACHE_SIZE
+#define KEY_VERSION_CACHE_SIZE 8
+#endif
+
+class KeyRing {
+public:
+	KeyRing();
+
+	/**
+	 * Adds the key of a version, from 1 to KEY_RING_SIZE. The key is referenced, not copied.
+	 * The first version added is the current one, until setCurrent().
+	 * Returns false if the version is out of range.
+	 */
+	bool add(byte version, const MFRC522::MIFARE_Key *key);
+
+	/**
+	 * Sets the version the cards are configured and upgraded with. Returns false if it wasn't added.
+	 */
+	bool setCurrent(byte version);
+
+	byte current() const {
+		return currentVersion;
+	}
+
+	/**
+	 * Key of a version, NULL if not in the ring.
+	 */
+	const MFRC522::MIFARE_Key *key(byte version) const {
+		return version >= 1 && version <= KEY_RING_SIZE ? keys[version - 1] : NULL;
+	}
+
+	/**
+	 * Sets whether cards on an older version are upgraded to the current one on their tap (default).
+	 * Upgrading rewrites the trailers of the secured sectors, after the operation of the tap:
+	 * a station where the tap must be short can leave it to the others.
+	 */
+	void setUpgrade(bool enable) {
+		upgrade = enable;
+	}
+
+	bool upgrading() const {
+		return upgrade;
+	}
+
+	/**
+	 * Version the card was last found on, the current one if not remembered.
+	 */
+	byte versionOf(const MFRC522::Uid &uid);
+
+	/**
+	 * Remembers the version the card was found on.
+	 */
+	void remember(const MFRC522::Uid &uid, byte version);
+
+	uint16_t hits;		// Cards found on the version remembered for them.
+	uint16_t retries;	// Authentications tried again with another version.
+	uint16_t upgrades;	// Cards upgraded to the current version.
+
+private:
+	byte indexOf(uint32_t uid);
+
+	const MFRC522::MIFARE_Key *keys[KEY_RING_SIZE];
+	byte currentVersion;
+	bool upgrade;
+	uint32_t uids[KEY_VERSION_CACHE_SIZE];		// Log::packUid() of the cards. A collision costs a retry.
+	byte versions[KEY_VERSION_CACHE_SIZE];		// Version of each card, 0 for a free entry.
+	byte next;									// Entry replaced next when none is free.
+};
+
+#endif /* KeyRing_h */
@@ -7,21 +7,106 @@
 
 #include"Log.h"
 
-void Log::info(String str) {
-	Serial.println(str);
+#define LOG_RING_MASK (LOG_RING_SIZE - 1)
+
+#if (LOG_RING_SIZE & LOG_RING_MASK) != 0 || LOG_RING_SIZE > 128
+#error LOG_RING_SIZE must be a power of 2, at most 128
+#endif
+
+Log::Log() :
+		head(0), tail(0), seq(0), droppedCount(0), device(0) {
+}
+
+void Log::begin(uint32_t store_id, uint16_t device_id) {
+	device = device_id;
+	event(EVENT_STARTED, (int32_t) store_id);
+}
+
+void Log::info(const String &str) {
+#if LOG_LEVEL < LOG_LEVEL_INFO
+	(void) str;
+#endif
+	LOG_INFOLN(str);
 }
 
 void Log::info(const __FlashStringHelper *ifsh) {
-	Serial.println(ifsh);
+#if LOG_LEVEL < LOG_LEVEL_INFO
+	(void) ifsh;
+#endif
+	LOG_INFOLN(ifsh);
+}
+
+bool Log::event(EventCode code, const MFRC522::Uid &uid, int32_t delta) {
+	return record(code, packUid(uid), delta);
 }
 
-void Log::event(uint32_t store_id, uint32_t device_id, uint32_t member_id,
-		MFRC522::Uid uid, String event, String message) {
+bool Log::event(EventCode code, int32_t value) {
+	return record(code, 0, value);
+}
 
+bool Log::record(EventCode code, uint32_t uid, int32_t delta) {
+	if (code == EVENT_NONE)
+		return true;
+	//The sequence number moves on for dropped records too, so the host sees the gap.
+	byte recordSeq = seq++;
+	if ((byte) (head - tail) == LOG_RING_SIZE) {
+		droppedCount++;
+		return false;
+	}
+	Record &record = ring[head & LOG_RING_MASK];
+	record.time = millis();
+	record.uid = uid;
+	record.delta = delta;
+	record.device = device;
+	record.code = code;
+	record.seq = recordSeq;
+	head++;
+	return true;
 }
 
-void Log::event(uint32_t store_id, uint32_t device_id, String event,
-		String message) {
+uint32_t Log::packUid(const MFRC522::Uid &uid) {
+	uint32_t packed = 0;
+	for (byte i = 0; i < uid.size && i < sizeof(uid.uidByte); i++)
+		packed ^= (uint32_t) uid.uidByte[i] << (8 * (3 - (i & 3)));
+	return packed;
+}
 
+void Log::drain() {
+	//Whole frames only: text written to Serial between two calls, e.g. by the LOG_* macros,
+	//can't land inside one.
+	byte frame[FRAME_SIZE];
+	while (head != tail && Serial.availableForWrite() >= FRAME_SIZE) {
+		encode(ring[tail & LOG_RING_MASK], frame);
+		tail++;
+		Serial.write(frame, FRAME_SIZE);
+	}
 }
 
+/**
+ * Writes a 32 bit value little endian.
+ */
+static byte *put32(byte *buffer, uint32_t value) {
+	for (byte i = 0; i < 4; i++, value >>= 8)
+		*buffer++ = (byte) value;
+	return buffer;
+}
+
+void Log::encode(const Record &record, byte *frame) {
+	byte *buffer = frame;
+	*buffer++ = FRAME_SYNC;
+	buffer = put32(buffer, record.time);
+	buffer = put32(buffer, record.uid);
+	buffer = put32(buffer, (uint32_t) record.delta);
+	*buffer++ = (byte) record.device;
+	*buffer++ = (byte) (record.device >> 8);
+	*buffer++ = record.code;
+	*buffer++ = record.seq;
+	//CRC-8, polynomial 0x07.
+	byte crc = 0;
+	for (byte *p = frame + 1; p < buffer; p++) {
+		crc ^= *p;
+		for (byte bit = 0; bit < 8; bit++)
+			crc = (crc & 0x80) ? (byte) ((crc << 1) ^ 0x07) : (byte) (crc << 1);
+	}
+	*buffer = crc;
+}
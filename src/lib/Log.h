@@ -9,12 +9,131 @@
 
 #include<MFRC522.h>
 
+/**
+ * Compile time log verbosity.
+ * Output below the selected level is removed from the binary together with its strings.
+ * Select the level by defining LOG_LEVEL for the whole build, e.g. in platform.local.txt:
+ *   compiler.cpp.extra_flags=-DLOG_LEVEL=2
+ * LOG_LEVEL_EVENT is the production level: errors and outcomes of the card operations only.
+ */
+#define LOG_LEVEL_NONE		0	// No output.
+#define LOG_LEVEL_ERROR		1	// Failures talking to the card.
+#define LOG_LEVEL_EVENT		2	// Outcome of the operations: charged, recharged, game won...
+#define LOG_LEVEL_INFO		3	// Log::info messages.
+#define LOG_LEVEL_DEBUG		4	// Every step of the operations, with hex dumps.
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_NOTHING() do {} while (0)
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) Serial.print(__VA_ARGS__)
+#define LOG_ERRORLN(...) Serial.println(__VA_ARGS__)
+#else
+#define LOG_ERROR(...) LOG_NOTHING()
+#define LOG_ERRORLN(...) LOG_NOTHING()
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_EVENT
+#define LOG_EVENT(...) Serial.print(__VA_ARGS__)
+#define LOG_EVENTLN(...) Serial.println(__VA_ARGS__)
+#else
+#define LOG_EVENT(...) LOG_NOTHING()
+#define LOG_EVENTLN(...) LOG_NOTHING()
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) Serial.print(__VA_ARGS__)
+#define LOG_INFOLN(...) Serial.println(__VA_ARGS__)
+#else
+#define LOG_INFO(...) LOG_NOTHING()
+#define LOG_INFOLN(...) LOG_NOTHING()
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) Serial.print(__VA_ARGS__)
+#define LOG_DEBUGLN(...) Serial.println(__VA_ARGS__)
+//Hex dump, the helper is defined next to its callers.
+#define LOG_DEBUG_BYTES(buffer, size) dump_byte_array(buffer, size)
+#else
+#define LOG_DEBUG(...) LOG_NOTHING()
+#define LOG_DEBUGLN(...) LOG_NOTHING()
+#define LOG_DEBUG_BYTES(buffer, size) LOG_NOTHING()
+#endif
+
+/**
+ * Records the event ring holds. A power of 2, at most 128.
+ * Each record takes 16 bytes of SRAM.
+ */
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 8
+#endif
+
+/**
+ * Event logging.
+ * Events are fixed size binary records queued in a static ring and sent to Serial later by drain(),
+ * called from a scheduler task, so recording an event on the charge path neither blocks nor allocates.
+ *
+ * Cost of event(): one millis() call for the time stamp, folding the UID into 32 bits (a loop over
+ * its 4, 7 or 10 bytes) and filling one 16 byte record of the ring. It doesn't wait on Serial.
+ * When the ring is full the event is dropped, counted in dropped(), and event() returns false.
+ *
+ * Each record is sent as a frame of FRAME_SIZE bytes:
+ *   FRAME_SYNC, time (4), uid (4), delta (4), device (2), code, seq, CRC-8 of the 16 record bytes.
+ * Fields are little endian. The host finds the frames in the Serial stream by the sync byte and CRC,
+ * and skips the text printed in between. A gap in seq shows dropped records.
+ */
 class Log {
 public:
+	/**
+	 * Event codes.
+	 */
+	enum EventCode
+		: byte {
+			EVENT_NONE,					// No event, never recorded.
+		EVENT_STARTED,				// Device started. delta: store id.
+		EVENT_CONFIGURED,			// Card configured. delta: initial points.
+		EVENT_POINTS_ADDED,			// delta: points added.
+		EVENT_POINTS_CHARGED,		// delta: -points charged.
+		EVENT_INSUFFICIENT_POINTS,	// delta: points required.
+		EVENT_REWARDS_ADDED,		// delta: rewards added.
+		EVENT_REWARDS_CHARGED,		// delta: -rewards charged.
+		EVENT_CARD_RESET,			// Card reset to the default keys. delta: 0.
+		EVENT_SEQ_STARTED,			// Sequence game started. delta: rewards at stake.
+		EVENT_SEQ_STEP,				// Sequence game step. delta: next step, -1 when the game is over.
+		EVENT_CARD_ERROR,			// Operation failed. delta: CardUtil status code.
+		EVENT_COMMIT_RECOVERED,		// Commit torn on an earlier tap, completed. delta: balance written, as CardUtil::Transaction::Field.
+	};
+
+	/**
+	 * An event, as queued.
+	 */
+	typedef struct {
+		uint32_t time;		// millis() when recorded.
+		uint32_t uid;		// Card UID, see packUid(). 0 for device events.
+		int32_t delta;		// Balance change, or the value given for the code.
+		uint16_t device;	// Device id given to begin().
+		byte code;			// EventCode.
+		byte seq;			// Sequence number of the record.
+	} Record;
+
+	static const byte FRAME_SYNC = 0xA5;
+	static const byte FRAME_SIZE = 18;
+
+	Log();
+
+	/**
+	 * Sets the ids sent with the events and records EVENT_STARTED.
+	 */
+	void begin(uint32_t store_id, uint16_t device_id);
+
 	/**
 	 * Logs info level message.
+	 * Does nothing below LOG_LEVEL_INFO. Prefer LOG_INFOLN() on hot paths, it drops the string as well.
 	 */
-	void info(String str);
+	void info(const String &str);
 
 	/**
 	 * Logs info level message.
@@ -23,15 +142,51 @@ public:
 
 	/**
 	 * Logs an event captured between a RFID Card and a device reader.
+	 * Returns false if the ring is full and the event was dropped.
 	 */
-	void event(uint32_t store_id, uint32_t device_id, uint32_t member_id,
-			MFRC522::Uid uid, String event, String message);
+	bool event(EventCode code, const MFRC522::Uid &uid, int32_t delta);
 
 	/**
 	 * Logs an event captured by a device.
+	 * Returns false if the ring is full and the event was dropped.
+	 */
+	bool event(EventCode code, int32_t value);
+
+	/**
+	 * Sends queued events to Serial, as many whole frames as fit in the transmit buffer without
+	 * waiting. To be called often, e.g. as a scheduler task.
+	 */
+	void drain();
+
+	/**
+	 * Number of events waiting to be sent.
 	 */
-	void event(uint32_t store_id, uint32_t device_id, String event,
-			String message);
+	byte pending() {
+		return head - tail;
+	}
+
+	/**
+	 * Number of events dropped because the ring was full.
+	 */
+	uint16_t dropped() {
+		return droppedCount;
+	}
+
+	/**
+	 * Packs the UID in 32 bits: the 4 byte UIDs as they are, longer ones folded with XOR.
+	 */
+	static uint32_t packUid(const MFRC522::Uid &uid);
+
+private:
+	bool record(EventCode code, uint32_t uid, int32_t delta);
+	void encode(const Record &record, byte *frame);
+
+	Record ring[LOG_RING_SIZE];
+	byte head;					// Free running index of the next record to be written.
+	byte tail;					// Free running index of the next record to be sent.
+	byte seq;					// Sequence number of the next record.
+	uint16_t droppedCount;
+	uint16_t device;
 };
 
 #endif /* Log_h */
@@ -0,0 +1,27 @@
+/*
+ * MotionDetector.cpp
+ * Detects motion in the samples of a photosensitive diode. See MotionDetector.h.
+ */
+
+#include "MotionDetector.h"
+
+MotionDetector::MotionDetector(int threshold) :
+		threshold(threshold), level(0), down(false), state(false) {
+}
+
+bool MotionDetector::update(int sample) {
+	bool switched = false;
+	if (sample > level + threshold) {
+		//Switch only if the signal has started increasing after a dip.
+		if (down) {
+			state = !state;
+			switched = true;
+		}
+		level = sample;
+		down = false;
+	} else if (sample < level - threshold) {
+		level = sample;
+		down = true;
+	}
+	return switched;
+}
@@ -0,0 +1,38 @@
+/*
+ * MotionDetector.h
+ * Detects motion in the samples of a photosensitive diode: a shadow passing over it makes the
+ * level dip and come back up. The output toggles each time the level comes back up after a dip.
+ *
+ * The level is followed with a dead band of threshold ADC counts: a change smaller than that is noise.
+ * This is the detection Motion_Detector used first, kept as the reference host/MotionBench compares
+ * AdaptiveDetector with: it misfires as the ambient light drifts, and detects a shadow once gone.
+ */
+#ifndef MotionDetector_h
+#define MotionDetector_h
+
+#include <Arduino.h>
+
+class MotionDetector {
+public:
+	MotionDetector(int threshold = 10);
+
+	/**
+	 * Takes the next sample. Returns true if the output switched.
+	 */
+	bool update(int sample);
+
+	/**
+	 * Current output: the LED state.
+	 */
+	bool output() const {
+		return state;
+	}
+
+private:
+	int threshold;	// Change in ADC counts taken as a move of the level.
+	int level;		// Level at the last move.
+	bool down;		// The last move was a dip.
+	bool state;		// Output.
+};
+
+#endif /* MotionDetector_h */
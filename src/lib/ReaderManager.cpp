@@ -0,0 +1,113 @@
+/*
+ * ReaderManager.cpp
+ * See ReaderManager.h.
+ */
+
+#include "ReaderManager.h"
+
+ReaderManager::ReaderManager(CardHandler handler) :
+		handler(handler), sleeping(0), readerCount(0), statsStartMs(0) {
+}
+
+byte ReaderManager::add(byte ssPin, byte rstPin, byte priority) {
+	if (readerCount == MAX_READERS)
+		return NO_READER;
+	byte index = readerCount++;
+	ssPins[index] = ssPin;
+	rstPins[index] = rstPin;
+	priorities[index] = priority > 0 ? priority : 1;
+	credits[index] = 0;
+	return index;
+}
+
+void ReaderManager::begin() {
+	for (byte i = 0; i < readerCount; i++) {
+		//Keep every SS high, so that only the reader being talked to listens on the bus.
+		pinMode(ssPins[i], OUTPUT);
+		digitalWrite(ssPins[i], HIGH);
+	}
+	for (byte i = 0; i < readerCount; i++)
+		readers[i].PCD_Init(ssPins[i], rstPins[i]);
+	resetStats();
+}
+
+void ReaderManager::resetStats() {
+	unsigned long now = millis();
+	memset(readerStats, 0, sizeof(readerStats));
+	for (byte i = 0; i < readerCount; i++)
+		readerStats[i].lastPollMs = now;
+	statsStartMs = now;
+}
+
+void ReaderManager::sleep(byte reader, unsigned long ms) {
+	if (reader >= readerCount)
+		return;
+	sleepUntil[reader] = millis() + ms;
+	sleeping |= 1 << reader;
+}
+
+byte ReaderManager::next() {
+	unsigned long now = millis();
+	int16_t total = 0;
+	byte best = NO_READER;
+	for (byte i = 0; i < readerCount; i++) {
+		if (sleeping & (1 << i)) {
+			//Signed difference, so millis() wrapping around is fine.
+			if ((long) (now - sleepUntil[i]) < 0)
+				continue;
+			sleeping &= ~(1 << i);
+			readerStats[i].lastPollMs = now;	//Asleep isn't waiting for a poll.
+		}
+		credits[i] += priorities[i];
+		total += priorities[i];
+		if (best == NO_READER || credits[i] > credits[best])
+			best = i;
+	}
+	if (best != NO_READER)
+		credits[best] -= total;
+	return best;
+}
+
+bool ReaderManager::poll() {
+	byte index = next();
+	if (index == NO_READER)
+		return false;
+	Stats &stats = readerStats[index];
+	unsigned long now = millis();
+	unsigned long gap = now - stats.lastPollMs;
+	stats.gapSumMs += gap;
+	if (gap > stats.maxGapMs)
+		stats.maxGapMs = gap;
+	stats.polls++;
+
+	unsigned long start = micros();
+	MFRC522 &mfrc522 = readers[index];
+	bool handled = mfrc522.PICC_IsNewCardPresent()
+			&& mfrc522.PICC_ReadCardSerial();
+	if (handled) {
+		stats.cards++;
+		handler(index, mfrc522);
+	}
+	stats.busyUs += micros() - start;
+	stats.lastPollMs = millis();
+	return handled;
+}
+
+void ReaderManager::printStats() {
+	unsigned long elapsedMs = millis() - statsStartMs;
+	for (byte i = 0; i < readerCount; i++) {
+		Stats &stats = readerStats[i];
+		Serial.print(F("READER,"));
+		Serial.print(i);
+		Serial.print(',');
+		Serial.print(stats.polls);
+		Serial.print(',');
+		Serial.print(stats.cards);
+		Serial.print(',');
+		Serial.print(elapsedMs > 0 ? stats.cards * 60000.0 / elapsedMs : 0.0);
+		Serial.print(',');
+		Serial.print(stats.polls > 0 ? (double) stats.gapSumMs / stats.polls : 0.0);
+		Serial.print(',');
+		Serial.println(stats.maxGapMs);
+	}
+}
@@ -0,0 +1,121 @@
+/*
+ * ReaderManager.h
+ * Serves several MFRC522 readers on a shared SPI bus, each with its own SS pin,
+ * e.g. every stop of a sequence game on a table run by one controller.
+ *
+ * poll() looks at one reader per call and hands a newly selected card to the handler,
+ * together with the reader it's on. Readers are picked by smooth weighted round-robin:
+ * a reader of priority p is polled p times in every round of (sum of priorities) polls,
+ * evenly spread, so none is starved. A reader can be put to sleep, e.g. while its game runs.
+ *
+ * e.g.
+ *   ReaderManager readers(handleCard);
+ *   readers.add(10, 9);
+ *   readers.add(8, 9, 2);	// Polled twice as often.
+ *   readers.begin();
+ *   scheduler.add(pollReaders, 0);	// pollReaders() calls readers.poll().
+ */
+#ifndef ReaderManager_h
+#define ReaderManager_h
+
+#include <MFRC522.h>
+
+class ReaderManager {
+public:
+	static const byte MAX_READERS = 4;		// Readers the manager can hold.
+	static const byte NO_READER = 0xFF;	// Returned when there's no room for another reader.
+
+	/**
+	 * Called with a newly selected card. The handler runs the CardUtil operations on mfrc522
+	 * and halts the card.
+	 */
+	typedef void (*CardHandler)(byte reader, MFRC522 &mfrc522);
+
+	// Counters of a reader, since begin() or resetStats().
+	typedef struct {
+		uint32_t polls;			// Times the reader was looked at.
+		uint32_t cards;			// Cards handed to the handler.
+		uint32_t gapSumMs;		// Sum of the times between two polls.
+		uint32_t maxGapMs;		// Longest time between two polls: worst delay to notice a card.
+		uint32_t busyUs;		// Time spent polling and in the handler.
+		unsigned long lastPollMs;	// millis() of the last poll.
+	} Stats;
+
+	/**
+	 * Constructor. Takes the function handling the cards.
+	 */
+	ReaderManager(CardHandler handler);
+
+	/**
+	 * Adds a reader on the given pins. Higher priorities are polled more often.
+	 * Returns the index of the reader, or NO_READER if the manager is full.
+	 */
+	byte add(byte ssPin,	//SS pin of the reader.
+			byte rstPin,	//RST pin of the reader, may be shared.
+			byte priority = 1	//Polls per round, at least 1.
+			);
+
+	/**
+	 * Initializes the readers. To be called once after SPI.begin().
+	 */
+	void begin();
+
+	/**
+	 * Polls the next reader. Returns true if a card was handled.
+	 */
+	bool poll();
+
+	/**
+	 * Stops polling the reader for ms milliseconds.
+	 */
+	void sleep(byte reader, unsigned long ms);
+
+	/**
+	 * Number of readers.
+	 */
+	byte count() {
+		return readerCount;
+	}
+
+	/**
+	 * The MFRC522 instance of the reader.
+	 */
+	MFRC522 &reader(byte reader) {
+		return readers[reader];
+	}
+
+	/**
+	 * Counters of the reader.
+	 */
+	const Stats &stats(byte reader) {
+		return readerStats[reader];
+	}
+
+	/**
+	 * Prints per reader: polls, cards, cards per minute, mean and max time between polls in ms,
+	 * as CSV lines "READER,<index>,<polls>,<cards>,<cards/min>,<mean gap>,<max gap>".
+	 */
+	void printStats();
+
+	/**
+	 * Clears the counters.
+	 */
+	void resetStats();
+
+private:
+	byte next();
+
+	CardHandler handler;
+	MFRC522 readers[MAX_READERS];
+	Stats readerStats[MAX_READERS];
+	byte ssPins[MAX_READERS];
+	byte rstPins[MAX_READERS];
+	byte priorities[MAX_READERS];
+	int16_t credits[MAX_READERS];		// Smooth weighted round-robin state.
+	unsigned long sleepUntil[MAX_READERS];	// millis() until which the reader sleeps.
+	byte sleeping;						// Bit per sleeping reader.
+	byte readerCount;
+	unsigned long statsStartMs;
+};
+
+#endif /* ReaderManager_h */
@@ -0,0 +1,87 @@
+/*
+ * SampleRing.h
+ * Lock-free single producer, single consumer ring of ADC samples.
+ * The producer is an interrupt handler (see AdcSampler), the consumer the sketch's loop().
+ *
+ * The indices are free running bytes, each written by one side only: head by push(), tail by pop().
+ * A byte is read and written in one instruction on AVR and the buffer and indices are volatile,
+ * so neither side needs to disable interrupts. The ring is full with SAMPLE_RING_SIZE samples in it;
+ * push() then drops the sample and counts an overrun rather than overwrite unread samples.
+ */
+#ifndef SampleRing_h
+#define SampleRing_h
+
+#include <Arduino.h>
+
+/**
+ * Samples the ring holds. A power of 2, at most 128.
+ * Each sample takes 2 bytes of SRAM. The ring bridges the loop() passes that don't drain it:
+ * at SAMPLE_RATE_HZ 1000 the default covers 64 ms, a 60 character line at 9600 baud.
+ */
+#ifndef SAMPLE_RING_SIZE
+#define SAMPLE_RING_SIZE 64
+#endif
+
+class SampleRing {
+public:
+	SampleRing() :
+			head(0), tail(0), overrunCount(0) {
+	}
+
+	/**
+	 * Adds a sample. Producer side, called from the interrupt handler.
+	 * Returns false if the ring is full and the sample was dropped.
+	 */
+	bool push(uint16_t sample) {
+		byte h = head;
+		if ((byte) (h - tail) == SAMPLE_RING_SIZE) {
+			overrunCount++;
+			return false;
+		}
+		buffer[h & (SAMPLE_RING_SIZE - 1)] = sample;
+		head = h + 1;
+		return true;
+	}
+
+	/**
+	 * Takes up to max samples, oldest first. Consumer side.
+	 * Returns the number of samples copied to samples.
+	 */
+	byte pop(uint16_t *samples, byte max) {
+		byte t = tail;
+		byte count = head - t;
+		if (count > max)
+			count = max;
+		for (byte i = 0; i < count; i++)
+			samples[i] = buffer[(byte) (t + i) & (SAMPLE_RING_SIZE - 1)];
+		tail = t + count;
+		return count;
+	}
+
+	/**
+	 * Number of samples waiting. Consumer side.
+	 */
+	byte available() {
+		return head - tail;
+	}
+
+	/**
+	 * Returns the number of samples dropped since the last call, and clears it. Consumer side.
+	 * The counter is 16 bits, read with interrupts off.
+	 */
+	uint16_t takeOverruns() {
+		noInterrupts();
+		uint16_t count = overrunCount;
+		overrunCount = 0;
+		interrupts();
+		return count;
+	}
+
+private:
+	volatile uint16_t buffer[SAMPLE_RING_SIZE];
+	volatile byte head;				// Free running index of the next sample to be written.
+	volatile byte tail;				// Free running index of the next sample to be read.
+	volatile uint16_t overrunCount;	// Samples dropped because the ring was full.
+};
+
+#endif /* SampleRing_h */
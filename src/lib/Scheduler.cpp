@@ -0,0 +1,123 @@
+/*
+ * Scheduler.cpp
+ * A cooperative, millis() based task scheduler. See Scheduler.h.
+ */
+
+#include "Scheduler.h"
+#ifdef __AVR__
+#include <avr/sleep.h>
+#endif
+
+Scheduler::Scheduler() :
+		maxTaskUs(0), sleepEnabled(false), sleptMs(0), sleptUs(0) {
+	for (byte i = 0; i < MAX_TASKS; i++)
+		tasks[i].flags = 0;
+}
+
+byte Scheduler::insert(Task task, unsigned long delayMs,
+		unsigned long periodMs, byte flags) {
+	for (byte i = 0; i < MAX_TASKS; i++) {
+		if (!(tasks[i].flags & FLAG_USED)) {
+			tasks[i].task = task;
+			tasks[i].due = millis() + delayMs;
+			tasks[i].period = periodMs;
+			tasks[i].flags = FLAG_USED | flags;
+			return i;
+		}
+	}
+	return NO_TASK;
+}
+
+byte Scheduler::add(Task task, unsigned long periodMs) {
+	return insert(task, 0, periodMs, 0);
+}
+
+byte Scheduler::once(Task task, unsigned long delayMs) {
+	return insert(task, delayMs, 0, FLAG_ONCE);
+}
+
+void Scheduler::sleep(byte id, unsigned long delayMs) {
+	if (id < MAX_TASKS)
+		tasks[id].due = millis() + delayMs;
+}
+
+void Scheduler::suspend(byte id) {
+	if (id < MAX_TASKS)
+		tasks[id].flags |= FLAG_SUSPENDED;
+}
+
+void Scheduler::resume(byte id) {
+	if (id < MAX_TASKS) {
+		tasks[id].flags &= ~FLAG_SUSPENDED;
+		tasks[id].due = millis();
+	}
+}
+
+bool Scheduler::isSuspended(byte id) {
+	return id < MAX_TASKS && (tasks[id].flags & FLAG_SUSPENDED);
+}
+
+void Scheduler::remove(byte id) {
+	if (id < MAX_TASKS)
+		tasks[id].flags = 0;
+}
+
+void Scheduler::run() {
+	for (byte i = 0; i < MAX_TASKS; i++) {
+		Entry &entry = tasks[i];
+		if ((entry.flags & (FLAG_USED | FLAG_SUSPENDED)) != FLAG_USED)
+			continue;
+		unsigned long now = millis();
+		//Signed difference, so millis() wrapping around after 49 days is fine.
+		if ((long) (now - entry.due) < 0)
+			continue;
+		if (entry.flags & FLAG_ONCE) {
+			entry.flags = 0;
+		} else {
+			//Keep the cadence, unless the task fell behind by more than a period.
+			entry.due += entry.period;
+			if ((long) (now - entry.due) >= 0)
+				entry.due = now + entry.period;
+		}
+		unsigned long start = micros();
+		entry.task();
+		unsigned long elapsed = micros() - start;
+		if (elapsed > maxTaskUs)
+			maxTaskUs = elapsed;
+	}
+	if (sleepEnabled && idleMs() > 0)
+		sleep();
+}
+
+unsigned long Scheduler::idleMs() {
+	unsigned long idle = (unsigned long) -1;
+	unsigned long now = millis();
+	for (byte i = 0; i < MAX_TASKS; i++) {
+		Entry &entry = tasks[i];
+		if ((entry.flags & (FLAG_USED | FLAG_SUSPENDED)) != FLAG_USED)
+			continue;
+		long left = (long) (entry.due - now);
+		if (left <= 0)
+			return 0;
+		if ((unsigned long) left < idle)
+			idle = left;
+	}
+	return idle;
+}
+
+void Scheduler::sleep() {
+	unsigned long start = micros();
+#ifdef __AVR__
+	//Idle mode keeps the timers, SPI and UART going: the millis() tick wakes the CPU within
+	//a millisecond, a byte received on Serial at once.
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_enable();
+	sleep_cpu();
+	sleep_disable();
+#else
+	delay(1);
+#endif
+	sleptUs += micros() - start;
+	sleptMs += sleptUs / 1000;
+	sleptUs %= 1000;
+}
@@ -0,0 +1,125 @@
+/*
+ * Scheduler.h
+ * A cooperative, millis() based task scheduler for the reader sketches.
+ * Tasks are plain functions that do a bit of work and return, instead of blocking in delay()
+ * or busy loops. The sketch calls run() from loop() and the due tasks are run in turn,
+ * so card polling, game timers, LED/piezo feedback and log draining can be interleaved.
+ *
+ * e.g. turn an LED off 2 seconds later without blocking:
+ *   digitalWrite(LED, HIGH);
+ *   scheduler.once(ledOff, 2000);
+ */
+#ifndef Scheduler_h
+#define Scheduler_h
+
+#include <Arduino.h>
+
+class Scheduler {
+public:
+	typedef void (*Task)();
+
+	static const byte MAX_TASKS = 8;		// Tasks the scheduler can hold.
+	static const byte NO_TASK = 0xFF;		// Returned when there's no room for another task.
+
+	Scheduler();
+
+	/**
+	 * Adds a task run every periodMs milliseconds. A period of 0 runs it on every pass.
+	 * Returns the id of the task, or NO_TASK if the scheduler is full.
+	 */
+	byte add(Task task,	//Function to be run.
+			unsigned long periodMs	//Time between two runs.
+			);
+
+	/**
+	 * Adds a task run once, delayMs milliseconds from now. It is removed after running.
+	 * Returns the id of the task, or NO_TASK if the scheduler is full.
+	 */
+	byte once(Task task,	//Function to be run.
+			unsigned long delayMs	//Time until it runs.
+			);
+
+	/**
+	 * Postpones the next run of the task by delayMs milliseconds from now.
+	 */
+	void sleep(byte id, unsigned long delayMs);
+
+	/**
+	 * Stops running the task until resume() is called.
+	 */
+	void suspend(byte id);
+
+	/**
+	 * Runs the task again, starting with the next pass.
+	 */
+	void resume(byte id);
+
+	/**
+	 * Returns true if the task is suspended.
+	 */
+	bool isSuspended(byte id);
+
+	/**
+	 * Removes the task.
+	 */
+	void remove(byte id);
+
+	/**
+	 * Runs the tasks which are due. To be called from loop().
+	 * With sleep enabled, the CPU then sleeps if no task is due, till the next interrupt.
+	 */
+	void run();
+
+	/**
+	 * Lets run() put the CPU to sleep while no task is due. Tasks run on every pass (period 0)
+	 * keep it awake: give them a period. Off by default.
+	 */
+	void setSleep(bool enable) {
+		sleepEnabled = enable;
+	}
+
+	/**
+	 * Time until the next task is due, in milliseconds. 0 if one is due.
+	 */
+	unsigned long idleMs();
+
+	/**
+	 * Time the CPU slept, in milliseconds.
+	 */
+	unsigned long sleptMillis() {
+		return sleptMs;
+	}
+
+	/**
+	 * Longest time a single task took to run, in microseconds.
+	 * A task blocking for long delays every other task: keep this low.
+	 */
+	unsigned long maxTaskMicros() {
+		return maxTaskUs;
+	}
+
+private:
+	enum Flags
+		: byte {
+			FLAG_USED = 0x01, FLAG_ONCE = 0x02, FLAG_SUSPENDED = 0x04,
+	};
+
+	typedef struct {
+		Task task;
+		unsigned long due;		// millis() at which the task runs next.
+		unsigned long period;	// Time between two runs.
+		byte flags;
+	} Entry;
+
+	byte insert(Task task, unsigned long delayMs, unsigned long periodMs,
+			byte flags);
+	void sleep();
+
+	Entry tasks[MAX_TASKS];
+	unsigned long maxTaskUs;
+	bool sleepEnabled;
+	unsigned long sleptMs;
+	unsigned long sleptUs;	// Less than a millisecond, not in sleptMs yet.
+};
+
+#endif /* Scheduler_h */
@@ -0,0 +1,32 @@
+/*
+ * Storage.h
+ * Byte addressed persistent storage, as used by the Journal.
+ * EEPROMStorage backs it with the AVR EEPROM on the Arduino, FileStorage with a file on the host.
+ */
+#ifndef Storage_h
+#define Storage_h
+
+#include <Arduino.h>
+
+class Storage {
+public:
+	virtual ~Storage() {
+	}
+
+	/**
+	 * Size of the storage in bytes.
+	 */
+	virtual uint16_t length() = 0;
+
+	/**
+	 * Reads the byte at addr.
+	 */
+	virtual byte read(uint16_t addr) = 0;
+
+	/**
+	 * Writes the byte at addr, only if it differs from the stored one: writes wear the cells and are slow.
+	 */
+	virtual void update(uint16_t addr, byte value) = 0;
+};
+
+#endif /* Storage_h */